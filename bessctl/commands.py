@@ -16,6 +16,7 @@ import traceback
 import tempfile
 import signal
 import collections
+import binascii
 
 import sugar
 from port import *
@@ -275,6 +276,20 @@ def get_var_attrs(cli, var_token, partial_word):
             var_type = 'gate'
             var_desc = 'input gate of a module (default 0)'
 
+        elif var_token == '[DELAY_NS]':
+            var_type = 'int'
+            var_desc = 'max time to hold packets, in nanoseconds ' \
+                '(default 0: until the end of the scheduling round)'
+
+        elif var_token == '[MAX_PKTS]':
+            var_type = 'int'
+            var_desc = 'max number of packets to trace (default 0: no limit)'
+
+        elif var_token == '[BPF_FILTER...]':
+            var_type = 'opts'
+            var_desc = 'packets to trace, in pcap-filter(7) syntax ' \
+                '(e.g., "tcp port 22", default: all)'
+
         elif var_token == '[ENV_VARS...]':
             var_type = 'map'
             var_desc = 'Environmental variables for configuration'
@@ -296,6 +311,22 @@ def get_var_attrs(cli, var_token, partial_word):
             var_desc = 'tcpdump(1) command-line options ' \
                 '(e.g., "-ne tcp port 22")'
 
+        elif var_token == 'CAPTURE_FILE':
+            var_type = 'filename'
+            var_desc = 'pcap file to write, rotated ones get a ".N" suffix'
+            var_candidates = complete_filename(partial_word)
+
+        elif var_token == '[CAPTURE_ARGS...]':
+            var_type = 'map'
+            var_desc = 'capture options: snaplen (default 128), ' \
+                'sample_every (default 1), filter (pcap-filter(7)), ' \
+                'ring_size, max_file_size, max_files, pcapng'
+
+        elif var_token == '[ATTR_WEIGHTS...]':
+            var_type = 'map'
+            var_desc = 'declared access weights of metadata attributes ' \
+                '(e.g., "ip_src=100", 0: measured)'
+
         elif var_token == '[BESSD_OPTS...]':
             var_type = 'opts'
             var_desc = 'bess daemon command-line options (see "bessd -h")'
@@ -1097,10 +1128,15 @@ def _show_module(cli, module_name):
         for gate in info.igates:
             track_str = 'batches N/A packets N/A'
             try:
-                track_str = 'batches %-16d packets %-16d' % (gate.cnt,
-                                                             gate.pkts)
+                track_str = 'batches %-16d packets %-16d avg %5.1f' % \
+                    (gate.cnt, gate.pkts, gate.avg_batch_size)
             except:
                 pass
+            if gate.coalescing:
+                track_str += ' (coalescing, %d ns)' % gate.coalesce_delay_ns
+            if gate.capture_pkts or gate.capture_dropped:
+                track_str += ' (captured %d, dropped %d)' % \
+                    (gate.capture_pkts, gate.capture_dropped)
             cli.fout.write('      %5d: %s %s\n' %
                            (gate.igate, track_str,
                             ', '.join('%s:%d ->' % (g.name, g.ogate)
@@ -1111,14 +1147,34 @@ def _show_module(cli, module_name):
         for gate in info.ogates:
             track_str = 'batches N/A packets N/A'
             try:
-                track_str = 'batches %-16d packets %-16d' % (gate.cnt,
-                                                             gate.pkts)
+                track_str = 'batches %-16d packets %-16d avg %5.1f' % \
+                    (gate.cnt, gate.pkts, gate.avg_batch_size)
             except:
                 pass
+            if gate.cycles and gate.pkts:
+                track_str += ' (%.1f cycles/pkt)' % \
+                    (float(gate.cycles) / gate.pkts)
+            if gate.capture_pkts or gate.capture_dropped:
+                track_str += ' (captured %d, dropped %d)' % \
+                    (gate.capture_pkts, gate.capture_dropped)
             cli.fout.write(
                     '      %5d: %s -> %d:%s\n' %
                     (gate.ogate, track_str, gate.igate, gate.name))
 
+    if info.dropped:
+        cli.fout.write('    Dropped at unconnected gates: %d packets\n' %
+                       info.dropped)
+        for drop in info.drops:
+            cli.fout.write('      %5d: %d\n' % (drop.ogate, drop.pkts))
+
+    if info.pkts_held:
+        cli.fout.write('    Packets held: %d\n' % info.pkts_held)
+
+    if info.mem.reserved:
+        cli.fout.write('    Memory: %d objects, %d bytes used, '
+                       '%d bytes reserved\n' %
+                       (info.mem.allocs, info.mem.bytes, info.mem.reserved))
+
     if hasattr(info, 'dump'):
         dump_str = pprint.pformat(info.dump, width=74)
         dump_str = '\n      '.join(dump_str.split('\n'))
@@ -1143,6 +1199,92 @@ def show_module_list(cli, module_names):
         _show_module(cli, module_name)
 
 
+@cmd('show metadata', 'Show the metadata layout of each scope component')
+def show_metadata(cli):
+    components = cli.bess.get_metadata_layout().components
+
+    if not components:
+        cli.fout.write('  There are no metadata attributes in use.\n')
+        return
+
+    cli.fout.write('  %-16s %5s %7s %5s %12s  %s\n' %
+                   ('Attribute', 'Size', 'Offset', 'Line', 'Weight',
+                    'Modules'))
+    for c in sorted(components, key=lambda c: (c.offset < 0, c.offset)):
+        if c.offset >= 0:
+            offset_str = '%d' % c.offset
+            line_str = '%d' % c.cache_line
+        else:
+            offset_str = {-1: 'nowrite', -2: 'noread'}.get(c.offset, 'nospace')
+            line_str = '-'
+        cli.fout.write('  %-16s %5d %7s %5s %12d  %s\n' %
+                       (c.attr, c.size, offset_str, line_str, c.weight,
+                        ' '.join(c.modules)))
+
+
+@cmd('repack metadata [ATTR_WEIGHTS...]',
+     'Lay out all metadata attributes anew from their current weights')
+def repack_metadata(cli, weights):
+    cli.bess.pause_all()
+    try:
+        cli.bess.repack_metadata(weights or {})
+    finally:
+        cli.bess.resume_all()
+
+    if cli.interactive:
+        cli.fout.write('Done.\n')
+
+
+@cmd('show mem', 'Show the memory used by each module and arena')
+def show_mem(cli):
+    stats = cli.bess.get_mem_stats()
+
+    cli.fout.write('  %-24s %6s %10s %14s %14s %6s\n' %
+                   ('Owner', 'Socket', 'Objects', 'Bytes', 'Reserved',
+                    'Frag'))
+    for o in sorted(stats.owners, key=lambda o: (o.name, o.socket)):
+        frag = 1.0 - float(o.bytes) / o.reserved if o.reserved else 0.0
+        cli.fout.write('  %-24s %6d %10d %14d %14d %5.1f%%\n' %
+                       (o.name or '(unattributed)', o.socket, o.allocs,
+                        o.bytes, o.reserved, frag * 100))
+
+    cli.fout.write('\n  %-6s %12s %12s %12s\n' %
+                   ('Socket', '2MB chunks', 'Huge pages', 'Free slabs'))
+    for a in stats.arenas:
+        cli.fout.write('  %-6d %12d %12d %12d\n' %
+                       (a.socket, a.chunks, a.huge_chunks, a.free_slabs))
+
+
+@cmd('show pool', 'Show the packet buffer pools and who holds their buffers')
+def show_pool(cli):
+    stats = cli.bess.get_pool_stats()
+
+    cli.fout.write('  %-6s %10s %10s %10s %10s %10s %10s\n' %
+                   ('Socket', 'Size', 'In use', 'High', 'Failures',
+                    'Modules', 'Other'))
+    for p in stats.pools:
+        in_use = p.size - p.avail
+        if stats.accounting:
+            high = '%d' % p.high_watermark
+            attributed = '%d' % p.attributed
+            other = '%d' % max(in_use - p.attributed, 0)
+        else:
+            high = attributed = other = '-'
+        cli.fout.write('  %-6d %10d %10d %10s %10d %10s %10s\n' %
+                       (p.socket, p.size, in_use, high, p.alloc_failures,
+                        attributed, other))
+
+    if not stats.accounting:
+        cli.fout.write('\n  Packet accounting is disabled '
+                       '("accounting enable" to find who holds buffers)\n')
+        return
+
+    if stats.holders:
+        cli.fout.write('\n  %-24s %10s\n' % ('Module', 'Packets'))
+    for h in stats.holders:
+        cli.fout.write('  %-24s %10d\n' % (h.name or '(destroyed)', h.pkts))
+
+
 def _show_mclass(cli, cls_name, detail):
     info = cli.bess.get_mclass_info(cls_name)
     cli.fout.write('%-16s %s\n' % (info.name, info.help))
@@ -1472,6 +1614,42 @@ def tcpdump_module(cli, module_name, direction, gate, opts):
             pass
 
 
+@cmd('capture start CAPTURE_FILE MODULE [DIRECTION] [OGATE] [CAPTURE_ARGS...]',
+     'Save sampled packets of a gate to pcap files, off the worker thread')
+def capture_start(cli, path, module_name, direction, gate, args):
+    if gate is None:
+        gate = 0
+
+    if direction is None:
+        direction = 'out'
+
+    if args is None:
+        args = {}
+
+    cli.bess.pause_all()
+    try:
+        cli.bess.enable_capture(os.path.abspath(path), module_name, direction,
+                                gate, **args)
+    finally:
+        cli.bess.resume_all()
+
+
+@cmd('capture stop MODULE [DIRECTION] [OGATE]',
+     'Stop a packet capture and flush its file')
+def capture_stop(cli, module_name, direction, gate):
+    if gate is None:
+        gate = 0
+
+    if direction is None:
+        direction = 'out'
+
+    cli.bess.pause_all()
+    try:
+        cli.bess.disable_capture(module_name, direction, gate)
+    finally:
+        cli.bess.resume_all()
+
+
 @cmd('track ENABLE_DISABLE [MODULE] [DIRECTION] [GATE]',
      'Count the packets and batches on a gate')
 def track_module(cli, flag, module_name, direction, gate):
@@ -1488,6 +1666,97 @@ def track_module(cli, flag, module_name, direction, gate):
         cli.bess.resume_all()
 
 
+@cmd('profile ENABLE_DISABLE [MODULE] [OGATE]',
+     'Measure the cycles spent downstream of output gates')
+def profile_module(cli, flag, module_name, gate):
+    cli.bess.pause_all()
+    try:
+        if flag == 'enable':
+            cli.bess.enable_track(module_name, 'out', gate, cycles=True)
+        else:
+            cli.bess.disable_track(module_name, 'out', gate, cycles=True)
+    finally:
+        cli.bess.resume_all()
+
+
+@cmd('accounting ENABLE_DISABLE',
+     'Track which module holds each packet buffer ("show pool")')
+def accounting(cli, flag):
+    cli.bess.pause_all()
+    try:
+        if flag == 'enable':
+            cli.bess.enable_packet_accounting()
+        else:
+            cli.bess.disable_packet_accounting()
+    finally:
+        cli.bess.resume_all()
+
+
+@cmd('trace start [MAX_PKTS] [BPF_FILTER...]',
+     'Trace packets through the pipeline as they arrive')
+def trace_start(cli, max_pkts, bpf_filter):
+    if max_pkts is None:
+        max_pkts = 0
+
+    if bpf_filter is None:
+        bpf_filter = []
+
+    cli.bess.pause_all()
+    try:
+        cli.bess.start_trace(' '.join(bpf_filter), max_pkts)
+    finally:
+        cli.bess.resume_all()
+
+
+@cmd('trace stop', 'Stop tracing packets')
+def trace_stop(cli):
+    cli.bess.pause_all()
+    try:
+        cli.bess.stop_trace()
+    finally:
+        cli.bess.resume_all()
+
+
+@cmd('show trace', 'Show the path of traced packets')
+def show_trace(cli):
+    trace = cli.bess.get_trace()
+
+    cli.fout.write('  Tracing %s, %d packets marked\n' %
+                   ('enabled' if trace.enabled else 'disabled', trace.marked))
+
+    first_ns = {}
+    for r in trace.records:
+        key = (r.wid, r.pkt)
+        first_ns.setdefault(key, r.ns)
+        if r.to_module:
+            dest = '%d:%s' % (r.igate, r.to_module)
+        else:
+            dest = '(dropped)'
+        cli.fout.write('  W%d %016x %+10d ns  %s:%d -> %s  %s\n' %
+                       (r.wid, r.pkt, r.ns - first_ns[key],
+                        r.from_module or '?', r.ogate, dest,
+                        binascii.hexlify(r.metadata)))
+
+
+@cmd('coalesce ENABLE_DISABLE MODULE [IGATE] [DELAY_NS]',
+     'Merge small batches arriving at an input gate')
+def coalesce_module(cli, flag, module_name, gate, delay_ns):
+    if gate is None:
+        gate = 0
+
+    if delay_ns is None:
+        delay_ns = 0
+
+    cli.bess.pause_all()
+    try:
+        if flag == 'enable':
+            cli.bess.enable_coalesce(module_name, gate, delay_ns)
+        else:
+            cli.bess.disable_coalesce(module_name, gate)
+    finally:
+        cli.bess.resume_all()
+
+
 @cmd('interactive', 'Switch to interactive mode')
 def interactive(cli):
     cli.fin = sys.stdin
@@ -1,9 +1,12 @@
 #include "bessctl.h"
 
+#include <algorithm>
 #include <future>
 #include <map>
 #include <string>
 #include <thread>
+#include <utility>
+#include <vector>
 
 #include <glog/logging.h>
 #include <grpc++/server.h>
@@ -11,17 +14,16 @@
 #include <grpc++/server_context.h>
 #include <grpc/grpc.h>
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wunused-parameter"
-#include "service.grpc.pb.h"
-#pragma GCC diagnostic pop
-
 #include "gate.h"
+#include "hooks/capture.h"
 #include "hooks/track.h"
+#include "mem_alloc.h"
 #include "message.h"
 #include "metadata.h"
 #include "module.h"
 #include "opts.h"
+#include "packet_accounting.h"
+#include "packet_tracer.h"
 #include "port.h"
 #include "scheduler.h"
 #include "traffic_class.h"
@@ -67,54 +69,82 @@ static inline Status return_with_errno(T* response, int code) {
   return Status::OK;
 }
 
+// Adds a TrackGate to gate, unless it has one already (as output gates do
+// while connected). Returns 0 on success.
+static int add_track_hook(bess::Gate* gate) {
+  TrackGate* hook = new TrackGate();
+  int ret = gate->AddHook(hook);
+  if (ret) {
+    delete hook;
+  }
+  return (ret == EEXIST) ? 0 : ret;
+}
+
 static pb_error_t enable_track_for_module(const Module* m, gate_idx_t gate_idx,
-                                          bool is_igate, bool use_gate) {
+                                          bool is_igate, bool use_gate,
+                                          bool cycles) {
   int ret;
 
   if (use_gate) {
-    if (!is_igate && gate_idx >= m->ogates().size()) {
+    if (!is_igate && (gate_idx >= m->ogates().size() ||
+                      !m->ogates()[gate_idx])) {
       return pb_error(EINVAL, "Output gate '%hu' does not exist", gate_idx);
     }
 
-    if (is_igate && gate_idx >= m->igates().size()) {
+    if (is_igate && (gate_idx >= m->igates().size() ||
+                     !m->igates()[gate_idx])) {
       return pb_error(EINVAL, "Input gate '%hu' does not exist", gate_idx);
     }
 
-    if (is_igate && (ret = m->igates()[gate_idx]->AddHook(new TrackGate()))) {
-      return pb_error(ret, "Failed to track input gate '%hu'", gate_idx);
+    if (is_igate) {
+      if ((ret = add_track_hook(m->igates()[gate_idx]))) {
+        return pb_error(ret, "Failed to track input gate '%hu'", gate_idx);
+      }
+      return pb_errno(0);
     }
 
-    if ((ret = m->ogates()[gate_idx]->AddHook(new TrackGate()))) {
+    if ((ret = add_track_hook(m->ogates()[gate_idx]))) {
       return pb_error(ret, "Failed to track output gate '%hu'", gate_idx);
     }
+    m->ogates()[gate_idx]->set_measure_cycles(cycles);
+    return pb_errno(0);
   }
 
   if (is_igate) {
     for (auto& gate : m->igates()) {
-      if ((ret = gate->AddHook(new TrackGate()))) {
+      if (gate && (ret = add_track_hook(gate))) {
         return pb_error(ret, "Failed to track input gate '%hu'",
                         gate->gate_idx());
       }
     }
   } else {
     for (auto& gate : m->ogates()) {
-      if ((ret = gate->AddHook(new TrackGate()))) {
+      if (!gate) {
+        continue;
+      }
+      if ((ret = add_track_hook(gate))) {
         return pb_error(ret, "Failed to track output gate '%hu'",
                         gate->gate_idx());
       }
+      gate->set_measure_cycles(cycles);
     }
   }
   return pb_errno(0);
 }
 
+// If cycles is set, only stops measuring cycles on output gates, and keeps
+// counting their batches and packets (as they do by default).
 static pb_error_t disable_track_for_module(const Module* m, gate_idx_t gate_idx,
-                                           bool is_igate, bool use_gate) {
+                                           bool is_igate, bool use_gate,
+                                           bool cycles) {
   if (use_gate) {
-    if (!is_igate && gate_idx >= m->ogates().size()) {
+    if (!is_igate && (gate_idx >= m->ogates().size() ||
+                      !m->ogates()[gate_idx])) {
       return pb_error(EINVAL, "Output gate '%hu' does not exist", gate_idx);
     }
 
-    if (is_igate && gate_idx >= m->igates().size()) {
+    if (is_igate && (gate_idx >= m->igates().size() ||
+                     !m->igates()[gate_idx])) {
       return pb_error(EINVAL, "Input gate '%hu' does not exist", gate_idx);
     }
 
@@ -122,17 +152,28 @@ static pb_error_t disable_track_for_module(const Module* m, gate_idx_t gate_idx,
       m->igates()[gate_idx]->RemoveHook(kGateHookTrackGate);
       return pb_errno(0);
     }
-    m->ogates()[gate_idx]->RemoveHook(kGateHookTrackGate);
+    if (!cycles) {
+      m->ogates()[gate_idx]->RemoveHook(kGateHookTrackGate);
+    }
+    m->ogates()[gate_idx]->set_measure_cycles(false);
     return pb_errno(0);
   }
 
   if (is_igate) {
     for (auto& gate : m->igates()) {
-      gate->RemoveHook(kGateHookTrackGate);
+      if (gate) {
+        gate->RemoveHook(kGateHookTrackGate);
+      }
     }
   } else {
     for (auto& gate : m->ogates()) {
-      gate->RemoveHook(kGateHookTrackGate);
+      if (!gate) {
+        continue;
+      }
+      if (!cycles) {
+        gate->RemoveHook(kGateHookTrackGate);
+      }
+      gate->set_measure_cycles(false);
     }
   }
   return pb_errno(0);
@@ -152,9 +193,24 @@ static int collect_igates(Module* m, GetModuleInfoResponse* response) {
     if (t) {
       igate->set_cnt(t->cnt());
       igate->set_pkts(t->pkts());
+      igate->set_avg_batch_size(t->avg_batch_size());
+      for (size_t i = 0; i <= bess::PacketBatch::kMaxBurst; i++) {
+        igate->add_batch_size_hist(t->batch_size_hist(i));
+      }
       igate->set_timestamp(get_epoch_time());
     }
 
+    if (g->coalescing()) {
+      igate->set_coalescing(true);
+      igate->set_coalesce_delay_ns(tsc_to_ns(g->coalesce_delay()));
+    }
+
+    Capture* c = reinterpret_cast<Capture*>(g->FindHook(kGateHookCapture));
+    if (c) {
+      igate->set_capture_pkts(c->captured());
+      igate->set_capture_dropped(c->dropped());
+    }
+
     igate->set_igate(g->gate_idx());
     for (const auto& og : g->ogates_upstream()) {
       GetModuleInfoResponse_IGate_OGate* ogate = igate->add_ogates();
@@ -180,8 +236,20 @@ static int collect_ogates(Module* m, GetModuleInfoResponse* response) {
     if (t) {
       ogate->set_cnt(t->cnt());
       ogate->set_pkts(t->pkts());
+      ogate->set_avg_batch_size(t->avg_batch_size());
+      for (size_t i = 0; i <= bess::PacketBatch::kMaxBurst; i++) {
+        ogate->add_batch_size_hist(t->batch_size_hist(i));
+      }
       ogate->set_timestamp(get_epoch_time());
     }
+    if (g->measure_cycles()) {
+      ogate->set_cycles(g->cycles());
+    }
+    Capture* c = reinterpret_cast<Capture*>(g->FindHook(kGateHookCapture));
+    if (c) {
+      ogate->set_capture_pkts(c->captured());
+      ogate->set_capture_dropped(c->dropped());
+    }
     ogate->set_name(g->igate()->module()->name());
     ogate->set_igate(g->igate()->gate_idx());
   }
@@ -189,6 +257,20 @@ static int collect_ogates(Module* m, GetModuleInfoResponse* response) {
   return 0;
 }
 
+static int collect_drops(Module* m, GetModuleInfoResponse* response) {
+  response->set_dropped(m->total_drops());
+
+  for (gate_idx_t i = 0; i <= Module::kNumDropCounters; i++) {
+    if (m->drops(i)) {
+      GetModuleInfoResponse_Drop* drop = response->add_drops();
+      drop->set_ogate(i);
+      drop->set_pkts(m->drops(i));
+    }
+  }
+
+  return 0;
+}
+
 static int collect_metadata(Module* m, GetModuleInfoResponse* response) {
   size_t i = 0;
   for (const auto& it : m->all_attrs()) {
@@ -218,6 +300,16 @@ static int collect_metadata(Module* m, GetModuleInfoResponse* response) {
   return 0;
 }
 
+static int collect_mem(Module* m, GetModuleInfoResponse* response) {
+  bess::memory::OwnerStats stats = bess::memory::GetOwnerStats(m->name());
+
+  response->mutable_mem()->set_allocs(stats.allocs);
+  response->mutable_mem()->set_bytes(stats.bytes);
+  response->mutable_mem()->set_reserved(stats.reserved);
+
+  return 0;
+}
+
 static ::Port* create_port(const std::string& name, const PortBuilder& driver,
                            queue_t num_inc_q, queue_t num_out_q,
                            size_t size_inc_q, size_t size_out_q,
@@ -970,7 +1062,53 @@ class BESSControlImpl final : public BESSControl::Service {
 
     collect_igates(m, response);
     collect_ogates(m, response);
+    collect_drops(m, response);
     collect_metadata(m, response);
+    collect_mem(m, response);
+
+    if (bess::packet_accounting.enabled()) {
+      response->set_pkts_held(bess::packet_accounting.CountHeld(m));
+    }
+
+    return Status::OK;
+  }
+  Status GetMetadataLayout(ServerContext*, const EmptyRequest*,
+                           GetMetadataLayoutResponse* response) override {
+    const int line_size = bess::metadata::kMetadataCacheLineSize;
+
+    for (const auto& l : bess::metadata::default_pipeline.layout()) {
+      GetMetadataLayoutResponse_Component* comp = response->add_components();
+
+      comp->set_attr(l.attr_id);
+      comp->set_size(l.size);
+      comp->set_offset(l.offset);
+      if (l.offset >= 0) {
+        comp->set_cache_line(l.offset / line_size);
+      }
+      comp->set_weight(l.weight);
+      for (const Module* m : l.modules) {
+        comp->add_modules(m->name());
+      }
+    }
+
+    return Status::OK;
+  }
+  Status RepackMetadata(ServerContext*, const RepackMetadataRequest* request,
+                        EmptyResponse* response) override {
+    if (is_any_worker_running()) {
+      return return_with_error(response, EBUSY, "There is a running worker");
+    }
+
+    for (const auto& w : request->weights()) {
+      bess::metadata::default_pipeline.SetAttributeWeight(w.attr(),
+                                                          w.weight());
+    }
+
+    bess::metadata::default_pipeline.Repack();
+    int ret = bess::metadata::default_pipeline.ComputeMetadataOffsets();
+    if (ret) {
+      return return_with_errno(response, -ret);
+    }
 
     return Status::OK;
   }
@@ -1213,6 +1351,117 @@ class BESSControlImpl final : public BESSControl::Service {
     return Status::OK;
   }
 
+  Status EnableCapture(ServerContext*, const EnableCaptureRequest* request,
+                       EmptyResponse* response) override {
+    if (is_any_worker_running()) {
+      return return_with_error(response, EBUSY, "There is a running worker");
+    }
+
+    const char* m_name = request->name().c_str();
+    gate_idx_t gate = request->gate();
+    bess::Gate* g;
+    int ret;
+
+    if (!request->name().length()) {
+      return return_with_error(response, EINVAL, "Missing 'name' field");
+    }
+
+    const auto& it = ModuleBuilder::all_modules().find(request->name());
+    if (it == ModuleBuilder::all_modules().end()) {
+      return return_with_error(response, ENOENT, "No module '%s' found",
+                               m_name);
+    }
+    Module* m = it->second;
+
+    if (request->is_igate()) {
+      if (gate >= m->igates().size() || !m->igates()[gate]) {
+        return return_with_error(response, EINVAL,
+                                 "Input gate '%hu' does not exist", gate);
+      }
+      g = m->igates()[gate];
+    } else {
+      if (gate >= m->ogates().size() || !m->ogates()[gate]) {
+        return return_with_error(response, EINVAL,
+                                 "Output gate '%hu' does not exist", gate);
+      }
+      g = m->ogates()[gate];
+    }
+
+    if (g->FindHook(kGateHookCapture)) {
+      return return_with_error(response, EEXIST,
+                               "Capture %s:%hu is already enabled", m_name,
+                               gate);
+    }
+
+    Capture::Options opts;
+    opts.path = request->path();
+    if (request->snaplen()) {
+      opts.snaplen = request->snaplen();
+    }
+    if (request->sample_every()) {
+      opts.sample_every = request->sample_every();
+    }
+    opts.filter = request->filter();
+    if (request->ring_size()) {
+      opts.ring_size = request->ring_size();
+    }
+    opts.max_file_size = request->max_file_size();
+    opts.max_files = request->max_files();
+    opts.pcapng = request->pcapng();
+
+    Capture* c = new Capture();
+    ret = c->Init(opts);
+    if (ret < 0) {
+      delete c;
+      return return_with_error(response, -ret, "Enabling capture %s:%hu failed",
+                               m_name, gate);
+    }
+
+    c->Start();
+    g->AddHook(c);
+    return Status::OK;
+  }
+
+  Status DisableCapture(ServerContext*, const DisableCaptureRequest* request,
+                        EmptyResponse* response) override {
+    if (is_any_worker_running()) {
+      return return_with_error(response, EBUSY, "There is a running worker");
+    }
+
+    const char* m_name = request->name().c_str();
+    gate_idx_t gate = request->gate();
+
+    if (!request->name().length()) {
+      return return_with_error(response, EINVAL, "Missing 'name' field");
+    }
+
+    const auto& it = ModuleBuilder::all_modules().find(request->name());
+    if (it == ModuleBuilder::all_modules().end()) {
+      return return_with_error(response, ENOENT, "No module '%s' found",
+                               m_name);
+    }
+    Module* m = it->second;
+
+    bess::Gate* g;
+    if (request->is_igate()) {
+      if (gate >= m->igates().size() || !m->igates()[gate]) {
+        return return_with_error(response, EINVAL,
+                                 "Input gate '%hu' does not exist", gate);
+      }
+      g = m->igates()[gate];
+    } else {
+      if (gate >= m->ogates().size() || !m->ogates()[gate]) {
+        return return_with_error(response, EINVAL,
+                                 "Output gate '%hu' does not exist", gate);
+      }
+      g = m->ogates()[gate];
+    }
+
+    // Flushes the remaining records and closes the file
+    g->RemoveHook(kGateHookCapture);
+    return Status::OK;
+  }
+
   Status EnableTrack(ServerContext*, const EnableTrackRequest* request,
                      EmptyResponse* response) override {
     if (is_any_worker_running()) {
@@ -1223,7 +1472,8 @@ class BESSControlImpl final : public BESSControl::Service {
       for (const auto& it : ModuleBuilder::all_modules()) {
         *error =
             enable_track_for_module(it.second, request->gate(),
-                                    request->is_igate(), request->use_gate());
+                                    request->is_igate(), request->use_gate(),
+                                    request->cycles());
         if (error->err() != 0) {
           return Status::OK;
         }
@@ -1234,10 +1484,12 @@ class BESSControlImpl final : public BESSControl::Service {
       if (it == ModuleBuilder::all_modules().end()) {
         *error =
             pb_error(ENOENT, "No module '%s' found", request->name().c_str());
+        return Status::OK;
       }
       *error =
           enable_track_for_module(it->second, request->gate(),
-                                  request->is_igate(), request->use_gate());
+                                  request->is_igate(), request->use_gate(),
+                                  request->cycles());
       return Status::OK;
     }
   }
@@ -1250,9 +1502,9 @@ class BESSControlImpl final : public BESSControl::Service {
     pb_error_t* error = response->mutable_error();
     if (!request->name().length()) {
       for (const auto& it : ModuleBuilder::all_modules()) {
-        *error =
-            disable_track_for_module(it.second, request->gate(),
-                                     request->is_igate(), request->use_gate());
+        *error = disable_track_for_module(
+            it.second, request->gate(), request->is_igate(),
+            request->use_gate(), request->cycles());
         if (error->err() != 0) {
           return Status::OK;
         }
@@ -1263,14 +1515,221 @@ class BESSControlImpl final : public BESSControl::Service {
       if (it == ModuleBuilder::all_modules().end()) {
         *error =
             pb_error(ENOENT, "No module '%s' found", request->name().c_str());
+        return Status::OK;
       }
-      *error =
-          disable_track_for_module(it->second, request->gate(),
-                                   request->is_igate(), request->use_gate());
+      *error = disable_track_for_module(it->second, request->gate(),
+                                        request->is_igate(),
+                                        request->use_gate(), request->cycles());
       return Status::OK;
     }
   }
 
+  Status EnableCoalesce(ServerContext*, const EnableCoalesceRequest* request,
+                        EmptyResponse* response) override {
+    if (is_any_worker_running()) {
+      return return_with_error(response, EBUSY, "There is a running worker");
+    }
+
+    if (!request->name().length()) {
+      return return_with_error(response, EINVAL, "Missing 'name' field");
+    }
+
+    const auto& it = ModuleBuilder::all_modules().find(request->name());
+    if (it == ModuleBuilder::all_modules().end()) {
+      return return_with_error(response, ENOENT, "No module '%s' found",
+                               request->name().c_str());
+    }
+
+    gate_idx_t igate = request->igate();
+    int ret = it->second->EnableCoalescing(igate, request->max_delay_ns());
+    if (ret < 0) {
+      return return_with_error(response, -ret,
+                               "Enabling coalescing on %s:%hu failed",
+                               request->name().c_str(), igate);
+    }
+
+    return Status::OK;
+  }
+
+  Status DisableCoalesce(ServerContext*, const DisableCoalesceRequest* request,
+                         EmptyResponse* response) override {
+    if (is_any_worker_running()) {
+      return return_with_error(response, EBUSY, "There is a running worker");
+    }
+
+    if (!request->name().length()) {
+      return return_with_error(response, EINVAL, "Missing 'name' field");
+    }
+
+    const auto& it = ModuleBuilder::all_modules().find(request->name());
+    if (it == ModuleBuilder::all_modules().end()) {
+      return return_with_error(response, ENOENT, "No module '%s' found",
+                               request->name().c_str());
+    }
+
+    gate_idx_t igate = request->igate();
+    int ret = it->second->DisableCoalescing(igate);
+    if (ret < 0) {
+      return return_with_error(response, -ret,
+                               "Disabling coalescing on %s:%hu failed",
+                               request->name().c_str(), igate);
+    }
+
+    return Status::OK;
+  }
+
+  Status StartTrace(ServerContext*, const StartTraceRequest* request,
+                    EmptyResponse* response) override {
+    if (is_any_worker_running()) {
+      return return_with_error(response, EBUSY, "There is a running worker");
+    }
+
+    int ret = bess::packet_tracer.Start(request->filter(), request->max_pkts());
+    if (ret < 0) {
+      return return_with_error(response, -ret, "Invalid filter '%s'",
+                               request->filter().c_str());
+    }
+
+    return Status::OK;
+  }
+
+  Status StopTrace(ServerContext*, const EmptyRequest*,
+                   EmptyResponse* response) override {
+    if (is_any_worker_running()) {
+      return return_with_error(response, EBUSY, "There is a running worker");
+    }
+
+    bess::packet_tracer.Stop();
+    return Status::OK;
+  }
+
+  Status GetTrace(ServerContext*, const EmptyRequest*,
+                  GetTraceResponse* response) override {
+    std::map<const Module*, std::string> names;
+    for (const auto& it : ModuleBuilder::all_modules()) {
+      names[it.second] = it.first;
+    }
+
+    response->set_enabled(bess::packet_tracer.enabled());
+    response->set_marked(bess::packet_tracer.marked());
+
+    for (int wid = 0; wid < MAX_WORKERS; wid++) {
+      std::vector<bess::TraceRecord> records;
+      bess::packet_tracer.Read(wid, &records);
+
+      for (const auto& r : records) {
+        GetTraceResponse_Record* record = response->add_records();
+
+        record->set_wid(wid);
+        record->set_tsc(r.tsc);
+        record->set_ns(tsc_to_ns(r.tsc));
+        record->set_pkt(reinterpret_cast<uintptr_t>(r.pkt));
+        // The module may have been destroyed since
+        const auto& from = names.find(r.from);
+        if (from != names.end()) {
+          record->set_from_module(from->second);
+        }
+        record->set_ogate(r.ogate);
+        const auto& to = names.find(r.to);
+        if (to != names.end()) {
+          record->set_to_module(to->second);
+        }
+        record->set_igate(r.igate);
+        record->set_metadata(r.metadata, sizeof(r.metadata));
+      }
+    }
+
+    return Status::OK;
+  }
+
+  Status GetMemStats(ServerContext*, const EmptyRequest*,
+                     GetMemStatsResponse* response) override {
+    for (const auto& s : bess::memory::GetOwnerStats()) {
+      GetMemStatsResponse_Owner* owner = response->add_owners();
+
+      owner->set_name(s.owner);
+      owner->set_socket(s.socket);
+      owner->set_allocs(s.allocs);
+      owner->set_bytes(s.bytes);
+      owner->set_reserved(s.reserved);
+    }
+
+    for (const auto& s : bess::memory::GetArenaStats()) {
+      GetMemStatsResponse_Arena* arena = response->add_arenas();
+
+      arena->set_socket(s.socket);
+      arena->set_chunks(s.chunks);
+      arena->set_huge_chunks(s.huge_chunks);
+      arena->set_free_slabs(s.free_slabs);
+    }
+
+    return Status::OK;
+  }
+
+  Status EnablePacketAccounting(ServerContext*, const EmptyRequest*,
+                                EmptyResponse* response) override {
+    if (is_any_worker_running()) {
+      return return_with_error(response, EBUSY, "There is a running worker");
+    }
+
+    bess::packet_accounting.Enable();
+    return Status::OK;
+  }
+
+  Status DisablePacketAccounting(ServerContext*, const EmptyRequest*,
+                                 EmptyResponse* response) override {
+    if (is_any_worker_running()) {
+      return return_with_error(response, EBUSY, "There is a running worker");
+    }
+
+    bess::packet_accounting.Disable();
+    return Status::OK;
+  }
+
+  Status GetPoolStats(ServerContext*, const EmptyRequest*,
+                      GetPoolStatsResponse* response) override {
+    response->set_accounting(bess::packet_accounting.enabled());
+
+    for (const auto& s : bess::packet_accounting.GetPoolStats()) {
+      GetPoolStatsResponse_Pool* pool = response->add_pools();
+
+      pool->set_socket(s.socket);
+      pool->set_size(s.size);
+      pool->set_avail(s.avail);
+      pool->set_high_watermark(s.high_watermark);
+      pool->set_alloc_failures(s.alloc_failures);
+      pool->set_attributed(s.attributed);
+    }
+
+    if (!bess::packet_accounting.enabled()) {
+      return Status::OK;
+    }
+
+    std::map<const Module*, std::string> names;
+    for (const auto& it : ModuleBuilder::all_modules()) {
+      names[it.second] = it.first;
+    }
+
+    std::vector<std::pair<uint64_t, const Module*>> held;
+    for (const auto& it : bess::packet_accounting.CountHeld()) {
+      held.emplace_back(it.second, it.first);
+    }
+    std::sort(held.rbegin(), held.rend());
+
+    for (const auto& it : held) {
+      GetPoolStatsResponse_Holder* holder = response->add_holders();
+
+      // The module may have been destroyed since
+      const auto& name = names.find(it.second);
+      if (name != names.end()) {
+        holder->set_name(name->second);
+      }
+      holder->set_pkts(it.first);
+    }
+
+    return Status::OK;
+  }
+
   Status KillBess(ServerContext*, const EmptyRequest*,
                   EmptyResponse* response) override {
     if (is_any_worker_running()) {
@@ -1354,6 +1813,10 @@ static void reset_core_affinity() {
 static std::unique_ptr<Server> server;
 static BESSControlImpl service;
 
+bess::pb::BESSControl::Service* GetControlService() {
+  return &service;
+}
+
 void SetupControl() {
   ServerBuilder builder;
 
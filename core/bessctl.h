@@ -1,8 +1,16 @@
 #ifndef BESS_BESSCTL_H_
 #define BESS_BESSCTL_H_
 
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#include "service.grpc.pb.h"
+#pragma GCC diagnostic pop
+
 void SetupControl();
 
 void RunControl();
 
+// The service behind the gRPC server, so that tests can call RPCs directly
+bess::pb::BESSControl::Service *GetControlService();
+
 #endif  // BESS_BESSCTL_H_
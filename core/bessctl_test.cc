@@ -0,0 +1,102 @@
+#include "bessctl.h"
+
+#include <gtest/gtest.h>
+
+#include "hooks/track.h"
+#include "module.h"
+
+namespace {
+
+class DummyModule : public Module {
+ public:
+  static const gate_idx_t kNumIGates = 1;
+  static const gate_idx_t kNumOGates = 1;
+};
+
+// Calls the RPCs of the control service, as bessctl would
+class BessctlTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    ADD_MODULE(DummyModule, "dummy", "dummy");
+    ASSERT_TRUE(__module__DummyModule);
+
+    const ModuleBuilder &builder =
+        ModuleBuilder::all_module_builders().find("DummyModule")->second;
+    m0_ = builder.CreateModule("m0", &bess::metadata::default_pipeline);
+    ASSERT_TRUE(ModuleBuilder::AddModule(m0_));
+    m1_ = builder.CreateModule("m1", &bess::metadata::default_pipeline);
+    ASSERT_TRUE(ModuleBuilder::AddModule(m1_));
+
+    ASSERT_EQ(0, m0_->ConnectModules(0, m1_, 0));
+    ogate_ = m0_->ogates()[0];
+    ASSERT_NE(nullptr, ogate_->FindHook(kGateHookTrackGate));
+  }
+
+  virtual void TearDown() {
+    ModuleBuilder::DestroyAllModules();
+    ModuleBuilder::all_module_builders_holder(true);
+  }
+
+  int EnableTrack(const std::string &name, bool use_gate, bool cycles) {
+    bess::pb::EnableTrackRequest request;
+    bess::pb::EmptyResponse response;
+    request.set_name(name);
+    request.set_use_gate(use_gate);
+    request.set_cycles(cycles);
+    EXPECT_TRUE(
+        GetControlService()->EnableTrack(nullptr, &request, &response).ok());
+    return response.error().err();
+  }
+
+  int DisableTrack(const std::string &name, bool use_gate, bool cycles) {
+    bess::pb::DisableTrackRequest request;
+    bess::pb::EmptyResponse response;
+    request.set_name(name);
+    request.set_use_gate(use_gate);
+    request.set_cycles(cycles);
+    EXPECT_TRUE(
+        GetControlService()->DisableTrack(nullptr, &request, &response).ok());
+    return response.error().err();
+  }
+
+  Module *m0_;
+  Module *m1_;
+  bess::OGate *ogate_;
+};
+
+// Connected output gates are tracked already, which profiling builds on
+TEST_F(BessctlTest, ProfileConnectedGate) {
+  const bess::GateHook *track = ogate_->FindHook(kGateHookTrackGate);
+
+  for (bool use_gate : {true, false}) {
+    ASSERT_EQ(0, EnableTrack("m0", use_gate, true));
+    EXPECT_TRUE(ogate_->measure_cycles());
+    EXPECT_EQ(track, ogate_->FindHook(kGateHookTrackGate));
+    EXPECT_EQ(1, ogate_->hooks().size());
+
+    ASSERT_EQ(0, DisableTrack("m0", use_gate, true));
+    EXPECT_FALSE(ogate_->measure_cycles());
+    EXPECT_EQ(track, ogate_->FindHook(kGateHookTrackGate));
+  }
+
+  // For all modules
+  ASSERT_EQ(0, EnableTrack("", false, true));
+  EXPECT_TRUE(ogate_->measure_cycles());
+  ASSERT_EQ(0, DisableTrack("", false, true));
+  EXPECT_FALSE(ogate_->measure_cycles());
+  EXPECT_EQ(track, ogate_->FindHook(kGateHookTrackGate));
+}
+
+TEST_F(BessctlTest, TrackConnectedGate) {
+  ASSERT_EQ(0, DisableTrack("m0", true, false));
+  EXPECT_EQ(nullptr, ogate_->FindHook(kGateHookTrackGate));
+
+  ASSERT_EQ(0, EnableTrack("m0", true, false));
+  EXPECT_NE(nullptr, ogate_->FindHook(kGateHookTrackGate));
+  EXPECT_FALSE(ogate_->measure_cycles());
+
+  EXPECT_EQ(ENOENT, EnableTrack("m2", true, false));
+  EXPECT_EQ(ENOENT, DisableTrack("m2", true, false));
+}
+
+}  // namespace (unnamed)
@@ -154,5 +154,14 @@ static void init_eal(const char *prog_name, int mb_per_socket,
 
 void init_dpdk(const ::std::string &prog_name, int mb_per_socket,
                int multi_instance, bool no_huge) {
+  /* The EAL can be initialized only once per process, while test fixtures
+   * linked into the same binary may each ask for it */
+  static bool initialized = false;
+
+  if (initialized) {
+    return;
+  }
+
   init_eal(prog_name.c_str(), mb_per_socket, multi_instance, no_huge);
+  initialized = true;
 }
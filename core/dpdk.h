@@ -23,6 +23,7 @@
 #error DPDK version is not available
 #endif
 
+/* Does nothing if already called, with whatever arguments */
 void init_dpdk(const ::std::string &prog_name, int mb_per_socket,
                int multi_instance, bool no_huge);
 
@@ -13,15 +13,9 @@
 #include "../port.h"
 
 class ZeroCopyVPortTest : public ::testing::Test {
- public:
-  static bool dpdk_inited;
-
  protected:
   virtual void SetUp() {
-    if (!dpdk_inited) {
-      init_dpdk("vport_zc_test", 2048, 0, true);
-      dpdk_inited = true;
-    }
+    init_dpdk("vport_zc_test", 2048, 0, true);
     bess::pb::EmptyArg arg;
     ADD_DRIVER(ZeroCopyVPort, "zcvport",
                "zero copy virtual port for trusted user apps")
@@ -46,8 +40,6 @@ class ZeroCopyVPortTest : public ::testing::Test {
   ZeroCopyVPort *port;
 };
 
-bool ZeroCopyVPortTest::dpdk_inited = false;
-
 TEST_F(ZeroCopyVPortTest, Send) {
   int cnt;
   bess::PacketBatch tx_batch;
@@ -52,4 +52,21 @@ void IGate::RemoveOgate(const OGate *og) {
     }
   }
 }
+
+void IGate::EnableCoalescing(uint64_t max_delay_tsc, int num_workers) {
+  DisableCoalescing();
+
+  coalesce_buffers_ = new CoalesceBuffer[num_workers]();
+  for (int i = 0; i < num_workers; i++) {
+    coalesce_buffers_[i].igate = this;
+  }
+  coalesce_delay_ = max_delay_tsc;
+}
+
+void IGate::DisableCoalescing() {
+  delete[] coalesce_buffers_;
+  coalesce_buffers_ = nullptr;
+  coalesce_delay_ = 0;
+}
+
 }  // namespace bess
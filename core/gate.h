@@ -26,6 +26,20 @@ static_assert(DROP_GATE <= MAX_GATES, "invalid macro value");
 
 class Gate;
 
+class IGate;
+
+// Per-worker buffer of a coalescing input gate, where small batches are merged
+// until the batch is full or its deadline passes. See Module::RunCoalesced().
+struct CoalesceBuffer {
+  PacketBatch batch;
+  uint64_t deadline; /* TSC by which the batch must be delivered */
+  IGate *igate;
+
+  /* Buffers with packets are linked in the list of the worker */
+  CoalesceBuffer *next;
+  bool linked;
+};
+
 // Gate hooks allow you to run arbitrary code on the packets flowing through a
 // gate before they get delievered to the upstream module.
 // TODO(melvin): GateHooks should be structured like Modules/Drivers, so bessctl
@@ -101,12 +115,14 @@ class Gate {
   DISALLOW_COPY_AND_ASSIGN(Gate);
 };
 
-class IGate;
-
 class OGate : public Gate {
  public:
   OGate(Module *m, gate_idx_t idx, void *arg)
-      : Gate(m, idx, arg), igate_(), igate_idx_() {}
+      : Gate(m, idx, arg),
+        igate_(),
+        igate_idx_(),
+        measure_cycles_(),
+        cycles_() {}
 
   void set_igate(IGate *ig) { igate_ = ig; }
   IGate *igate() const { return igate_; }
@@ -114,17 +130,34 @@ class OGate : public Gate {
   void set_igate_idx(gate_idx_t idx) { igate_idx_ = idx; }
   gate_idx_t igate_idx() const { return igate_idx_; }
 
+  // If enabled, the TSC cycles spent downstream of this gate (including all
+  // modules the batch goes through from there) are accumulated.
+  bool measure_cycles() const { return measure_cycles_; }
+  void set_measure_cycles(bool enable) { measure_cycles_ = enable; }
+
+  uint64_t cycles() const { return cycles_; }
+  void incr_cycles(uint64_t n) { cycles_ += n; }
+  void clear_cycles() { cycles_ = 0; }
+
  private:
   IGate *igate_;
   gate_idx_t igate_idx_; /* cache for igate->gate_idx */
 
+  bool measure_cycles_;
+  uint64_t cycles_;
+
   DISALLOW_COPY_AND_ASSIGN(OGate);
 };
 
 class IGate : public Gate {
  public:
   IGate(Module *m, gate_idx_t idx, void *arg)
-      : Gate(m, idx, arg), ogates_upstream_() {}
+      : Gate(m, idx, arg),
+        ogates_upstream_(),
+        coalesce_buffers_(),
+        coalesce_delay_() {}
+
+  ~IGate() { DisableCoalescing(); }
 
   const std::vector<OGate *> &ogates_upstream() const {
     return ogates_upstream_;
@@ -134,8 +167,21 @@ class IGate : public Gate {
 
   void RemoveOgate(const OGate *og);
 
+  // Makes small batches wait up to max_delay_tsc cycles to be merged with
+  // later ones, with a separate buffer for each of num_workers workers.
+  // Must be called while workers are paused.
+  void EnableCoalescing(uint64_t max_delay_tsc, int num_workers);
+  void DisableCoalescing();
+
+  bool coalescing() const { return coalesce_buffers_ != nullptr; }
+  uint64_t coalesce_delay() const { return coalesce_delay_; }
+  CoalesceBuffer *coalesce_buffer(int wid) { return &coalesce_buffers_[wid]; }
+
  private:
   std::vector<OGate *> ogates_upstream_;
+
+  CoalesceBuffer *coalesce_buffers_; /* nullptr if not coalescing */
+  uint64_t coalesce_delay_;          /* in TSC cycles */
 };
 
 }  // namespace bess
@@ -1,11 +1,16 @@
 #include "gate.h"
 
+#include <pcap/pcap.h>
+#include <unistd.h>
+
 #include <gtest/gtest.h>
 
+#include "hooks/capture.h"
 #include "hooks/tcpdump.h"
 #include "hooks/track.h"
 #include "module.h"
 #include "pktbatch.h"
+#include "utils/pcap.h"
 
 namespace bess {
 
@@ -75,6 +80,169 @@ TEST(HookTest, TrackGate) {
   ASSERT_EQ(b.cnt(), t.pkts());
 }
 
+TEST(HookTest, TrackGateAvgBatchSize) {
+  TrackGate t;
+  bess::PacketBatch b;
+  ASSERT_EQ(0.0, t.avg_batch_size());
+  b.set_cnt(32);
+  t.ProcessBatch(&b);
+  b.set_cnt(2);
+  t.ProcessBatch(&b);
+  ASSERT_EQ(17.0, t.avg_batch_size());
+}
+
+TEST(HookTest, TrackGateBatchSizeHist) {
+  TrackGate t;
+  bess::PacketBatch b;
+  b.set_cnt(32);
+  t.ProcessBatch(&b);
+  t.ProcessBatch(&b);
+  b.set_cnt(0);
+  t.ProcessBatch(&b);
+  ASSERT_EQ(2, t.batch_size_hist(32));
+  ASSERT_EQ(1, t.batch_size_hist(0));
+  ASSERT_EQ(0, t.batch_size_hist(1));
+}
+
+class CaptureTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    char path[] = "/tmp/bess_capture_test_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_LE(0, fd);
+    close(fd);
+    path_ = path;
+
+    memset(pkts_, 0, sizeof(pkts_));
+    batch_.clear();
+    for (int i = 0; i < kNumPkts; i++) {
+      pkts_[i].set_buffer(pkts_[i].data());
+      pkts_[i].set_data_len(kPktLen);
+      pkts_[i].set_total_len(kPktLen);
+      memset(pkts_[i].data(), i, kPktLen);
+      batch_.add(&pkts_[i]);
+    }
+  }
+
+  virtual void TearDown() {
+    unlink(path_.c_str());
+    unlink((path_ + ".1").c_str());
+  }
+
+  // Returns the number of packets in a capture file, or -1
+  static int CountPackets(const std::string &path, uint32_t caplen) {
+    char errbuf[PCAP_ERRBUF_SIZE];
+    pcap_t *handle = pcap_open_offline(path.c_str(), errbuf);
+    if (!handle) {
+      return -1;
+    }
+
+    const u_char *data;
+    struct pcap_pkthdr hdr;
+    int cnt = 0;
+    while ((data = pcap_next(handle, &hdr)) != nullptr) {
+      EXPECT_EQ(caplen, hdr.caplen);
+      EXPECT_EQ(kPktLen, hdr.len);
+      cnt++;
+    }
+
+    pcap_close(handle);
+    return cnt;
+  }
+
+  static const int kNumPkts = 12;
+  static const uint32_t kPktLen = 60;
+
+  std::string path_;
+  bess::Packet pkts_[kNumPkts];
+  bess::PacketBatch batch_;
+};
+
+const uint32_t CaptureTest::kPktLen;
+
+TEST_F(CaptureTest, InvalidOptions) {
+  Capture::Options opts;
+  Capture c;
+  ASSERT_EQ(-EINVAL, c.Init(opts));
+
+  opts.path = path_;
+  opts.ring_size = 3;
+  ASSERT_EQ(-EINVAL, c.Init(opts));
+
+  opts.ring_size = 4;
+  opts.filter = "not a (valid filter";
+  ASSERT_EQ(-EINVAL, c.Init(opts));
+}
+
+TEST_F(CaptureTest, SamplingAndOverflow) {
+  Capture::Options opts;
+  opts.path = path_;
+  opts.snaplen = 16;
+  opts.sample_every = 2;
+  opts.ring_size = 4;
+
+  Capture *c = new Capture();
+  ASSERT_EQ(0, c->Init(opts));
+
+  // 6 of the 12 packets are sampled, but only 4 fit in the ring
+  c->ProcessBatch(&batch_);
+  ASSERT_EQ(4, c->captured());
+  ASSERT_EQ(2, c->dropped());
+
+  ASSERT_EQ(4, c->Drain());
+  ASSERT_EQ(0, c->Drain());
+
+  // The ring has room again
+  batch_.set_cnt(2);
+  c->ProcessBatch(&batch_);
+  ASSERT_EQ(5, c->captured());
+  ASSERT_EQ(2, c->dropped());
+
+  delete c;
+  ASSERT_EQ(5, CountPackets(path_, 16));
+}
+
+TEST_F(CaptureTest, Rotation) {
+  Capture::Options opts;
+  opts.path = path_;
+  opts.snaplen = 16;
+  opts.max_file_size =
+      sizeof(struct pcap_hdr) + 2 * (sizeof(struct pcap_rec_hdr) + 16);
+  opts.max_files = 2;
+
+  Capture *c = new Capture();
+  ASSERT_EQ(0, c->Init(opts));
+
+  // 2 packets per file, the third file overwrites the first one
+  batch_.set_cnt(5);
+  c->ProcessBatch(&batch_);
+  ASSERT_EQ(5, c->Drain());
+  ASSERT_EQ(3, c->files());
+
+  delete c;
+  ASSERT_EQ(1, CountPackets(path_, 16));
+  ASSERT_EQ(2, CountPackets(path_ + ".1", 16));
+}
+
+TEST_F(CaptureTest, Pcapng) {
+  Capture::Options opts;
+  opts.path = path_;
+  opts.snaplen = 1500;
+  opts.pcapng = true;
+  opts.filter = "ether[0] == 3";
+
+  Capture *c = new Capture();
+  ASSERT_EQ(0, c->Init(opts));
+  c->Start();
+
+  // Only the fourth packet starts with a 3
+  c->ProcessBatch(&batch_);
+  ASSERT_EQ(1, c->captured());
+
+  delete c;
+  ASSERT_EQ(1, CountPackets(path_, kPktLen));
+}
+
 TEST_F(IOGateTest, OGate) {
   og->set_igate(ig);
   og->set_igate_idx(0);
@@ -88,4 +256,15 @@ TEST_F(IOGateTest, IGate) {
   ig->RemoveOgate(og);
   ASSERT_EQ(0, ig->ogates_upstream().size());
 }
+
+TEST_F(IOGateTest, Coalescing) {
+  ASSERT_FALSE(ig->coalescing());
+  ig->EnableCoalescing(100, 2);
+  ASSERT_TRUE(ig->coalescing());
+  ASSERT_EQ(100, ig->coalesce_delay());
+  ASSERT_EQ(ig, ig->coalesce_buffer(1)->igate);
+  ASSERT_TRUE(ig->coalesce_buffer(1)->batch.empty());
+  ig->DisableCoalescing();
+  ASSERT_FALSE(ig->coalescing());
+}
 }  // namespace bess
@@ -0,0 +1,409 @@
+#include "capture.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <glog/logging.h>
+
+#include "../mem_alloc.h"
+#include "../utils/common.h"
+#include "../utils/pcap.h"
+#include "../utils/time.h"
+#include "../worker.h"
+
+// How long the writer thread sleeps when all rings are empty
+static const useconds_t kIdleUs = 1000;
+
+Capture::Capture()
+    : bess::GateHook(kGateHookCapture, kGateHookPriorityCapture),
+      path_(),
+      snaplen_(),
+      sample_every_(1),
+      filter_(),
+      ring_size_(),
+      slot_size_(),
+      max_file_size_(),
+      max_files_(),
+      pcapng_(),
+      tsc_base_(),
+      ns_base_(),
+      file_(),
+      file_size_(),
+      files_(),
+      reported_drops_(),
+      last_report_tsc_(),
+      writer_(),
+      running_() {
+  for (int wid = 0; wid < MAX_WORKERS; wid++) {
+    rings_[wid] = nullptr;
+  }
+}
+
+Capture::~Capture() {
+  if (running_) {
+    running_ = false;
+    writer_.join();
+  }
+
+  // The gate is gone by now, so nothing is published after this.
+  Drain();
+
+  if (file_) {
+    fclose(file_);
+  }
+
+  if (captured() || dropped()) {
+    LOG(INFO) << "Capture " << path_ << ": " << captured() << " packets in "
+              << files_ << " file(s), " << dropped() << " dropped";
+  }
+
+  pcap_freecode(&filter_);
+  for (int wid = 0; wid < MAX_WORKERS; wid++) {
+    Ring *r = rings_[wid];
+    if (r) {
+      r->~Ring();
+      mem_free(r);
+    }
+  }
+}
+
+int Capture::Init(const Options &opts) {
+  if (!opts.path.length() || !opts.snaplen || !opts.sample_every ||
+      !opts.ring_size || (opts.ring_size & (opts.ring_size - 1))) {
+    return -EINVAL;
+  }
+
+  if (opts.filter.length() &&
+      pcap_compile_nopcap(opts.snaplen, DLT_EN10MB, &filter_,
+                          opts.filter.c_str(), 1, PCAP_NETMASK_UNKNOWN) == -1) {
+    return -EINVAL;
+  }
+
+  path_ = opts.path;
+  snaplen_ = opts.snaplen;
+  sample_every_ = opts.sample_every;
+  ring_size_ = opts.ring_size;
+  slot_size_ = align_ceil(sizeof(Record) + snaplen_, sizeof(uint64_t));
+  max_file_size_ = opts.max_file_size;
+  max_files_ = opts.max_files;
+  pcapng_ = opts.pcapng;
+
+  int ret = OpenFile();
+  if (ret < 0) {
+    return ret;
+  }
+
+  tsc_base_ = rdtsc();
+  ns_base_ = get_epoch_time() * 1e9;
+  last_report_tsc_ = tsc_base_;
+  return 0;
+}
+
+Capture::Ring *Capture::AddRing(int wid) {
+  // On the socket of the worker
+  void *mem = mem_alloc_ex(sizeof(Ring) + ring_size_ * slot_size_,
+                           alignof(Ring), -1);
+  if (!mem) {
+    LOG_FIRST_N(ERROR, 1) << "Capture " << path_ << ": no memory for the ring"
+                          << " of worker " << wid;
+    return nullptr;
+  }
+
+  Ring *r = new (mem) Ring();
+  r->head = 0;
+  r->captured = 0;
+  r->dropped = 0;
+  r->countdown = 1;
+  r->tail = 0;
+
+  rings_[wid].store(r, std::memory_order_release);
+  return r;
+}
+
+void Capture::Start() {
+  running_ = true;
+  writer_ = std::thread(&Capture::Run, this);
+}
+
+void Capture::Run() {
+  while (running_) {
+    ReportDrops();
+    if (!Drain()) {
+      if (file_) {
+        fflush(file_);
+      }
+      usleep(kIdleUs);
+    }
+  }
+}
+
+uint64_t Capture::captured() const {
+  uint64_t sum = 0;
+  for (int wid = 0; wid < MAX_WORKERS; wid++) {
+    const Ring *r = rings_[wid].load(std::memory_order_acquire);
+    if (r) {
+      sum += r->captured.load(std::memory_order_relaxed);
+    }
+  }
+  return sum;
+}
+
+uint64_t Capture::dropped() const {
+  uint64_t sum = 0;
+  for (int wid = 0; wid < MAX_WORKERS; wid++) {
+    const Ring *r = rings_[wid].load(std::memory_order_acquire);
+    if (r) {
+      sum += r->dropped.load(std::memory_order_relaxed);
+    }
+  }
+  return sum;
+}
+
+void Capture::ProcessBatch(const bess::PacketBatch *batch) {
+  const int wid = ctx.wid();
+  Ring *r = rings_[wid].load(std::memory_order_relaxed);
+
+  if (unlikely(!r)) {
+    r = AddRing(wid);
+    if (!r) {
+      return;
+    }
+  }
+
+  uint64_t head = r->head.load(std::memory_order_relaxed);
+  uint64_t tail = r->tail.load(std::memory_order_acquire);
+  uint64_t tsc = rdtsc();
+  uint64_t captured = 0;
+  uint64_t dropped = 0;
+
+  for (int i = 0; i < batch->cnt(); i++) {
+    bess::Packet *pkt = batch->pkts()[i];
+
+    if (filter_.bf_insns &&
+        !bpf_filter(filter_.bf_insns, pkt->head_data<u_char *>(),
+                    pkt->total_len(), pkt->head_len())) {
+      continue;
+    }
+
+    if (--r->countdown) {
+      continue;
+    }
+    r->countdown = sample_every_;
+
+    if (head - tail >= ring_size_) {
+      // The cached tail may be stale. Only look again when the ring seems
+      // full, to keep the consumer's cache line out of the fast path.
+      tail = r->tail.load(std::memory_order_acquire);
+      if (head - tail >= ring_size_) {
+        dropped++;
+        continue;
+      }
+    }
+
+    Record *rec = slot(r, head);
+    rec->tsc = tsc;
+    rec->cap_len = std::min<uint32_t>(snaplen_, pkt->head_len());
+    rec->orig_len = pkt->total_len();
+    memcpy(rec + 1, pkt->head_data(), rec->cap_len);
+
+    head++;
+    captured++;
+  }
+
+  // Publish the whole batch at once
+  r->head.store(head, std::memory_order_release);
+
+  // Single writer: no need for atomic read-modify-write operations
+  if (captured) {
+    r->captured.store(r->captured.load(std::memory_order_relaxed) + captured,
+                      std::memory_order_relaxed);
+  }
+  if (dropped) {
+    r->dropped.store(r->dropped.load(std::memory_order_relaxed) + dropped,
+                     std::memory_order_relaxed);
+  }
+}
+
+size_t Capture::Drain() {
+  size_t cnt = 0;
+
+  if (!ring_size_) {
+    return 0;  // Init() failed
+  }
+
+  // Records from different workers are not merged by timestamp, so the
+  // files may be slightly out of order when several workers feed the gate.
+  for (int wid = 0; wid < MAX_WORKERS; wid++) {
+    Ring *r = rings_[wid].load(std::memory_order_acquire);
+    if (!r) {
+      continue;
+    }
+
+    uint64_t tail = r->tail.load(std::memory_order_relaxed);
+    uint64_t head = r->head.load(std::memory_order_acquire);
+
+    for (; tail < head; tail++) {
+      WriteRecord(slot(r, tail));
+      cnt++;
+    }
+
+    r->tail.store(tail, std::memory_order_release);
+  }
+
+  return cnt;
+}
+
+void Capture::ReportDrops() {
+  uint64_t now = rdtsc();
+
+  if (now - last_report_tsc_ < tsc_hz) {
+    return;
+  }
+  last_report_tsc_ = now;
+
+  uint64_t drops = dropped();
+  if (drops > reported_drops_) {
+    LOG(WARNING) << "Capture " << path_ << ": " << drops - reported_drops_
+                 << " packets dropped (ring full, " << drops << " total)";
+    reported_drops_ = drops;
+  }
+}
+
+std::string Capture::FileName(uint32_t seq) const {
+  if (max_files_) {
+    seq %= max_files_;
+  }
+  return seq ? path_ + "." + std::to_string(seq) : path_;
+}
+
+int Capture::OpenFile() {
+  static const struct pcap_hdr PCAP_FILE_HDR = {
+      .magic_number = PCAP_MAGIC_NUMBER,
+      .version_major = PCAP_VERSION_MAJOR,
+      .version_minor = PCAP_VERSION_MINOR,
+      .thiszone = PCAP_THISZONE,
+      .sigfigs = PCAP_SIGFIGS,
+      .snaplen = PCAP_SNAPLEN,
+      .network = PCAP_NETWORK,
+  };
+  static const struct pcapng_shb PCAPNG_SHB = {
+      .block_type = PCAPNG_BLOCK_SHB,
+      .block_len = sizeof(struct pcapng_shb),
+      .byte_order = PCAPNG_BYTE_ORDER_MAGIC,
+      .version_major = PCAPNG_VERSION_MAJOR,
+      .version_minor = PCAPNG_VERSION_MINOR,
+      .section_len = {0xffffffff, 0xffffffff},
+      .block_len_trail = sizeof(struct pcapng_shb),
+  };
+  static const struct pcapng_idb PCAPNG_IDB = {
+      .block_type = PCAPNG_BLOCK_IDB,
+      .block_len = sizeof(struct pcapng_idb),
+      .link_type = PCAP_NETWORK,
+      .reserved = 0,
+      .snaplen = PCAP_SNAPLEN,
+      .tsresol_code = PCAPNG_OPT_IF_TSRESOL,
+      .tsresol_len = 1,
+      .tsresol = 9,
+      .tsresol_pad = {0, 0, 0},
+      .endofopt_code = PCAPNG_OPT_ENDOFOPT,
+      .endofopt_len = 0,
+      .block_len_trail = sizeof(struct pcapng_idb),
+  };
+
+  if (file_) {
+    fclose(file_);
+  }
+
+  std::string name = FileName(files_);
+  file_ = fopen(name.c_str(), "w");
+  if (!file_) {
+    file_size_ = 0;  // do not retry on every record
+    int err = errno;
+    PLOG(ERROR) << "Capture: fopen(" << name << ")";
+    return -err;
+  }
+
+  bool ok;
+  if (pcapng_) {
+    ok = fwrite(&PCAPNG_SHB, sizeof(PCAPNG_SHB), 1, file_) == 1 &&
+         fwrite(&PCAPNG_IDB, sizeof(PCAPNG_IDB), 1, file_) == 1;
+    file_size_ = sizeof(PCAPNG_SHB) + sizeof(PCAPNG_IDB);
+  } else {
+    ok = fwrite(&PCAP_FILE_HDR, sizeof(PCAP_FILE_HDR), 1, file_) == 1;
+    file_size_ = sizeof(PCAP_FILE_HDR);
+  }
+
+  if (!ok) {
+    int err = errno ? errno : EIO;
+    PLOG(ERROR) << "Capture: fwrite(" << name << ")";
+    fclose(file_);
+    file_ = nullptr;
+    return -err;
+  }
+
+  files_++;
+  return 0;
+}
+
+void Capture::WriteRecord(const Record *rec) {
+  static const char padding[4] = {};
+
+  uint64_t ns = ns_base_ + tsc_to_ns(rec->tsc - tsc_base_);
+  size_t pad_len = 0;
+  size_t rec_len;
+
+  if (pcapng_) {
+    pad_len = align_ceil(rec->cap_len, 4) - rec->cap_len;
+    rec_len = sizeof(struct pcapng_epb) + rec->cap_len + pad_len +
+              sizeof(uint32_t);
+  } else {
+    rec_len = sizeof(struct pcap_rec_hdr) + rec->cap_len;
+  }
+
+  if (max_file_size_ && file_size_ + rec_len > max_file_size_) {
+    // Rotate, unless the record would not fit in an empty file either
+    size_t hdr_len = pcapng_
+                         ? sizeof(struct pcapng_shb) + sizeof(struct pcapng_idb)
+                         : sizeof(struct pcap_hdr);
+    if (file_size_ > hdr_len) {
+      OpenFile();
+    }
+  }
+
+  if (!file_) {
+    return;  // already logged by OpenFile()
+  }
+
+  if (pcapng_) {
+    struct pcapng_epb epb = {
+        .block_type = PCAPNG_BLOCK_EPB,
+        .block_len = static_cast<uint32_t>(rec_len),
+        .interface_id = 0,
+        .ts_high = static_cast<uint32_t>(ns >> 32),
+        .ts_low = static_cast<uint32_t>(ns),
+        .cap_len = rec->cap_len,
+        .orig_len = rec->orig_len,
+    };
+    uint32_t block_len = rec_len;
+
+    fwrite(&epb, sizeof(epb), 1, file_);
+    fwrite(rec + 1, rec->cap_len, 1, file_);
+    fwrite(padding, pad_len, 1, file_);
+    fwrite(&block_len, sizeof(block_len), 1, file_);
+  } else {
+    struct pcap_rec_hdr hdr = {
+        .ts_sec = static_cast<uint32_t>(ns / 1000000000),
+        .ts_usec = static_cast<uint32_t>(ns % 1000000000 / 1000),
+        .incl_len = rec->cap_len,
+        .orig_len = rec->orig_len,
+    };
+
+    fwrite(&hdr, sizeof(hdr), 1, file_);
+    fwrite(rec + 1, rec->cap_len, 1, file_);
+  }
+
+  file_size_ += rec_len;
+}
@@ -0,0 +1,141 @@
+#ifndef BESS_HOOKS_CAPTURE_
+#define BESS_HOOKS_CAPTURE_
+
+#include <pcap/pcap.h>
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+#include "../module.h"
+
+const std::string kGateHookCapture = "capture";
+const uint16_t kGateHookPriorityCapture = 2;
+
+// Capture saves truncated copies of (a sample of) the packets seen by a gate
+// into pcap or pcapng files. Unlike TcpDump, the worker never makes a system
+// call and never waits: packets are copied into a single-producer
+// single-consumer ring per worker, and a writer thread drains the rings to
+// disk. Packets that do not fit in a ring are left out of the capture (not
+// dropped from the datapath) and counted.
+class Capture final : public bess::GateHook {
+ public:
+  struct Options {
+    Options()
+        : path(),
+          snaplen(128),
+          sample_every(1),
+          filter(),
+          ring_size(4096),
+          max_file_size(),
+          max_files(),
+          pcapng() {}
+
+    std::string path;        // first file; the next ones get a ".N" suffix
+    uint32_t snaplen;        // max bytes kept from each packet
+    uint32_t sample_every;   // keep 1 out of this many (matching) packets
+    std::string filter;      // in pcap-filter(7) syntax, empty for all
+    uint32_t ring_size;      // records per worker, power of 2
+    uint64_t max_file_size;  // rotate when a file would exceed it, 0: never
+    uint32_t max_files;      // overwrite the oldest file after this many
+    bool pcapng;             // pcapng with ns timestamps instead of pcap
+  };
+
+  Capture();
+
+  // Stops the writer thread and flushes what is left in the rings
+  ~Capture();
+
+  // Compiles the filter and opens the first file. Returns 0 or -errno.
+  // The ring of a worker is allocated with its first batch, so that idle
+  // workers take no memory.
+  int Init(const Options &opts);
+
+  // Launches the writer thread
+  void Start();
+
+  // Writes out all records published so far and returns how many.
+  // Called by the writer thread; only exposed for testing.
+  size_t Drain();
+
+  void ProcessBatch(const bess::PacketBatch *batch);
+
+  // Packets copied into the rings
+  uint64_t captured() const;
+
+  // Packets left out because a ring was full
+  uint64_t dropped() const;
+
+  // Files opened so far, including rotated ones
+  uint32_t files() const { return files_; }
+
+ private:
+  struct Record {
+    uint64_t tsc;
+    uint32_t cap_len;
+    uint32_t orig_len;
+    // followed by cap_len bytes of packet data
+  };
+
+  // Followed by ring_size_ slots of slot_size_ bytes, in the same allocation.
+  // Each ring starts on its own cache line, and the fields of the worker and
+  // those of the writer thread are on different ones.
+  struct Ring {
+    // Written by the worker
+    alignas(64) std::atomic<uint64_t> head;
+    std::atomic<uint64_t> captured;
+    std::atomic<uint64_t> dropped;
+    uint32_t countdown;  // packets left before the next sample
+
+    // Written by the writer thread
+    alignas(64) std::atomic<uint64_t> tail;
+  };
+
+  Record *slot(Ring *r, uint64_t idx) const {
+    return reinterpret_cast<Record *>(reinterpret_cast<char *>(r + 1) +
+                                      (idx & (ring_size_ - 1)) * slot_size_);
+  }
+
+  // Called by worker wid on its first batch. Returns nullptr if out of memory.
+  Ring *AddRing(int wid);
+
+  std::string FileName(uint32_t seq) const;
+
+  int OpenFile();
+
+  void WriteRecord(const Record *rec);
+
+  void ReportDrops();
+
+  void Run();
+
+  // Set by Init(), read-only afterwards
+  std::string path_;
+  uint32_t snaplen_;
+  uint32_t sample_every_;
+  struct bpf_program filter_; /* bf_insns is nullptr if everything matches */
+  uint32_t ring_size_;
+  size_t slot_size_;
+  uint64_t max_file_size_;
+  uint32_t max_files_;
+  bool pcapng_;
+
+  uint64_t tsc_base_;  // rdtsc() at ns_base_
+  uint64_t ns_base_;   // wall-clock time of Init(), since the Epoch
+
+  // nullptr until the worker feeds the gate
+  std::atomic<Ring *> rings_[MAX_WORKERS];
+
+  // Owned by the writer thread
+  FILE *file_;
+  uint64_t file_size_;
+  uint32_t files_;
+  uint64_t reported_drops_;
+  uint64_t last_report_tsc_;
+
+  std::thread writer_;
+  std::atomic<bool> running_;
+};
+
+#endif  // BESS_HOOKS_CAPTURE_
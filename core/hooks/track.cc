@@ -3,4 +3,5 @@
 void TrackGate::ProcessBatch(const bess::PacketBatch *batch) {
   cnt_ += 1;
   pkts_ += batch->cnt();
+  hist_[batch->cnt()] += 1;
 }
@@ -6,13 +6,15 @@
 const std::string kGateHookTrackGate = "track_gate";
 const uint16_t kGateHookPriorityTrackGate = 0;
 
-// TrackGate counts the number of packets and batches seen by a gate.
+// TrackGate counts the number of packets and batches seen by a gate, along
+// with a histogram of batch sizes.
 class TrackGate final : public bess::GateHook {
  public:
   TrackGate()
       : bess::GateHook(kGateHookTrackGate, kGateHookPriorityTrackGate),
         cnt_(),
-        pkts_(){};
+        pkts_(),
+        hist_(){};
 
   uint64_t cnt() const { return cnt_; }
   void incr_cnt(uint64_t n) { cnt_ += n; }
@@ -20,11 +22,20 @@ class TrackGate final : public bess::GateHook {
   uint64_t pkts() const { return pkts_; }
   void incr_pkts(uint64_t n) { pkts_ += n; }
 
+  // Small values show where batches get fragmented
+  double avg_batch_size() const {
+    return cnt_ ? static_cast<double>(pkts_) / cnt_ : 0.0;
+  }
+
+  // Number of batches with exactly `size` packets
+  uint64_t batch_size_hist(int size) const { return hist_[size]; }
+
   void ProcessBatch(const bess::PacketBatch *batch);
 
  private:
   uint64_t cnt_;
   uint64_t pkts_;
+  uint64_t hist_[bess::PacketBatch::kMaxBurst + 1];
 };
 
 #endif  // BESS_HOOKS_TRACK_
@@ -6,6 +6,7 @@
 #include "bessd.h"
 #include "debug.h"
 #include "dpdk.h"
+#include "mem_alloc.h"
 #include "opts.h"
 #include "packet.h"
 #include "port.h"
@@ -40,6 +41,10 @@ int main(int argc, char *argv[]) {
   // TODO(barath): Make these DPDK calls generic, so as to not be so tied to
   // DPDK.
   init_dpdk(argv[0], FLAGS_m, FLAGS_a, FLAGS_no_huge);
+  if (!FLAGS_no_huge) {
+    bess::memory::SetHugetlbLimit(static_cast<size_t>(FLAGS_huge_mem_mb)
+                                  << 20);
+  }
   bess::init_mempool();
 
   PortBuilder::InitDrivers();
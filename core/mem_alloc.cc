@@ -1,70 +1,723 @@
 #include "mem_alloc.h"
 
-#define LIBC 0
-#define DPDK 1
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
-/* either LIBC or DPDK */
-#define MEM_ALLOC_PROVIDER LIBC
+#include <glog/logging.h>
 
-#if MEM_ALLOC_PROVIDER == LIBC
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <map>
+#include <mutex>
 
-#include <malloc.h>
+namespace bess {
+namespace memory {
 
-#include <cstdlib>
-#include <cstring>
+static const size_t kSlabSize = 64 * 1024;
+static const size_t kChunkSize = 2 * 1024 * 1024;  // one huge page
+static const size_t kPageSize = 4096;
+static const size_t kHeaderSize = 64;
+static const size_t kMinAlign = 16;
 
-void *mem_alloc(size_t size) {
-  return calloc(1, size);
+static const int kMaxSockets = 8;
+static const int kMaxOwners = 4096;
+
+// Slot sizes of the slabs. Each is a multiple of the alignments it serves.
+static const uint32_t kClassSizes[] = {
+    16,   32,   48,   64,   96,   128,  192,  256,   384,   512,
+    768,  1024, 1536, 2048, 3072, 4096, 6144, 8192, 12288, 16384,
+};
+static const int kNumClasses = sizeof(kClassSizes) / sizeof(kClassSizes[0]);
+
+// Each thread caches up to kCacheBinSize free slots for an owner, socket, and
+// size class, so that it locks the owner only once every kCacheBatch
+// allocations or frees of a kind, at most. Bins are direct-mapped.
+static const int kCacheBins = 32;
+static const uint32_t kCacheBinSize = 32;
+static const uint32_t kCacheBatch = kCacheBinSize / 2;
+
+// Not in the glibc headers of older distributions
+static const int kMpolPreferred = 1;
+
+enum BlockKind : uint32_t {
+  kSlab = 0x51ab51ab,
+  kLarge = 0x1a26e000,
+};
+
+// The header of a slab or of a large object, in the first bytes of a
+// kSlabSize-aligned block, so that it is found by masking an object address
+struct Block {
+  BlockKind kind;
+  owner_t owner;
+  uint8_t socket;
+  uint8_t cls;  // slab only
+
+  // Slab only
+  uint32_t used;      // live objects
+  uint32_t capacity;  // objects
+  void *free_list;    // freed slots, linked through their first word
+  char *unused;       // slots never handed out start here
+  Block *prev;        // in the list of slabs with free slots of the pool
+  Block *next;
+
+  size_t map_size;  // large only: bytes mapped, including the header
+  bool huge;        // large only: backed by hugetlbfs pages
+};
+
+static_assert(sizeof(Block) <= kHeaderSize, "Block header is too large");
+
+// The slabs of an owner for a socket and size class that have free slots
+struct Pool {
+  Block *partial;
+};
+
+struct OwnerState {
+  std::mutex lock;
+  Pool pools[kMaxSockets][kNumClasses];
+  OwnerStats stats[kMaxSockets];
+};
+
+struct Arena {
+  std::mutex lock;
+  Block *free_slabs;
+  ArenaStats stats;
+};
+
+static Arena arenas[kMaxSockets];
+static std::atomic<OwnerState *> owners[kMaxOwners];
+static thread_local owner_t current_owner;
+
+// hugetlbfs pages are taken from those left over by DPDK, and only up to the
+// limit on each socket, see SetHugetlbLimit()
+static std::atomic<size_t> hugetlb_limit;
+static std::atomic<size_t> hugetlb_used[kMaxSockets];
+
+struct OwnerRegistry {
+  std::mutex lock;
+  std::map<std::string, owner_t> ids;
+  std::vector<std::string> names;
+};
+
+static OwnerRegistry &registry() {
+  static OwnerRegistry *r = new OwnerRegistry();
+  return *r;
+}
+
+static OwnerState *GetOwnerState(owner_t id) {
+  OwnerState *o = owners[id].load(std::memory_order_acquire);
+  if (o) {
+    return o;
+  }
+
+  // The unnamed owner is created on first use
+  std::lock_guard<std::mutex> guard(registry().lock);
+  o = owners[id].load(std::memory_order_relaxed);
+  if (!o) {
+    o = new OwnerState();
+    for (int i = 0; i < kMaxSockets; i++) {
+      o->stats[i] = {std::string(), i, 0, 0, 0};
+    }
+    owners[id].store(o, std::memory_order_release);
+  }
+  return o;
+}
+
+static owner_t RegisterOwner(const std::string &name) {
+  OwnerRegistry &r = registry();
+  std::lock_guard<std::mutex> guard(r.lock);
+
+  if (r.names.empty()) {
+    r.names.emplace_back();  // id 0: allocations outside of any OwnerScope
+  }
+
+  auto it = r.ids.find(name);
+  if (it != r.ids.end()) {
+    return it->second;
+  }
+
+  if (r.names.size() >= static_cast<size_t>(kMaxOwners)) {
+    LOG_FIRST_N(WARNING, 1) << "Too many memory owners; " << name
+                            << " is not accounted separately";
+    return 0;
+  }
+
+  owner_t id = r.names.size();
+  r.ids.emplace(name, id);
+  r.names.push_back(name);
+  return id;
+}
+
+static std::string OwnerName(owner_t id) {
+  OwnerRegistry &r = registry();
+  std::lock_guard<std::mutex> guard(r.lock);
+  return id < r.names.size() ? r.names[id] : std::string();
+}
+
+static int ThreadSocket() {
+  static thread_local int socket = -1;
+
+  if (socket < 0) {
+    unsigned int cpu;
+    unsigned int node;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0 &&
+        node < static_cast<unsigned int>(kMaxSockets)) {
+      socket = node;
+    } else {
+      socket = 0;
+    }
+  }
+
+  return socket;
+}
+
+// Best effort: the kernel may not support NUMA, and memory is still usable
+static void BindToSocket(void *addr, size_t len, int socket) {
+  unsigned long mask = 1UL << socket;
+  syscall(SYS_mbind, addr, len, kMpolPreferred, &mask, sizeof(mask) * 8, 0);
+}
+
+static bool ReserveHugetlb(int socket, size_t len) {
+  size_t used = hugetlb_used[socket].load(std::memory_order_relaxed);
+
+  do {
+    if (used + len > hugetlb_limit.load(std::memory_order_relaxed)) {
+      return false;
+    }
+  } while (!hugetlb_used[socket].compare_exchange_weak(used, used + len));
+
+  return true;
+}
+
+static void UnreserveHugetlb(int socket, size_t len) {
+  hugetlb_used[socket] -= len;
+}
+
+// Maps len bytes (a multiple of kChunkSize if huge is set) aligned to align,
+// from hugetlbfs if huge is set, or from regular pages that may be turned
+// into transparent huge pages. Returns nullptr on failure.
+static void *MapAligned(size_t len, size_t align, bool huge) {
+  if (huge) {
+    void *p = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    return (p == MAP_FAILED) ? nullptr : p;
+  }
+
+  size_t map_len = len + align - kPageSize;
+  char *p = static_cast<char *>(mmap(nullptr, map_len, PROT_READ | PROT_WRITE,
+                                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  if (p == MAP_FAILED) {
+    return nullptr;
+  }
+
+  char *aligned = reinterpret_cast<char *>(
+      (reinterpret_cast<uintptr_t>(p) + align - 1) & ~(align - 1));
+  if (aligned > p) {
+    munmap(p, aligned - p);
+  }
+  if (p + map_len > aligned + len) {
+    munmap(aligned + len, p + map_len - (aligned + len));
+  }
+
+  if (len >= kChunkSize) {
+    madvise(aligned, len, MADV_HUGEPAGE);
+  }
+  return aligned;
 }
 
-/* TODO: socket is ignored for now */
-void *mem_alloc_ex(size_t size, size_t align, int) {
-  void *ptr;
-  int ret;
+// Adds a new chunk of slabs to the arena. Called with the arena locked.
+static bool GrowArena(Arena *a, int socket) {
+  bool huge = ReserveHugetlb(socket, kChunkSize);
+  char *chunk = nullptr;
+
+  if (huge) {
+    chunk = static_cast<char *>(MapAligned(kChunkSize, kChunkSize, true));
+    if (!chunk) {
+      UnreserveHugetlb(socket, kChunkSize);
+      huge = false;
+    }
+  }
+
+  if (!chunk) {
+    chunk = static_cast<char *>(MapAligned(kChunkSize, kChunkSize, false));
+    if (!chunk) {
+      return false;
+    }
+  }
+
+  BindToSocket(chunk, kChunkSize, socket);
 
-  ret = posix_memalign(&ptr, align, size);
-  if (ret)
+  for (size_t off = 0; off < kChunkSize; off += kSlabSize) {
+    Block *slab = reinterpret_cast<Block *>(chunk + off);
+    slab->next = a->free_slabs;
+    a->free_slabs = slab;
+  }
+
+  a->stats.socket = socket;
+  a->stats.chunks++;
+  a->stats.huge_chunks += huge;
+  a->stats.free_slabs += kChunkSize / kSlabSize;
+  return true;
+}
+
+static Block *GetSlab(int socket) {
+  Arena *a = &arenas[socket];
+  std::lock_guard<std::mutex> guard(a->lock);
+
+  if (!a->free_slabs && !GrowArena(a, socket)) {
     return nullptr;
+  }
 
-  memset(ptr, 0, size);
+  Block *slab = a->free_slabs;
+  a->free_slabs = slab->next;
+  a->stats.free_slabs--;
+  return slab;
+}
+
+static void PutSlab(Block *slab) {
+  Arena *a = &arenas[slab->socket];
+  std::lock_guard<std::mutex> guard(a->lock);
 
-  return ptr;
+  slab->next = a->free_slabs;
+  a->free_slabs = slab;
+  a->stats.free_slabs++;
 }
 
-void *mem_realloc(void *ptr, size_t size) {
-  size_t old_size = malloc_usable_size(ptr);
-  char *new_ptr = static_cast<char *>(realloc(ptr, size));
+static void LinkSlab(Pool *p, Block *slab) {
+  slab->prev = nullptr;
+  slab->next = p->partial;
+  if (p->partial) {
+    p->partial->prev = slab;
+  }
+  p->partial = slab;
+}
+
+static void UnlinkSlab(Pool *p, Block *slab) {
+  if (slab->prev) {
+    slab->prev->next = slab->next;
+  } else {
+    p->partial = slab->next;
+  }
+  if (slab->next) {
+    slab->next->prev = slab->prev;
+  }
+}
 
-  if (new_ptr && size > old_size) {
-    memset(new_ptr + old_size, 0, size - old_size);
+static int SizeClass(size_t size, size_t align) {
+  for (int i = 0; i < kNumClasses; i++) {
+    if (kClassSizes[i] >= size && kClassSizes[i] % align == 0) {
+      return i;
+    }
   }
+  return -1;
+}
 
-  return new_ptr;
+static Block *BlockOf(void *ptr) {
+  return reinterpret_cast<Block *>(reinterpret_cast<uintptr_t>(ptr) &
+                                   ~(kSlabSize - 1));
 }
 
-void mem_free(void *ptr) {
-  free(ptr);
+// Takes up to n slots from the slabs of the pool, with the owner locked
+static uint32_t PopSlots(OwnerState *o, int cls, int socket, owner_t owner,
+                         void **slots, uint32_t n) {
+  uint32_t slot_size = kClassSizes[cls];
+  Pool *p = &o->pools[socket][cls];
+  uint32_t i;
+
+  for (i = 0; i < n; i++) {
+    Block *slab = p->partial;
+
+    if (!slab) {
+      slab = GetSlab(socket);
+      if (!slab) {
+        break;
+      }
+
+      slab->kind = kSlab;
+      slab->owner = owner;
+      slab->socket = socket;
+      slab->cls = cls;
+      slab->used = 0;
+      slab->capacity = (kSlabSize - kHeaderSize) / slot_size;
+      slab->free_list = nullptr;
+      slab->unused = reinterpret_cast<char *>(slab) + kHeaderSize;
+      LinkSlab(p, slab);
+      o->stats[socket].reserved += kSlabSize;
+    }
+
+    if (slab->free_list) {
+      slots[i] = slab->free_list;
+      slab->free_list = *static_cast<void **>(slots[i]);
+    } else {
+      slots[i] = slab->unused;
+      slab->unused += slot_size;
+    }
+
+    if (++slab->used == slab->capacity) {
+      UnlinkSlab(p, slab);
+    }
+  }
+
+  return i;
 }
 
-#elif MEM_ALLOC_PROVIDER == DPDK
+// Puts a slot back into its slab, with the owner locked
+static void PushSlot(OwnerState *o, void *obj) {
+  Block *slab = BlockOf(obj);
+  Pool *p = &o->pools[slab->socket][slab->cls];
 
-#include <rte_config.h>
-#include <rte_malloc.h>
+  *static_cast<void **>(obj) = slab->free_list;
+  slab->free_list = obj;
 
-void *mem_alloc(size_t size) {
-  return rte_zmalloc(/* name= */ nullptr, size, /* align= */ 0);
+  if (slab->used-- == slab->capacity) {
+    LinkSlab(p, slab);
+  }
+
+  // Keep one empty slab per pool to avoid thrashing
+  if (slab->used == 0 && (p->partial != slab || slab->next)) {
+    UnlinkSlab(p, slab);
+    o->stats[slab->socket].reserved -= kSlabSize;
+    PutSlab(slab);
+  }
 }
 
-void *mem_realloc(void *ptr, size_t size) {
-  return rte_realloc(ptr, size, /* align= */ 0);
+struct CacheBin {
+  uint32_t key;    // 0 if empty, see CacheKey()
+  uint32_t cnt;    // cached slots
+  int64_t allocs;  // allocations less frees, not charged to the owner yet
+  void *slots[kCacheBinSize];
+};
+
+static uint32_t CacheKey(owner_t owner, int socket, int cls) {
+  return (static_cast<uint32_t>(owner) + 1) << 16 | socket << 8 | cls;
 }
 
-void mem_free(void *ptr) {
-  rte_free(ptr);
+// Charges the allocations and frees made through the bin, with the owner
+// locked
+static void Charge(OwnerState *o, int socket, int cls, CacheBin *bin) {
+  OwnerStats *stats = &o->stats[socket];
+
+  stats->allocs += bin->allocs;
+  stats->bytes += bin->allocs * static_cast<int64_t>(kClassSizes[cls]);
+  bin->allocs = 0;
+}
+
+// Returns all slots of the bin to their owner, and empties it
+static void FlushBin(CacheBin *bin) {
+  if (!bin->key) {
+    return;
+  }
+
+  owner_t owner = (bin->key >> 16) - 1;
+  int socket = (bin->key >> 8) & 0xff;
+  int cls = bin->key & 0xff;
+  OwnerState *o = GetOwnerState(owner);
+
+  {
+    std::lock_guard<std::mutex> guard(o->lock);
+    for (uint32_t i = 0; i < bin->cnt; i++) {
+      PushSlot(o, bin->slots[i]);
+    }
+    Charge(o, socket, cls, bin);
+  }
+
+  bin->key = 0;
+  bin->cnt = 0;
+}
+
+struct ThreadCache {
+  CacheBin bins[kCacheBins];
+
+  // Slots cached by an exiting thread would be lost otherwise
+  ~ThreadCache() { Drain(); }
+
+  void Drain() {
+    for (CacheBin &bin : bins) {
+      FlushBin(&bin);
+    }
+  }
+
+  // Takes the bin for the key, flushing whatever it cached for another
+  CacheBin *Bin(owner_t owner, int socket, int cls) {
+    uint32_t key = CacheKey(owner, socket, cls);
+    CacheBin *bin = &bins[(owner * kNumClasses + cls + socket) % kCacheBins];
+
+    if (bin->key != key) {
+      FlushBin(bin);
+      bin->key = key;
+    }
+    return bin;
+  }
+};
+
+static thread_local ThreadCache thread_cache;
+
+static void *AllocSmall(int cls, int socket, owner_t owner) {
+  CacheBin *bin = thread_cache.Bin(owner, socket, cls);
+
+  if (!bin->cnt) {
+    OwnerState *o = GetOwnerState(owner);
+    std::lock_guard<std::mutex> guard(o->lock);
+    bin->cnt = PopSlots(o, cls, socket, owner, bin->slots, kCacheBatch);
+    Charge(o, socket, cls, bin);
+    if (!bin->cnt) {
+      return nullptr;
+    }
+  }
+
+  void *obj = bin->slots[--bin->cnt];
+  bin->allocs++;
+
+  // The whole slot, so that mem_realloc() within the slot zero-fills as well
+  memset(obj, 0, kClassSizes[cls]);
+  return obj;
+}
+
+static void FreeSmall(Block *slab, void *obj) {
+  CacheBin *bin = thread_cache.Bin(slab->owner, slab->socket, slab->cls);
+
+  // Give back the slots cached the longest, and keep the warm ones
+  if (bin->cnt == kCacheBinSize) {
+    OwnerState *o = GetOwnerState(slab->owner);
+    std::lock_guard<std::mutex> guard(o->lock);
+    for (uint32_t i = 0; i < kCacheBatch; i++) {
+      PushSlot(o, bin->slots[i]);
+    }
+    Charge(o, slab->socket, slab->cls, bin);
+    memmove(bin->slots, bin->slots + kCacheBatch,
+            (kCacheBinSize - kCacheBatch) * sizeof(bin->slots[0]));
+    bin->cnt -= kCacheBatch;
+  }
+
+  bin->slots[bin->cnt++] = obj;
+  bin->allocs--;
+}
+
+static void *AllocLarge(size_t size, size_t align, int socket,
+                        owner_t owner) {
+  size_t offset = std::max(kHeaderSize, align);
+  size_t len = (offset + size + kPageSize - 1) & ~(kPageSize - 1);
+  char *base = nullptr;
+
+  bool huge = false;
+
+  if (len >= kChunkSize) {
+    size_t huge_len = (len + kChunkSize - 1) & ~(kChunkSize - 1);
+    if (ReserveHugetlb(socket, huge_len)) {
+      base = static_cast<char *>(MapAligned(huge_len, kChunkSize, true));
+      if (base) {
+        len = huge_len;
+        huge = true;
+      } else {
+        UnreserveHugetlb(socket, huge_len);
+      }
+    }
+  }
+
+  if (!base) {
+    base = static_cast<char *>(MapAligned(len, kSlabSize, false));
+    if (!base) {
+      return nullptr;
+    }
+  }
+
+  BindToSocket(base, len, socket);
+
+  Block *b = reinterpret_cast<Block *>(base);
+  b->kind = kLarge;
+  b->owner = owner;
+  b->socket = socket;
+  b->map_size = len;
+  b->huge = huge;
+
+  OwnerState *o = GetOwnerState(owner);
+  {
+    std::lock_guard<std::mutex> guard(o->lock);
+    OwnerStats *stats = &o->stats[socket];
+    stats->allocs++;
+    stats->bytes += len - offset;
+    stats->reserved += len;
+  }
+
+  // Fresh mappings are zero-filled
+  return base + offset;
+}
+
+static void FreeLarge(Block *b, void *obj) {
+  OwnerState *o = GetOwnerState(b->owner);
+  size_t offset = static_cast<char *>(obj) - reinterpret_cast<char *>(b);
+  size_t len = b->map_size;
+  bool huge = b->huge;  // b is unmapped below
+  int socket = b->socket;
+
+  {
+    std::lock_guard<std::mutex> guard(o->lock);
+    OwnerStats *stats = &o->stats[socket];
+    stats->allocs--;
+    stats->bytes -= len - offset;
+    stats->reserved -= len;
+  }
+
+  munmap(b, len);
+  if (huge) {
+    UnreserveHugetlb(socket, len);
+  }
+}
+
+static size_t UsableSize(Block *b, void *ptr) {
+  if (b->kind == kSlab) {
+    return kClassSizes[b->cls];
+  }
+  return b->map_size - (static_cast<char *>(ptr) - reinterpret_cast<char *>(b));
+}
+
+owner_t CurrentOwner() {
+  return current_owner;
+}
+
+OwnerScope::OwnerScope(const std::string &owner) : prev_(current_owner) {
+  current_owner = RegisterOwner(owner);
+}
+
+OwnerScope::~OwnerScope() {
+  current_owner = prev_;
+}
+
+void SetHugetlbLimit(size_t bytes_per_socket) {
+  hugetlb_limit = bytes_per_socket;
+}
+
+void *Alloc(size_t size, size_t align, int socket, owner_t owner) {
+  if (align < kMinAlign) {
+    align = kMinAlign;
+  }
+  DCHECK_EQ(align & (align - 1), 0U);
+  if (align >= kSlabSize) {
+    return nullptr;
+  }
+
+  if (socket < 0 || socket >= kMaxSockets) {
+    socket = ThreadSocket();
+  }
+
+  int cls = (align <= kHeaderSize) ? SizeClass(size, align) : -1;
+  if (cls >= 0) {
+    return AllocSmall(cls, socket, owner);
+  }
+  return AllocLarge(size, align, socket, owner);
+}
+
+std::vector<OwnerStats> GetOwnerStats() {
+  std::vector<OwnerStats> ret;
+
+  thread_cache.Drain();
+
+  for (int id = 0; id < kMaxOwners; id++) {
+    OwnerState *o = owners[id].load(std::memory_order_acquire);
+    if (!o) {
+      continue;
+    }
+
+    std::string name = OwnerName(id);
+    std::lock_guard<std::mutex> guard(o->lock);
+    for (int i = 0; i < kMaxSockets; i++) {
+      if (o->stats[i].reserved) {
+        ret.push_back(o->stats[i]);
+        ret.back().owner = name;
+      }
+    }
+  }
+
+  return ret;
+}
+
+OwnerStats GetOwnerStats(const std::string &owner) {
+  OwnerStats ret = {owner, -1, 0, 0, 0};
+
+  thread_cache.Drain();
+
+  OwnerRegistry &r = registry();
+  owner_t id;
+  {
+    std::lock_guard<std::mutex> guard(r.lock);
+    auto it = r.ids.find(owner);
+    if (it == r.ids.end()) {
+      return ret;
+    }
+    id = it->second;
+  }
+
+  OwnerState *o = owners[id].load(std::memory_order_acquire);
+  if (!o) {
+    return ret;
+  }
+
+  std::lock_guard<std::mutex> guard(o->lock);
+  for (int i = 0; i < kMaxSockets; i++) {
+    ret.allocs += o->stats[i].allocs;
+    ret.bytes += o->stats[i].bytes;
+    ret.reserved += o->stats[i].reserved;
+  }
+  return ret;
 }
 
-#else
+std::vector<ArenaStats> GetArenaStats() {
+  std::vector<ArenaStats> ret;
+
+  for (int i = 0; i < kMaxSockets; i++) {
+    std::lock_guard<std::mutex> guard(arenas[i].lock);
+    if (arenas[i].stats.chunks) {
+      ret.push_back(arenas[i].stats);
+    }
+  }
 
-#error "Unknown mem_alloc provider"
+  return ret;
+}
+
+}  // namespace memory
+}  // namespace bess
+
+void *mem_alloc(size_t size) {
+  return bess::memory::Alloc(size, 0, -1, bess::memory::CurrentOwner());
+}
+
+void *mem_alloc_ex(size_t size, size_t align, int socket) {
+  return bess::memory::Alloc(size, align, socket,
+                             bess::memory::CurrentOwner());
+}
+
+void *mem_realloc(void *ptr, size_t size) {
+  if (!ptr) {
+    return mem_alloc(size);
+  }
 
-#endif
+  bess::memory::Block *b = bess::memory::BlockOf(ptr);
+  size_t old_size = bess::memory::UsableSize(b, ptr);
+  if (size <= old_size) {
+    return ptr;
+  }
+
+  // Stays with the owner and socket of the original object
+  void *new_ptr = bess::memory::Alloc(size, 0, b->socket, b->owner);
+  if (new_ptr) {
+    memcpy(new_ptr, ptr, old_size);
+    mem_free(ptr);
+  }
+
+  return new_ptr;
+}
+
+void mem_free(void *ptr) {
+  if (!ptr) {
+    return;
+  }
+
+  bess::memory::Block *b = bess::memory::BlockOf(ptr);
+  if (b->kind == bess::memory::kSlab) {
+    bess::memory::FreeSmall(b, ptr);
+  } else {
+    DCHECK_EQ(b->kind, bess::memory::kLarge);
+    bess::memory::FreeLarge(b, ptr);
+  }
+}
@@ -1,19 +1,143 @@
-/* a tiny shim layer to switch between rte_malloc and malloc
- * (or something else in the future) */
+/* Memory allocator for the tables of modules (hash tables, flow records, ...).
+ *
+ * Small objects (up to 16KB) come from per-size-class slabs of 64KB, carved
+ * out of 2MB arenas that are bound to a NUMA socket. Larger objects are mapped
+ * on their own. Each slab belongs to one owner (usually a module) and one
+ * socket, so that the objects of a module are packed together and their usage
+ * can be accounted to it.
+ *
+ * Each thread caches a few free slots per owner, socket and size class, so
+ * that small allocations and frees in the datapath take no lock, but once
+ * every few dozen calls to move slots between the cache and the slabs.
+ *
+ * Arenas and large objects are backed by transparent huge pages, if the kernel
+ * has them enabled. hugetlbfs pages are reserved for DPDK by default, and
+ * taken only up to the limit set with SetHugetlbLimit() (bessd -huge_mem_mb),
+ * from the pages left over by DPDK. They are not counted by DPDK.
+ *
+ * Allocations are charged to the owner of the calling thread, set with
+ * bess::memory::OwnerScope (modules are the owners while they are created,
+ * initialized, or run commands). A reallocated or freed object stays with the
+ * owner and socket it was allocated for. */
 
 #ifndef BESS_MEMALLOC_H_
 #define BESS_MEMALLOC_H_
 
 #include <cstddef>
-
-/* TODO: Use C++11-style allocator */
+#include <cstdint>
+#include <new>
+#include <string>
+#include <vector>
 
 void *mem_alloc(size_t size); /* zero initialized by default */
 
+/* align must be a power of two, up to 32KB. socket -1 is the socket of the
+ * calling thread. */
 void *mem_alloc_ex(size_t size, size_t align, int socket);
 
 void *mem_realloc(void *ptr, size_t size);
 
 void mem_free(void *ptr);
 
+namespace bess {
+namespace memory {
+
+typedef uint16_t owner_t;
+
+/* Returns the owner of the allocations of the calling thread */
+owner_t CurrentOwner();
+
+/* Charges the allocations of the calling thread to owner, while in scope */
+class OwnerScope {
+ public:
+  explicit OwnerScope(const std::string &owner);
+  ~OwnerScope();
+
+ private:
+  owner_t prev_;
+};
+
+/* Allocates for a given owner; see mem_alloc_ex() */
+void *Alloc(size_t size, size_t align, int socket, owner_t owner);
+
+/* Lets arenas and large objects take hugetlbfs pages, up to this many bytes
+ * on each socket. 0, the default, leaves them all to DPDK. Memory already
+ * mapped is not affected. */
+void SetHugetlbLimit(size_t bytes_per_socket);
+
+/* Usage of an owner on a socket. reserved - bytes is lost to fragmentation
+ * (free slots in the slabs of the owner, headers, and page rounding). */
+struct OwnerStats {
+  std::string owner; /* empty for allocations outside of any OwnerScope */
+  int socket;
+  uint64_t allocs;   /* live objects */
+  uint64_t bytes;    /* used by them, rounded up to their size class */
+  uint64_t reserved; /* slabs and large objects held by the owner */
+};
+
+struct ArenaStats {
+  int socket;
+  uint64_t chunks;      /* 2MB arena chunks */
+  uint64_t huge_chunks; /* of them, backed by hugetlbfs pages */
+  uint64_t free_slabs;  /* not held by any owner */
+};
+
+/* Owners/sockets with any reserved memory. Allocations and frees through the
+ * cache of another thread may be charged late, by up to a few dozen objects
+ * per owner and size class. Those of the calling thread are charged first. */
+std::vector<OwnerStats> GetOwnerStats();
+
+/* Sum over all sockets for an owner */
+OwnerStats GetOwnerStats(const std::string &owner);
+
+/* Sockets with any arena chunks */
+std::vector<ArenaStats> GetArenaStats();
+
+/* A standard allocator for containers (std::vector, CuckooMap, ...). The owner
+ * is captured when the allocator (i.e., the container) is constructed, so that
+ * later growth, e.g., by worker threads, is charged to it as well. */
+template <typename T>
+class Allocator {
+ public:
+  typedef T value_type;
+
+  Allocator() : owner_(CurrentOwner()), socket_(-1) {}
+
+  explicit Allocator(int socket) : owner_(CurrentOwner()), socket_(socket) {}
+
+  template <typename U>
+  Allocator(const Allocator<U> &o) : owner_(o.owner()), socket_(o.socket()) {}
+
+  T *allocate(size_t n) {
+    void *p = Alloc(n * sizeof(T), alignof(T), socket_, owner_);
+    if (!p) {
+      throw std::bad_alloc();
+    }
+    return static_cast<T *>(p);
+  }
+
+  void deallocate(T *p, size_t) { mem_free(p); }
+
+  owner_t owner() const { return owner_; }
+  int socket() const { return socket_; }
+
+ private:
+  owner_t owner_;
+  int socket_;
+};
+
+/* Any allocator can free the memory of another */
+template <typename T, typename U>
+bool operator==(const Allocator<T> &, const Allocator<U> &) {
+  return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const Allocator<T> &, const Allocator<U> &) {
+  return false;
+}
+
+}  // namespace memory
+}  // namespace bess
+
 #endif  // BESS_MEMALLOC_H_
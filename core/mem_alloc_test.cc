@@ -0,0 +1,250 @@
+#include "mem_alloc.h"
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "utils/cuckoo_map.h"
+
+using bess::memory::Allocator;
+using bess::memory::ArenaStats;
+using bess::memory::GetArenaStats;
+using bess::memory::GetOwnerStats;
+using bess::memory::OwnerScope;
+using bess::memory::OwnerStats;
+
+namespace {
+
+static bool IsZero(const void *p, size_t len) {
+  const char *c = static_cast<const char *>(p);
+  for (size_t i = 0; i < len; i++) {
+    if (c[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+TEST(MemAllocTest, ZeroedAndAligned) {
+  const size_t sizes[] = {0, 1, 17, 100, 4000, 16384, 16385, 100000, 3 << 20};
+
+  for (size_t size : sizes) {
+    char *p = static_cast<char *>(mem_alloc(size));
+    ASSERT_NE(nullptr, p) << size;
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(p) % 16) << size;
+    EXPECT_TRUE(IsZero(p, size)) << size;
+    memset(p, 0xff, size);
+
+    // Recycled slots are zeroed as well
+    mem_free(p);
+    p = static_cast<char *>(mem_alloc(size));
+    EXPECT_TRUE(IsZero(p, size)) << size;
+    mem_free(p);
+  }
+
+  for (size_t align = 16; align <= 16384; align *= 2) {
+    void *p = mem_alloc_ex(100, align, -1);
+    ASSERT_NE(nullptr, p) << align;
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(p) % align) << align;
+    mem_free(p);
+  }
+}
+
+TEST(MemAllocTest, Realloc) {
+  char *p = static_cast<char *>(mem_realloc(nullptr, 10));
+  ASSERT_NE(nullptr, p);
+  memset(p, 'a', 10);
+
+  for (size_t size = 20; size < (1 << 20); size *= 3) {
+    p = static_cast<char *>(mem_realloc(p, size));
+    ASSERT_NE(nullptr, p);
+    EXPECT_EQ(std::string(10, 'a'), std::string(p, 10));
+    EXPECT_TRUE(IsZero(p + 10, size - 10)) << size;
+  }
+
+  mem_free(p);
+}
+
+// Objects are packed into the slabs of their owner, and freed slabs go back
+// to the arena
+TEST(MemAllocTest, OwnerStats) {
+  const int kObjects = 1000;
+  std::vector<void *> objs;
+
+  {
+    OwnerScope scope("slab_owner");
+    for (int i = 0; i < kObjects; i++) {
+      objs.push_back(mem_alloc(100));
+    }
+  }
+
+  // 100 bytes in 128-byte slots, 511 of them per 64KB slab
+  OwnerStats stats = GetOwnerStats("slab_owner");
+  EXPECT_EQ(kObjects, stats.allocs);
+  EXPECT_EQ(kObjects * 128, stats.bytes);
+  EXPECT_EQ(2 * 65536, stats.reserved);
+
+  // Reallocated objects stay with their owner
+  objs[0] = mem_realloc(objs[0], 200);
+  stats = GetOwnerStats("slab_owner");
+  EXPECT_EQ(kObjects, stats.allocs);
+  EXPECT_EQ((kObjects - 1) * 128 + 256, stats.bytes);
+
+  for (void *p : objs) {
+    mem_free(p);
+  }
+
+  // One empty slab is kept for each size class
+  stats = GetOwnerStats("slab_owner");
+  EXPECT_EQ(0, stats.allocs);
+  EXPECT_EQ(0, stats.bytes);
+  EXPECT_EQ(2 * 65536, stats.reserved);
+
+  {
+    OwnerScope scope("large_owner");
+    void *p = mem_alloc(1 << 20);
+    stats = GetOwnerStats("large_owner");
+    EXPECT_EQ(1, stats.allocs);
+    EXPECT_LE(1 << 20, stats.bytes);
+    EXPECT_LT(stats.bytes, stats.reserved);
+    mem_free(p);
+  }
+
+  stats = GetOwnerStats("large_owner");
+  EXPECT_EQ(0, stats.allocs);
+  EXPECT_EQ(0, stats.reserved);
+}
+
+// Containers are charged to the owner at their construction, even if they
+// grow later, outside of its scope
+TEST(MemAllocTest, Allocator) {
+  std::unique_ptr<std::vector<uint64_t, Allocator<uint64_t>>> v;
+  std::unique_ptr<bess::utils::CuckooMap<uint32_t, uint64_t>> map;
+
+  {
+    OwnerScope scope("container_owner");
+    v.reset(new std::vector<uint64_t, Allocator<uint64_t>>());
+    map.reset(new bess::utils::CuckooMap<uint32_t, uint64_t>());
+  }
+
+  uint64_t base = GetOwnerStats("container_owner").bytes;
+  EXPECT_LT(0, base);  // the initial buckets of the map
+
+  for (uint32_t i = 0; i < 100000; i++) {
+    v->push_back(i);
+  }
+  for (uint32_t i = 1; i <= 10; i++) {
+    map->Insert(i, i);
+  }
+  EXPECT_LE(base + 100000 * sizeof(uint64_t),
+            GetOwnerStats("container_owner").bytes);
+
+  for (uint32_t i = 0; i < 100000; i++) {
+    ASSERT_EQ(i, (*v)[i]);
+  }
+  for (uint32_t i = 1; i <= 10; i++) {
+    ASSERT_EQ(i, map->Find(i)->second);
+  }
+
+  v.reset();
+  map.reset();
+  EXPECT_EQ(0, GetOwnerStats("container_owner").allocs);
+}
+
+TEST(MemAllocTest, Sockets) {
+  OwnerScope scope("socket_owner");
+
+  // Memory is bound to the socket on a best-effort basis
+  void *p = mem_alloc_ex(64, 64, 1);
+  ASSERT_NE(nullptr, p);
+
+  bool found = false;
+  for (const OwnerStats &s : GetOwnerStats()) {
+    if (s.owner == "socket_owner") {
+      EXPECT_EQ(1, s.socket);
+      EXPECT_EQ(1, s.allocs);
+      found = true;
+    }
+  }
+  EXPECT_TRUE(found);
+
+  mem_free(p);
+}
+
+TEST(MemAllocTest, Threads) {
+  const int kThreads = 4;
+  std::vector<std::thread> threads;
+
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([t]() {
+      OwnerScope scope("thread_owner");
+      std::vector<void *> objs;
+
+      for (int i = 0; i < 100000; i++) {
+        objs.push_back(mem_alloc(16 << (i % 8)));
+        if (i % 3 == t % 3) {
+          mem_free(objs.back());
+          objs.pop_back();
+        }
+      }
+      for (void *p : objs) {
+        mem_free(p);
+      }
+    });
+  }
+
+  for (std::thread &t : threads) {
+    t.join();
+  }
+
+  OwnerStats stats = GetOwnerStats("thread_owner");
+  EXPECT_EQ(0, stats.allocs);
+  EXPECT_EQ(0, stats.bytes);
+}
+
+// Objects freed by another thread go to the cache of that thread, and are
+// given back to their owner when it exits
+TEST(MemAllocTest, FreeInOtherThread) {
+  const int kObjects = 1000;
+  std::vector<void *> objs;
+
+  std::thread producer([&objs]() {
+    OwnerScope scope("handoff_owner");
+    for (int i = 0; i < kObjects; i++) {
+      objs.push_back(mem_alloc(64));
+    }
+  });
+  producer.join();
+
+  EXPECT_EQ(kObjects, GetOwnerStats("handoff_owner").allocs);
+
+  std::thread consumer([&objs]() {
+    for (void *p : objs) {
+      mem_free(p);
+    }
+  });
+  consumer.join();
+
+  OwnerStats stats = GetOwnerStats("handoff_owner");
+  EXPECT_EQ(0, stats.allocs);
+  EXPECT_EQ(0, stats.bytes);
+  EXPECT_EQ(65536, stats.reserved);
+}
+
+// hugetlbfs pages are left to DPDK unless asked for
+TEST(MemAllocTest, NoHugetlbByDefault) {
+  void *p = mem_alloc(3 << 20);
+  ASSERT_NE(nullptr, p);
+
+  for (const ArenaStats &s : GetArenaStats()) {
+    EXPECT_EQ(0, s.huge_chunks);
+  }
+
+  mem_free(p);
+}
+
+}  // namespace (unnamed)
@@ -6,6 +6,7 @@
 #include <functional>
 #include <queue>
 
+#include "hooks/track.h"
 #include "mem_alloc.h"
 #include "module.h"
 
@@ -18,29 +19,9 @@ Pipeline default_pipeline;
 
 // Helpers -----------------------------------------------------------------
 
-static mt_offset_t ComputeNextOffset(mt_offset_t curr_offset, int8_t size) {
-  uint32_t overflow;
-  int8_t rounded_size;
-
-  rounded_size = align_ceil_pow2(size);
-
-  if (curr_offset % rounded_size) {
-    curr_offset = align_ceil(curr_offset, rounded_size);
-  }
-
-  overflow = (uint32_t)curr_offset + (uint32_t)size;
-
-  return overflow > kMetadataTotalSize ? kMetadataOffsetNoSpace : curr_offset;
-}
-
 // Generate warnings for modules that read metadata that never gets set.
-static void CheckOrphanReaders() {
-  for (const auto &it : ModuleBuilder::all_modules()) {
-    const Module *m = it.second;
-    if (!m) {
-      break;
-    }
-
+static void CheckOrphanReaders(const std::vector<Module *> &modules) {
+  for (const Module *m : modules) {
     size_t i = 0;
     for (const auto &attr : m->all_attrs()) {
       if (m->attr_offset(i) == kMetadataOffsetNoRead) {
@@ -57,34 +38,51 @@ static inline attr_id_t get_attr_id(const struct Attribute *attr) {
   return attr->name;
 }
 
-// ScopeComponent ----------------------------------------------------------
+static bool AccessesAttr(const Module *m, const attr_id_t &id) {
+  for (const auto &attr : m->all_attrs()) {
+    if (get_attr_id(&attr) == id) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Number of packets delivered to m so far, as counted by TrackGate hooks
+static uint64_t PacketsSeen(const Module *m) {
+  uint64_t pkts = 0;
 
-class ScopeComponentComp {
- public:
-  explicit ScopeComponentComp(const bool &revparam = false)
-      : reverse_(revparam) {}
+  for (const auto &g : m->igates()) {
+    if (!g) {
+      continue;
+    }
 
-  bool operator()(const ScopeComponent *lhs, const ScopeComponent *rhs) const {
-    if (reverse_) {
-      return (lhs->offset() < rhs->offset());
+    for (const auto &og : g->ogates_upstream()) {
+      TrackGate *t =
+          reinterpret_cast<TrackGate *>(og->FindHook(kGateHookTrackGate));
+      if (t) {
+        pkts += t->pkts();
+      }
     }
-    return (lhs->offset() > rhs->offset());
   }
 
- private:
-  bool reverse_;
-};
+  return pkts;
+}
+
+// ScopeComponent ----------------------------------------------------------
 
-static bool DegreeComp(const ScopeComponent &a, const ScopeComponent &b) {
+// Hot components get to pick their place first. Among equally hot ones, those
+// with more neighbors are the hardest to fit.
+static bool LayoutComp(const ScopeComponent &a, const ScopeComponent &b) {
+  if (a.weight() != b.weight()) {
+    return a.weight() > b.weight();
+  }
   return a.degree() > b.degree();
 }
 
 bool ScopeComponent::DisjointFrom(const ScopeComponent &rhs) {
   for (const auto &i : modules_) {
-    for (const auto &j : rhs.modules_) {
-      if (i == j) {
-        return 0;
-      }
+    if (rhs.modules_.count(i)) {
+      return 0;
     }
   }
   return 1;
@@ -92,13 +90,85 @@ bool ScopeComponent::DisjointFrom(const ScopeComponent &rhs) {
 
 // Pipeline ----------------------------------------------------------------
 
-int Pipeline::PrepareMetadataComputation() {
-  for (const auto &it : ModuleBuilder::all_modules()) {
-    Module *m = it.second;
-    if (!m) {
-      break;
+void Pipeline::RemoveModule(const Module *m) {
+  dirty_modules_.erase(const_cast<Module *>(m));
+  computed_modules_.erase(m);
+
+  layout_.erase(std::remove_if(layout_.begin(), layout_.end(),
+                               [m](const ComponentLayout &l) {
+                                 return std::find(l.modules.begin(),
+                                                  l.modules.end(),
+                                                  m) != l.modules.end();
+                               }),
+                layout_.end());
+}
+
+void Pipeline::SetAttributeWeight(const std::string &attr_name,
+                                  uint64_t weight) {
+  if (weight) {
+    attr_weights_[attr_name] = weight;
+  } else {
+    attr_weights_.erase(attr_name);
+  }
+}
+
+void Pipeline::Repack() {
+  for (const Module *m : computed_modules_) {
+    dirty_modules_.insert(const_cast<Module *>(m));
+  }
+  computed_modules_.clear();
+}
+
+std::vector<Module *> Pipeline::CollectDirtyModules() {
+  std::vector<Module *> modules;
+  std::set<Module *> visited;
+  std::queue<Module *> q;
+
+  for (Module *m : dirty_modules_) {
+    visited.insert(m);
+    q.push(m);
+  }
+  dirty_modules_.clear();
+
+  auto visit = [&visited, &q](Module *m) {
+    if (visited.insert(m).second) {
+      q.push(m);
+    }
+  };
+
+  while (!q.empty()) {
+    Module *m = q.front();
+    q.pop();
+    modules.push_back(m);
+
+    for (const auto &g : m->igates()) {
+      if (!g) {
+        continue;
+      }
+      for (const auto &og : g->ogates_upstream()) {
+        visit(og->module());
+      }
+    }
+
+    for (const auto &og : m->ogates()) {
+      if (!og) {
+        continue;
+      }
+      visit(og->igate()->module());
     }
+  }
+
+  // Same order as a full computation over all_modules() would take
+  std::sort(modules.begin(), modules.end(),
+            [](const Module *a, const Module *b) {
+              return a->name() < b->name();
+            });
+
+  return modules;
+}
 
+int Pipeline::PrepareMetadataComputation(const std::vector<Module *> &modules) {
+  for (Module *m : modules) {
     if (!module_components_.count(m)) {
       module_components_.emplace(
           m, reinterpret_cast<scope_id_t *>(
@@ -179,6 +249,10 @@ void Pipeline::TraverseUpstream(Module *m, const struct Attribute *attr) {
   module_scopes_[m] = static_cast<int>(scope_components_.size());
 
   for (const auto &g : m->igates()) {
+    if (!g) {
+      continue;
+    }
+
     for (const auto &og : g->ogates_upstream()) {
       TraverseUpstream(og->module(), attr);
     }
@@ -307,60 +381,110 @@ void Pipeline::FillOffsetArrays() {
   }
 }
 
-void Pipeline::AssignOffsets() {
-  mt_offset_t offset = 0;
-  ScopeComponent *comp1;
-  const ScopeComponent *comp2;
+bool Pipeline::OverlapsNeighbors(const ScopeComponent &comp,
+                                 mt_offset_t offset) const {
+  for (size_t j : comp.neighbors()) {
+    const ScopeComponent &other = scope_components_[j];
 
-  for (size_t i = 0; i < scope_components_.size(); i++) {
-    std::priority_queue<const ScopeComponent *,
-                        std::vector<const ScopeComponent *>, ScopeComponentComp>
-        h;
-    comp1 = &scope_components_[i];
-
-    if (comp1->invalid()) {
-      comp1->set_offset(kMetadataOffsetNoRead);
-      comp1->set_assigned(true);
+    if (!other.assigned() || !IsValidOffset(other.offset())) {
       continue;
     }
 
-    if (comp1->assigned() || comp1->modules().size() == 1) {
+    if (offset < other.offset() + other.size() &&
+        other.offset() < offset + comp.size()) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+mt_offset_t Pipeline::FindFreeOffset(const ScopeComponent &comp) const {
+  const int size = comp.size();
+  const int align = align_ceil_pow2(size);
+  const int line_size = kMetadataCacheLineSize;
+  mt_offset_t best = kMetadataOffsetNoSpace;
+  int64_t best_score = 0;
+
+  for (int offset = 0; offset + size <= static_cast<int>(kMetadataTotalSize);
+       offset += align) {
+    const int line = offset / line_size;
+
+    // Never split an attribute across two cache lines
+    if ((offset + size - 1) / line_size != line) {
+      continue;
+    }
+
+    if (OverlapsNeighbors(comp, offset)) {
       continue;
     }
 
-    offset = 0;
+    // Prefer the line of hot attributes accessed by the same modules, and
+    // leave the lines of hot attributes that are not to those who are.
+    int64_t score = 0;
+    for (size_t j : comp.neighbors()) {
+      const ScopeComponent &other = scope_components_[j];
 
-    for (size_t j = 0; j < scope_components_.size(); j++) {
-      if (i == j) {
+      if (!other.assigned() || !IsValidOffset(other.offset()) ||
+          other.offset() / line_size != line) {
         continue;
       }
 
-      if (!scope_components_[i].DisjointFrom(scope_components_[j]) &&
-          scope_components_[j].assigned()) {
-        h.push(&scope_components_[j]);
+      bool coaccessed = false;
+      for (const Module *m : other.accessors()) {
+        if (comp.accessors().count(m)) {
+          coaccessed = true;
+          break;
+        }
       }
+      int64_t weight = other.weight();
+      score += coaccessed ? weight : -weight;
     }
 
-    while (!h.empty()) {
-      comp2 = h.top();
-      h.pop();
+    // Ties go to the lowest offset
+    if (best == kMetadataOffsetNoSpace || score > best_score) {
+      best = offset;
+      best_score = score;
+    }
+  }
 
-      if (comp2->offset() == kMetadataOffsetNoRead ||
-          comp2->offset() == kMetadataOffsetNoWrite ||
-          comp2->offset() == kMetadataOffsetNoSpace) {
-        continue;
-      }
+  return best;
+}
 
-      if (offset + comp1->size() > comp2->offset()) {
-        offset =
-            ComputeNextOffset(comp2->offset() + comp2->size(), comp1->size());
-      } else {
-        break;
-      }
+void Pipeline::AssignOffsets() {
+  // Indices have changed since the components were sorted
+  ComputeScopeNeighbors();
+
+  // First keep the components that can stay where they were, in case packets
+  // carrying them are in flight...
+  for (auto &comp : scope_components_) {
+    if (comp.invalid()) {
+      comp.set_offset(kMetadataOffsetNoRead);
+      comp.set_assigned(true);
+      continue;
     }
 
-    comp1->set_offset(offset);
-    comp1->set_assigned(true);
+    if (comp.assigned() || comp.modules().size() == 1) {
+      continue;
+    }
+
+    mt_offset_t offset = comp.preferred_offset();
+    if (IsValidOffset(offset) &&
+        offset + comp.size() <= static_cast<int>(kMetadataTotalSize) &&
+        !OverlapsNeighbors(comp, offset)) {
+      comp.set_offset(offset);
+      comp.set_assigned(true);
+    }
+  }
+
+  // ...then place the rest, hottest first.
+  for (auto &comp : scope_components_) {
+    if (comp.assigned() || comp.modules().size() == 1) {
+      continue;
+    }
+
+    comp.set_offset(FindFreeOffset(comp));
+    comp.set_assigned(true);
   }
 
   FillOffsetArrays();
@@ -379,13 +503,9 @@ void Pipeline::LogAllScopes() const {
     VLOG(1) << "}";
   }
 
-  for (const auto &it : ModuleBuilder::all_modules()) {
-    const Module *m = it.second;
-    if (!m) {
-      break;
-    }
-
-    const scope_id_t *scope_arr = module_components_.find(m)->second;
+  for (const auto &it : module_components_) {
+    const Module *m = it.first;
+    const scope_id_t *scope_arr = it.second;
 
     LOG(INFO) << "Module " << m->name()
               << " part of the following scope components: ";
@@ -397,14 +517,84 @@ void Pipeline::LogAllScopes() const {
   }
 }
 
-void Pipeline::ComputeScopeDegrees() {
+// Two components are neighbors if they share a module, i.e., they must not
+// overlap. Going through the modules avoids comparing all pairs.
+void Pipeline::ComputeScopeNeighbors() {
+  std::map<const Module *, std::vector<size_t>> components_of;
+
   for (size_t i = 0; i < scope_components_.size(); i++) {
-    for (size_t j = i + 1; j < scope_components_.size(); j++) {
-      if (!scope_components_[i].DisjointFrom(scope_components_[j])) {
-        scope_components_[i].incr_degree();
-        scope_components_[j].incr_degree();
+    scope_components_[i].clear_neighbors();
+    for (const Module *m : scope_components_[i].modules()) {
+      components_of[m].push_back(i);
+    }
+  }
+
+  std::vector<bool> seen(scope_components_.size());
+  for (size_t i = 0; i < scope_components_.size(); i++) {
+    ScopeComponent &comp = scope_components_[i];
+
+    seen[i] = true;
+    for (const Module *m : comp.modules()) {
+      for (size_t j : components_of[m]) {
+        if (!seen[j]) {
+          seen[j] = true;
+          comp.add_neighbor(j);
+        }
       }
     }
+
+    seen[i] = false;
+    for (size_t j : comp.neighbors()) {
+      seen[j] = false;
+    }
+  }
+}
+
+void Pipeline::ComputeScopeWeights() {
+  for (auto &comp : scope_components_) {
+    uint64_t measured = 0;
+
+    for (const Module *m : comp.modules()) {
+      if (AccessesAttr(m, comp.attr_id())) {
+        comp.add_accessor(m);
+        measured += PacketsSeen(m) + 1;
+      }
+    }
+
+    const auto &it = attr_weights_.find(comp.attr_id());
+    comp.set_weight(it != attr_weights_.end() ? it->second : measured);
+  }
+}
+
+void Pipeline::UpdateLayout(const std::vector<Module *> &modules) {
+  std::set<const Module *> recomputed(modules.begin(), modules.end());
+
+  // All modules of a component were recomputed together
+  layout_.erase(std::remove_if(layout_.begin(), layout_.end(),
+                               [&recomputed](const ComponentLayout &l) {
+                                 return recomputed.count(l.modules[0]);
+                               }),
+                layout_.end());
+
+  for (const auto &comp : scope_components_) {
+    ComponentLayout l;
+
+    l.attr_id = comp.attr_id();
+    l.size = comp.size();
+    l.offset = comp.offset();
+    l.weight = comp.weight();
+    l.modules.assign(comp.modules().begin(), comp.modules().end());
+    layout_.push_back(l);
+  }
+}
+
+void Pipeline::ComputeScopeDegrees() {
+  ComputeScopeNeighbors();
+
+  for (auto &comp : scope_components_) {
+    for (size_t n = comp.neighbors().size(); n > 0; n--) {
+      comp.incr_degree();
+    }
   }
 }
 
@@ -412,18 +602,22 @@ void Pipeline::ComputeScopeDegrees() {
 int Pipeline::ComputeMetadataOffsets() {
   int ret;
 
-  ret = PrepareMetadataComputation();
+  if (dirty_modules_.empty()) {
+    return 0;
+  }
+
+  std::vector<Module *> modules = CollectDirtyModules();
+
+  ret = PrepareMetadataComputation(modules);
 
   if (ret) {
     CleanupMetadataComputation();
+    dirty_modules_.insert(modules.begin(), modules.end());
     return ret;
   }
 
-  for (const auto &it : ModuleBuilder::all_modules()) {
-    Module *m = it.second;
-    if (!m) {
-      break;
-    }
+  for (Module *m : modules) {
+    bool computed = computed_modules_.count(m);
 
     size_t i = 0;
     for (const auto &attr : m->all_attrs()) {
@@ -431,9 +625,13 @@ int Pipeline::ComputeMetadataOffsets() {
           attr.mode == Attribute::AccessMode::kUpdate) {
         m->set_attr_offset(i, kMetadataOffsetNoRead);
       } else if (attr.mode == Attribute::AccessMode::kWrite) {
+        mt_offset_t prev_offset =
+            computed ? m->attr_offset(i) : kMetadataOffsetNoSpace;
+
         m->set_attr_offset(i, kMetadataOffsetNoWrite);
         if (attr.scope_id == -1) {
           IdentifySingleScopeComponent(m, &attr);
+          scope_components_.back().set_preferred_offset(prev_offset);
         }
       }
       i++;
@@ -441,14 +639,18 @@ int Pipeline::ComputeMetadataOffsets() {
   }
 
   ComputeScopeDegrees();
-  std::sort(scope_components_.begin(), scope_components_.end(), DegreeComp);
+  ComputeScopeWeights();
+  std::sort(scope_components_.begin(), scope_components_.end(), LayoutComp);
   AssignOffsets();
+  UpdateLayout(modules);
+
+  computed_modules_.insert(modules.begin(), modules.end());
 
   if (VLOG_IS_ON(1)) {
     LogAllScopes();
   }
 
-  CheckOrphanReaders();
+  CheckOrphanReaders(modules);
 
   CleanupMetadataComputation();
   return 0;
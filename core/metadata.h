@@ -30,6 +30,11 @@ static const size_t kMetadataTotalSize = SNBUF_METADATA;
 static_assert(kMetadataTotalSize <= SIZE_MAX,
               "Total metadata size check failed");
 
+// Attributes accessed together are packed into the same cache line.
+static const size_t kMetadataCacheLineSize = 64;
+static_assert(SNBUF_METADATA_OFF % kMetadataCacheLineSize == 0,
+              "Metadata must start at a cache line boundary");
+
 // Normal offset values are 0 or a positive value.
 typedef int8_t mt_offset_t;
 typedef int16_t scope_id_t;
@@ -64,11 +69,15 @@ class ScopeComponent {
       : attr_id_(),
         size_(),
         offset_(),
+        preferred_offset_(kMetadataOffsetNoSpace),
         scope_id_(),
         assigned_(),
         invalid_(),
         modules_(),
-        degree_() {}
+        accessors_(),
+        degree_(),
+        weight_(),
+        neighbors_() {}
 
   ~ScopeComponent() {}
 
@@ -81,6 +90,11 @@ class ScopeComponent {
   mt_offset_t offset() const { return offset_; }
   void set_offset(mt_offset_t offset) { offset_ = offset; }
 
+  // The offset the attribute had before the recomputation, if any. Reusing it
+  // keeps running modules from seeing offsets shuffle on every change.
+  mt_offset_t preferred_offset() const { return preferred_offset_; }
+  void set_preferred_offset(mt_offset_t offset) { preferred_offset_ = offset; }
+
   scope_id_t scope_id() const { return scope_id_; }
   void set_scope_id(scope_id_t id) { scope_id_ = id; }
 
@@ -94,9 +108,23 @@ class ScopeComponent {
   void add_module(Module *m) { modules_.insert(m); }
   void clear_modules() { modules_.clear(); }
 
+  // Modules that actually read or write the attribute, as opposed to those
+  // the packets just pass through.
+  const std::set<const Module *> &accessors() const { return accessors_; }
+  void add_accessor(const Module *m) { accessors_.insert(m); }
+
+  // How often the attribute is accessed, relative to the other components
+  uint64_t weight() const { return weight_; }
+  void set_weight(uint64_t weight) { weight_ = weight; }
+
   int degree() const { return degree_; }
   void incr_degree() { degree_++; }
 
+  // Indices of the other components sharing a module with this one
+  const std::vector<size_t> &neighbors() const { return neighbors_; }
+  void add_neighbor(size_t idx) { neighbors_.push_back(idx); }
+  void clear_neighbors() { neighbors_.clear(); }
+
   bool DisjointFrom(const ScopeComponent &rhs);
 
  private:
@@ -104,13 +132,26 @@ class ScopeComponent {
   attr_id_t attr_id_;
   int size_;
   mt_offset_t offset_;
+  mt_offset_t preferred_offset_;
   scope_id_t scope_id_;
 
   /* computation state fields */
   bool assigned_;
   bool invalid_;
   std::set<Module *> modules_;
+  std::set<const Module *> accessors_;
   int degree_;
+  uint64_t weight_;
+  std::vector<size_t> neighbors_;
+};
+
+// Where the attribute of a scope component ended up, kept for inspection
+struct ComponentLayout {
+  attr_id_t attr_id;
+  int size;
+  mt_offset_t offset;
+  uint64_t weight;
+  std::vector<const Module *> modules;
 };
 
 class Pipeline {
@@ -119,11 +160,39 @@ class Pipeline {
       : scope_components_(),
         module_scopes_(),
         module_components_(),
+        dirty_modules_(),
+        computed_modules_(),
+        attr_weights_(),
+        layout_(),
         registered_attrs_() {}
 
-  // Main entry point for calculating metadata offsets.
+  // Main entry point for calculating metadata offsets. Only the (weakly)
+  // connected parts of the module graph that contain a module marked dirty
+  // since the last call are recomputed; the rest keep their offsets.
   int ComputeMetadataOffsets();
 
+  // Must be called whenever m is added, gets a new attribute, or has one of
+  // its gates connected or disconnected.
+  void MarkDirty(Module *m) { dirty_modules_.insert(m); }
+
+  // Must be called before m is destroyed, after it has been disconnected.
+  void RemoveModule(const Module *m);
+
+  // Declares how often attr_name is accessed, instead of the number of
+  // packets measured at the gates of the modules accessing it. Zero reverts
+  // to the measured value. Takes effect on the next recomputation of the
+  // components of the attribute.
+  void SetAttributeWeight(const std::string &attr_name, uint64_t weight);
+
+  // Marks the whole module graph dirty and forgets the current offsets, so
+  // that the next ComputeMetadataOffsets() packs every component anew from
+  // the current (declared or measured) weights. As attributes may move, no
+  // worker may run until then.
+  void Repack();
+
+  // The current layout of all scope components
+  const std::vector<ComponentLayout> &layout() const { return layout_; }
+
   // Registers attr and returns 0 if no attribute named @attr_name with size
   // other than @size has already been registered for this pipeline.
   // Returns -EINVAL on error.
@@ -133,9 +202,12 @@ class Pipeline {
  private:
   friend class MetadataTest;
 
-  // Allocate and initiliaze scope component storage.
+  // Returns the modules weakly connected to any dirty module.
+  std::vector<Module *> CollectDirtyModules();
+
+  // Allocate and initiliaze scope component storage for modules.
   // Returns 0 on sucess, -errno on failure.
-  int PrepareMetadataComputation();
+  int PrepareMetadataComputation(const std::vector<Module *> &modules);
 
   void CleanupMetadataComputation();
 
@@ -163,8 +235,22 @@ class Pipeline {
   // component.
   void IdentifyScopeComponent(Module *m, const struct Attribute *attr);
 
+  // Sets the accessors and weight of every scope component.
+  void ComputeScopeWeights();
+
+  // Replaces the layout of the components of modules with the current ones.
+  void UpdateLayout(const std::vector<Module *> &modules);
+
+  // Whether comp would overlap an assigned neighbor if placed at offset.
+  bool OverlapsNeighbors(const ScopeComponent &comp, mt_offset_t offset) const;
+
+  // Returns an offset at which comp overlaps no assigned neighbor, preferring
+  // cache lines that hold the hottest attributes accessed together with it.
+  mt_offset_t FindFreeOffset(const ScopeComponent &comp) const;
+
   void FillOffsetArrays();
   void AssignOffsets();
+  void ComputeScopeNeighbors();
   void ComputeScopeDegrees();
 
   std::vector<ScopeComponent> scope_components_;
@@ -175,6 +261,17 @@ class Pipeline {
   // Maps modules to the scope componenets they belong to.
   std::map<const Module *, scope_id_t *> module_components_;
 
+  // Modules whose part of the graph needs recomputation
+  std::set<Module *> dirty_modules_;
+
+  // Modules that have been assigned offsets at least once
+  std::set<const Module *> computed_modules_;
+
+  // Declared weights of attributes, see SetAttributeWeight()
+  std::map<std::string, uint64_t> attr_weights_;
+
+  std::vector<ComponentLayout> layout_;
+
   // Keeps track of the attributes used by modules in this pipeline
   // count(=int) represents how many modules registered the attribute, and the
   // attribute is deregistered once it reaches back to 0.
@@ -0,0 +1,117 @@
+#include "metadata.h"
+
+#include <benchmark/benchmark.h>
+#include <glog/logging.h>
+
+#include <string>
+#include <vector>
+
+#include "module.h"
+
+using bess::metadata::Attribute;
+using bess::metadata::default_pipeline;
+
+namespace {
+
+class DummyModule : public Module {};
+
+// Builds a graph of num_modules modules, one chain of chain_length modules
+// per tenant. The head of each chain writes two attributes that the rest of
+// the chain updates or reads.
+class MetadataFixture : public benchmark::Fixture {
+ protected:
+  void SetUp(benchmark::State &state) override {
+    const int num_modules = state.range(0);
+    const int chain_length = state.range(1);
+
+    ADD_MODULE(DummyModule, "dummy", "the most ordinary module ever");
+    DCHECK(__module__DummyModule);
+
+    const auto &builder =
+        ModuleBuilder::all_module_builders().find("DummyModule")->second;
+
+    for (int i = 0; i < num_modules; i++) {
+      Module *m = builder.CreateModule("m" + std::to_string(i),
+                                       &default_pipeline);
+      ModuleBuilder::AddModule(m);
+
+      int pos = i % chain_length;
+      if (pos == 0) {
+        m->AddMetadataAttr("tenant", 4, Attribute::AccessMode::kWrite);
+        m->AddMetadataAttr("flow", 8, Attribute::AccessMode::kWrite);
+      } else if (pos == chain_length - 1) {
+        m->AddMetadataAttr("tenant", 4, Attribute::AccessMode::kRead);
+        m->AddMetadataAttr("flow", 8, Attribute::AccessMode::kRead);
+      } else if (pos % 2) {
+        m->AddMetadataAttr("flow", 8, Attribute::AccessMode::kUpdate);
+      }
+
+      modules_.push_back(m);
+    }
+
+    default_pipeline.ComputeMetadataOffsets();
+  }
+
+  void TearDown(benchmark::State &) override {
+    ModuleBuilder::DestroyAllModules();
+    ModuleBuilder::all_module_builders_holder(true);
+    modules_.clear();
+  }
+
+  std::vector<Module *> modules_;
+};
+
+}  // namespace (unnamed)
+
+// Connects the modules one edge at a time and recomputes the offsets after
+// each, as resume_all_workers() would after every "connect" command.
+BENCHMARK_DEFINE_F(MetadataFixture, BuildGraph)(benchmark::State &state) {
+  const int chain_length = state.range(1);
+  int edges = 0;
+
+  while (state.KeepRunning()) {
+    edges = 0;
+    for (size_t i = 1; i < modules_.size(); i++) {
+      if (i % chain_length == 0) {
+        continue;
+      }
+
+      int ret = modules_[i - 1]->ConnectModules(0, modules_[i], 0);
+      DCHECK_EQ(ret, 0);
+      default_pipeline.ComputeMetadataOffsets();
+      edges++;
+    }
+
+    state.PauseTiming();
+    for (size_t i = 0; i < modules_.size(); i++) {
+      modules_[i]->DisconnectModules(0);
+    }
+    default_pipeline.ComputeMetadataOffsets();
+    state.ResumeTiming();
+  }
+
+  state.SetItemsProcessed(state.iterations() * edges);
+}
+
+BENCHMARK_REGISTER_F(MetadataFixture, BuildGraph)
+    ->Args({5000, 5})
+    ->Args({5000, 50})
+    ->Args({5000, 500});
+
+// Pausing and resuming workers without changing the graph
+BENCHMARK_DEFINE_F(MetadataFixture, Unchanged)(benchmark::State &state) {
+  for (size_t i = 1; i < modules_.size(); i++) {
+    modules_[i - 1]->ConnectModules(0, modules_[i], 0);
+  }
+  default_pipeline.ComputeMetadataOffsets();
+
+  while (state.KeepRunning()) {
+    default_pipeline.ComputeMetadataOffsets();
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_REGISTER_F(MetadataFixture, Unchanged)->Args({5000, 5000});
+
+BENCHMARK_MAIN();
@@ -5,6 +5,7 @@
 #include <cstdlib>
 #include <vector>
 
+#include "hooks/track.h"
 #include "module.h"
 
 namespace {
@@ -120,6 +121,145 @@ TEST_F(MetadataTest, SingleAttrSimplePipe) {
   ASSERT_EQ(m0->attr_offset(0), m1->attr_offset(0));
 }
 
+// Offsets must follow changes made after the first computation
+TEST_F(MetadataTest, DisconnectRecomputes) {
+  ASSERT_EQ(0, m0->AddMetadataAttr("a", 1, Attribute::AccessMode::kWrite));
+  ASSERT_EQ(0, m1->AddMetadataAttr("a", 1, Attribute::AccessMode::kRead));
+  m0->ConnectModules(0, m1, 0);
+
+  ASSERT_EQ(0, default_pipeline.ComputeMetadataOffsets());
+  ASSERT_GE(m1->attr_offset(0), 0);
+
+  m0->DisconnectModules(0);
+  ASSERT_EQ(0, default_pipeline.ComputeMetadataOffsets());
+  ASSERT_EQ(kMetadataOffsetNoWrite, m0->attr_offset(0));
+  ASSERT_EQ(kMetadataOffsetNoRead, m1->attr_offset(0));
+}
+
+// Attributes keep their offsets if the new edge does not force them to move
+TEST_F(MetadataTest, IncrementalKeepsOffsets) {
+  Module *m2 = ::create_foo();
+  ASSERT_EQ(0, m0->AddMetadataAttr("a", 4, Attribute::AccessMode::kWrite));
+  ASSERT_EQ(1, m0->AddMetadataAttr("b", 4, Attribute::AccessMode::kWrite));
+  ASSERT_EQ(0, m1->AddMetadataAttr("b", 4, Attribute::AccessMode::kRead));
+  ASSERT_EQ(0, m2->AddMetadataAttr("a", 4, Attribute::AccessMode::kRead));
+  m0->ConnectModules(0, m1, 0);
+
+  ASSERT_EQ(0, default_pipeline.ComputeMetadataOffsets());
+  ASSERT_EQ(kMetadataOffsetNoWrite, m0->attr_offset(0));
+  mt_offset_t b_offset = m0->attr_offset(1);
+  ASSERT_GE(b_offset, 0);
+
+  m1->ConnectModules(0, m2, 0);
+  ASSERT_EQ(0, default_pipeline.ComputeMetadataOffsets());
+  ASSERT_EQ(b_offset, m0->attr_offset(1));
+  ASSERT_EQ(b_offset, m1->attr_offset(0));
+  ASSERT_GE(m0->attr_offset(0), 0);
+  ASSERT_EQ(m0->attr_offset(0), m2->attr_offset(0));
+  ASSERT_TRUE(m0->attr_offset(0) >= b_offset + 4 ||
+              m0->attr_offset(0) + 4 <= b_offset);
+}
+
+// Hot attributes used by the same modules should share a cache line, away
+// from those used by other modules.
+TEST_F(MetadataTest, CacheLinePacking) {
+  Module *m2 = ::create_foo();
+  Module *m3 = ::create_foo();
+  default_pipeline.SetAttributeWeight("a", 100);
+  default_pipeline.SetAttributeWeight("y", 50);
+  default_pipeline.SetAttributeWeight("z", 10);
+
+  ASSERT_EQ(0, m0->AddMetadataAttr("a", 32, Attribute::AccessMode::kWrite));
+  ASSERT_EQ(1, m0->AddMetadataAttr("z", 32, Attribute::AccessMode::kWrite));
+  ASSERT_EQ(0, m1->AddMetadataAttr("y", 32, Attribute::AccessMode::kWrite));
+  ASSERT_EQ(0, m2->AddMetadataAttr("y", 32, Attribute::AccessMode::kRead));
+  ASSERT_EQ(0, m3->AddMetadataAttr("a", 32, Attribute::AccessMode::kRead));
+  ASSERT_EQ(1, m3->AddMetadataAttr("z", 32, Attribute::AccessMode::kRead));
+  m0->ConnectModules(0, m1, 0);
+  m1->ConnectModules(0, m2, 0);
+  m2->ConnectModules(0, m3, 0);
+
+  ASSERT_EQ(0, default_pipeline.ComputeMetadataOffsets());
+
+  const int line_size = kMetadataCacheLineSize;
+  mt_offset_t a = m0->attr_offset(0);
+  mt_offset_t z = m0->attr_offset(1);
+  mt_offset_t y = m1->attr_offset(0);
+  ASSERT_GE(a, 0);
+  ASSERT_GE(z, 0);
+  ASSERT_GE(y, 0);
+  EXPECT_EQ(a / line_size, z / line_size);
+  EXPECT_NE(a / line_size, y / line_size);
+
+  ASSERT_EQ(3, default_pipeline.layout().size());
+  EXPECT_EQ("a", default_pipeline.layout()[0].attr_id);
+  EXPECT_EQ(100, default_pipeline.layout()[0].weight);
+  EXPECT_EQ(4, default_pipeline.layout()[0].modules.size());
+
+  default_pipeline.SetAttributeWeight("a", 0);
+  default_pipeline.SetAttributeWeight("y", 0);
+  default_pipeline.SetAttributeWeight("z", 0);
+}
+
+// Offsets stay put as the measured weights change, until the pipeline is
+// repacked.
+TEST_F(MetadataTest, RepackMeasuredWeights) {
+  Module *m2 = ::create_foo();
+
+  ASSERT_EQ(0, m0->AddMetadataAttr("p", 32, Attribute::AccessMode::kWrite));
+  ASSERT_EQ(1, m0->AddMetadataAttr("q", 32, Attribute::AccessMode::kWrite));
+  ASSERT_EQ(2, m0->AddMetadataAttr("r", 32, Attribute::AccessMode::kWrite));
+  ASSERT_EQ(0, m1->AddMetadataAttr("p", 32, Attribute::AccessMode::kRead));
+  ASSERT_EQ(1, m1->AddMetadataAttr("q", 32, Attribute::AccessMode::kRead));
+  ASSERT_EQ(0, m2->AddMetadataAttr("p", 32, Attribute::AccessMode::kRead));
+  ASSERT_EQ(1, m2->AddMetadataAttr("r", 32, Attribute::AccessMode::kRead));
+  ASSERT_EQ(0, m0->ConnectModules(0, m1, 0));
+  ASSERT_EQ(0, m0->ConnectModules(1, m2, 0));
+
+  TrackGate *to_m1 = reinterpret_cast<TrackGate *>(
+      m0->ogates()[0]->FindHook(kGateHookTrackGate));
+  TrackGate *to_m2 = reinterpret_cast<TrackGate *>(
+      m0->ogates()[1]->FindHook(kGateHookTrackGate));
+  ASSERT_TRUE(to_m1);
+  ASSERT_TRUE(to_m2);
+
+  const int line_size = kMetadataCacheLineSize;
+
+  // q is the hotter one, so it shares the line of p
+  to_m1->incr_pkts(1000);
+  ASSERT_EQ(0, default_pipeline.ComputeMetadataOffsets());
+  mt_offset_t p = m0->attr_offset(0);
+  mt_offset_t q = m0->attr_offset(1);
+  mt_offset_t r = m0->attr_offset(2);
+  ASSERT_GE(p, 0);
+  ASSERT_GE(q, 0);
+  ASSERT_GE(r, 0);
+  EXPECT_EQ(p / line_size, q / line_size);
+  EXPECT_NE(p / line_size, r / line_size);
+
+  // Now r is, but nothing changed in the graph
+  to_m2->incr_pkts(100000);
+  ASSERT_EQ(0, default_pipeline.ComputeMetadataOffsets());
+  EXPECT_EQ(p, m0->attr_offset(0));
+  EXPECT_EQ(q, m0->attr_offset(1));
+  EXPECT_EQ(r, m0->attr_offset(2));
+
+  default_pipeline.Repack();
+  ASSERT_EQ(0, default_pipeline.ComputeMetadataOffsets());
+  p = m0->attr_offset(0);
+  q = m0->attr_offset(1);
+  r = m0->attr_offset(2);
+  ASSERT_GE(p, 0);
+  ASSERT_GE(q, 0);
+  ASSERT_GE(r, 0);
+  EXPECT_EQ(p / line_size, r / line_size);
+  EXPECT_NE(p / line_size, q / line_size);
+  EXPECT_EQ(p, m1->attr_offset(0));
+  EXPECT_EQ(q, m1->attr_offset(1));
+  EXPECT_EQ(p, m2->attr_offset(0));
+  EXPECT_EQ(r, m2->attr_offset(1));
+}
+
 // Check that the "error" offsets arre assigned correctly
 TEST_F(MetadataTest, SingleAttrSimplePipeBackwardsFails) {
   ASSERT_EQ(0, m0->AddMetadataAttr("a", 1, Attribute::AccessMode::kRead));
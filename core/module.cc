@@ -15,6 +15,8 @@
 #include "mem_alloc.h"
 #include "scheduler.h"
 #include "utils/pcap.h"
+#include "utils/simd.h"
+#include "utils/time.h"
 
 const Commands Module::cmds;
 
@@ -22,6 +24,8 @@ std::map<std::string, Module *> ModuleBuilder::all_modules_;
 
 Module *ModuleBuilder::CreateModule(const std::string &name,
                                     bess::metadata::Pipeline *pipeline) const {
+  // Tables allocated by the module are charged to it (see mem_alloc.h)
+  bess::memory::OwnerScope owner(name);
   Module *m = module_generator_();
   m->set_name(name);
   m->set_module_builder(this);
@@ -30,7 +34,12 @@ Module *ModuleBuilder::CreateModule(const std::string &name,
 }
 
 bool ModuleBuilder::AddModule(Module *m) {
-  return all_modules_.insert({m->name(), m}).second;
+  if (!all_modules_.insert({m->name(), m}).second) {
+    return false;
+  }
+
+  m->pipeline()->MarkDirty(m);
+  return true;
 }
 
 int ModuleBuilder::DestroyModule(Module *m, bool erase) {
@@ -55,6 +64,11 @@ int ModuleBuilder::DestroyModule(Module *m, bool erase) {
 
   m->DestroyAllTasks();
   m->DeregisterAllAttributes();
+  m->pipeline()->RemoveModule(m);
+
+  if (bess::packet_accounting.enabled()) {
+    bess::packet_accounting.Forget(m);
+  }
 
   if (erase) {
     all_modules_.erase(m->name());
@@ -161,6 +175,7 @@ pb_cmd_response_t ModuleBuilder::RunCommand(
         return response;
       }
 
+      bess::memory::OwnerScope owner(m->name());
       return cmd.func(m, arg);
     }
   }
@@ -173,6 +188,7 @@ pb_cmd_response_t ModuleBuilder::RunCommand(
 
 pb_error_t ModuleBuilder::RunInit(Module *m,
                                   const google::protobuf::Any &arg) const {
+  bess::memory::OwnerScope owner(m->name());
   return init_func_(m, arg);
 }
 
@@ -248,6 +264,7 @@ int Module::AddMetadataAttr(const std::string &name, size_t size,
   attr.scope_id = -1;
 
   attrs_.push_back(attr);
+  pipeline_->MarkDirty(this);
 
   return attrs_.size() - 1;
 }
@@ -300,6 +317,9 @@ int Module::ConnectModules(gate_idx_t ogate_idx, Module *m_next,
   ogate->AddHook(new TrackGate());
   igate->PushOgate(ogate);
 
+  pipeline_->MarkDirty(this);
+  pipeline_->MarkDirty(m_next);
+
   return 0;
 }
 
@@ -322,6 +342,8 @@ int Module::DisconnectModules(gate_idx_t ogate_idx) {
   }
 
   igate = ogate->igate();
+  pipeline_->MarkDirty(this);
+  pipeline_->MarkDirty(igate->module());
 
   /* Does the igate become inactive as well? */
   igate->RemoveOgate(ogate);
@@ -356,8 +378,11 @@ int Module::DisconnectModulesUpstream(gate_idx_t igate_idx) {
     return 0;
   }
 
+  pipeline_->MarkDirty(this);
+
   for (const auto &ogate : igate->ogates_upstream()) {
     Module *m_prev = ogate->module();
+    pipeline_->MarkDirty(m_prev);
     m_prev->ogates_[ogate->gate_idx()] = nullptr;
     ogate->ClearHooks();
     delete ogate;
@@ -370,9 +395,108 @@ int Module::DisconnectModulesUpstream(gate_idx_t igate_idx) {
   return 0;
 }
 
+// Returns true if all cnt (> 0) gates are the same as gates[0].
+static inline bool is_single_gate(const gate_idx_t *gates, int cnt) {
+  const gate_idx_t first = gates[0];
+  int i = 0;
+
+#if __AVX2__
+  const __m256i first256 = _mm256_set1_epi16(first);
+  for (; i + 16 <= cnt; i += 16) {
+    __m256i v =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(gates + i));
+    if (_mm256_movemask_epi8(_mm256_cmpeq_epi16(v, first256)) != -1) {
+      return false;
+    }
+  }
+#endif
+
+  const __m128i first128 = _mm_set1_epi16(first);
+  for (; i + 8 <= cnt; i += 8) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(gates + i));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi16(v, first128)) != 0xffff) {
+      return false;
+    }
+  }
+
+  for (; i < cnt; i++) {
+    if (gates[i] != first) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
 void Module::RunSplit(const gate_idx_t *out_gates,
                       bess::PacketBatch *mixed_batch) {
   int cnt = mixed_batch->cnt();
+
+  if (unlikely(cnt <= 0)) {
+    return;
+  }
+
+  /* fast path: every packet goes to the same ogate, so no need to copy */
+  if (is_single_gate(out_gates, cnt)) {
+    RunChooseModule(out_gates[0], mixed_batch);
+    return;
+  }
+
+  if (!RunSplitFewGates(out_gates, mixed_batch)) {
+    RunSplitManyGates(out_gates, mixed_batch);
+  }
+}
+
+bool Module::RunSplitFewGates(const gate_idx_t *out_gates,
+                              bess::PacketBatch *mixed_batch) {
+  int cnt = mixed_batch->cnt();
+  int num_groups = 0;
+
+  bess::Packet **p_pkt = &mixed_batch->pkts()[0];
+
+  /* all group gates fit in a single SSE register */
+  gate_idx_t group_gates[kMaxSplitGroups] __xmm_aligned = {};
+  bess::PacketBatch batches[kMaxSplitGroups];
+
+  __m128i group_gates_vec = _mm_setzero_si128();
+
+  /* phase 1: find the group of each packet with a single comparison */
+  for (int i = 0; i < cnt; i++) {
+    gate_idx_t ogate = out_gates[i];
+    int group;
+
+    int mask = _mm_movemask_epi8(
+                   _mm_cmpeq_epi16(group_gates_vec, _mm_set1_epi16(ogate))) &
+               ((1 << (num_groups * 2)) - 1);
+
+    if (likely(mask)) {
+      group = __builtin_ctz(mask) / 2;
+    } else {
+      if (num_groups == kMaxSplitGroups) {
+        return false;
+      }
+
+      group = num_groups++;
+      group_gates[group] = ogate;
+      batches[group].clear();
+      group_gates_vec =
+          _mm_load_si128(reinterpret_cast<const __m128i *>(group_gates));
+    }
+
+    batches[group].add(*(p_pkt++));
+  }
+
+  /* phase 2: fire. batches are already on the local stack */
+  for (int i = 0; i < num_groups; i++) {
+    RunChooseModule(group_gates[i], &batches[i]);
+  }
+
+  return true;
+}
+
+void Module::RunSplitManyGates(const gate_idx_t *out_gates,
+                               bess::PacketBatch *mixed_batch) {
+  int cnt = mixed_batch->cnt();
   int num_pending = 0;
 
   bess::Packet **p_pkt = &mixed_batch->pkts()[0];
@@ -410,85 +534,71 @@ void Module::RunSplit(const gate_idx_t *out_gates,
     RunChooseModule(pending[i], &batches[i]);
 }
 
-#if SN_TRACE_MODULES
-#define MAX_TRACE_DEPTH 32
-#define MAX_TRACE_BUFSIZE 4096
-
-struct callstack {
-  int depth;
+void Module::RunCoalesced(bess::IGate *igate, bess::PacketBatch *batch) {
+  bess::CoalesceBuffer *buf = igate->coalesce_buffer(ctx.wid());
+  bess::PacketBatch *pending = &buf->batch;
+  int cnt = batch->cnt();
 
-  int newlined;
-  int indent[MAX_TRACE_DEPTH];
-  int curr_indent;
-
-  int buflen;
-  char buf[MAX_TRACE_BUFSIZE];
-};
+  /* nothing to merge with */
+  if (pending->empty() && cnt == bess::PacketBatch::kMaxBurst) {
+    igate->module()->ProcessBatch(batch);
+    return;
+  }
 
-__thread struct callstack worker_callstack;
+  for (int i = 0; i < cnt;) {
+    int n = std::min(cnt - i,
+                     static_cast<int>(bess::PacketBatch::kMaxBurst) -
+                         pending->cnt());
 
-void _trace_start(Module *mod, char *type) {
-  struct callstack *s = &worker_callstack;
+    if (pending->empty()) {
+      buf->deadline = ctx.current_tsc() + igate->coalesce_delay();
+    }
 
-  DCHECK_EQ(s->depth, 0);
-  DCHECK_EQ(s->buflen, 0);
+    rte_memcpy(reinterpret_cast<void *>(pending->pkts() + pending->cnt()),
+               reinterpret_cast<const void *>(batch->pkts() + i),
+               n * sizeof(bess::Packet *));
+    pending->incr_cnt(n);
+    i += n;
 
-  s->buflen = snprintf(s->buf + s->buflen, MAX_TRACE_BUFSIZE - s->buflen,
-                       "Worker %d %-8s | %s", current_wid, type, mod->name());
+    if (pending->full()) {
+      DeliverCoalesced(buf);
+    }
+  }
 
-  s->curr_indent = s->buflen;
+  if (!pending->empty() && !buf->linked) {
+    ctx.AddCoalescePending(buf);
+  }
 }
 
-void _trace_end(int print_out) {
-  struct callstack *s = &worker_callstack;
+void Module::DeliverCoalesced(bess::CoalesceBuffer *buf) {
+  bess::PacketBatch batch;
 
-  DCHECK_EQ(s->depth, 0);
-  s->buflen = 0;
-  s->newlined = 0;
+  /* move to local stack, since it may be reentrant */
+  batch.Copy(&buf->batch);
+  buf->batch.clear();
 
-  if (print_out) {
-    DLOG(INFO) << s->buf;
-  }
+  ctx.set_current_igate(buf->igate->gate_idx());
+  buf->igate->module()->ProcessBatch(&batch);
 }
 
-void _trace_before_call(Module *mod, Module *next, bess::PacketBatch *batch) {
-  struct callstack *s = &worker_callstack;
-  int len;
-
-  s->indent[s->depth] = s->curr_indent;
-
-  if (s->newlined) {
-    s->buflen += snprintf(s->buf + s->buflen, MAX_TRACE_BUFSIZE - s->buflen,
-                          "%*s", s->curr_indent, "");
+int Module::EnableCoalescing(gate_idx_t igate_idx, uint64_t max_delay_ns) {
+  if (!is_active_gate<bess::IGate>(igates_, igate_idx)) {
+    return -EINVAL;
   }
 
-  len = snprintf(s->buf + s->buflen, MAX_TRACE_BUFSIZE - s->buflen,
-                 " ---(%d)--> %s", batch->cnt, next->name);
-
-  s->buflen += len;
-  s->curr_indent += len;
-
-  s->depth++;
-  DCHECK_LT(s->depth, MAX_TRACE_DEPTH);
-
-  s->newlined = 0;
+  uint64_t max_delay_tsc = max_delay_ns * (tsc_hz / 1e9);
+  igates_[igate_idx]->EnableCoalescing(max_delay_tsc, MAX_WORKERS);
+  return 0;
 }
 
-void _trace_after_call(void) {
-  struct callstack *s = &worker_callstack;
-
-  s->depth--;
-
-  if (!s->newlined) {
-    s->newlined = 1;
-
-    s->buflen +=
-        snprintf(s->buf + s->buflen, MAX_TRACE_BUFSIZE - s->buflen, "\n");
+int Module::DisableCoalescing(gate_idx_t igate_idx) {
+  if (!is_active_gate<bess::IGate>(igates_, igate_idx)) {
+    return -EINVAL;
   }
 
-  s->curr_indent = s->indent[s->depth];
+  igates_[igate_idx]->DisableCoalescing();
+  return 0;
 }
-#endif
 
 // TODO(melvin): Much of this belongs in the TcpDump constructor.
 int Module::EnableTcpDump(const char *fifo, int is_igate, gate_idx_t gate_idx) {
@@ -10,7 +10,9 @@
 #include "message.h"
 #include "metadata.h"
 #include "packet.h"
+#include "packet_tracer.h"
 #include "task.h"
+#include "utils/time.h"
 
 using bess::gate_idx_t;
 
@@ -157,7 +159,9 @@ class Module {
         attr_offsets_(),
         tasks_(),
         igates_(),
-        ogates_() {}
+        ogates_(),
+        drops_(),
+        pkts_held_() {}
   virtual ~Module() {}
 
   pb_error_t Init(const bess::pb::EmptyArg &arg);
@@ -199,9 +203,21 @@ class Module {
    * NOTE:
    *   1. Order is preserved for packets with the same gate.
    *   2. No ordering guarantee for packets with different gates.
+   *   3. If all packets go to the same gate, mixed_batch itself is passed on.
    */
   void RunSplit(const gate_idx_t *ogates, bess::PacketBatch *mixed_batch);
 
+  /* Merges the batch into the coalescing buffer of igate for this worker,
+   * passing on full batches to the module of igate */
+  static void RunCoalesced(bess::IGate *igate, bess::PacketBatch *batch);
+
+  /* Passes on whatever is in the buffer, leaving it empty */
+  static void DeliverCoalesced(bess::CoalesceBuffer *buf);
+
+  /* returns -errno if fails */
+  int EnableCoalescing(gate_idx_t igate_idx, uint64_t max_delay_ns);
+  int DisableCoalescing(gate_idx_t igate_idx);
+
   /* returns -errno if fails */
   int ConnectModules(gate_idx_t ogate_idx, Module *m_next,
                      gate_idx_t igate_idx);
@@ -260,7 +276,39 @@ class Module {
     return ogates_;
   };
 
+  // Packets dropped at ogate_idx because it is not connected (or DROP_GATE).
+  // Only the first kNumDropCounters ogates are counted separately.
+  uint64_t drops(gate_idx_t ogate_idx) const {
+    return drops_[drop_counter_idx(ogate_idx)];
+  }
+  uint64_t total_drops() const {
+    uint64_t total = 0;
+    for (uint64_t cnt : drops_) {
+      total += cnt;
+    }
+    return total;
+  }
+
+  static const gate_idx_t kNumDropCounters = 16;
+
  private:
+  static gate_idx_t drop_counter_idx(gate_idx_t ogate_idx) {
+    return ogate_idx < kNumDropCounters ? ogate_idx : kNumDropCounters;
+  }
+
+  /* Frees the batch sent to an ogate that leads nowhere */
+  inline void Deadend(gate_idx_t ogate_idx, bess::PacketBatch *batch);
+
+  // Up to this many distinct ogates, RunSplit() groups packets on the stack
+  // rather than scattering them into the per-worker split batches.
+  static const int kMaxSplitGroups = 8;
+
+  // Returns false, without running anything, if there are too many ogates.
+  bool RunSplitFewGates(const gate_idx_t *ogates,
+                        bess::PacketBatch *mixed_batch);
+  void RunSplitManyGates(const gate_idx_t *ogates,
+                         bess::PacketBatch *mixed_batch);
+
   void DestroyAllTasks();
   void DeregisterAllAttributes();
 
@@ -286,29 +334,68 @@ class Module {
   std::vector<bess::IGate *> igates_;
   std::vector<bess::OGate *> ogates_;
 
+  /* the last one is shared by all ogates from kNumDropCounters on */
+  uint64_t drops_[kNumDropCounters + 1];
+
+  // Packets stamped with this module, less those that moved on, as counted by
+  // PacketAccounting on each worker. The last slot is for all other threads.
+  // Padded so that no two workers write to the same cache line.
+  struct HeldCounter {
+    int64_t cnt;
+    char pad[64 - sizeof(int64_t)];
+  };
+  mutable HeldCounter pkts_held_[MAX_WORKERS + 1];
+
+  friend class bess::PacketAccounting;
+
   DISALLOW_COPY_AND_ASSIGN(Module);
 };
 
-static inline void deadend(bess::PacketBatch *batch) {
-  ctx.incr_silent_drops(batch->cnt());
+inline void Module::Deadend(gate_idx_t ogate_idx, bess::PacketBatch *batch) {
+  int cnt = batch->cnt();
+
+  if (unlikely(bess::packet_tracer.enabled())) {
+    bess::packet_tracer.TraceBatch(this, ogate_idx, nullptr, batch);
+  }
+
+  ctx.incr_silent_drops(cnt);
+  drops_[drop_counter_idx(ogate_idx)] += cnt;
   bess::Packet::Free(batch);
 }
 
+static inline void deliver_batch(bess::OGate *ogate, bess::PacketBatch *batch) {
+  if (unlikely(ogate->igate()->coalescing())) {
+    Module::RunCoalesced(ogate->igate(), batch);
+    return;
+  }
+
+  (static_cast<Module *>(ogate->arg()))->ProcessBatch(batch);
+}
+
 inline void Module::RunChooseModule(gate_idx_t ogate_idx,
                                     bess::PacketBatch *batch) {
   bess::OGate *ogate;
 
   if (unlikely(ogate_idx >= ogates_.size())) {
-    deadend(batch);
+    Deadend(ogate_idx, batch);
     return;
   }
 
   ogate = ogates_[ogate_idx];
 
   if (unlikely(!ogate)) {
-    deadend(batch);
+    Deadend(ogate_idx, batch);
     return;
   }
+
+  if (unlikely(bess::packet_tracer.enabled())) {
+    bess::packet_tracer.TraceBatch(this, ogate_idx, ogate, batch);
+  }
+
+  if (unlikely(bess::packet_accounting.enabled())) {
+    bess::packet_accounting.StampBatch(ogate->igate()->module(), batch);
+  }
+
   for (auto &hook : ogate->hooks()) {
     hook->ProcessBatch(batch);
   }
@@ -318,7 +405,15 @@ inline void Module::RunChooseModule(gate_idx_t ogate_idx,
   }
 
   ctx.set_current_igate(ogate->igate_idx());
-  (static_cast<Module *>(ogate->arg()))->ProcessBatch(batch);
+
+  if (likely(!ogate->measure_cycles())) {
+    deliver_batch(ogate, batch);
+    return;
+  }
+
+  uint64_t start = rdtsc();
+  deliver_batch(ogate, batch);
+  ogate->incr_cycles(rdtsc() - start);
 }
 
 inline void Module::RunNextModule(bess::PacketBatch *batch) {
@@ -328,12 +423,6 @@ inline void Module::RunNextModule(bess::PacketBatch *batch) {
 /* run all per-thread initializers */
 void init_module_worker(void);
 
-#if SN_TRACE_MODULES
-void _trace_before_call(Module *mod, Module *next, bess::PacketBatch *batch);
-
-void _trace_after_call(void);
-#endif
-
 static inline gate_idx_t get_igate() {
   return ctx.current_igate();
 }
@@ -4,6 +4,7 @@
 #include <glog/logging.h>
 
 #include "traffic_class.h"
+#include "utils/random.h"
 
 namespace {
 
@@ -46,6 +47,48 @@ class DummyRelayModule : public Module {
   RunNextModule(batch);
 }
 
+// Splits every batch according to a precomputed sequence of gate patterns.
+class DummySplitModule : public Module {
+ public:
+  static const gate_idx_t kNumOGates = MAX_GATES;
+
+  DummySplitModule() : Module(), rng_(), out_gates_(), next_() {}
+
+  void ProcessBatch(bess::PacketBatch *batch) override;
+
+  // Each packet is sent to one of num_gates gates chosen uniformly at random
+  void GenerateGates(int num_gates, size_t num_batches) {
+    out_gates_.resize(num_batches * bess::PacketBatch::kMaxBurst);
+    for (auto &gate : out_gates_) {
+      gate = rng_.GetRange(num_gates);
+    }
+    next_ = 0;
+  }
+
+ private:
+  Random rng_;
+  std::vector<gate_idx_t> out_gates_;
+  size_t next_;
+};
+
+[[gnu::noinline]] void DummySplitModule::ProcessBatch(
+    bess::PacketBatch *batch) {
+  const gate_idx_t *out_gates = &out_gates_[next_];
+
+  next_ += bess::PacketBatch::kMaxBurst;
+  if (next_ >= out_gates_.size()) {
+    next_ = 0;
+  }
+
+  RunSplit(out_gates, batch);
+}
+
+// Does nothing, since the packets are fake and must not be freed.
+class DummySinkModule : public Module {
+ public:
+  void ProcessBatch(bess::PacketBatch *) override {}
+};
+
 // Simple harness for testing the Module class.
 class ModuleFixture : public benchmark::Fixture {
  protected:
@@ -88,6 +131,55 @@ class ModuleFixture : public benchmark::Fixture {
   std::vector<Module *> relays;
 };
 
+// Source -> Split -> (num_gates ogates) -> Sink
+class SplitFixture : public benchmark::Fixture {
+ protected:
+  void SetUp(benchmark::State &state) override {
+    const int num_gates = state.range(0);
+
+    ADD_MODULE(DummySourceModule, "src", "the most sophisticated modue ever");
+    ADD_MODULE(DummySplitModule, "split", "the most sophisticated modue ever");
+    ADD_MODULE(DummySinkModule, "sink", "the most sophisticated modue ever");
+    DCHECK(__module__DummySourceModule);
+    DCHECK(__module__DummySplitModule);
+    DCHECK(__module__DummySinkModule);
+
+    const auto &builders = ModuleBuilder::all_module_builders();
+    const auto &builder_src = builders.find("DummySourceModule")->second;
+    const auto &builder_split = builders.find("DummySplitModule")->second;
+    const auto &builder_sink = builders.find("DummySinkModule")->second;
+
+    src_ = builder_src.CreateModule("src0", &bess::metadata::default_pipeline);
+    ModuleBuilder::AddModule(src_);
+
+    DummySplitModule *split = static_cast<DummySplitModule *>(
+        builder_split.CreateModule("split0",
+                                   &bess::metadata::default_pipeline));
+    ModuleBuilder::AddModule(split);
+
+    Module *sink =
+        builder_sink.CreateModule("sink0", &bess::metadata::default_pipeline);
+    ModuleBuilder::AddModule(sink);
+
+    int ret = src_->ConnectModules(0, split, 0);
+    DCHECK_EQ(ret, 0);
+
+    for (int i = 0; i < num_gates; i++) {
+      ret = split->ConnectModules(i, sink, 0);
+      DCHECK_EQ(ret, 0);
+    }
+
+    split->GenerateGates(num_gates, 1024);
+  }
+
+  void TearDown(benchmark::State &) override {
+    ModuleBuilder::DestroyAllModules();
+    ModuleBuilder::all_module_builders_holder(true);
+  }
+
+  Module *src_;
+};
+
 }  // namespace (unnamed)
 
 BENCHMARK_DEFINE_F(ModuleFixture, Chain)(benchmark::State &state) {
@@ -119,4 +211,31 @@ BENCHMARK_REGISTER_F(ModuleFixture, Chain)
     ->Arg(9)
     ->Arg(10);
 
+// Arg: number of distinct ogates the packets of a batch are spread across.
+// 1 is the uniform case, and 1024 is effectively a different gate per packet.
+BENCHMARK_DEFINE_F(SplitFixture, Split)(benchmark::State &state) {
+  const size_t batch_size = bess::PacketBatch::kMaxBurst;
+
+  std::string leaf_name = "leaf";
+  bess::LeafTrafficClass *leaf = new bess::LeafTrafficClass(leaf_name);
+
+  Task t(src_, reinterpret_cast<void *>(batch_size), leaf);
+
+  while (state.KeepRunning()) {
+    struct task_result ret = t.Scheduled();
+    DCHECK_EQ(ret.packets, batch_size);
+  }
+
+  state.SetItemsProcessed(state.iterations() * batch_size);
+  delete leaf;
+}
+
+BENCHMARK_REGISTER_F(SplitFixture, Split)
+    ->Arg(1)
+    ->Arg(2)
+    ->Arg(4)
+    ->Arg(8)
+    ->Arg(16)
+    ->Arg(1024);
+
 BENCHMARK_MAIN()
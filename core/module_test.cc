@@ -31,12 +31,25 @@ class AcmeModule : public Module {
 const Commands AcmeModule::cmds = {
     {"foo", "EmptyArg", MODULE_CMD_FUNC(&AcmeModule::FooPb), 0}};
 
+class CountingModule : public Module {
+ public:
+  void ProcessBatch(bess::PacketBatch *batch) override {
+    batches++;
+    pkts += batch->cnt();
+  }
+
+  int batches = {};
+  int pkts = {};
+};
+
 // Simple harness for testing the Module class.
 class ModuleTester : public ::testing::Test {
  protected:
   virtual void SetUp() {
     ADD_MODULE(AcmeModule, "acme_module", "foo bar");
     ASSERT_TRUE(__module__AcmeModule);
+    ADD_MODULE(CountingModule, "counting", "counting");
+    ASSERT_TRUE(__module__CountingModule);
   }
 
   virtual void TearDown() {
@@ -179,6 +192,82 @@ TEST_F(ModuleTester, ConnectModules) {
   }
 }
 
+TEST_F(ModuleTester, CoalesceSmallBatches) {
+  Module *m;
+
+  EXPECT_EQ(0, create_acme("m", &m));
+  ASSERT_NE(nullptr, m);
+
+  const ModuleBuilder &builder =
+      ModuleBuilder::all_module_builders().find("CountingModule")->second;
+  CountingModule *c = static_cast<CountingModule *>(
+      builder.CreateModule("c", &bess::metadata::default_pipeline));
+  ASSERT_TRUE(ModuleBuilder::AddModule(c));
+
+  EXPECT_EQ(0, m->ConnectModules(0, c, 0));
+  c->igates()[0]->EnableCoalescing(1000, MAX_WORKERS);
+  ctx.set_current_tsc(1000000);
+
+  // 40 packets in batches of 4
+  bess::PacketBatch batch;
+  for (int i = 0; i < 10; i++) {
+    batch.clear();
+    for (int j = 0; j < 4; j++) {
+      // never dereferenced
+      batch.add(reinterpret_cast<bess::Packet *>(0x1000 + i * 4 + j));
+    }
+    m->RunNextModule(&batch);
+  }
+
+  EXPECT_EQ(1, c->batches);
+  EXPECT_EQ(32, c->pkts);
+  EXPECT_TRUE(ctx.has_coalesced_batches());
+
+  // Before the deadline
+  ctx.FlushCoalescedBatches(1000500);
+  EXPECT_EQ(1, c->batches);
+
+  ctx.FlushCoalescedBatches(1001000);
+  EXPECT_EQ(2, c->batches);
+  EXPECT_EQ(40, c->pkts);
+  EXPECT_FALSE(ctx.has_coalesced_batches());
+
+  // Full batches pass right through
+  batch.set_cnt(bess::PacketBatch::kMaxBurst);
+  m->RunNextModule(&batch);
+  EXPECT_EQ(3, c->batches);
+  EXPECT_FALSE(ctx.has_coalesced_batches());
+}
+
+TEST_F(ModuleTester, MeasureCycles) {
+  Module *m;
+
+  EXPECT_EQ(0, create_acme("m", &m));
+  ASSERT_NE(nullptr, m);
+
+  const ModuleBuilder &builder =
+      ModuleBuilder::all_module_builders().find("CountingModule")->second;
+  CountingModule *c = static_cast<CountingModule *>(
+      builder.CreateModule("c", &bess::metadata::default_pipeline));
+  ASSERT_TRUE(ModuleBuilder::AddModule(c));
+  EXPECT_EQ(0, m->ConnectModules(0, c, 0));
+
+  bess::OGate *og = m->ogates()[0];
+  bess::PacketBatch batch;
+  batch.clear();
+
+  m->RunNextModule(&batch);
+  EXPECT_EQ(1, c->batches);
+  EXPECT_EQ(0, og->cycles());
+
+  og->set_measure_cycles(true);
+  m->RunNextModule(&batch);
+  EXPECT_EQ(2, c->batches);
+  EXPECT_LT(0, og->cycles());
+
+  EXPECT_EQ(0, m->total_drops());
+}
+
 TEST_F(ModuleTester, ResetModules) {
   Module *m;
 
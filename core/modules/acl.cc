@@ -6,38 +6,183 @@
 
 #include <string>
 
+#include "../utils/conn_tracker.h"
+#include "../utils/rcu.h"
+
+using bess::utils::ConnState;
+
+enum {
+  ATTR_R_CONN_STATE,
+};
+
 const Commands ACL::cmds = {
-    {"add", "ACLArg", MODULE_CMD_FUNC(&ACL::CommandAdd), 0},
-    {"clear", "EmptyArg", MODULE_CMD_FUNC(&ACL::CommandClear), 0}};
+    {"add", "ACLArg", MODULE_CMD_FUNC(&ACL::CommandAdd), 1},
+    {"clear", "EmptyArg", MODULE_CMD_FUNC(&ACL::CommandClear), 1},
+    {"get_cache_stats", "EmptyArg", MODULE_CMD_FUNC(&ACL::CommandGetCacheStats),
+     0}};
+
+static bess::utils::BitmapClassifier<5>::Range PrefixRange(
+    const CIDRNetwork &net) {
+  uint32_t mask = ntohl(net.mask);
+  uint32_t lo = ntohl(net.addr) & mask;
+  return {lo, lo | ~mask};
+}
+
+static bess::utils::BitmapClassifier<5>::Range PortRange(uint16_t port) {
+  if (port == 0) {
+    return {0, 0xffff};
+  }
+  return {port, port};
+}
+
+static bess::utils::BitmapClassifier<5>::Range StateRange(bool established) {
+  if (!established) {
+    return bess::utils::BitmapClassifier<5>::Any();
+  }
+  uint8_t state = static_cast<uint8_t>(ConnState::kEstablished);
+  return {state, state};
+}
+
+static std::vector<bess::utils::BitmapClassifier<5>::Rule> ClassifierRules(
+    const std::vector<ACL::ACLRule> &rules) {
+  std::vector<bess::utils::BitmapClassifier<5>::Rule> ret;
+  for (const auto &rule : rules) {
+    ret.push_back({{PrefixRange(rule.src_ip), PrefixRange(rule.dst_ip),
+                    PortRange(rule.src_port), PortRange(rule.dst_port),
+                    StateRange(rule.established)}});
+  }
+  return ret;
+}
+
+ACL::Compiled::Compiled(const std::vector<ACLRule> &rules, uint64_t ver)
+    : classifier(ClassifierRules(rules)), drop(), version(ver) {
+  for (const auto &rule : rules) {
+    drop.push_back(rule.drop);
+  }
+}
 
 pb_error_t ACL::Init(const bess::pb::ACLArg &arg) {
+  using AccessMode = bess::metadata::Attribute::AccessMode;
+
   for (const auto &rule : arg.rules()) {
-    ACLRule new_rule = {
-        .src_ip = CIDRNetwork(rule.src_ip()),
-        .dst_ip = CIDRNetwork(rule.dst_ip()),
-        .src_port = htons(static_cast<uint16_t>(rule.src_port())),
-        .dst_port = htons(static_cast<uint16_t>(rule.dst_port())),
-        .established = rule.established(),
-        .drop = rule.drop()};
-    rules_.push_back(new_rule);
+    if (rule.established() && !conn_state_) {
+      AddMetadataAttr("conn_state", 1, AccessMode::kRead);
+      conn_state_ = true;
+    }
+  }
+
+  pb_error_t err = AddRules(arg);
+  if (err.err() != 0) {
+    return err;
   }
+
+  cache_size_ = arg.cache_size();
+
+  // No traffic yet, so the first rules are compiled right away
+  std::lock_guard<std::mutex> guard(rules_lock_);
+  classifier_ = new Compiled(rules_, version_);
+  built_version_ = version_;
   return pb_errno(0);
 }
 
+void ACL::DeInit() {
+  if (builder_.joinable()) {
+    builder_.join();
+  }
+  delete classifier_.load();
+}
+
 pb_cmd_response_t ACL::CommandAdd(const bess::pb::ACLArg &arg) {
   pb_cmd_response_t response;
-  set_cmd_response_error(&response, Init(arg));
+
+  pb_error_t err = AddRules(arg);
+  if (err.err() != 0) {
+    set_cmd_response_error(&response, err);
+    return response;
+  }
+
+  std::lock_guard<std::mutex> guard(rules_lock_);
+  StartBuilder();
   return response;
 }
 
 pb_cmd_response_t ACL::CommandClear(const bess::pb::EmptyArg &) {
+  std::lock_guard<std::mutex> guard(rules_lock_);
   rules_.clear();
+  version_++;
+  StartBuilder();
   return pb_cmd_response_t();
 }
 
+pb_error_t ACL::AddRules(const bess::pb::ACLArg &arg) {
+  for (const auto &rule : arg.rules()) {
+    if (rule.established() && !conn_state_) {
+      return pb_error(EINVAL,
+                      "'established' rules must be given at creation, as "
+                      "the connection state is not read otherwise");
+    }
+  }
+
+  std::lock_guard<std::mutex> guard(rules_lock_);
+
+  for (const auto &rule : arg.rules()) {
+    ACLRule new_rule = {
+        .src_ip = CIDRNetwork(rule.src_ip()),
+        .dst_ip = CIDRNetwork(rule.dst_ip()),
+        .src_port = static_cast<uint16_t>(rule.src_port()),
+        .dst_port = static_cast<uint16_t>(rule.dst_port()),
+        .established = rule.established(),
+        .drop = rule.drop()};
+    rules_.push_back(new_rule);
+  }
+  version_++;
+  return pb_errno(0);
+}
+
+// Called with rules_lock_ held
+void ACL::StartBuilder() {
+  if (building_) {
+    return;  // It will pick up the new version
+  }
+
+  // Done with its last build, if any
+  if (builder_.joinable()) {
+    builder_.join();
+  }
+
+  building_ = true;
+  builder_ = std::thread(&ACL::BuildLoop, this);
+}
+
+void ACL::BuildLoop() {
+  while (true) {
+    std::vector<ACLRule> rules;
+    uint64_t version;
+
+    {
+      std::lock_guard<std::mutex> guard(rules_lock_);
+      if (built_version_ == version_) {
+        building_ = false;
+        return;
+      }
+      rules = rules_;
+      version = version_;
+    }
+
+    const Compiled *old = classifier_.exchange(new Compiled(rules, version));
+    bess::utils::Rcu::Defer([old]() { delete old; });
+
+    std::lock_guard<std::mutex> guard(rules_lock_);
+    built_version_ = version;
+  }
+}
+
 void ACL::ProcessBatch(bess::PacketBatch *batch) {
   gate_idx_t out_gates[bess::PacketBatch::kMaxBurst];
   gate_idx_t incoming_gate = get_igate();
+  const Compiled *compiled = classifier_.load(std::memory_order_acquire);
+  CacheKey keys[bess::PacketBatch::kMaxBurst];
+  bool pass[bess::PacketBatch::kMaxBurst];
 
   int cnt = batch->cnt();
   for (int i = 0; i < cnt; i++) {
@@ -49,23 +194,79 @@ void ACL::ProcessBatch(bess::PacketBatch *batch) {
     struct udp_hdr *udp = reinterpret_cast<struct udp_hdr *>(
         reinterpret_cast<uint8_t *>(ip) + ip_bytes);
 
-    IPAddress src_ip = ip->src_addr;
-    IPAddress dst_ip = ip->dst_addr;
-    uint16_t src_port = udp->src_port;
-    uint16_t dst_port = udp->dst_port;
+    uint8_t state = 0;
+    if (conn_state_) {
+      state = get_attr<uint8_t>(this, ATTR_R_CONN_STATE, pkt);
+    }
 
-    out_gates[i] = DROP_GATE;  // By default, drop unmatched packets
+    keys[i].values = {{ntohl(ip->src_addr), ntohl(ip->dst_addr),
+                       ntohs(udp->src_port), ntohs(udp->dst_port), state}};
+    keys[i].pad = 0;
+  }
 
-    for (const auto &rule : rules_) {
-      if (rule.Match(src_ip, dst_ip, src_port, dst_port)) {
-        if (!rule.drop) {
-          out_gates[i] = incoming_gate;
-        }
-        break;  // Stop matching other rules
-      }
+  if (cache_size_ == 0) {
+    for (int i = 0; i < cnt; i++) {
+      pass[i] = Pass(compiled, keys[i]);
     }
+  } else {
+    PassCached(compiled, keys, cnt, pass);
+  }
+
+  for (int i = 0; i < cnt; i++) {
+    out_gates[i] = pass[i] ? incoming_gate : DROP_GATE;
   }
   RunSplit(out_gates, batch);
 }
 
+bool ACL::Pass(const Compiled *compiled, const CacheKey &key) {
+  // The first rule that matches decides. By default, drop unmatched packets
+  int rule = compiled->classifier.Match(key.values);
+  return rule >= 0 && !compiled->drop[rule];
+}
+
+void ACL::PassCached(const Compiled *compiled, const CacheKey *keys, int cnt,
+                     bool *pass) {
+  static_assert(bess::PacketBatch::kMaxBurst <= flow_cache_t::kMaxBulk,
+                "a batch does not fit in a bulk lookup");
+  const void *key_ptrs[bess::PacketBatch::kMaxBurst];
+  uint32_t hashes[bess::PacketBatch::kMaxBurst];
+
+  std::unique_ptr<flow_cache_t> &cache = caches_[ctx.wid()];
+  if (!cache) {
+    cache.reset(new flow_cache_t(sizeof(CacheKey), cache_size_));
+  }
+
+  for (int i = 0; i < cnt; i++) {
+    key_ptrs[i] = &keys[i];
+  }
+
+  // Cached verdicts are of the version of the classifier
+  uint64_t hits =
+      cache->FindBulk(key_ptrs, cnt, compiled->version, hashes, pass);
+
+  for (int i = 0; i < cnt; i++) {
+    if (!(hits & (1ULL << i))) {
+      pass[i] = Pass(compiled, keys[i]);
+      cache->Insert(&keys[i], hashes[i], compiled->version, pass[i]);
+    }
+  }
+}
+
+pb_cmd_response_t ACL::CommandGetCacheStats(const bess::pb::EmptyArg &) {
+  bess::pb::FlowCacheStats r;
+
+  for (const auto &cache : caches_) {
+    if (cache) {
+      r.set_hits(r.hits() + cache->stats().hits);
+      r.set_misses(r.misses() + cache->stats().misses);
+      r.set_evictions(r.evictions() + cache->stats().evictions);
+    }
+  }
+
+  pb_cmd_response_t response;
+  response.mutable_error()->set_err(0);
+  response.mutable_other()->PackFrom(r);
+  return response;
+}
+
 ADD_MODULE(ACL, "acl", "ACL module from NetBricks")
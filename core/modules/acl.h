@@ -1,44 +1,119 @@
 #ifndef BESS_MODULES_ACL_H_
 #define BESS_MODULES_ACL_H_
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include "../module.h"
 #include "../module_msg.pb.h"
+#include "../utils/bitmap_classifier.h"
+#include "../utils/flow_cache.h"
 #include "../utils/ip.h"
+#include "../worker.h"
 
 using bess::utils::IPAddress;
 using bess::utils::CIDRNetwork;
 
+// Rules are compiled into a classifier, which is rebuilt in the background
+// when they change. Packets are classified with the previous rules meanwhile.
+//
+// Rules for established connections read the "conn_state" attribute, set by
+// a Conntrack module upstream. It is only read if some of the rules given at
+// creation are such; rules added later cannot be, if none was.
+//
+// With cache_size, each worker has a FlowCache of the verdicts by the fields
+// of the packets, invalidated whenever a new classifier is published.
 class ACL final : public Module {
  public:
   struct ACLRule {
-    bool Match(IPAddress sip, IPAddress dip, uint16_t sport,
-               uint16_t dport) const {
-      return src_ip.Match(sip) && dst_ip.Match(dip) &&
-             (src_port == 0 || src_port == sport) &&
-             (dst_port == 0 || dst_port == dport);
-    }
-
     CIDRNetwork src_ip;
     CIDRNetwork dst_ip;
-    uint16_t src_port;
-    uint16_t dst_port;
+    uint16_t src_port;  // 0 for any
+    uint16_t dst_port;  // 0 for any
     bool established;
     bool drop;
   };
 
   static const Commands cmds;
 
+  ACL()
+      : Module(),
+        conn_state_(),
+        rules_lock_(),
+        rules_(),
+        version_(),
+        built_version_(),
+        building_(),
+        builder_(),
+        classifier_(nullptr),
+        cache_size_(),
+        caches_() {}
+
   pb_error_t Init(const bess::pb::ACLArg &arg);
+  void DeInit() override;
 
   void ProcessBatch(bess::PacketBatch *batch) override;
 
   pb_cmd_response_t CommandAdd(const bess::pb::ACLArg &arg);
   pb_cmd_response_t CommandClear(const bess::pb::EmptyArg &arg);
+  pb_cmd_response_t CommandGetCacheStats(const bess::pb::EmptyArg &arg);
 
  private:
+  // src IP, dst IP, src port, dst port (host order), and connection state
+  typedef bess::utils::BitmapClassifier<5> classifier_t;
+
+  // The compiled rules of a version, and whether each one drops
+  struct Compiled {
+    Compiled(const std::vector<ACLRule> &rules, uint64_t version);
+
+    classifier_t classifier;
+    std::vector<bool> drop;
+    uint64_t version;
+  };
+
+  // The fields of a packet, padded to a multiple of 8 bytes for FlowCache
+  struct alignas(8) CacheKey {
+    classifier_t::Values values;
+    uint32_t pad;
+  };
+
+  // Whether packets pass
+  typedef bess::utils::FlowCache<bool> flow_cache_t;
+
+  pb_error_t AddRules(const bess::pb::ACLArg &arg);
+
+  // Starts the builder thread, unless running
+  void StartBuilder();
+
+  // Builds the rules until the latest version is published
+  void BuildLoop();
+
+  // Whether a packet with the fields passes
+  static bool Pass(const Compiled *compiled, const CacheKey &key);
+
+  // As Pass(), for cnt packets, through the cache of the worker
+  void PassCached(const Compiled *compiled, const CacheKey *keys, int cnt,
+                  bool *pass);
+
+  // Whether the "conn_state" attribute is read
+  bool conn_state_;
+
+  // Guards the rules, their versions, and the builder thread
+  std::mutex rules_lock_;
   std::vector<ACLRule> rules_;
+  uint64_t version_;        // bumped whenever rules_ changes
+  uint64_t built_version_;  // of the published classifier
+  bool building_;
+  std::thread builder_;
+
+  // Read by workers without locks, freed with RCU once replaced
+  std::atomic<const Compiled *> classifier_;
+
+  uint64_t cache_size_;  // entries per worker, or 0 for no cache
+  std::unique_ptr<flow_cache_t> caches_[MAX_WORKERS];
 };
 
 #endif  // BESS_MODULES_ACL_H_
@@ -0,0 +1,161 @@
+#include "conntrack.h"
+
+#include "../utils/ether.h"
+#include "../utils/format.h"
+#include "../utils/icmp.h"
+#include "../utils/ip.h"
+#include "../utils/tcp.h"
+#include "../utils/udp.h"
+
+using bess::utils::ConnState;
+using bess::utils::ConnTracker;
+using bess::utils::ConnTuple;
+using bess::utils::EthHeader;
+using bess::utils::IcmpHeader;
+using bess::utils::Ipv4Header;
+using bess::utils::TcpHeader;
+using bess::utils::UdpHeader;
+
+enum {
+  ATTR_W_CONN_STATE,
+};
+
+const Commands Conntrack::cmds = {
+    {"get_summary", "EmptyArg",
+     MODULE_CMD_FUNC(&Conntrack::CommandGetSummary), 0},
+    {"clear", "EmptyArg", MODULE_CMD_FUNC(&Conntrack::CommandClear), 0},
+};
+
+pb_error_t Conntrack::Init(const bess::pb::ConntrackArg &arg) {
+  using AccessMode = bess::metadata::Attribute::AccessMode;
+
+  max_flows_ = arg.max_flows() ? arg.max_flows() : kDefaultMaxFlows;
+  AddMetadataAttr("conn_state", 1, AccessMode::kWrite);
+
+  return pb_errno(0);
+}
+
+// Returns false if the packet is not of a protocol that is tracked
+static bool ParseTuple(bess::Packet *pkt, ConnTuple *tuple,
+                       uint8_t *tcp_flags) {
+  EthHeader *eth = pkt->head_data<EthHeader *>();
+  Ipv4Header *ip = reinterpret_cast<Ipv4Header *>(eth + 1);
+
+  if (eth->ether_type.to_cpu() != 0x0800) {
+    return false;
+  }
+
+  // Only the first fragment has the L4 header
+  if (ntohs(ip->fragment_offset) & 0x1fff) {
+    return false;
+  }
+
+  void *l4 = reinterpret_cast<uint8_t *>(ip) + (ip->header_length << 2);
+
+  tuple->src_ip = ip->src;
+  tuple->dst_ip = ip->dst;
+  tuple->proto = ip->protocol;
+  *tcp_flags = 0;
+
+  switch (ip->protocol) {
+    case ConnTracker::kProtoTcp: {
+      TcpHeader *tcp = reinterpret_cast<TcpHeader *>(l4);
+      tuple->src_port = tcp->src_port;
+      tuple->dst_port = tcp->dst_port;
+      *tcp_flags = tcp->flags;
+      return true;
+    }
+    case ConnTracker::kProtoUdp: {
+      UdpHeader *udp = reinterpret_cast<UdpHeader *>(l4);
+      tuple->src_port = udp->src_port;
+      tuple->dst_port = udp->dst_port;
+      return true;
+    }
+    case ConnTracker::kProtoIcmp: {
+      IcmpHeader *icmp = reinterpret_cast<IcmpHeader *>(l4);
+      if (icmp->type != 8 && icmp->type != 0) {  // Echo request/reply
+        return false;
+      }
+      tuple->src_port = tuple->dst_port = icmp->ident;
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+void Conntrack::ProcessBatch(bess::PacketBatch *batch) {
+  std::unique_ptr<ConnTracker> &tracker = trackers_[ctx.wid()];
+  if (!tracker) {
+    tracker.reset(new ConnTracker(max_flows_));
+  }
+
+  int cnt = batch->cnt();
+  ConnTuple tuples[bess::PacketBatch::kMaxBurst];
+  uint8_t tcp_flags[bess::PacketBatch::kMaxBurst];
+  ConnState states[bess::PacketBatch::kMaxBurst];
+  int idx[bess::PacketBatch::kMaxBurst];  // of packets that are tracked
+  int n = 0;
+
+  for (int i = 0; i < cnt; i++) {
+    bess::Packet *pkt = batch->pkts()[i];
+
+    if (ParseTuple(pkt, &tuples[n], &tcp_flags[n])) {
+      idx[n++] = i;
+    } else {
+      set_attr<uint8_t>(this, ATTR_W_CONN_STATE, pkt,
+                        static_cast<uint8_t>(ConnState::kUntracked));
+    }
+  }
+
+  tracker->TrackBulk(tuples, tcp_flags, n, ctx.current_ns(), states);
+
+  for (int i = 0; i < n; i++) {
+    set_attr<uint8_t>(this, ATTR_W_CONN_STATE, batch->pkts()[idx[i]],
+                      static_cast<uint8_t>(states[i]));
+  }
+
+  RunNextModule(batch);
+}
+
+std::string Conntrack::GetDesc() const {
+  uint64_t count = 0;
+
+  for (const auto &tracker : trackers_) {
+    if (tracker) {
+      count += tracker->Count();
+    }
+  }
+  return bess::utils::Format("%lu connections", count);
+}
+
+pb_cmd_response_t Conntrack::CommandGetSummary(const bess::pb::EmptyArg &) {
+  bess::pb::ConntrackCommandGetSummaryResponse r;
+
+  for (const auto &tracker : trackers_) {
+    if (tracker) {
+      const ConnTracker::Stats &stats = tracker->stats();
+      r.set_flows(r.flows() + tracker->Count());
+      r.set_created(r.created() + stats.created);
+      r.set_expired(r.expired() + stats.expired);
+      r.set_invalid(r.invalid() + stats.invalid);
+      r.set_table_full(r.table_full() + stats.table_full);
+    }
+  }
+
+  pb_cmd_response_t response;
+  response.mutable_error()->set_err(0);
+  response.mutable_other()->PackFrom(r);
+  return response;
+}
+
+pb_cmd_response_t Conntrack::CommandClear(const bess::pb::EmptyArg &) {
+  for (auto &tracker : trackers_) {
+    if (tracker) {
+      tracker->Clear();
+    }
+  }
+  return pb_cmd_response_t();
+}
+
+ADD_MODULE(Conntrack, "conntrack", "tracks TCP, UDP, and ICMP connections")
@@ -0,0 +1,44 @@
+#ifndef BESS_MODULES_CONNTRACK_H_
+#define BESS_MODULES_CONNTRACK_H_
+
+#include <memory>
+#include <string>
+
+#include "../module.h"
+#include "../module_msg.pb.h"
+#include "../utils/conn_tracker.h"
+#include "../worker.h"
+
+// Stateful connection tracking for IPv4 TCP, UDP, and ICMP echo. Publishes the
+// state of the connection of each packet as the "conn_state" attribute (see
+// bess::utils::ConnState), e.g., for ACL rules that only admit established
+// connections. Packets are passed through unchanged.
+//
+// Each worker tracks connections on its own, without locks, so both
+// directions of a connection must be steered to the same worker (e.g., with
+// symmetric RSS or HashLB in l4_sym mode). The table of a worker, of max_flows
+// connections, is allocated on its first packet.
+class Conntrack final : public Module {
+ public:
+  static const Commands cmds;
+
+  // Default max_flows, per worker
+  static const uint64_t kDefaultMaxFlows = 1 << 20;
+
+  Conntrack() : Module(), max_flows_(), trackers_() {}
+
+  pb_error_t Init(const bess::pb::ConntrackArg &arg);
+
+  void ProcessBatch(bess::PacketBatch *batch) override;
+
+  std::string GetDesc() const override;
+
+  pb_cmd_response_t CommandGetSummary(const bess::pb::EmptyArg &arg);
+  pb_cmd_response_t CommandClear(const bess::pb::EmptyArg &arg);
+
+ private:
+  uint64_t max_flows_;
+  std::unique_ptr<bess::utils::ConnTracker> trackers_[MAX_WORKERS];
+};
+
+#endif  // BESS_MODULES_CONNTRACK_H_
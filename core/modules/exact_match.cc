@@ -5,6 +5,9 @@
 
 #include "../utils/endian.h"
 #include "../utils/format.h"
+#include "../utils/rcu.h"
+
+using bess::utils::Rcu;
 
 // XXX: this is repeated in many modules. get rid of them when converting .h to
 // .hh, etc... it's in defined in some old header
@@ -14,12 +17,14 @@ static inline int is_valid_gate(gate_idx_t gate) {
 
 const Commands ExactMatch::cmds = {
     {"add", "ExactMatchCommandAddArg", MODULE_CMD_FUNC(&ExactMatch::CommandAdd),
-     0},
+     1},
     {"delete", "ExactMatchCommandDeleteArg",
-     MODULE_CMD_FUNC(&ExactMatch::CommandDelete), 0},
-    {"clear", "EmptyArg", MODULE_CMD_FUNC(&ExactMatch::CommandClear), 0},
+     MODULE_CMD_FUNC(&ExactMatch::CommandDelete), 1},
+    {"clear", "EmptyArg", MODULE_CMD_FUNC(&ExactMatch::CommandClear), 1},
     {"set_default_gate", "ExactMatchCommandSetDefaultGateArg",
-     MODULE_CMD_FUNC(&ExactMatch::CommandSetDefaultGate), 1}};
+     MODULE_CMD_FUNC(&ExactMatch::CommandSetDefaultGate), 1},
+    {"update", "ExactMatchCommandUpdateArg",
+     MODULE_CMD_FUNC(&ExactMatch::CommandUpdate), 1}};
 
 pb_error_t ExactMatch::AddFieldOne(const bess::pb::ExactMatchArg_Field &field,
                                    struct EmField *f, int idx) {
@@ -48,8 +53,8 @@ pb_error_t ExactMatch::AddFieldOne(const bess::pb::ExactMatchArg_Field &field,
   int force_be = (f->attr_id < 0);
 
   if (field.mask() == 0) {
-    /* by default all bits are considered */
-    f->mask = ((uint64_t)1 << (f->size * 8)) - 1;
+    /* by default all bits are considered (shifting by 64 is undefined) */
+    f->mask = (f->size == 8) ? ~0ull : ((uint64_t)1 << (f->size * 8)) - 1;
   } else {
     if (uint64_to_bin((uint8_t *)&f->mask, f->size, field.mask(),
                       bess::utils::is_be_system() | force_be))
@@ -67,6 +72,10 @@ pb_error_t ExactMatch::AddFieldOne(const bess::pb::ExactMatchArg_Field &field,
 pb_error_t ExactMatch::Init(const bess::pb::ExactMatchArg &arg) {
   int size_acc = 0;
 
+  if (arg.fields_size() > MAX_FIELDS) {
+    return pb_error(EINVAL, "must have at most %d fields", MAX_FIELDS);
+  }
+
   for (auto i = 0; i < arg.fields_size(); ++i) {
     pb_error_t err;
     struct EmField *f = &fields_[i];
@@ -84,28 +93,33 @@ pb_error_t ExactMatch::Init(const bess::pb::ExactMatchArg &arg) {
   num_fields_ = arg.fields_size();
   total_key_size_ = align_ceil(size_acc, sizeof(uint64_t));
 
-  int ret = ht_.Init(total_key_size_, sizeof(gate_idx_t));
-  if (ret < 0) {
-    return pb_error(-ret, "hash table creation failed");
+  for (htable_t &table : tables_) {
+    int ret = table.Init(total_key_size_, sizeof(gate_idx_t));
+    if (ret < 0) {
+      return pb_error(-ret, "hash table creation failed");
+    }
   }
 
   return pb_errno(0);
 }
 
 void ExactMatch::DeInit() {
-  ht_.Close();
+  for (htable_t &table : tables_) {
+    table.Close();
+  }
 }
 
 void ExactMatch::ProcessBatch(bess::PacketBatch *batch) {
-  gate_idx_t default_gate;
   gate_idx_t out_gates[bess::PacketBatch::kMaxBurst];
 
   int key_size = total_key_size_;
-  char keys[bess::PacketBatch::kMaxBurst][HASH_KEY_SIZE] __ymm_aligned;
 
-  int cnt = batch->cnt();
+  // Each field is gathered with an 8-byte store, which may spill over the end
+  // of the last field into the room after the key
+  const int key_stride = HASH_KEY_SIZE + sizeof(uint64_t);
+  char keys[bess::PacketBatch::kMaxBurst][key_stride] __ymm_aligned;
 
-  default_gate = ACCESS_ONCE(default_gate_);
+  int cnt = batch->cnt();
 
   for (int i = 0; i < cnt; i++) {
     memset(&keys[i][key_size - 8], 0, sizeof(uint64_t));
@@ -125,7 +139,7 @@ void ExactMatch::ProcessBatch(bess::PacketBatch *batch) {
 
     char *key = keys[0] + pos;
 
-    for (int j = 0; j < cnt; j++, key += HASH_KEY_SIZE) {
+    for (int j = 0; j < cnt; j++, key += key_stride) {
       char *buf_addr = reinterpret_cast<char *>(batch->pkts()[j]->buffer());
 
       /* for offset-based attrs we use relative offset */
@@ -138,17 +152,36 @@ void ExactMatch::ProcessBatch(bess::PacketBatch *batch) {
     }
   }
 
+  const em_hkey_t *key_ptrs[bess::PacketBatch::kMaxBurst];
+
   for (int i = 0; i < cnt; i++) {
-    gate_idx_t *ret = static_cast<gate_idx_t *>(
-        ht_.Get(reinterpret_cast<em_hkey_t *>(keys[i])));
-    out_gates[i] = ret ? *ret : default_gate;
+    key_ptrs[i] = reinterpret_cast<em_hkey_t *>(keys[i]);
   }
 
+  Classify(key_ptrs, cnt, out_gates);
   RunSplit(out_gates, batch);
 }
 
+void ExactMatch::Classify(const em_hkey_t *const *keys, int cnt,
+                          gate_idx_t *out_gates) {
+  static_assert(bess::PacketBatch::kMaxBurst <= htable_t::kMaxBulk,
+                "a batch does not fit in a bulk lookup");
+  gate_idx_t *ret[bess::PacketBatch::kMaxBurst];
+
+  gate_idx_t default_gate = ACCESS_ONCE(default_gate_);
+
+  // The table stays valid until this worker is quiescent, even if swapped
+  const htable_t *ht = ht_.load(std::memory_order_acquire);
+  ht->GetBulk(keys, cnt, ret, nullptr);
+
+  for (int i = 0; i < cnt; i++) {
+    out_gates[i] = ret[i] ? *ret[i] : default_gate;
+  }
+}
+
 std::string ExactMatch::GetDesc() const {
-  return bess::utils::Format("%d fields, %d rules", num_fields_, ht_.Count());
+  return bess::utils::Format("%d fields, %d rules", num_fields_,
+                             ht_.load()->Count());
 }
 
 pb_error_t ExactMatch::GatherKey(const RepeatedPtrField<std::string> &fields,
@@ -203,7 +236,8 @@ pb_cmd_response_t ExactMatch::CommandAdd(
     return response;
   }
 
-  ret = ht_.Set(&key, &gate);
+  std::lock_guard<std::mutex> guard(ht_lock_);
+  ret = ApplyInPlace({RuleOp::kAdd, gate, key});
   if (ret) {
     set_cmd_response_error(&response, pb_error(-ret, "ht_set() failed"));
     return response;
@@ -233,7 +267,8 @@ pb_cmd_response_t ExactMatch::CommandDelete(
     return response;
   }
 
-  ret = ht_.Del(&key);
+  std::lock_guard<std::mutex> guard(ht_lock_);
+  ret = ApplyInPlace({RuleOp::kDelete, 0, key});
   if (ret < 0) {
     set_cmd_response_error(&response, pb_error(-ret, "ht_del() failed"));
     return response;
@@ -244,7 +279,10 @@ pb_cmd_response_t ExactMatch::CommandDelete(
 }
 
 pb_cmd_response_t ExactMatch::CommandClear(const bess::pb::EmptyArg &) {
-  ht_.Clear();
+  {
+    std::lock_guard<std::mutex> guard(ht_lock_);
+    ApplyInPlace({RuleOp::kClear, 0, em_hkey_t()});
+  }
 
   pb_cmd_response_t response;
   set_cmd_response_error(&response, pb_errno(0));
@@ -260,4 +298,130 @@ pb_cmd_response_t ExactMatch::CommandSetDefaultGate(
   return response;
 }
 
+pb_cmd_response_t ExactMatch::CommandUpdate(
+    const bess::pb::ExactMatchCommandUpdateArg &arg) {
+  pb_cmd_response_t response;
+  std::vector<RuleOp> ops;
+  pb_error_t err;
+
+  if (arg.clear()) {
+    ops.push_back({RuleOp::kClear, 0, em_hkey_t()});
+  }
+
+  for (int i = 0; i < arg.deletes_size(); i++) {
+    RuleOp op = {RuleOp::kDelete, 0, em_hkey_t()};
+    if ((err = GatherKey(arg.deletes(i).fields(), &op.key)).err() != 0) {
+      set_cmd_response_error(&response, err);
+      return response;
+    }
+    // Nothing is left to delete after a clear
+    if (!arg.clear()) {
+      ops.push_back(op);
+    }
+  }
+
+  for (int i = 0; i < arg.adds_size(); i++) {
+    RuleOp op = {RuleOp::kAdd, static_cast<gate_idx_t>(arg.adds(i).gate()),
+                 em_hkey_t()};
+    if (!is_valid_gate(op.gate)) {
+      set_cmd_response_error(
+          &response, pb_error(EINVAL, "adds[%d]: invalid gate: %hu", i,
+                              op.gate));
+      return response;
+    }
+    if ((err = GatherKey(arg.adds(i).fields(), &op.key)).err() != 0) {
+      set_cmd_response_error(&response, err);
+      return response;
+    }
+    ops.push_back(op);
+  }
+
+  std::lock_guard<std::mutex> guard(ht_lock_);
+
+  if (!SyncShadow(true)) {
+    set_cmd_response_error(&response,
+                           pb_error(ENOMEM, "shadow table creation failed"));
+    return response;
+  }
+
+  htable_t *shadow = shadow_table();
+  for (const RuleOp &op : ops) {
+    int ret = ApplyOp(shadow, op);
+    if (ret < 0) {
+      // The rules are unchanged, but the shadow has to be rebuilt
+      shadow_ready_ = false;
+      set_cmd_response_error(
+          &response,
+          pb_error(-ret, "%s failed, no rules changed",
+                   op.type == RuleOp::kAdd ? "ht_set()" : "ht_del()"));
+      return response;
+    }
+  }
+
+  ht_.store(shadow, std::memory_order_release);
+  shadow_token_ = Rcu::Retire();
+  pending_ = std::move(ops);
+
+  set_cmd_response_error(&response, pb_errno(0));
+  return response;
+}
+
+int ExactMatch::ApplyOp(htable_t *ht, const RuleOp &op) {
+  switch (op.type) {
+    case RuleOp::kAdd:
+      return ht->Set(&op.key, &op.gate);
+    case RuleOp::kDelete:
+      return ht->Del(&op.key);
+    default:
+      ht->Clear();
+      return 0;
+  }
+}
+
+int ExactMatch::ApplyInPlace(const RuleOp &op) {
+  int ret = ApplyOp(ht_.load(std::memory_order_relaxed), op);
+
+  if (ret >= 0 && shadow_ready_) {
+    pending_.push_back(op);
+    SyncShadow(false);
+  }
+  return ret;
+}
+
+bool ExactMatch::SyncShadow(bool wait) {
+  if (!Rcu::Expired(shadow_token_)) {
+    if (!wait) {
+      return false;
+    }
+    Rcu::Synchronize();
+  }
+
+  htable_t *shadow = shadow_table();
+
+  for (const RuleOp &op : pending_) {
+    if (!shadow_ready_ || ApplyOp(shadow, op) < 0) {
+      shadow_ready_ = false;
+      break;
+    }
+  }
+  pending_.clear();
+
+  if (!shadow_ready_) {
+    const htable_t *current = ht_.load(std::memory_order_relaxed);
+    uint32_t next = 0;
+    const void *key;
+
+    shadow->Clear();
+    while ((key = current->Iterate(&next))) {
+      const em_hkey_t *k = static_cast<const em_hkey_t *>(key);
+      if (shadow->Set(k, current->Get(k)) < 0) {
+        return false;
+      }
+    }
+    shadow_ready_ = true;
+  }
+
+  return true;
+}
+
 ADD_MODULE(ExactMatch, "em", "Multi-field classifier with an exact match table")
@@ -1,14 +1,16 @@
 #ifndef BESS_MODULES_EXACTMATCH_H_
 #define BESS_MODULES_EXACTMATCH_H_
 
-#include <rte_config.h>
-#include <rte_hash_crc.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
 
 #include "../module.h"
 #include "../module_msg.pb.h"
+#include "../utils/hash_key.h"
 #include "../utils/htable.h"
 
-#define MAX_FIELDS 8
+#define MAX_FIELDS 16
 #define MAX_FIELD_SIZE 8
 
 static_assert(MAX_FIELD_SIZE <= sizeof(uint64_t),
@@ -16,6 +18,9 @@ static_assert(MAX_FIELD_SIZE <= sizeof(uint64_t),
 
 #define HASH_KEY_SIZE (MAX_FIELDS * MAX_FIELD_SIZE)
 
+static_assert(HASH_KEY_SIZE <= bess::utils::kMaxHashKeySize,
+              "key cannot be larger than 128 bytes");
+
 #if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
 #error this code assumes little endian architecture (x86)
 #endif
@@ -27,74 +32,9 @@ struct em_hkey_t {
   uint64_t u64_arr[MAX_FIELDS];
 };
 
-inline int em_keycmp(const void *key, const void *key_stored, size_t key_len) {
-  const uint64_t *a = ((em_hkey_t *)key)->u64_arr;
-  const uint64_t *b = ((em_hkey_t *)key_stored)->u64_arr;
-
-  switch (key_len >> 3) {
-    default:
-      promise_unreachable();
-    case 8:
-      if (unlikely(a[7] != b[7]))
-        return 1;
-    case 7:
-      if (unlikely(a[6] != b[6]))
-        return 1;
-    case 6:
-      if (unlikely(a[5] != b[5]))
-        return 1;
-    case 5:
-      if (unlikely(a[4] != b[4]))
-        return 1;
-    case 4:
-      if (unlikely(a[3] != b[3]))
-        return 1;
-    case 3:
-      if (unlikely(a[2] != b[2]))
-        return 1;
-    case 2:
-      if (unlikely(a[1] != b[1]))
-        return 1;
-    case 1:
-      if (unlikely(a[0] != b[0]))
-        return 1;
-  }
-
-  return 0;
-}
-
-inline uint32_t em_hash(const void *key, uint32_t key_len, uint32_t init_val) {
-#if __SSE4_2__ && __x86_64
-  const uint64_t *a = ((em_hkey_t *)key)->u64_arr;
-
-  switch (key_len >> 3) {
-    default:
-      promise_unreachable();
-    case 8:
-      init_val = crc32c_sse42_u64(*a++, init_val);
-    case 7:
-      init_val = crc32c_sse42_u64(*a++, init_val);
-    case 6:
-      init_val = crc32c_sse42_u64(*a++, init_val);
-    case 5:
-      init_val = crc32c_sse42_u64(*a++, init_val);
-    case 4:
-      init_val = crc32c_sse42_u64(*a++, init_val);
-    case 3:
-      init_val = crc32c_sse42_u64(*a++, init_val);
-    case 2:
-      init_val = crc32c_sse42_u64(*a++, init_val);
-    case 1:
-      init_val = crc32c_sse42_u64(*a++, init_val);
-  }
-
-  return init_val;
-#else
-  return rte_hash_crc(key, key_len, init_val);
-#endif
-}
-
-typedef HTable<em_hkey_t, gate_idx_t, em_keycmp, em_hash> htable_t;
+typedef HTable<em_hkey_t, gate_idx_t, bess::utils::HashKeyCmp,
+               bess::utils::HashKeyHash>
+    htable_t;
 
 struct EmField {
   /* bits with 1: the bit must be considered.
@@ -124,7 +64,11 @@ class ExactMatch final : public Module {
         total_key_size_(),
         num_fields_(),
         fields_(),
-        ht_() {}
+        tables_(),
+        ht_(&tables_[0]),
+        shadow_ready_(),
+        shadow_token_(),
+        pending_() {}
 
   void DeInit() override;
 
@@ -132,6 +76,10 @@ class ExactMatch final : public Module {
 
   std::string GetDesc() const override;
 
+  // Sets out_gates[i] to the gate of the rule of keys[i] (or to the default
+  // gate), with cnt <= kMaxBurst
+  void Classify(const em_hkey_t *const *keys, int cnt, gate_idx_t *out_gates);
+
   pb_error_t Init(const bess::pb::ExactMatchArg &arg);
   pb_cmd_response_t CommandAdd(const bess::pb::ExactMatchCommandAddArg &arg);
   pb_cmd_response_t CommandDelete(
@@ -139,8 +87,31 @@ class ExactMatch final : public Module {
   pb_cmd_response_t CommandClear(const bess::pb::EmptyArg &arg);
   pb_cmd_response_t CommandSetDefaultGate(
       const bess::pb::ExactMatchCommandSetDefaultGateArg &arg);
+  pb_cmd_response_t CommandUpdate(
+      const bess::pb::ExactMatchCommandUpdateArg &arg);
 
  private:
+  // A change of the rules, kept to be replayed on the shadow table
+  struct RuleOp {
+    enum Type { kAdd, kDelete, kClear } type;
+    gate_idx_t gate;
+    em_hkey_t key;
+  };
+
+  static int ApplyOp(htable_t *ht, const RuleOp &op);
+
+  // Updates the table that workers look up in place, and then the shadow
+  int ApplyInPlace(const RuleOp &op);
+
+  // Brings the shadow table up to date with the current one, unless some
+  // worker may still be reading it and wait is false. Returns whether the
+  // shadow is up to date (fails only if out of memory).
+  bool SyncShadow(bool wait);
+
+  htable_t *shadow_table() {
+    return &tables_[ht_.load(std::memory_order_relaxed) == &tables_[0]];
+  }
+
   pb_error_t AddFieldOne(const bess::pb::ExactMatchArg_Field &field,
                          struct EmField *f, int idx);
   pb_error_t GatherKey(const RepeatedPtrField<std::string> &fields,
@@ -153,7 +124,23 @@ class ExactMatch final : public Module {
   int num_fields_;
   EmField fields_[MAX_FIELDS];
 
-  htable_t ht_;
+  // Workers look up *ht_ without locking, while commands may update it at
+  // any time. This only serializes the commands.
+  std::mutex ht_lock_;
+
+  // Single changes are made to *ht_ in place. The update command makes its
+  // changes to the other table (the shadow), and then swaps them atomically.
+  // Once no worker reads the old table anymore, it becomes the shadow, and
+  // the changes are replayed on it. There is no shadow until the first update.
+  htable_t tables_[2];
+  std::atomic<htable_t *> ht_;
+  bool shadow_ready_;
+
+  // RCU token of the last swap
+  uint64_t shadow_token_;
+
+  // Changes to *ht_ that the shadow lacks
+  std::vector<RuleOp> pending_;
 };
 
 #endif  // BESS_MODULES_EXACTMATCH_H_
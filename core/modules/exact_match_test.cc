@@ -0,0 +1,291 @@
+#include "exact_match.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "../utils/random.h"
+#include "../utils/rcu.h"
+
+using bess::utils::Rcu;
+
+namespace {
+
+// A single 4-byte field
+class ExactMatchTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    bess::pb::ExactMatchArg arg;
+    auto *field = arg.add_fields();
+    field->set_offset(0);
+    field->set_size(4);
+
+    em_.reset(new ExactMatch());
+    ASSERT_EQ(0, em_->Init(arg).err());
+  }
+
+  virtual void TearDown() {
+    em_->DeInit();
+    Rcu::Synchronize();
+  }
+
+  static em_hkey_t make_key(uint32_t v) {
+    em_hkey_t key = {};
+    key.u64_arr[0] = v;
+    return key;
+  }
+
+  static std::string field(uint32_t v) {
+    return std::string(reinterpret_cast<const char *>(&v), sizeof(v));
+  }
+
+  static void add_rule(bess::pb::ExactMatchCommandUpdateArg *arg, uint32_t v,
+                       gate_idx_t gate) {
+    auto *add = arg->add_adds();
+    add->set_gate(gate);
+    add->add_fields(field(v));
+  }
+
+  static void delete_rule(bess::pb::ExactMatchCommandUpdateArg *arg,
+                          uint32_t v) {
+    arg->add_deletes()->add_fields(field(v));
+  }
+
+  gate_idx_t Classify(uint32_t v) {
+    em_hkey_t key = make_key(v);
+    const em_hkey_t *key_ptr = &key;
+    gate_idx_t gate;
+
+    em_->Classify(&key_ptr, 1, &gate);
+    return gate;
+  }
+
+  std::unique_ptr<ExactMatch> em_;
+};
+
+TEST_F(ExactMatchTest, Update) {
+  bess::pb::ExactMatchCommandUpdateArg arg;
+  add_rule(&arg, 1, 1);
+  add_rule(&arg, 2, 2);
+  ASSERT_EQ(0, em_->CommandUpdate(arg).error().err());
+  EXPECT_EQ(1, Classify(1));
+  EXPECT_EQ(2, Classify(2));
+  EXPECT_EQ(DROP_GATE, Classify(3));
+
+  // Deletes come before adds
+  arg.Clear();
+  delete_rule(&arg, 1);
+  delete_rule(&arg, 2);
+  add_rule(&arg, 2, 3);
+  ASSERT_EQ(0, em_->CommandUpdate(arg).error().err());
+  EXPECT_EQ(DROP_GATE, Classify(1));
+  EXPECT_EQ(3, Classify(2));
+
+  // A single change made in place must reach the shadow too
+  bess::pb::ExactMatchCommandAddArg single;
+  single.set_gate(4);
+  single.add_fields(field(4));
+  ASSERT_EQ(0, em_->CommandAdd(single).error().err());
+  EXPECT_EQ(4, Classify(4));
+
+  arg.Clear();
+  add_rule(&arg, 5, 5);
+  ASSERT_EQ(0, em_->CommandUpdate(arg).error().err());
+  EXPECT_EQ(3, Classify(2));
+  EXPECT_EQ(4, Classify(4));
+  EXPECT_EQ(5, Classify(5));
+
+  // Nothing changes if any of the changes fails
+  arg.Clear();
+  add_rule(&arg, 6, 6);
+  delete_rule(&arg, 1);
+  EXPECT_EQ(ENOENT, em_->CommandUpdate(arg).error().err());
+  EXPECT_EQ(DROP_GATE, Classify(6));
+  EXPECT_EQ(5, Classify(5));
+
+  arg.Clear();
+  arg.set_clear(true);
+  add_rule(&arg, 7, 7);
+  ASSERT_EQ(0, em_->CommandUpdate(arg).error().err());
+  EXPECT_EQ(DROP_GATE, Classify(2));
+  EXPECT_EQ(DROP_GATE, Classify(4));
+  EXPECT_EQ(DROP_GATE, Classify(5));
+  EXPECT_EQ(7, Classify(7));
+
+  arg.Clear();
+  add_rule(&arg, 8, 8);
+  ASSERT_EQ(0, em_->CommandUpdate(arg).error().err());
+  EXPECT_EQ(DROP_GATE, Classify(5));
+  EXPECT_EQ(7, Classify(7));
+  EXPECT_EQ(8, Classify(8));
+
+  // Deletes are no-ops after a clear, not missing rules
+  arg.Clear();
+  arg.set_clear(true);
+  delete_rule(&arg, 7);
+  delete_rule(&arg, 9);
+  add_rule(&arg, 9, 9);
+  ASSERT_EQ(0, em_->CommandUpdate(arg).error().err());
+  EXPECT_EQ(DROP_GATE, Classify(7));
+  EXPECT_EQ(DROP_GATE, Classify(8));
+  EXPECT_EQ(9, Classify(9));
+}
+
+// Streams 1M rule changes while a worker classifies packets of a stable set
+// of flows. Each update moves half of them to other gates by deleting and
+// adding their rules again, so no packet may miss if updates are atomic.
+TEST_F(ExactMatchTest, HitlessUpdates) {
+  const uint32_t kStable = 1000;
+  const int kChangesPerUpdate = 1000;
+  const int kNumChanges = 1000000;
+
+  bess::pb::ExactMatchCommandUpdateArg arg;
+  for (uint32_t i = 0; i < kStable; i++) {
+    add_rule(&arg, i, 0);
+  }
+  ASSERT_EQ(0, em_->CommandUpdate(arg).error().err());
+
+  std::atomic<bool> stop(false);
+  std::atomic<uint64_t> packets(0);
+  std::atomic<uint64_t> lost(0);
+
+  std::thread worker([&]() {
+    const int burst = bess::PacketBatch::kMaxBurst;
+    em_hkey_t keys[burst];
+    const em_hkey_t *key_ptrs[burst];
+    gate_idx_t out_gates[burst];
+    Random rng;
+    uint64_t n = 0;
+
+    Rcu::RegisterThread();
+    while (!stop.load(std::memory_order_relaxed)) {
+      for (int i = 0; i < burst; i++) {
+        keys[i] = make_key(rng.GetRange(kStable));
+        key_ptrs[i] = &keys[i];
+      }
+
+      em_->Classify(key_ptrs, burst, out_gates);
+      for (int i = 0; i < burst; i++) {
+        if (out_gates[i] == DROP_GATE) {
+          lost++;
+        }
+      }
+
+      n += burst;
+      Rcu::Quiescent();
+    }
+
+    packets += n;
+    Rcu::UnregisterThread();
+  });
+
+  Random rng;
+  for (int changes = 0; changes < kNumChanges;
+       changes += kChangesPerUpdate) {
+    gate_idx_t gate = changes / kChangesPerUpdate % MAX_GATES;
+
+    // Distinct flows, as each can only be deleted once
+    uint32_t first = rng.GetRange(kStable);
+    arg.Clear();
+    for (int i = 0; i < kChangesPerUpdate / 2; i++) {
+      uint32_t v = (first + i) % kStable;
+      delete_rule(&arg, v);
+      add_rule(&arg, v, gate);
+    }
+
+    int err = em_->CommandUpdate(arg).error().err();
+    EXPECT_EQ(0, err);
+    if (err) {
+      break;
+    }
+  }
+
+  stop = true;
+  worker.join();
+
+  EXPECT_LT(0, packets);
+  EXPECT_EQ(0, lost);
+}
+
+// A key of num_fields 8-byte fields, which differs from others in each
+static em_hkey_t make_large_key(int num_fields, uint64_t v) {
+  em_hkey_t key = {};
+  for (int i = 0; i < num_fields; i++) {
+    key.u64_arr[i] = v * (i + 1);
+  }
+  return key;
+}
+
+static void set_large_fields(
+    int num_fields, uint64_t v,
+    google::protobuf::RepeatedPtrField<std::string> *fields) {
+  em_hkey_t key = make_large_key(num_fields, v);
+  for (int i = 0; i < num_fields; i++) {
+    fields->Add()->assign(reinterpret_cast<const char *>(&key.u64_arr[i]),
+                          sizeof(uint64_t));
+  }
+}
+
+// Keys of 32 bytes or more, which HashKeyHash() hashes otherwise than the
+// default hash of HTable: rules must be added and looked up with the same
+TEST(ExactMatchLargeKeyTest, AddDelete) {
+  const int burst = bess::PacketBatch::kMaxBurst;
+  const int kNumRules = 1000;
+
+  // 32, 40, 64 and 128-byte keys
+  for (int num_fields : {4, 5, 8, MAX_FIELDS}) {
+    bess::pb::ExactMatchArg init_arg;
+    for (int i = 0; i < num_fields; i++) {
+      auto *field = init_arg.add_fields();
+      field->set_offset(i * 8);
+      field->set_size(8);
+    }
+
+    ExactMatch em;
+    ASSERT_EQ(0, em.Init(init_arg).err());
+
+    for (int i = 0; i < kNumRules; i++) {
+      bess::pb::ExactMatchCommandAddArg arg;
+      arg.set_gate(i);
+      set_large_fields(num_fields, i + 1, arg.mutable_fields());
+      ASSERT_EQ(0, em.CommandAdd(arg).error().err());
+    }
+
+    for (int i = 0; i < kNumRules * 2; i += burst) {
+      em_hkey_t keys[burst];
+      const em_hkey_t *key_ptrs[burst];
+      gate_idx_t gates[burst];
+
+      for (int j = 0; j < burst; j++) {
+        keys[j] = make_large_key(num_fields, i + j + 1);
+        key_ptrs[j] = &keys[j];
+      }
+      em.Classify(key_ptrs, burst, gates);
+
+      for (int j = 0; j < burst; j++) {
+        EXPECT_EQ((i + j < kNumRules) ? i + j : DROP_GATE, gates[j])
+            << num_fields * 8 << "-byte keys";
+      }
+    }
+
+    for (int i = 0; i < kNumRules; i++) {
+      bess::pb::ExactMatchCommandDeleteArg arg;
+      set_large_fields(num_fields, i + 1, arg.mutable_fields());
+      ASSERT_EQ(0, em.CommandDelete(arg).error().err());
+    }
+
+    em_hkey_t key = make_large_key(num_fields, 1);
+    const em_hkey_t *key_ptr = &key;
+    gate_idx_t gate;
+    em.Classify(&key_ptr, 1, &gate);
+    EXPECT_EQ(DROP_GATE, gate);
+
+    em.DeInit();
+    Rcu::Synchronize();
+  }
+}
+
+}  // namespace (unnamed)
@@ -82,7 +82,8 @@ inline struct flow *FlowGen::ScheduleFlow(uint64_t time_ns) {
   struct flow *f;
 
   if (flows_free_.empty()) {
-    f = new flow();
+    f = static_cast<struct flow *>(bess::memory::Alloc(
+        sizeof(*f), alignof(struct flow), -1, flow_alloc_.owner()));
     if (!f)
       return nullptr;
   } else {
@@ -391,9 +392,13 @@ pb_error_t FlowGen::Init(const bess::pb::FlowGenArg &arg) {
 
 void FlowGen::DeInit() {
   while (!flows_free_.empty()) {
-    delete flows_free_.top();
+    flow_alloc_.deallocate(flows_free_.top(), 1);
     flows_free_.pop();
   }
+  while (!events_.empty()) {
+    flow_alloc_.deallocate(events_.top().second, 1);
+    events_.pop();
+  }
 
   delete templ_;
 }
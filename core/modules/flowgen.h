@@ -4,6 +4,7 @@
 #include <queue>
 #include <stack>
 
+#include "../mem_alloc.h"
 #include "../module.h"
 #include "../module_msg.pb.h"
 #include "../utils/random.h"
@@ -41,6 +42,7 @@ class FlowGen final : public Module {
         active_flows_(),
         generated_flows_(),
         flows_free_(),
+        flow_alloc_(),
         events_(),
         templ_(),
         template_size_(),
@@ -88,6 +90,8 @@ class FlowGen final : public Module {
   uint64_t generated_flows_;
   // pool of free flow structs. LIFO for temporal locality.
   std::stack<struct flow *> flows_free_;
+  // flow structs are charged to this module, even if allocated by workers
+  bess::memory::Allocator<struct flow> flow_alloc_;
 
   // Priority queue of future events
   EventQueue events_;
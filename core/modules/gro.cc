@@ -0,0 +1,299 @@
+#include "gro.h"
+
+#include <netinet/in.h>
+
+#include <cstring>
+
+#include "../utils/checksum.h"
+#include "../utils/ether.h"
+#include "../utils/format.h"
+#include "../utils/ip.h"
+#include "../utils/tcp.h"
+#include "../utils/time.h"
+
+using bess::utils::EthHeader;
+using bess::utils::Ipv4Header;
+using bess::utils::TcpHeader;
+using bess::utils::ChecksumFinish;
+using bess::utils::ChecksumPartial;
+using bess::utils::ChecksumSwap;
+using bess::utils::PseudoHeaderSum;
+
+static_assert(GRO::kMaxFlows == 64, "FlowIndex() returns 6 bits");
+
+static const uint32_t kDefaultMaxSegs = 32;
+static const uint32_t kMaxSegs = 255;    // rte_mbuf.nb_segs is 8 bits
+static const uint32_t kMaxSize = 65535;  // Ipv4Header.length is 16 bits
+
+// Only pure ACKs, possibly with PSH, are merged. PSH ends a merged packet.
+static const uint8_t kMergeableFlags = TCP_FLAG_ACK | TCP_FLAG_PUSH;
+
+const Commands GRO::cmds = {};
+
+pb_error_t GRO::Init(const bess::pb::GROArg &arg) {
+  max_segs_ = arg.max_segs() ? arg.max_segs() : kDefaultMaxSegs;
+  if (max_segs_ < 2 || max_segs_ > kMaxSegs) {
+    return pb_error(EINVAL, "'max_segs' must be [2, %u]", kMaxSegs);
+  }
+
+  max_size_ = arg.max_size() ? arg.max_size() : kMaxSize;
+  if (max_size_ > kMaxSize) {
+    return pb_error(EINVAL, "'max_size' must be <= %u", kMaxSize);
+  }
+
+  verify_checksum_ = !arg.trust_checksum();
+
+  timeout_ = arg.timeout_ns() * tsc_hz / 1000000000;
+  if (timeout_) {
+    if (RegisterTask(nullptr) == INVALID_TASK_ID) {
+      return pb_error(ENOMEM, "Task creation failed");
+    }
+  }
+
+  return pb_errno(0);
+}
+
+void GRO::DeInit() {
+  for (int i = 0; i < kMaxFlows; i++) {
+    if (active_ & (1ULL << i)) {
+      bess::Packet::Free(flows_[i].head);
+    }
+  }
+  active_ = 0;
+}
+
+std::string GRO::GetDesc() const {
+  return bess::utils::Format("%lu segs -> %lu pkts", pkts_in_, pkts_out_);
+}
+
+bool GRO::Parse(bess::Packet *pkt, Segment *seg) const {
+  EthHeader *eth = pkt->head_data<EthHeader *>();
+  Ipv4Header *ip = reinterpret_cast<Ipv4Header *>(eth + 1);
+
+  if (eth->ether_type.to_cpu() != 0x0800 || ip->protocol != IPPROTO_TCP) {
+    return false;
+  }
+
+  uint32_t ip_bytes = ip->header_length << 2;
+  TcpHeader *tcp = reinterpret_cast<TcpHeader *>(
+      reinterpret_cast<uint8_t *>(ip) + ip_bytes);
+  uint32_t tcp_bytes = tcp->offset << 2;
+  uint32_t ip_len = ntohs(ip->length);
+
+  seg->flow.src_ip = ip->src;
+  seg->flow.dst_ip = ip->dst;
+  seg->flow.src_port = tcp->src_port;
+  seg->flow.dst_port = tcp->dst_port;
+  seg->seq = ntohl(tcp->seq_num);
+  seg->hdr_len = sizeof(*eth) + ip_bytes + tcp_bytes;
+  seg->payload_len = 0;
+  seg->payload_sum = 0;
+  seg->flags = tcp->flags;
+  seg->mergeable = false;
+
+  // No IP options or fragments, headers and payload in the first segment
+  if (ip_bytes != sizeof(*ip) || (ntohs(ip->fragment_offset) & 0x3fff) ||
+      (tcp->flags & ~kMergeableFlags) || !(tcp->flags & TCP_FLAG_ACK) ||
+      ip_len <= ip_bytes + tcp_bytes ||
+      sizeof(*eth) + ip_len > static_cast<uint32_t>(pkt->head_len()) ||
+      !pkt->is_simple()) {
+    return true;
+  }
+
+  seg->payload_len = ip_len - ip_bytes - tcp_bytes;
+  seg->payload_sum = ChecksumPartial(
+      pkt->head_data<uint8_t *>() + seg->hdr_len, seg->payload_len);
+
+  if (!verify_checksum_) {
+    seg->mergeable = true;
+    return true;
+  }
+
+  // Merging recomputes the checksum, so make sure we do not turn a corrupted
+  // segment into a valid one. The payload sum is needed anyway.
+  uint32_t sum = PseudoHeaderSum(ip->src, ip->dst, IPPROTO_TCP,
+                                 tcp_bytes + seg->payload_len) +
+                 ChecksumPartial(tcp, tcp_bytes) + seg->payload_sum;
+  seg->mergeable = (ChecksumFinish(sum) == 0);
+  return true;
+}
+
+bool GRO::CanMerge(const Context *c, bess::Packet *pkt,
+                   const Segment &seg) const {
+  if (!seg.mergeable || seg.seq != c->next_seq || seg.hdr_len != c->hdr_len ||
+      c->head->nb_segs() >= static_cast<int>(max_segs_) ||
+      c->hdr_len - sizeof(EthHeader) + c->payload_len + seg.payload_len >
+          max_size_) {
+    return false;
+  }
+
+  const Ipv4Header *ip = pkt->head_data<Ipv4Header *>(sizeof(EthHeader));
+  const Ipv4Header *head_ip =
+      c->head->head_data<Ipv4Header *>(sizeof(EthHeader));
+  if (ip->type_of_service != head_ip->type_of_service ||
+      ip->ttl != head_ip->ttl) {
+    return false;
+  }
+
+  const TcpHeader *tcp = reinterpret_cast<const TcpHeader *>(ip + 1);
+  const TcpHeader *head_tcp = reinterpret_cast<const TcpHeader *>(head_ip + 1);
+
+  // Same ACK and same options (e.g., timestamps), as Linux does
+  return tcp->ack_num == head_tcp->ack_num &&
+         memcmp(tcp + 1, head_tcp + 1,
+                c->hdr_len - sizeof(EthHeader) - sizeof(Ipv4Header) -
+                    sizeof(TcpHeader)) == 0;
+}
+
+void GRO::Start(Context *c, bess::Packet *pkt, const Segment &seg,
+                uint64_t now) {
+  c->flow = seg.flow;
+  c->head = pkt;
+  c->tail = pkt;
+  c->next_seq = seg.seq + seg.payload_len;
+  c->hdr_len = seg.hdr_len;
+  c->payload_len = seg.payload_len;
+  c->payload_sum = seg.payload_sum;
+  c->deadline = now + timeout_;
+
+  // Drop the Ethernet padding, if any, so that it is not chained
+  pkt->trim(pkt->head_len() - seg.hdr_len - seg.payload_len);
+}
+
+void GRO::Merge(Context *c, bess::Packet *pkt, const Segment &seg) {
+  bess::Packet *head = c->head;
+  TcpHeader *head_tcp = head->head_data<TcpHeader *>(sizeof(EthHeader) +
+                                                      sizeof(Ipv4Header));
+  const TcpHeader *tcp =
+      pkt->head_data<TcpHeader *>(sizeof(EthHeader) + sizeof(Ipv4Header));
+
+  // The receiver sees the latest window and the PSH flag of any segment
+  head_tcp->window = tcp->window;
+  head_tcp->flags |= tcp->flags;
+
+  // Sums of data at odd offsets of the TCP payload are byte-swapped
+  c->payload_sum += (c->payload_len & 1) ? ChecksumSwap(seg.payload_sum)
+                                         : seg.payload_sum;
+  c->payload_len += seg.payload_len;
+  c->next_seq += seg.payload_len;
+
+  pkt->adj(seg.hdr_len);
+  pkt->trim(pkt->head_len() - seg.payload_len);
+  c->tail->set_next(pkt);
+  c->tail = pkt;
+
+  head->set_nb_segs(head->nb_segs() + 1);
+  head->set_total_len(head->total_len() + seg.payload_len);
+}
+
+void GRO::Flush(int idx, bess::PacketBatch *out) {
+  Context *c = &flows_[idx];
+  bess::Packet *head = c->head;
+
+  active_ &= ~(1ULL << idx);
+
+  if (head->nb_segs() > 1) {
+    Ipv4Header *ip = head->head_data<Ipv4Header *>(sizeof(EthHeader));
+    TcpHeader *tcp = reinterpret_cast<TcpHeader *>(ip + 1);
+    uint16_t tcp_bytes = c->hdr_len - sizeof(EthHeader) - sizeof(*ip);
+
+    ip->length = htons(sizeof(*ip) + tcp_bytes + c->payload_len);
+    ip->checksum = 0;
+    ip->checksum = ChecksumFinish(ChecksumPartial(ip, sizeof(*ip)));
+
+    tcp->checksum = 0;
+    tcp->checksum = ChecksumFinish(
+        PseudoHeaderSum(ip->src, ip->dst, IPPROTO_TCP,
+                        tcp_bytes + c->payload_len) +
+        ChecksumPartial(tcp, tcp_bytes) + c->payload_sum);
+  }
+
+  Emit(head, out);
+}
+
+void GRO::FlushExpired(uint64_t now, bess::PacketBatch *out) {
+  uint64_t active = active_;
+
+  while (active) {
+    int idx = __builtin_ctzll(active);
+    active &= active - 1;
+    if (flows_[idx].deadline <= now) {
+      Flush(idx, out);
+    }
+  }
+}
+
+void GRO::ProcessBatch(bess::PacketBatch *batch) {
+  bess::PacketBatch out;
+  uint64_t now = timeout_ ? rdtsc() : 0;
+  int cnt = batch->cnt();
+
+  out.clear();
+  pkts_in_ += cnt;
+
+  for (int i = 0; i < cnt; i++) {
+    bess::Packet *pkt = batch->pkts()[i];
+    Segment seg;
+
+    if (!Parse(pkt, &seg)) {
+      Emit(pkt, &out);
+      continue;
+    }
+
+    int idx = FlowIndex(seg.flow);
+    Context *c = &flows_[idx];
+    bool active = active_ & (1ULL << idx);
+
+    if (active && c->flow == seg.flow) {
+      if (CanMerge(c, pkt, seg)) {
+        Merge(c, pkt, seg);
+        if (seg.flags & TCP_FLAG_PUSH) {
+          Flush(idx, &out);
+        }
+        continue;
+      }
+      // Keep the order within the flow
+      Flush(idx, &out);
+    } else if (active && seg.mergeable) {
+      // Another flow hashed to the same slot: evict it
+      Flush(idx, &out);
+    }
+
+    if (seg.mergeable && !(seg.flags & TCP_FLAG_PUSH)) {
+      Start(c, pkt, seg, now);
+      active_ |= 1ULL << idx;
+    } else {
+      Emit(pkt, &out);
+    }
+  }
+
+  // Without a timeout, nothing is held across batches
+  FlushExpired(timeout_ ? now : UINT64_MAX, &out);
+
+  if (!out.empty()) {
+    RunNextModule(&out);
+  }
+}
+
+/* flushes idle flows when segments are held across batches */
+struct task_result GRO::RunTask(void *) {
+  bess::PacketBatch out;
+  uint64_t pkts = pkts_out_;
+  uint64_t bytes = bytes_out_;
+
+  if (!active_) {
+    return (struct task_result){.packets = 0, .bits = 0};
+  }
+
+  out.clear();
+  FlushExpired(rdtsc(), &out);
+  if (!out.empty()) {
+    RunNextModule(&out);
+  }
+
+  return (struct task_result){
+      .packets = pkts_out_ - pkts, .bits = (bytes_out_ - bytes) * 8,
+  };
+}
+
+ADD_MODULE(GRO, "gro", "merges TCP segments into multi-segment packets")
@@ -0,0 +1,133 @@
+#ifndef BESS_MODULES_GRO_H_
+#define BESS_MODULES_GRO_H_
+
+#include <string>
+
+#include "../module.h"
+#include "../module_msg.pb.h"
+#include "../pktbatch.h"
+
+// Generic receive offload for TCP over IPv4. In-order segments of the same
+// flow are merged into one multi-segment packet: the first segment keeps its
+// headers, the following ones are chained after it with their headers
+// stripped, and the IP length and the IP/TCP checksums are fixed up. Stages
+// after GRO (e.g., UrlFilter or a VPort to a container) then pay their
+// per-packet costs once per merged packet.
+//
+// Segments are held until the end of the batch, or for at most timeout_ns
+// across batches if it is set (the module task must be attached to flush idle
+// flows then). Packets that cannot be merged are passed through, after
+// flushing their flow so that the order within a flow is kept. Since the
+// checksums of merged packets are recomputed, segments with a bad checksum are
+// not merged, unless trust_checksum is set (e.g., the checksums of packets
+// from a VPort with offloads may be left to the NIC). Downstream modules and
+// ports must accept multi-segment packets.
+class GRO final : public Module {
+ public:
+  static const Commands cmds;
+
+  // Flows being merged at a time; must fit in the bitmask of active flows
+  static const int kMaxFlows = 64;
+
+  GRO()
+      : Module(),
+        timeout_(),
+        max_segs_(),
+        max_size_(),
+        verify_checksum_(),
+        active_(),
+        flows_(),
+        pkts_in_(),
+        pkts_out_(),
+        bytes_out_() {}
+
+  pb_error_t Init(const bess::pb::GROArg &arg);
+
+  void DeInit() override;
+
+  struct task_result RunTask(void *arg) override;
+  void ProcessBatch(bess::PacketBatch *batch) override;
+
+  std::string GetDesc() const override;
+
+ private:
+  struct Flow {
+    uint32_t src_ip;
+    uint32_t dst_ip;
+    uint16_t src_port;
+    uint16_t dst_port;
+
+    bool operator==(const Flow &o) const {
+      return src_ip == o.src_ip && dst_ip == o.dst_ip &&
+             src_port == o.src_port && dst_port == o.dst_port;
+    }
+  };
+
+  // A parsed TCP segment
+  struct Segment {
+    Flow flow;
+    uint32_t seq;          // host order
+    uint16_t hdr_len;      // Ethernet + IP + TCP headers
+    uint16_t payload_len;
+    uint32_t payload_sum;  // partial checksum of the payload
+    uint8_t flags;         // TCP flags
+    bool mergeable;
+  };
+
+  // A flow being merged
+  struct Context {
+    Flow flow;
+    bess::Packet *head;  // carries the headers
+    bess::Packet *tail;  // last segment of the chain
+    uint32_t next_seq;   // host order
+    uint16_t hdr_len;
+    uint32_t payload_len;
+    uint32_t payload_sum;
+    uint64_t deadline;  // TSC
+  };
+
+  // Returns false if pkt is not a TCP/IPv4 packet
+  bool Parse(bess::Packet *pkt, Segment *seg) const;
+
+  bool CanMerge(const Context *c, bess::Packet *pkt,
+                const Segment &seg) const;
+
+  void Start(Context *c, bess::Packet *pkt, const Segment &seg, uint64_t now);
+  void Merge(Context *c, bess::Packet *pkt, const Segment &seg);
+
+  // Fixes up the headers of the merged packet and sends it to out
+  void Flush(int idx, bess::PacketBatch *out);
+
+  // Flushes the flows whose deadline is before now (all if now is -1)
+  void FlushExpired(uint64_t now, bess::PacketBatch *out);
+
+  void Emit(bess::Packet *pkt, bess::PacketBatch *out) {
+    out->add(pkt);
+    pkts_out_++;
+    bytes_out_ += pkt->total_len();
+    if (out->full()) {
+      RunNextModule(out);
+      out->clear();
+    }
+  }
+
+  static int FlowIndex(const Flow &flow) {
+    uint64_t h = (static_cast<uint64_t>(flow.src_ip ^ flow.dst_ip) << 32) |
+                 (static_cast<uint32_t>(flow.src_port) << 16) | flow.dst_port;
+    return (h * 0x9e3779b97f4a7c15ULL) >> 58;  // top log2(kMaxFlows) bits
+  }
+
+  uint64_t timeout_;  // in TSC cycles, 0: flush at the end of each batch
+  uint32_t max_segs_;
+  uint32_t max_size_;  // max IP datagram size of a merged packet
+  bool verify_checksum_;
+
+  uint64_t active_;  // bitmask of flows_ in use
+  Context flows_[kMaxFlows];
+
+  uint64_t pkts_in_;
+  uint64_t pkts_out_;
+  uint64_t bytes_out_;
+};
+
+#endif  // BESS_MODULES_GRO_H_
@@ -0,0 +1,143 @@
+// Benchmark for GRO module.
+
+#include <pcap/pcap.h>
+
+#include <benchmark/benchmark.h>
+#include <glog/logging.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "gro.h"
+
+namespace {
+
+// Frees nothing: the packets are reused by every iteration
+class NullSink : public Module {
+ public:
+  void ProcessBatch(bess::PacketBatch *batch) override {
+    pkts += batch->cnt();
+  }
+
+  uint64_t pkts = {};
+};
+
+// Runs the bulk TCP trace (4 flows of MSS-sized segments with timestamps,
+// interleaved 8 segments at a time, plus the ACKs of the receivers) through
+// GRO, with at most state.range(0) segments per merged packet.
+class GROFixture : public benchmark::Fixture {
+ protected:
+  // Only the headers of the first segment of a merged packet are modified
+  static const size_t kHeaderBytes = 128;
+
+  void SetUp(benchmark::State &state) override {
+    ADD_MODULE(GRO, "gro", "merges TCP segments into multi-segment packets");
+    DCHECK(__module__GRO);
+    ADD_MODULE(NullSink, "null_sink", "counts packets");
+    DCHECK(__module__NullSink);
+
+    gro_ = static_cast<GRO *>(Create("GRO"));
+    sink_ = static_cast<NullSink *>(Create("NullSink"));
+
+    bess::pb::GROArg arg;
+    arg.set_max_segs(state.range(0));
+    CHECK_EQ(gro_->Init(arg).err(), 0);
+    CHECK_EQ(gro_->ConnectModules(0, sink_, 0), 0);
+
+    char errbuf[PCAP_ERRBUF_SIZE];
+    pcap_t *handle = pcap_open_offline(
+        "testdata/test-pktcaptures/tcp-bulk.pcap", errbuf);
+    CHECK(handle) << errbuf;
+
+    const u_char *data;
+    struct pcap_pkthdr hdr;
+    while ((data = pcap_next(handle, &hdr)) != nullptr) {
+      bess::Packet *pkt = new bess::Packet();
+      memset(pkt, 0, sizeof(*pkt));
+      pkt->set_buffer(pkt->data());
+      memcpy(pkt->data(), data, hdr.caplen);
+      pkts_.push_back(pkt);
+      lens_.push_back(hdr.caplen);
+      headers_.emplace_back(reinterpret_cast<const char *>(data),
+                            hdr.caplen < kHeaderBytes ? hdr.caplen
+                                                      : kHeaderBytes);
+      bytes_ += hdr.caplen;
+    }
+
+    pcap_close(handle);
+  }
+
+  void TearDown(benchmark::State &) override {
+    ModuleBuilder::DestroyAllModules();
+    ModuleBuilder::all_module_builders_holder(true);
+    for (bess::Packet *pkt : pkts_) {
+      delete pkt;
+    }
+    pkts_.clear();
+    lens_.clear();
+    headers_.clear();
+  }
+
+  static Module *Create(const std::string &class_name) {
+    const ModuleBuilder &builder =
+        ModuleBuilder::all_module_builders().find(class_name)->second;
+    Module *m = builder.CreateModule(
+        ModuleBuilder::GenerateDefaultName(builder.class_name(),
+                                           builder.name_template()),
+        &bess::metadata::default_pipeline);
+    ModuleBuilder::AddModule(m);
+    return m;
+  }
+
+  // Undoes what GRO did to the packets in the previous iteration
+  void Reset() {
+    for (size_t i = 0; i < pkts_.size(); i++) {
+      bess::Packet *pkt = pkts_[i];
+      pkt->set_data_off(0);
+      pkt->set_nb_segs(1);
+      pkt->set_next(nullptr);
+      pkt->set_data_len(lens_[i]);
+      pkt->set_total_len(lens_[i]);
+      memcpy(pkt->data(), headers_[i].data(), headers_[i].size());
+    }
+  }
+
+  GRO *gro_;
+  NullSink *sink_;
+  std::vector<bess::Packet *> pkts_;
+  std::vector<uint16_t> lens_;
+  std::vector<std::string> headers_;
+  uint64_t bytes_ = {};
+};
+
+}  // namespace (unnamed)
+
+BENCHMARK_DEFINE_F(GROFixture, Merge)(benchmark::State &state) {
+  bess::PacketBatch batch;
+
+  while (state.KeepRunning()) {
+    Reset();
+
+    batch.clear();
+    for (bess::Packet *pkt : pkts_) {
+      batch.add(pkt);
+      if (batch.full()) {
+        gro_->ProcessBatch(&batch);
+        batch.clear();
+      }
+    }
+    if (!batch.empty()) {
+      gro_->ProcessBatch(&batch);
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * pkts_.size());
+  state.SetBytesProcessed(state.iterations() * bytes_);
+  state.SetLabel(std::to_string(sink_->pkts / state.iterations()) +
+                 " packets out of " + std::to_string(pkts_.size()));
+}
+
+BENCHMARK_REGISTER_F(GROFixture, Merge)->Arg(2)->Arg(8)->Arg(32);
+
+BENCHMARK_MAIN();
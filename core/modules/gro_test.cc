@@ -0,0 +1,241 @@
+#include "gro.h"
+
+#include <pcap/pcap.h>
+
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../utils/checksum.h"
+#include "../utils/ether.h"
+#include "../utils/ip.h"
+#include "../utils/tcp.h"
+
+using bess::utils::EthHeader;
+using bess::utils::Ipv4Header;
+using bess::utils::TcpHeader;
+using bess::utils::ChecksumFinish;
+using bess::utils::ChecksumPartial;
+using bess::utils::PseudoHeaderSum;
+
+namespace {
+
+class CollectModule : public Module {
+ public:
+  void ProcessBatch(bess::PacketBatch *batch) override {
+    for (int i = 0; i < batch->cnt(); i++) {
+      pkts.push_back(batch->pkts()[i]);
+    }
+  }
+
+  std::vector<bess::Packet *> pkts;
+};
+
+class GROTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    ADD_MODULE(GRO, "gro", "merges TCP segments into multi-segment packets");
+    ASSERT_TRUE(__module__GRO);
+    ADD_MODULE(CollectModule, "collect", "collects packets");
+    ASSERT_TRUE(__module__CollectModule);
+
+    gro_ = static_cast<GRO *>(Create("GRO"));
+    sink_ = static_cast<CollectModule *>(Create("CollectModule"));
+    ASSERT_EQ(0, gro_->ConnectModules(0, sink_, 0));
+  }
+
+  virtual void TearDown() {
+    ModuleBuilder::DestroyAllModules();
+    ModuleBuilder::all_module_builders_holder(true);
+    for (bess::Packet *pkt : pkts_) {
+      delete pkt;
+    }
+  }
+
+  static Module *Create(const std::string &class_name) {
+    const ModuleBuilder &builder =
+        ModuleBuilder::all_module_builders().find(class_name)->second;
+    Module *m = builder.CreateModule(
+        ModuleBuilder::GenerateDefaultName(builder.class_name(),
+                                           builder.name_template()),
+        &bess::metadata::default_pipeline);
+    ModuleBuilder::AddModule(m);
+    return m;
+  }
+
+  void Init(bool trust_checksum) {
+    bess::pb::GROArg arg;
+    arg.set_trust_checksum(trust_checksum);
+    ASSERT_EQ(0, gro_->Init(arg).err());
+  }
+
+  void LoadPcap(const std::string &path) {
+    char errbuf[PCAP_ERRBUF_SIZE];
+    pcap_t *handle = pcap_open_offline(path.c_str(), errbuf);
+    ASSERT_NE(nullptr, handle) << errbuf;
+
+    const u_char *data;
+    struct pcap_pkthdr hdr;
+    while ((data = pcap_next(handle, &hdr)) != nullptr) {
+      bess::Packet *pkt = new bess::Packet();
+      memset(pkt, 0, sizeof(*pkt));
+      pkt->set_buffer(pkt->data());
+      pkt->set_nb_segs(1);
+      pkt->set_data_len(hdr.caplen);
+      pkt->set_total_len(hdr.caplen);
+      memcpy(pkt->data(), data, hdr.caplen);
+      pkts_.push_back(pkt);
+    }
+
+    pcap_close(handle);
+  }
+
+  // Runs pkts_[begin, end) through GRO in batches
+  void Run(size_t begin, size_t end) {
+    bess::PacketBatch batch;
+    batch.clear();
+
+    for (size_t i = begin; i < end; i++) {
+      batch.add(pkts_[i]);
+      if (batch.full()) {
+        gro_->ProcessBatch(&batch);
+        batch.clear();
+      }
+    }
+
+    if (!batch.empty()) {
+      gro_->ProcessBatch(&batch);
+    }
+  }
+
+  // Returns the TCP payload of a (possibly chained) packet
+  static std::string Payload(bess::Packet *pkt) {
+    const Ipv4Header *ip = pkt->head_data<Ipv4Header *>(sizeof(EthHeader));
+    const TcpHeader *tcp = reinterpret_cast<const TcpHeader *>(ip + 1);
+    size_t hdr_len = sizeof(EthHeader) + sizeof(*ip) + (tcp->offset << 2);
+
+    std::string payload(pkt->head_data<char *>() + hdr_len,
+                        pkt->head_len() - hdr_len);
+    for (bess::Packet *seg = pkt->next(); seg; seg = seg->next()) {
+      payload.append(seg->head_data<char *>(), seg->head_len());
+    }
+    return payload;
+  }
+
+  // Checks the IP length and the IP/TCP checksums of a (chained) packet
+  static void ExpectValidHeaders(bess::Packet *pkt) {
+    Ipv4Header *ip = pkt->head_data<Ipv4Header *>(sizeof(EthHeader));
+    TcpHeader *tcp = reinterpret_cast<TcpHeader *>(ip + 1);
+    size_t tcp_bytes = tcp->offset << 2;
+    std::string payload = Payload(pkt);
+
+    EXPECT_EQ(pkt->total_len() - sizeof(EthHeader), ntohs(ip->length));
+    EXPECT_EQ(0, ChecksumFinish(ChecksumPartial(ip, sizeof(*ip))));
+
+    uint32_t sum = PseudoHeaderSum(ip->src, ip->dst, IPPROTO_TCP,
+                                   tcp_bytes + payload.size()) +
+                   ChecksumPartial(tcp, tcp_bytes) +
+                   ChecksumPartial(payload.data(), payload.size());
+    EXPECT_EQ(0, ChecksumFinish(sum));
+  }
+
+  GRO *gro_;
+  CollectModule *sink_;
+  std::vector<bess::Packet *> pkts_;
+};
+
+// The trace has a handshake, 6 data segments (the last one with PSH), and a
+// teardown. The data segments become a single packet. It was captured at the
+// sender, before the NIC filled in the TCP checksums.
+TEST_F(GROTest, MergeInOrder) {
+  Init(true);
+  LoadPcap("testdata/test-pktcaptures/tcpflow-http-3.pcap");
+  ASSERT_EQ(11, pkts_.size());
+
+  Run(0, pkts_.size());
+  ASSERT_EQ(6, sink_->pkts.size());
+
+  bess::Packet *merged = sink_->pkts[2];
+  EXPECT_EQ(pkts_[2], merged);
+  EXPECT_EQ(6, merged->nb_segs());
+  EXPECT_EQ(pkts_[8], sink_->pkts[3]);
+  EXPECT_TRUE(merged->head_data<TcpHeader *>(sizeof(EthHeader) +
+                                             sizeof(Ipv4Header))
+                  ->flags &
+              TCP_FLAG_PUSH);
+  ExpectValidHeaders(merged);
+
+  std::ifstream f("testdata/test-pktcaptures/tcpflow-http-3.bytes",
+                  std::ios::binary);
+  std::string expected((std::istreambuf_iterator<char>(f)),
+                       std::istreambuf_iterator<char>());
+  EXPECT_EQ(expected, Payload(merged));
+}
+
+// A gap in the sequence numbers ends the merged packet, and the segments of a
+// flow leave the module in the order they came in.
+TEST_F(GROTest, OutOfOrder) {
+  Init(true);
+  LoadPcap("testdata/test-pktcaptures/tcpflow-http-3.pcap");
+  std::swap(pkts_[4], pkts_[5]);
+
+  Run(2, 8);
+  ASSERT_EQ(4, sink_->pkts.size());
+  EXPECT_EQ(pkts_[2], sink_->pkts[0]);
+  EXPECT_EQ(2, sink_->pkts[0]->nb_segs());
+  EXPECT_EQ(pkts_[4], sink_->pkts[1]);
+  EXPECT_EQ(1, sink_->pkts[1]->nb_segs());
+  EXPECT_EQ(pkts_[5], sink_->pkts[2]);
+  EXPECT_EQ(1, sink_->pkts[2]->nb_segs());
+  EXPECT_EQ(pkts_[6], sink_->pkts[3]);
+  EXPECT_EQ(2, sink_->pkts[3]->nb_segs());
+
+  ExpectValidHeaders(sink_->pkts[0]);
+  ExpectValidHeaders(sink_->pkts[3]);
+}
+
+TEST_F(GROTest, CorruptedSegment) {
+  Init(false);
+  LoadPcap("testdata/test-pktcaptures/tcp-bulk.pcap");
+  pkts_[3]->head_data<char *>()[pkts_[3]->head_len() - 1] ^= 1;
+
+  // One run of 8 segments and the ACK of the receiver
+  Run(0, 9);
+  ASSERT_EQ(4, sink_->pkts.size());
+  EXPECT_EQ(3, sink_->pkts[0]->nb_segs());
+  EXPECT_EQ(pkts_[3], sink_->pkts[1]);
+  EXPECT_EQ(1, sink_->pkts[1]->nb_segs());
+  EXPECT_EQ(pkts_[4], sink_->pkts[2]);
+  EXPECT_EQ(4, sink_->pkts[2]->nb_segs());
+  EXPECT_EQ(pkts_[8], sink_->pkts[3]);
+}
+
+// 4 flows of back-to-back MSS-sized segments, interleaved 8 at a time and
+// followed by a pure ACK from the receiver
+TEST_F(GROTest, BulkFlows) {
+  Init(false);
+  LoadPcap("testdata/test-pktcaptures/tcp-bulk.pcap");
+  ASSERT_EQ(144, pkts_.size());
+
+  std::string expected;
+  for (bess::Packet *pkt : pkts_) {
+    expected += Payload(pkt);
+  }
+
+  // 16 runs and 16 ACKs. Without a timeout, the 4 runs that straddle two
+  // batches are split in two.
+  Run(0, pkts_.size());
+  ASSERT_EQ(36, sink_->pkts.size());
+
+  std::string payload;
+  for (bess::Packet *pkt : sink_->pkts) {
+    ExpectValidHeaders(pkt);
+    payload += Payload(pkt);
+  }
+  EXPECT_EQ(expected.size(), payload.size());
+}
+
+}  // namespace (unnamed)
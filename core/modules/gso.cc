@@ -0,0 +1,313 @@
+#include "gso.h"
+
+#include <netinet/in.h>
+
+#include <cstring>
+
+#include "../utils/checksum.h"
+#include "../utils/ether.h"
+#include "../utils/format.h"
+#include "../utils/ip.h"
+#include "../utils/tcp.h"
+
+using bess::utils::EthHeader;
+using bess::utils::Ipv4Header;
+using bess::utils::TcpHeader;
+using bess::utils::ChecksumFinish;
+using bess::utils::ChecksumPartial;
+using bess::utils::ChecksumSwap;
+using bess::utils::PseudoHeaderSum;
+
+static const uint32_t kDefaultMtu = 1500;
+static const uint32_t kMinMtu = 576;    // every IPv4 host must accept this
+static const uint32_t kMaxMtu = 65535;  // Ipv4Header.length is 16 bits
+
+// Ethernet + IP + TCP headers, with options
+static const size_t kMaxHeaderLen = sizeof(EthHeader) + 60 + 60;
+
+// Segments per packet. A 64KB packet with 60-byte IP and TCP headers makes
+// 144 segments at the minimum MTU.
+static const uint32_t kMaxSegs = 256;
+
+// Payloads shorter than this are copied rather than attached
+static const uint32_t kMinZeroCopy = 256;
+
+static const uint16_t kIpFlagDF = 0x4000;
+static const uint16_t kIpFlagMF = 0x2000;
+static const uint16_t kIpFragMask = 0x3fff;  // MF and offset
+
+namespace {
+
+// Where the next byte of payload is in a (multi-segment) packet
+struct Cursor {
+  bess::Packet *seg;
+  uint32_t off;
+};
+
+// Appends len bytes of payload at cur to seg, by copying them or by chaining
+// indirect packets. Adds the checksum sum of the bytes to *sum, if not null.
+// Returns false if there are no free packets left.
+bool AppendPayload(bess::Packet *seg, Cursor *cur, uint32_t len, bool copy,
+                   uint32_t *sum) {
+  bess::Packet *tail = seg;
+  uint32_t done = 0;
+
+  while (done < len) {
+    while (cur->off == static_cast<uint32_t>(cur->seg->head_len())) {
+      cur->seg = cur->seg->next();
+      cur->off = 0;
+    }
+
+    uint32_t n = cur->seg->head_len() - cur->off;
+    if (n > len - done) {
+      n = len - done;
+    }
+
+    const uint8_t *data = cur->seg->head_data<uint8_t *>(cur->off);
+    if (sum) {
+      // The payload starts at an even offset of the TCP header
+      uint32_t s = ChecksumPartial(data, n);
+      *sum += (done & 1) ? ChecksumSwap(s) : s;
+    }
+
+    if (copy) {
+      memcpy(seg->append(n), data, n);
+    } else {
+      if (seg->nb_segs() == UINT8_MAX) {
+        return false;
+      }
+
+      bess::Packet *ind = bess::__packet_alloc_pool(seg->pool());
+      if (!ind) {
+        return false;
+      }
+
+      ind->attach(cur->seg);
+      ind->set_data_off(ind->data_off() + cur->off);
+      ind->set_data_len(n);
+      ind->set_total_len(n);
+
+      tail->set_next(ind);
+      tail = ind;
+      seg->set_nb_segs(seg->nb_segs() + 1);
+      seg->set_total_len(seg->total_len() + n);
+    }
+
+    cur->off += n;
+    done += n;
+  }
+
+  return true;
+}
+
+}  // namespace (unnamed)
+
+const Commands GSO::cmds = {};
+
+pb_error_t GSO::Init(const bess::pb::GSOArg &arg) {
+  mtu_ = arg.mtu() ? arg.mtu() : kDefaultMtu;
+  if (mtu_ < kMinMtu || mtu_ > kMaxMtu) {
+    return pb_error(EINVAL, "'mtu' must be [%u, %u]", kMinMtu, kMaxMtu);
+  }
+
+  copy_ = arg.copy();
+  if (copy_ && sizeof(EthHeader) + mtu_ > SNBUF_DATA) {
+    return pb_error(EINVAL, "'mtu' must be <= %zu with 'copy'",
+                    SNBUF_DATA - sizeof(EthHeader));
+  }
+
+  return pb_errno(0);
+}
+
+std::string GSO::GetDesc() const {
+  return bess::utils::Format("%lu pkts -> %lu segs", pkts_split_, segs_out_);
+}
+
+bool GSO::Split(bess::Packet *pkt, bess::PacketBatch *out) {
+  EthHeader *eth = pkt->head_data<EthHeader *>();
+  Ipv4Header *ip = reinterpret_cast<Ipv4Header *>(eth + 1);
+
+  if (eth->ether_type.to_cpu() != 0x0800 ||
+      static_cast<size_t>(pkt->head_len()) < sizeof(*eth) + sizeof(*ip)) {
+    return false;
+  }
+
+  uint32_t ip_bytes = ip->header_length << 2;
+  uint32_t ip_len = ntohs(ip->length);
+  uint16_t frag = ntohs(ip->fragment_offset);
+
+  if (ip_len <= mtu_ || ip->version != 4 || ip_bytes < sizeof(*ip) ||
+      (frag & kIpFragMask) ||
+      sizeof(*eth) + ip_len > static_cast<uint32_t>(pkt->total_len())) {
+    return false;
+  }
+
+  bool tcp = (ip->protocol == IPPROTO_TCP);
+  uint32_t hdr_len;
+  uint32_t tcp_bytes = 0;
+  uint32_t step;  // payload bytes per segment
+
+  if (tcp) {
+    if (static_cast<size_t>(pkt->head_len()) <
+        sizeof(*eth) + ip_bytes + sizeof(TcpHeader)) {
+      return false;
+    }
+    const TcpHeader *t = reinterpret_cast<const TcpHeader *>(
+        reinterpret_cast<uint8_t *>(ip) + ip_bytes);
+    tcp_bytes = t->offset << 2;
+    if (tcp_bytes < sizeof(TcpHeader) || ip_bytes + tcp_bytes >= mtu_) {
+      return false;
+    }
+    hdr_len = sizeof(*eth) + ip_bytes + tcp_bytes;
+    step = mtu_ - ip_bytes - tcp_bytes;
+  } else if (ip->protocol == IPPROTO_UDP) {
+    // Options would have to be filtered for each fragment
+    if ((frag & kIpFlagDF) || ip_bytes != sizeof(*ip)) {
+      return false;
+    }
+    hdr_len = sizeof(*eth) + ip_bytes;
+    step = (mtu_ - ip_bytes) & ~7;  // fragment offsets are in 8-byte units
+  } else {
+    return false;
+  }
+
+  uint32_t payload_len = sizeof(*eth) + ip_len - hdr_len;
+  uint32_t nb_segs = (payload_len + step - 1) / step;
+  if (hdr_len > static_cast<uint32_t>(pkt->head_len()) || nb_segs > kMaxSegs) {
+    return false;
+  }
+
+  // The header template, with the fields that differ between segments zeroed
+  // so that their checksum sums can be computed once for the whole packet
+  uint8_t tmpl[kMaxHeaderLen];
+  memcpy(tmpl, eth, hdr_len);
+
+  Ipv4Header *t_ip = reinterpret_cast<Ipv4Header *>(tmpl + sizeof(*eth));
+  TcpHeader *t_tcp = reinterpret_cast<TcpHeader *>(
+      reinterpret_cast<uint8_t *>(t_ip) + ip_bytes);
+  uint16_t ip_id = ntohs(ip->id);
+  uint32_t seq = 0;
+  uint8_t flags = 0;
+  uint32_t l4_sum = 0;
+
+  t_ip->length = 0;
+  t_ip->checksum = 0;
+  if (tcp) {
+    t_ip->id = 0;
+  }
+  uint32_t ip_sum = ChecksumPartial(t_ip, ip_bytes);
+
+  if (tcp) {
+    seq = ntohl(t_tcp->seq_num);
+    flags = t_tcp->flags;
+    t_tcp->seq_num = 0;
+    t_tcp->flags = 0;
+    t_tcp->checksum = 0;
+    l4_sum = PseudoHeaderSum(ip->src, ip->dst, IPPROTO_TCP, 0) +
+             ChecksumPartial(t_tcp, tcp_bytes);
+  }
+
+  bess::Packet *segs[kMaxSegs];
+  if (rte_pktmbuf_alloc_bulk(pkt->pool(),
+                             reinterpret_cast<struct rte_mbuf **>(segs),
+                             nb_segs) != 0) {
+    dropped_++;
+    bess::Packet::Free(pkt);
+    return true;
+  }
+
+  Cursor cur = {pkt, hdr_len};
+
+  for (uint32_t i = 0; i < nb_segs; i++) {
+    bess::Packet *seg = segs[i];
+    uint32_t off = i * step;
+    uint32_t len = (payload_len - off < step) ? payload_len - off : step;
+    bool last = (i == nb_segs - 1);
+    uint32_t payload_sum = 0;
+
+    memcpy(seg->metadata(), pkt->metadata(), SNBUF_METADATA);
+
+    uint8_t *hdr = static_cast<uint8_t *>(seg->append(hdr_len));
+    memcpy(hdr, tmpl, hdr_len);
+
+    if (!AppendPayload(seg, &cur, len, copy_ || len < kMinZeroCopy,
+                       tcp ? &payload_sum : nullptr)) {
+      for (uint32_t j = 0; j < nb_segs; j++) {
+        bess::Packet::Free(segs[j]);
+      }
+      dropped_++;
+      bess::Packet::Free(pkt);
+      return true;
+    }
+
+    Ipv4Header *s_ip = reinterpret_cast<Ipv4Header *>(hdr + sizeof(*eth));
+    s_ip->length = htons(hdr_len - sizeof(*eth) + len);
+    uint32_t sum = ip_sum + s_ip->length;
+
+    if (tcp) {
+      s_ip->id = htons(ip_id + i);
+      sum += s_ip->id;
+    } else {
+      uint16_t frag_bits = htons((last ? 0 : kIpFlagMF) | (off >> 3));
+      s_ip->fragment_offset |= frag_bits;
+      sum += frag_bits;
+    }
+    s_ip->checksum = ChecksumFinish(sum);
+
+    if (tcp) {
+      TcpHeader *s_tcp = reinterpret_cast<TcpHeader *>(
+          reinterpret_cast<uint8_t *>(s_ip) + ip_bytes);
+      uint8_t f = flags;
+
+      // As Linux does, CWR is only on the first segment, FIN and PSH only on
+      // the last one
+      if (i > 0) {
+        f &= ~TCP_FLAG_CWR;
+      }
+      if (!last) {
+        f &= ~(TCP_FLAG_FIN | TCP_FLAG_PUSH);
+      }
+
+      s_tcp->seq_num = htonl(seq + off);
+      s_tcp->flags = f;
+
+      // htons(f) is the flags in the second byte of a 16-bit word, as in the
+      // header
+      sum = l4_sum + htons(tcp_bytes + len) + (s_tcp->seq_num & 0xffff) +
+            (s_tcp->seq_num >> 16) + htons(f) + payload_sum;
+      s_tcp->checksum = ChecksumFinish(sum);
+    }
+  }
+
+  // The indirect segments hold references to the data
+  bess::Packet::Free(pkt);
+
+  for (uint32_t i = 0; i < nb_segs; i++) {
+    Emit(segs[i], out);
+  }
+
+  pkts_split_++;
+  segs_out_ += nb_segs;
+  return true;
+}
+
+void GSO::ProcessBatch(bess::PacketBatch *batch) {
+  bess::PacketBatch out;
+  int cnt = batch->cnt();
+
+  out.clear();
+
+  for (int i = 0; i < cnt; i++) {
+    bess::Packet *pkt = batch->pkts()[i];
+
+    if (!Split(pkt, &out)) {
+      Emit(pkt, &out);
+    }
+  }
+
+  if (!out.empty()) {
+    RunNextModule(&out);
+  }
+}
+
+ADD_MODULE(GSO, "gso", "splits large TCP/UDP packets into MTU-sized ones")
@@ -0,0 +1,72 @@
+#ifndef BESS_MODULES_GSO_H_
+#define BESS_MODULES_GSO_H_
+
+#include <string>
+
+#include "../module.h"
+#include "../module_msg.pb.h"
+#include "../pktbatch.h"
+
+// Generic segmentation offload for IPv4, the reverse of GRO. Packets whose IP
+// length exceeds mtu (e.g., 64KB TSO/UFO packets sent by a container through
+// a VPort) are split before they reach a port:
+//  - TCP segments are cut into MSS-sized segments (mtu minus the IP and TCP
+//    headers). Each segment gets a copy of the original headers with the
+//    sequence number, IP ID/length, and flags (CWR on the first, FIN/PSH on
+//    the last segment only) fixed up, and fresh IP/TCP checksums.
+//  - UDP datagrams are cut into IP fragments, as UFO does. The UDP header
+//    (and its checksum over the whole datagram) is only in the first fragment.
+//
+// The headers of a packet are parsed once into a template whose checksum sums
+// are computed with the per-segment fields zeroed, so each segment only adds
+// its own fields to them. Unless copy is set, the payload is not copied:
+// segments are chained as indirect packets that point into the data of the
+// original packet, which is freed once the last segment is sent. Short
+// payloads (e.g., the tail of a packet) are copied, which is cheaper than an
+// indirect packet. With copy, segments are linear packets, for ports that do
+// not take multi-segment packets.
+//
+// The input may be a multi-segment packet, as long as its headers are in the
+// first segment. Segments are allocated from the mempool of the input packet.
+// Other packets, including those with DF set that would need fragmenting, are
+// passed through unchanged.
+class GSO final : public Module {
+ public:
+  static const Commands cmds;
+
+  GSO()
+      : Module(),
+        mtu_(),
+        copy_(),
+        pkts_split_(),
+        segs_out_(),
+        dropped_() {}
+
+  pb_error_t Init(const bess::pb::GSOArg &arg);
+
+  void ProcessBatch(bess::PacketBatch *batch) override;
+
+  std::string GetDesc() const override;
+
+ private:
+  // Returns false if pkt is to be passed through. Otherwise pkt is consumed:
+  // its segments are sent to out, or it is dropped if we run out of packets.
+  bool Split(bess::Packet *pkt, bess::PacketBatch *out);
+
+  void Emit(bess::Packet *pkt, bess::PacketBatch *out) {
+    out->add(pkt);
+    if (out->full()) {
+      RunNextModule(out);
+      out->clear();
+    }
+  }
+
+  uint32_t mtu_;
+  bool copy_;
+
+  uint64_t pkts_split_;
+  uint64_t segs_out_;
+  uint64_t dropped_;
+};
+
+#endif  // BESS_MODULES_GSO_H_
@@ -0,0 +1,168 @@
+// Benchmark for GSO module.
+
+#include <rte_mbuf.h>
+
+#include <benchmark/benchmark.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include "../dpdk.h"
+#include "../utils/ether.h"
+#include "../utils/ip.h"
+#include "../utils/tcp.h"
+#include "gso.h"
+
+using bess::utils::be16_t;
+using bess::utils::EthHeader;
+using bess::utils::Ipv4Header;
+using bess::utils::TcpHeader;
+
+namespace {
+
+// Frees the segments, as a port would after sending them
+class FreeSink : public Module {
+ public:
+  void ProcessBatch(bess::PacketBatch *batch) override {
+    segs += batch->cnt();
+    for (int i = 0; i < batch->cnt(); i++) {
+      bytes += batch->pkts()[i]->total_len();
+    }
+    bess::Packet::Free(batch);
+  }
+
+  uint64_t segs = {};
+  uint64_t bytes = {};
+};
+
+struct rte_mempool *pool;
+
+// Splits one TCP packet with state.range(0) bytes of payload (e.g., a TSO
+// packet from a VPort, in a chain of full buffers) into 1448-byte segments,
+// with zero copy if state.range(1) is 0.
+class GSOFixture : public benchmark::Fixture {
+ protected:
+  void SetUp(benchmark::State &state) override {
+    init_dpdk("gso_bench", 0, 0, true);
+
+    // Segments are allocated from the mempool of the input packet
+    if (!pool) {
+      pool = rte_pktmbuf_pool_create("gso_bench", 16383, 256, SNBUF_RESERVE,
+                                     SNBUF_HEADROOM + SNBUF_DATA,
+                                     SOCKET_ID_ANY);
+      CHECK(pool);
+    }
+
+    ADD_MODULE(GSO, "gso", "splits large TCP/UDP packets into MTU-sized ones");
+    DCHECK(__module__GSO);
+    ADD_MODULE(FreeSink, "free_sink", "frees packets");
+    DCHECK(__module__FreeSink);
+
+    gso_ = static_cast<GSO *>(Create("GSO"));
+    sink_ = static_cast<FreeSink *>(Create("FreeSink"));
+
+    bess::pb::GSOArg arg;
+    arg.set_copy(state.range(1));
+    CHECK_EQ(gso_->Init(arg).err(), 0);
+    CHECK_EQ(gso_->ConnectModules(0, sink_, 0), 0);
+
+    pkt_ = MakePacket(state.range(0));
+  }
+
+  void TearDown(benchmark::State &) override {
+    ModuleBuilder::DestroyAllModules();
+    ModuleBuilder::all_module_builders_holder(true);
+    bess::Packet::Free(pkt_);
+  }
+
+  static Module *Create(const std::string &class_name) {
+    const ModuleBuilder &builder =
+        ModuleBuilder::all_module_builders().find(class_name)->second;
+    Module *m = builder.CreateModule(
+        ModuleBuilder::GenerateDefaultName(builder.class_name(),
+                                           builder.name_template()),
+        &bess::metadata::default_pipeline);
+    ModuleBuilder::AddModule(m);
+    return m;
+  }
+
+  static bess::Packet *MakePacket(size_t payload_len) {
+    const size_t hdr_len =
+        sizeof(EthHeader) + sizeof(Ipv4Header) + sizeof(TcpHeader) + 12;
+    std::string frame(hdr_len + payload_len, 'x');
+    EthHeader *eth = reinterpret_cast<EthHeader *>(&frame[0]);
+    Ipv4Header *ip = reinterpret_cast<Ipv4Header *>(eth + 1);
+    TcpHeader *tcp = reinterpret_cast<TcpHeader *>(ip + 1);
+
+    memset(eth, 0, hdr_len);
+    eth->ether_type = be16_t(htons(0x0800));
+    ip->version = 4;
+    ip->header_length = sizeof(*ip) >> 2;
+    ip->length = htons(frame.size() - sizeof(*eth));
+    ip->ttl = 64;
+    ip->protocol = IPPROTO_TCP;
+    ip->src = htonl(0x0a000001);
+    ip->dst = htonl(0x0a000002);
+    tcp->offset = (sizeof(*tcp) + 12) >> 2;
+    tcp->flags = TCP_FLAG_ACK | TCP_FLAG_PUSH;
+    memset(tcp + 1, 0x01, 12);
+
+    bess::Packet *head = nullptr;
+    bess::Packet *tail = nullptr;
+    for (size_t off = 0; off < frame.size(); off += SNBUF_DATA) {
+      size_t n = std::min<size_t>(SNBUF_DATA, frame.size() - off);
+      bess::Packet *seg =
+          reinterpret_cast<bess::Packet *>(rte_pktmbuf_alloc(pool));
+      CHECK(seg);
+      memcpy(seg->append(n), frame.data() + off, n);
+
+      if (!head) {
+        head = seg;
+      } else {
+        tail->set_next(seg);
+        head->set_nb_segs(head->nb_segs() + 1);
+        head->set_total_len(head->total_len() + n);
+      }
+      tail = seg;
+    }
+
+    return head;
+  }
+
+  GSO *gso_;
+  FreeSink *sink_;
+  bess::Packet *pkt_;
+};
+
+}  // namespace (unnamed)
+
+BENCHMARK_DEFINE_F(GSOFixture, Split)(benchmark::State &state) {
+  bess::PacketBatch batch;
+
+  while (state.KeepRunning()) {
+    // GSO frees the packet once it is split; keep it for the next iteration
+    for (bess::Packet *seg = pkt_; seg; seg = seg->next()) {
+      seg->update_refcnt(1);
+    }
+
+    batch.clear();
+    batch.add(pkt_);
+    gso_->ProcessBatch(&batch);
+  }
+
+  // Mpps and Gbps of the segments sent out
+  state.SetItemsProcessed(sink_->segs);
+  state.SetBytesProcessed(sink_->bytes);
+  state.SetLabel(std::to_string(sink_->segs / state.iterations()) +
+                 " segments per packet");
+}
+
+BENCHMARK_REGISTER_F(GSOFixture, Split)
+    ->Args({8192, 0})
+    ->Args({8192, 1})
+    ->Args({65000, 0})
+    ->Args({65000, 1});
+
+BENCHMARK_MAIN();
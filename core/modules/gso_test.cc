@@ -0,0 +1,353 @@
+#include "gso.h"
+
+#include <rte_mbuf.h>
+#include <rte_mempool.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../dpdk.h"
+#include "../utils/checksum.h"
+#include "../utils/ether.h"
+#include "../utils/ip.h"
+#include "../utils/random.h"
+#include "../utils/tcp.h"
+#include "../utils/udp.h"
+
+using bess::utils::be16_t;
+using bess::utils::EthHeader;
+using bess::utils::Ipv4Header;
+using bess::utils::TcpHeader;
+using bess::utils::UdpHeader;
+using bess::utils::ChecksumFinish;
+using bess::utils::ChecksumPartial;
+using bess::utils::PseudoHeaderSum;
+
+namespace {
+
+class CollectModule : public Module {
+ public:
+  void ProcessBatch(bess::PacketBatch *batch) override {
+    for (int i = 0; i < batch->cnt(); i++) {
+      pkts.push_back(batch->pkts()[i]);
+    }
+  }
+
+  std::vector<bess::Packet *> pkts;
+};
+
+// Ethernet + IP + TCP with a 12-byte option (e.g., timestamps)
+const size_t kTcpHdrLen =
+    sizeof(EthHeader) + sizeof(Ipv4Header) + sizeof(TcpHeader) + 12;
+const size_t kUdpHdrLen =
+    sizeof(EthHeader) + sizeof(Ipv4Header) + sizeof(UdpHeader);
+
+// MSS for the default MTU of 1500
+const size_t kMss = 1500 - sizeof(Ipv4Header) - sizeof(TcpHeader) - 12;
+
+class GSOTest : public ::testing::Test {
+ protected:
+  // Segments are allocated from the mempool of the packets being split and
+  // point into their buffers, so the packets must come from a real mempool
+  static void SetUpTestCase() {
+    init_dpdk("gso_test", 0, 0, true);
+
+    if (!pool_) {
+      pool_ = rte_pktmbuf_pool_create("gso_test", 4095, 0, SNBUF_RESERVE,
+                                      SNBUF_HEADROOM + SNBUF_DATA,
+                                      SOCKET_ID_ANY);
+      ASSERT_NE(nullptr, pool_);
+    }
+  }
+
+  virtual void SetUp() {
+    ADD_MODULE(GSO, "gso", "splits large TCP/UDP packets into MTU-sized ones");
+    ASSERT_TRUE(__module__GSO);
+    ADD_MODULE(CollectModule, "collect", "collects packets");
+    ASSERT_TRUE(__module__CollectModule);
+
+    gso_ = static_cast<GSO *>(Create("GSO"));
+    sink_ = static_cast<CollectModule *>(Create("CollectModule"));
+    ASSERT_EQ(0, gso_->ConnectModules(0, sink_, 0));
+
+    free_pkts_ = rte_mempool_avail_count(pool_);
+  }
+
+  virtual void TearDown() {
+    for (bess::Packet *pkt : sink_->pkts) {
+      bess::Packet::Free(pkt);
+    }
+
+    // Every segment, direct or indirect, must have been returned
+    EXPECT_EQ(free_pkts_, rte_mempool_avail_count(pool_));
+
+    ModuleBuilder::DestroyAllModules();
+    ModuleBuilder::all_module_builders_holder(true);
+  }
+
+  static Module *Create(const std::string &class_name) {
+    const ModuleBuilder &builder =
+        ModuleBuilder::all_module_builders().find(class_name)->second;
+    Module *m = builder.CreateModule(
+        ModuleBuilder::GenerateDefaultName(builder.class_name(),
+                                           builder.name_template()),
+        &bess::metadata::default_pipeline);
+    ModuleBuilder::AddModule(m);
+    return m;
+  }
+
+  void Init(bool copy) {
+    bess::pb::GSOArg arg;
+    arg.set_copy(copy);
+    ASSERT_EQ(0, gso_->Init(arg).err());
+  }
+
+  static std::string RandomBytes(size_t len) {
+    Random rd;
+    std::string s(len, '\0');
+
+    for (size_t i = 0; i < len; i++) {
+      s[i] = rd.Get();
+    }
+    return s;
+  }
+
+  static std::string TcpFrame(const std::string &payload, uint8_t flags) {
+    std::string frame(kTcpHdrLen, '\0');
+    EthHeader *eth = reinterpret_cast<EthHeader *>(&frame[0]);
+    Ipv4Header *ip = reinterpret_cast<Ipv4Header *>(eth + 1);
+    TcpHeader *tcp = reinterpret_cast<TcpHeader *>(ip + 1);
+
+    eth->ether_type = be16_t(htons(0x0800));
+    ip->version = 4;
+    ip->header_length = sizeof(*ip) >> 2;
+    ip->length = htons(kTcpHdrLen - sizeof(*eth) + payload.size());
+    ip->id = htons(0xfffe);  // wraps around
+    ip->fragment_offset = htons(0x4000);
+    ip->ttl = 64;
+    ip->protocol = IPPROTO_TCP;
+    ip->src = htonl(0x0a000001);
+    ip->dst = htonl(0x0a000002);
+    tcp->src_port = htons(5001);
+    tcp->dst_port = htons(80);
+    tcp->seq_num = htonl(0xfffff000);  // wraps around
+    tcp->ack_num = htonl(1);
+    tcp->offset = (sizeof(*tcp) + 12) >> 2;
+    tcp->flags = flags;
+    tcp->window = htons(1024);
+    memset(tcp + 1, 0x01, 12);  // NOPs
+
+    return frame + payload;
+  }
+
+  static std::string UdpFrame(const std::string &payload, bool df) {
+    std::string frame(kUdpHdrLen, '\0');
+    EthHeader *eth = reinterpret_cast<EthHeader *>(&frame[0]);
+    Ipv4Header *ip = reinterpret_cast<Ipv4Header *>(eth + 1);
+    UdpHeader *udp = reinterpret_cast<UdpHeader *>(ip + 1);
+
+    eth->ether_type = be16_t(htons(0x0800));
+    ip->version = 4;
+    ip->header_length = sizeof(*ip) >> 2;
+    ip->length = htons(kUdpHdrLen - sizeof(*eth) + payload.size());
+    ip->id = htons(1234);
+    ip->fragment_offset = htons(df ? 0x4000 : 0);
+    ip->ttl = 64;
+    ip->protocol = IPPROTO_UDP;
+    ip->src = htonl(0x0a000001);
+    ip->dst = htonl(0x0a000002);
+    udp->src_port = htons(5001);
+    udp->dst_port = htons(53);
+    udp->length = htons(sizeof(*udp) + payload.size());
+
+    return frame + payload;
+  }
+
+  // Makes a packet of frame, in segments of at most seg_len bytes
+  static bess::Packet *Chain(const std::string &frame, size_t seg_len) {
+    bess::Packet *head = nullptr;
+    bess::Packet *tail = nullptr;
+
+    for (size_t off = 0; off < frame.size(); off += seg_len) {
+      size_t n = std::min(seg_len, frame.size() - off);
+      bess::Packet *seg =
+          reinterpret_cast<bess::Packet *>(rte_pktmbuf_alloc(pool_));
+      memcpy(seg->append(n), frame.data() + off, n);
+
+      if (!head) {
+        head = seg;
+      } else {
+        tail->set_next(seg);
+        head->set_nb_segs(head->nb_segs() + 1);
+        head->set_total_len(head->total_len() + n);
+      }
+      tail = seg;
+    }
+
+    return head;
+  }
+
+  static std::string Linearize(bess::Packet *pkt) {
+    std::string s;
+    for (bess::Packet *seg = pkt; seg; seg = seg->next()) {
+      s.append(seg->head_data<char *>(), seg->head_len());
+    }
+    return s;
+  }
+
+  void Run(bess::Packet *pkt) {
+    bess::PacketBatch batch;
+    batch.clear();
+    batch.add(pkt);
+    gso_->ProcessBatch(&batch);
+  }
+
+  // Checks the output TCP segments and returns their concatenated payload
+  std::string CheckTcpSegments(uint8_t flags) {
+    std::string payload;
+
+    for (size_t i = 0; i < sink_->pkts.size(); i++) {
+      std::string frame = Linearize(sink_->pkts[i]);
+      const Ipv4Header *ip = reinterpret_cast<const Ipv4Header *>(
+          frame.data() + sizeof(EthHeader));
+      const TcpHeader *tcp = reinterpret_cast<const TcpHeader *>(ip + 1);
+      size_t l4_len = frame.size() - sizeof(EthHeader) - sizeof(*ip);
+      bool last = (i == sink_->pkts.size() - 1);
+
+      EXPECT_EQ(frame.size(), sink_->pkts[i]->total_len());
+      EXPECT_EQ(frame.size() - sizeof(EthHeader), ntohs(ip->length));
+      EXPECT_LE(ntohs(ip->length), 1500);
+      EXPECT_EQ(static_cast<uint16_t>(0xfffe + i), ntohs(ip->id));
+      EXPECT_EQ(0, ChecksumFinish(ChecksumPartial(ip, sizeof(*ip))));
+
+      EXPECT_EQ(static_cast<uint32_t>(0xfffff000 + i * kMss),
+                ntohl(tcp->seq_num));
+      EXPECT_EQ(1, ntohl(tcp->ack_num));
+      uint8_t expected = flags;
+      if (i > 0) {
+        expected &= ~TCP_FLAG_CWR;
+      }
+      if (!last) {
+        expected &= ~(TCP_FLAG_FIN | TCP_FLAG_PUSH);
+      }
+      EXPECT_EQ(expected, tcp->flags);
+      EXPECT_EQ(0, ChecksumFinish(PseudoHeaderSum(ip->src, ip->dst,
+                                                  IPPROTO_TCP, l4_len) +
+                                  ChecksumPartial(tcp, l4_len)));
+
+      payload += frame.substr(kTcpHdrLen);
+    }
+
+    return payload;
+  }
+
+  static struct rte_mempool *pool_;
+
+  GSO *gso_;
+  CollectModule *sink_;
+  unsigned int free_pkts_;
+};
+
+struct rte_mempool *GSOTest::pool_ = nullptr;
+
+// A 10000-byte payload in an odd-sized chain, so that segment boundaries fall
+// at odd offsets of the input segments
+TEST_F(GSOTest, TcpSegments) {
+  Init(false);
+  const uint8_t flags =
+      TCP_FLAG_ACK | TCP_FLAG_PUSH | TCP_FLAG_FIN | TCP_FLAG_CWR;
+  std::string payload = RandomBytes(10000);
+
+  Run(Chain(TcpFrame(payload, flags), 1001));
+  ASSERT_EQ(7, sink_->pkts.size());
+  for (bess::Packet *pkt : sink_->pkts) {
+    // Zero copy: the headers plus indirect segments
+    EXPECT_LT(1, pkt->nb_segs());
+  }
+  EXPECT_EQ(payload, CheckTcpSegments(flags));
+}
+
+TEST_F(GSOTest, TcpCopy) {
+  Init(true);
+  std::string payload = RandomBytes(5000);
+
+  Run(Chain(TcpFrame(payload, TCP_FLAG_ACK), 1001));
+  ASSERT_EQ(4, sink_->pkts.size());
+  for (bess::Packet *pkt : sink_->pkts) {
+    EXPECT_EQ(1, pkt->nb_segs());
+  }
+  EXPECT_EQ(payload, CheckTcpSegments(TCP_FLAG_ACK));
+}
+
+// A short last segment is copied
+TEST_F(GSOTest, TcpShortTail) {
+  Init(false);
+  std::string payload = RandomBytes(kMss * 2 + 99);
+
+  Run(Chain(TcpFrame(payload, TCP_FLAG_ACK), SNBUF_DATA));
+  ASSERT_EQ(3, sink_->pkts.size());
+  EXPECT_LT(1, sink_->pkts[0]->nb_segs());
+  EXPECT_LT(1, sink_->pkts[1]->nb_segs());
+  EXPECT_EQ(1, sink_->pkts[2]->nb_segs());
+  EXPECT_EQ(payload, CheckTcpSegments(TCP_FLAG_ACK));
+}
+
+TEST_F(GSOTest, UdpFragments) {
+  Init(false);
+  std::string payload = RandomBytes(4000);
+  std::string frame = UdpFrame(payload, false);
+  const size_t kFragLen = 1480;
+
+  Run(Chain(frame, 1500));
+  ASSERT_EQ(3, sink_->pkts.size());
+
+  // The UDP header and payload, in fragments of 1480 bytes
+  std::string datagram = frame.substr(sizeof(EthHeader) + sizeof(Ipv4Header));
+  std::string reassembled;
+
+  for (size_t i = 0; i < sink_->pkts.size(); i++) {
+    std::string frag = Linearize(sink_->pkts[i]);
+    const Ipv4Header *ip =
+        reinterpret_cast<const Ipv4Header *>(frag.data() + sizeof(EthHeader));
+    bool last = (i == sink_->pkts.size() - 1);
+
+    EXPECT_EQ(frag.size() - sizeof(EthHeader), ntohs(ip->length));
+    EXPECT_EQ(1234, ntohs(ip->id));
+    EXPECT_EQ((last ? 0 : 0x2000) | (i * kFragLen >> 3),
+              ntohs(ip->fragment_offset));
+    EXPECT_EQ(0, ChecksumFinish(ChecksumPartial(ip, sizeof(*ip))));
+
+    reassembled += frag.substr(sizeof(EthHeader) + sizeof(*ip));
+  }
+
+  EXPECT_EQ(datagram, reassembled);
+}
+
+TEST_F(GSOTest, PassThrough) {
+  Init(false);
+  std::vector<bess::Packet *> pkts = {
+      Chain(TcpFrame(RandomBytes(kMss), TCP_FLAG_ACK), SNBUF_DATA),
+      Chain(UdpFrame(RandomBytes(4000), true), 1500),  // DF
+      Chain(std::string(2000, '\0'), 1000),            // not IPv4
+  };
+  std::vector<std::string> frames;
+
+  bess::PacketBatch batch;
+  batch.clear();
+  for (bess::Packet *pkt : pkts) {
+    frames.push_back(Linearize(pkt));
+    batch.add(pkt);
+  }
+  gso_->ProcessBatch(&batch);
+
+  ASSERT_EQ(pkts.size(), sink_->pkts.size());
+  for (size_t i = 0; i < pkts.size(); i++) {
+    EXPECT_EQ(pkts[i], sink_->pkts[i]);
+    EXPECT_EQ(frames[i], Linearize(sink_->pkts[i]));
+  }
+}
+
+}  // namespace (unnamed)
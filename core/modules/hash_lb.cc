@@ -1,7 +1,19 @@
 #include "hash_lb.h"
 
+#include <netinet/in.h>
 #include <rte_hash_crc.h>
 
+#include <cstring>
+
+#include "../utils/ether.h"
+#include "../utils/ip.h"
+#include "../utils/maglev.h"
+
+using bess::utils::EthHeader;
+using bess::utils::Ipv4Header;
+using bess::utils::Ipv6Header;
+using bess::utils::Maglev;
+
 const enum LbMode DEFAULT_MODE = LB_L4;
 
 static inline uint32_t hash_64(uint64_t val, uint32_t init_val) {
@@ -12,176 +24,275 @@ static inline uint32_t hash_64(uint64_t val, uint32_t init_val) {
 #endif
 }
 
-/* Returns a value in [0, range) as a function of an opaque number.
- * Also see utils/random.h */
-static inline uint16_t hash_range(uint32_t hashval, uint16_t range) {
-#if 1
-  union {
-    uint64_t i;
-    double d;
-  } tmp;
+static inline int is_valid_gate(gate_idx_t gate) {
+  return (gate < MAX_GATES || gate == DROP_GATE);
+}
 
-  /* the resulting number is 1.(b0)(b1)..(b31)00000..00 */
-  tmp.i = 0x3ff0000000000000ul | ((uint64_t)hashval << 20);
+// The fields of a flow that are hashed, with hash_64(v0, v1)
+struct FlowKey {
+  uint64_t v0;
+  uint32_t v1;
+};
 
-  return (tmp.d - 1.0) * range;
-#else
-  /* This IDIV instruction is significantly slower */
-  return hashval % range;
-#endif
+static inline FlowKey l2_key(const EthHeader *eth) {
+  const char *head = reinterpret_cast<const char *>(eth);
+  return {*(reinterpret_cast<const uint64_t *>(head)),
+          *(reinterpret_cast<const uint32_t *>(head + 8))};
 }
 
-static inline int is_valid_gate(gate_idx_t gate) {
-  return (gate < MAX_GATES || gate == DROP_GATE);
+// Without a branch, which would mispredict half of the time
+template <typename T>
+static inline void swap_if(bool cond, T *a, T *b) {
+  T diff = (*a ^ *b) & -static_cast<T>(cond);
+  *a ^= diff;
+  *b ^= diff;
 }
 
-const Commands HashLB::cmds = {{"set_mode", "HashLBCommandSetModeArg",
-                                MODULE_CMD_FUNC(&HashLB::CommandSetMode), 0},
-                               {"set_gates", "HashLBCommandSetGatesArg",
-                                MODULE_CMD_FUNC(&HashLB::CommandSetGates), 0}};
+// Both addresses, ordered if symmetric
+template <bool symmetric>
+static inline uint64_t ipv4_addrs(const Ipv4Header *ip) {
+  uint32_t src = ip->src;
+  uint32_t dst = ip->dst;
 
-pb_cmd_response_t HashLB::CommandSetMode(
-    const bess::pb::HashLBCommandSetModeArg &arg) {
-  pb_cmd_response_t response;
-  if (arg.mode() == "l2") {
-    mode_ = LB_L2;
-  } else if (arg.mode() == "l3") {
-    mode_ = LB_L3;
-  } else if (arg.mode() == "l4") {
-    mode_ = LB_L4;
-  } else {
-    set_cmd_response_error(&response,
-                           pb_error(EINVAL, "available LB modes: l2, l3, l4"));
+  if (symmetric) {
+    swap_if(src > dst, &src, &dst);
   }
-  return response;
+  return (static_cast<uint64_t>(dst) << 32) | src;
 }
 
-pb_cmd_response_t HashLB::CommandSetGates(
-    const bess::pb::HashLBCommandSetGatesArg &arg) {
-  pb_cmd_response_t response;
+// Both addresses, each folded to 32 bits, ordered if symmetric
+template <bool symmetric>
+static inline uint64_t ipv6_addrs(const Ipv6Header *ip) {
+  uint64_t src[2];
+  uint64_t dst[2];
+  memcpy(src, ip->src, sizeof(src));
+  memcpy(dst, ip->dst, sizeof(dst));
 
-  if (arg.gates_size() > MAX_HLB_GATES) {
-    set_cmd_response_error(
-        &response, pb_error(EINVAL, "no more than %d gates", MAX_HLB_GATES));
-    return response;
+  uint32_t src_hash = hash_64(src[1], hash_64(src[0], 0));
+  uint32_t dst_hash = hash_64(dst[1], hash_64(dst[0], 0));
+
+  if (symmetric) {
+    swap_if((src[0] > dst[0]) | ((src[0] == dst[0]) & (src[1] > dst[1])),
+            &src_hash, &dst_hash);
   }
+  return (static_cast<uint64_t>(dst_hash) << 32) | src_hash;
+}
 
-  for (int i = 0; i < arg.gates_size(); i++) {
-    gates_[i] = arg.gates(i);
-    if (!is_valid_gate(gates_[i])) {
-      set_cmd_response_error(&response,
-                             pb_error(EINVAL, "invalid gate %d", gates_[i]));
-      return response;
-    }
+// The L4 protocol, and the ports if TCP or UDP, ordered if symmetric
+template <bool symmetric>
+static inline uint32_t l4_fields(uint8_t protocol, const void *l4) {
+  if (protocol != IPPROTO_TCP && protocol != IPPROTO_UDP) {
+    return protocol;
   }
 
-  num_gates_ = arg.gates_size();
+  const uint16_t *ports = reinterpret_cast<const uint16_t *>(l4);
+  uint16_t src_port = ports[0];
+  uint16_t dst_port = ports[1];
 
-  set_cmd_response_error(&response, pb_errno(0));
-  return response;
+  if (symmetric) {
+    swap_if(src_port > dst_port, &src_port, &dst_port);
+  }
+  return ((static_cast<uint32_t>(dst_port) << 16) | src_port) ^ protocol;
 }
 
-pb_error_t HashLB::Init(const bess::pb::HashLBArg &arg) {
-  mode_ = DEFAULT_MODE;
+template <bool symmetric, bool l4>
+static inline FlowKey ip_key(const EthHeader *eth) {
+  switch (eth->ether_type.to_cpu()) {
+    case 0x0800: {
+      const Ipv4Header *ip = reinterpret_cast<const Ipv4Header *>(eth + 1);
+      const char *l4_header =
+          reinterpret_cast<const char *>(ip) + ip->header_length * 4;
+
+      // Fragments have no ports (but for the first)
+      if (l4 && !(ntohs(ip->fragment_offset) & 0x3fff)) {
+        return {ipv4_addrs<symmetric>(ip),
+                l4_fields<symmetric>(ip->protocol, l4_header)};
+      }
+      return {ipv4_addrs<symmetric>(ip), l4 ? ip->protocol : 0u};
+    }
 
-  if (arg.gates_size() > MAX_HLB_GATES) {
-    return pb_error(EINVAL, "no more than %d gates", MAX_HLB_GATES);
+    case 0x86dd: {
+      const Ipv6Header *ip = reinterpret_cast<const Ipv6Header *>(eth + 1);
+      return {ipv6_addrs<symmetric>(ip),
+              l4 ? l4_fields<symmetric>(ip->next_header, ip + 1) : 0u};
+    }
+
+    default:
+      return l2_key(eth);
   }
+}
 
-  for (int i = 0; i < arg.gates_size(); i++) {
-    gates_[i] = arg.gates(i);
-    if (!is_valid_gate(gates_[i])) {
-      return pb_error(EINVAL, "invalid gate %d", gates_[i]);
-    }
+// The key extraction is inlined into the loop, so that the hashes of
+// different packets (free of mispredicted branches) overlap in the pipeline
+template <FlowKey (*key)(const EthHeader *)>
+static inline void hash_batch(bess::PacketBatch *batch, uint32_t *hashes) {
+  const int cnt = batch->cnt();
+
+  for (int i = 0; i < cnt; i++) {
+    FlowKey k = key(batch->pkts()[i]->head_data<EthHeader *>());
+    hashes[i] = hash_64(k.v0, k.v1);
   }
+}
 
-  num_gates_ = arg.gates_size();
+const Commands HashLB::cmds = {{"set_mode", "HashLBCommandSetModeArg",
+                                MODULE_CMD_FUNC(&HashLB::CommandSetMode), 0},
+                               {"set_gates", "HashLBCommandSetGatesArg",
+                                MODULE_CMD_FUNC(&HashLB::CommandSetGates), 0}};
 
-  if (arg.mode() == "l2") {
+pb_error_t HashLB::SetMode(const std::string &mode) {
+  if (mode == "l2") {
     mode_ = LB_L2;
-  } else if (arg.mode() == "l3") {
+  } else if (mode == "l3") {
     mode_ = LB_L3;
-  } else if (arg.mode() == "l4") {
+  } else if (mode == "l4") {
     mode_ = LB_L4;
+  } else if (mode == "l3_sym") {
+    mode_ = LB_L3_SYM;
+  } else if (mode == "l4_sym") {
+    mode_ = LB_L4_SYM;
   } else {
-    return pb_error(EINVAL, "available LB modes: l2, l3, l4");
+    return pb_error(EINVAL, "available LB modes: l2, l3, l4, l3_sym, l4_sym");
   }
 
   return pb_errno(0);
 }
 
-void HashLB::LbL2(bess::PacketBatch *batch, gate_idx_t *out_gates) {
-  for (int i = 0; i < batch->cnt(); i++) {
-    bess::Packet *snb = batch->pkts()[i];
-    char *head = snb->head_data<char *>();
-
-    uint64_t v0 = *(reinterpret_cast<uint64_t *>(head));
-    uint32_t v1 = *(reinterpret_cast<uint32_t *>(head + 8));
+template <typename T>
+pb_error_t HashLB::SetGates(const T &arg) {
+  if (arg.gates_size() > MAX_HLB_GATES) {
+    return pb_error(EINVAL, "no more than %d gates", MAX_HLB_GATES);
+  }
 
-    uint32_t hash_val = hash_64(v0, v1);
+  if (static_cast<size_t>(arg.gates_size()) > table_.size()) {
+    return pb_error(EINVAL, "no more gates than the table size (%zu)",
+                    table_.size());
+  }
 
-    out_gates[i] = gates_[hash_range(hash_val, num_gates_)];
+  if (arg.weights_size() && arg.weights_size() != arg.gates_size()) {
+    return pb_error(EINVAL, "%d weights for %d gates", arg.weights_size(),
+                    arg.gates_size());
   }
-}
 
-void HashLB::LbL3(bess::PacketBatch *batch, gate_idx_t *out_gates) {
-  /* assumes untagged packets */
-  const int ip_offset = 14;
+  std::vector<gate_idx_t> gates;
+  std::vector<Maglev::Backend> backends;
+  std::vector<int> times_listed(MAX_GATES + 1);
 
-  for (int i = 0; i < batch->cnt(); i++) {
-    bess::Packet *snb = batch->pkts()[i];
-    char *head = snb->head_data<char *>();
+  for (int i = 0; i < arg.gates_size(); i++) {
+    gate_idx_t gate = arg.gates(i);
+    if (!is_valid_gate(gate)) {
+      return pb_error(EINVAL, "invalid gate %d", gate);
+    }
 
-    uint32_t hash_val;
-    uint64_t v = *(reinterpret_cast<uint64_t *>(head + ip_offset + 12));
+    uint64_t weight = arg.weights_size() ? arg.weights(i) : 1;
+    if (weight > Maglev::kMaxWeight) {
+      return pb_error(EINVAL, "weight of gate %d must be %u or less", gate,
+                      Maglev::kMaxWeight);
+    }
 
-    hash_val = hash_64(v, 0);
+    // A gate listed more than once gets a share of the table each time, as
+    // a different backend
+    uint64_t id = (static_cast<uint64_t>(times_listed[gate]++) << 16) | gate;
+    gates.push_back(gate);
+    backends.push_back({id, static_cast<uint32_t>(weight)});
+  }
 
-    out_gates[i] = gates_[hash_range(hash_val, num_gates_)];
+  std::vector<int> table(table_.size());
+  Maglev::Populate(backends, &table);
+  for (size_t i = 0; i < table.size(); i++) {
+    table_[i] = (table[i] >= 0) ? gates[table[i]] : DROP_GATE;
   }
-}
 
-void HashLB::LbL4(bess::PacketBatch *batch, gate_idx_t *out_gates) {
-  /* assumes untagged packets without IP options */
-  const int ip_offset = 14;
-  const int l4_offset = ip_offset + 20;
+  return pb_errno(0);
+}
 
-  for (int i = 0; i < batch->cnt(); i++) {
-    bess::Packet *snb = batch->pkts()[i];
-    char *head = snb->head_data<char *>();
+pb_cmd_response_t HashLB::CommandSetMode(
+    const bess::pb::HashLBCommandSetModeArg &arg) {
+  pb_cmd_response_t response;
+  set_cmd_response_error(&response, SetMode(arg.mode()));
+  return response;
+}
 
-    uint32_t hash_val;
-    uint64_t v0 = *(reinterpret_cast<uint64_t *>(head + ip_offset + 12));
-    uint32_t v1 = *(reinterpret_cast<uint64_t *>(head + l4_offset)); /* ports */
+pb_cmd_response_t HashLB::CommandSetGates(
+    const bess::pb::HashLBCommandSetGatesArg &arg) {
+  pb_cmd_response_t response;
+  set_cmd_response_error(&response, SetGates(arg));
+  return response;
+}
 
-    v1 ^= *(reinterpret_cast<uint32_t *>(head + ip_offset + 9)); /* ip_proto */
+pb_error_t HashLB::Init(const bess::pb::HashLBArg &arg) {
+  mode_ = DEFAULT_MODE;
 
-    hash_val = hash_64(v0, v1);
+  uint64_t table_size =
+      arg.table_size() ? arg.table_size() : kDefaultTableSize;
+  if (table_size > kMaxTableSize || !Maglev::IsPrime(table_size)) {
+    return pb_error(EINVAL, "table_size must be a prime of %u or less",
+                    kMaxTableSize);
+  }
+  table_.resize(table_size, DROP_GATE);
 
-    out_gates[i] = gates_[hash_range(hash_val, num_gates_)];
+  pb_error_t err = SetGates(arg);
+  if (err.err() != 0) {
+    return err;
   }
+
+  return SetMode(arg.mode());
 }
 
-void HashLB::ProcessBatch(bess::PacketBatch *batch) {
-  gate_idx_t out_gates[bess::PacketBatch::kMaxBurst];
+void HashLB::LbL2(bess::PacketBatch *batch, uint32_t *hashes) {
+  hash_batch<l2_key>(batch, hashes);
+}
+
+/* assumes untagged packets */
+template <bool symmetric>
+void HashLB::LbL3(bess::PacketBatch *batch, uint32_t *hashes) {
+  hash_batch<ip_key<symmetric, false>>(batch, hashes);
+}
+
+/* assumes untagged packets */
+template <bool symmetric>
+void HashLB::LbL4(bess::PacketBatch *batch, uint32_t *hashes) {
+  hash_batch<ip_key<symmetric, true>>(batch, hashes);
+}
+
+void HashLB::Classify(bess::PacketBatch *batch, gate_idx_t *out_gates) {
+  uint32_t hashes[bess::PacketBatch::kMaxBurst];
 
   switch (mode_) {
     case LB_L2:
-      LbL2(batch, out_gates);
+      LbL2(batch, hashes);
       break;
 
     case LB_L3:
-      LbL3(batch, out_gates);
+      LbL3<false>(batch, hashes);
       break;
 
     case LB_L4:
-      LbL4(batch, out_gates);
+      LbL4<false>(batch, hashes);
+      break;
+
+    case LB_L3_SYM:
+      LbL3<true>(batch, hashes);
+      break;
+
+    case LB_L4_SYM:
+      LbL4<true>(batch, hashes);
       break;
 
     default:
       DCHECK(0);
   }
 
+  // Scales the hash to [0, size), without a division
+  const uint64_t size = table_.size();
+  for (int i = 0; i < batch->cnt(); i++) {
+    out_gates[i] = table_[(hashes[i] * size) >> 32];
+  }
+}
+
+void HashLB::ProcessBatch(bess::PacketBatch *batch) {
+  gate_idx_t out_gates[bess::PacketBatch::kMaxBurst];
+
+  Classify(batch, out_gates);
   RunSplit(out_gates, batch);
 }
 
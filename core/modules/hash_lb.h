@@ -1,42 +1,67 @@
 #ifndef BESS_MODULES_HASHLB_H_
 #define BESS_MODULES_HASHLB_H_
 
+#include <string>
+#include <vector>
+
 #include "../module.h"
 #include "../module_msg.pb.h"
 
 #define MAX_HLB_GATES 16384
 
-/* TODO: add symmetric mode (e.g., LB_L4_SYM), v6 mode, etc. */
+/* The L3 and L4 modes take IPv4 and IPv6 (without extension headers) packets,
+ * and hash others as in LB_L2. Ports are of TCP and UDP only. */
 enum LbMode {
-  LB_L2, /* dst MAC + src MAC */
-  LB_L3, /* src IP + dst IP */
-  LB_L4  /* L4 proto + src IP + dst IP + src port + dst port */
+  LB_L2,     /* dst MAC + src MAC */
+  LB_L3,     /* src IP + dst IP */
+  LB_L4,     /* L4 proto + src IP + dst IP + src port + dst port */
+  LB_L3_SYM, /* as LB_L3, but the same for both directions of a flow */
+  LB_L4_SYM  /* as LB_L4, but the same for both directions of a flow */
 };
 
+// Splits packets over gates by the hash of their flow, which indexes a
+// Maglev lookup table of the gates (see utils/maglev.h). When gates are
+// added or removed, few flows of the other gates move to others.
 class HashLB final : public Module {
  public:
   static const gate_idx_t kNumOGates = MAX_GATES;
 
+  static const uint32_t kDefaultTableSize = 65537;
+  static const uint32_t kMaxTableSize = 1 << 20;
+
   static const Commands cmds;
 
-  HashLB() : Module(), gates_(), num_gates_(), mode_() {}
+  HashLB() : Module(), table_(), mode_() {}
 
   pb_error_t Init(const bess::pb::HashLBArg &arg);
 
   void ProcessBatch(bess::PacketBatch *batch) override;
 
+  // Sets out_gates[i] to the gate of the i-th packet of the batch
+  void Classify(bess::PacketBatch *batch, gate_idx_t *out_gates);
+
   pb_cmd_response_t CommandSetMode(
       const bess::pb::HashLBCommandSetModeArg &arg);
   pb_cmd_response_t CommandSetGates(
       const bess::pb::HashLBCommandSetGatesArg &arg);
 
  private:
-  void LbL2(bess::PacketBatch *batch, gate_idx_t *ogates);
-  void LbL3(bess::PacketBatch *batch, gate_idx_t *ogates);
-  void LbL4(bess::PacketBatch *batch, gate_idx_t *ogates);
+  // Each sets hashes[i] to the hash of the flow of the i-th packet
+  void LbL2(bess::PacketBatch *batch, uint32_t *hashes);
+  template <bool symmetric>
+  void LbL3(bess::PacketBatch *batch, uint32_t *hashes);
+  template <bool symmetric>
+  void LbL4(bess::PacketBatch *batch, uint32_t *hashes);
+
+  pb_error_t SetMode(const std::string &mode);
+
+  // Repopulates table_ (of its current size) with the gates and weights of
+  // arg, a HashLBArg or HashLBCommandSetGatesArg
+  template <typename T>
+  pb_error_t SetGates(const T &arg);
 
-  gate_idx_t gates_[MAX_HLB_GATES];
-  int num_gates_;
+  // Gates by the hash of the flow, scaled to the size
+  std::vector<gate_idx_t> table_;
   enum LbMode mode_;
 };
 
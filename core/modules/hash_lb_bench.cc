@@ -0,0 +1,145 @@
+// Benchmarks for the HashLB module: classifying packets of random TCP flows
+// in each mode, and populating the Maglev table when the gates change.
+
+#include <benchmark/benchmark.h>
+#include <glog/logging.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <string>
+#include <vector>
+
+#include "../utils/ether.h"
+#include "../utils/ip.h"
+#include "../utils/random.h"
+#include "hash_lb.h"
+
+using bess::utils::EthHeader;
+using bess::utils::Ipv4Header;
+using bess::utils::Ipv6Header;
+using bess::utils::be16_t;
+
+namespace {
+
+const char *kModes[] = {"l2", "l3", "l4", "l3_sym", "l4_sym"};
+const int kNumPackets = 1 << 12;
+const int kNumGates = 16;
+
+class HashLBFixture : public benchmark::Fixture {
+ public:
+  void SetUp(benchmark::State &state) override {
+    bool ipv6 = state.range(1);
+    Random rng;
+    rng.SetSeed(0);
+
+    bess::pb::HashLBArg arg;
+    arg.set_mode(kModes[state.range(0)]);
+    for (int gate = 0; gate < kNumGates; gate++) {
+      arg.add_gates(gate);
+    }
+    CHECK_EQ(lb_.Init(arg).err(), 0);
+
+    for (int i = 0; i < kNumPackets; i++) {
+      bess::Packet *pkt = new bess::Packet();
+      memset(pkt, 0, sizeof(*pkt));
+      pkt->set_buffer(pkt->data());
+      pkts_.push_back(pkt);
+
+      EthHeader *eth = pkt->head_data<EthHeader *>();
+      uint16_t *ports;
+      if (ipv6) {
+        Ipv6Header *ip = reinterpret_cast<Ipv6Header *>(eth + 1);
+        eth->ether_type = be16_t(htons(0x86dd));
+        ip->next_header = IPPROTO_TCP;
+        for (int j = 0; j < 16; j++) {
+          ip->src[j] = rng.Get();
+          ip->dst[j] = rng.Get();
+        }
+        ports = reinterpret_cast<uint16_t *>(ip + 1);
+      } else {
+        Ipv4Header *ip = reinterpret_cast<Ipv4Header *>(eth + 1);
+        eth->ether_type = be16_t(htons(0x0800));
+        ip->version = 4;
+        ip->header_length = 5;
+        ip->protocol = IPPROTO_TCP;
+        ip->src = rng.Get();
+        ip->dst = rng.Get();
+        ports = reinterpret_cast<uint16_t *>(ip + 1);
+      }
+      ports[0] = rng.Get();
+      ports[1] = rng.Get();
+    }
+  }
+
+  void TearDown(benchmark::State &) override {
+    for (bess::Packet *pkt : pkts_) {
+      delete pkt;
+    }
+    pkts_.clear();
+  }
+
+ protected:
+  HashLB lb_;
+  std::vector<bess::Packet *> pkts_;
+};
+
+}  // namespace (unnamed)
+
+// Modes (by index of kModes) x IPv6
+BENCHMARK_DEFINE_F(HashLBFixture, Classify)(benchmark::State &state) {
+  const int burst = bess::PacketBatch::kMaxBurst;
+  gate_idx_t out_gates[burst];
+  size_t i = 0;
+
+  while (state.KeepRunning()) {
+    bess::PacketBatch batch;
+    batch.clear();
+    for (int j = 0; j < burst; j++) {
+      batch.add(pkts_[i + j]);
+    }
+
+    lb_.Classify(&batch, out_gates);
+    benchmark::DoNotOptimize(out_gates[0]);
+
+    i = (i + burst) % kNumPackets;
+  }
+
+  state.SetItemsProcessed(state.iterations() * burst);
+}
+
+BENCHMARK_REGISTER_F(HashLBFixture, Classify)
+    ->Args({0, false})
+    ->Args({1, false})
+    ->Args({2, false})
+    ->Args({3, false})
+    ->Args({4, false})
+    ->Args({2, true})
+    ->Args({4, true});
+
+// Setting the gates (table size x number of gates), with varied weights
+static void BM_HashLBSetGates(benchmark::State &state) {
+  HashLB lb;
+  bess::pb::HashLBArg arg;
+  arg.set_mode("l4");
+  arg.set_table_size(state.range(0));
+  CHECK_EQ(lb.Init(arg).err(), 0);
+
+  bess::pb::HashLBCommandSetGatesArg set_gates;
+  for (int gate = 0; gate < state.range(1); gate++) {
+    set_gates.add_gates(gate);
+    set_gates.add_weights(gate % 4 + 1);
+  }
+
+  while (state.KeepRunning()) {
+    CHECK_EQ(lb.CommandSetGates(set_gates).error().err(), 0);
+  }
+}
+
+BENCHMARK(BM_HashLBSetGates)
+    ->Args({65537, 16})
+    ->Args({65537, 1024})
+    ->Args({1048573, 1024})
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
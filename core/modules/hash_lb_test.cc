@@ -0,0 +1,312 @@
+#include "hash_lb.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../utils/ether.h"
+#include "../utils/ip.h"
+#include "../utils/random.h"
+
+using bess::utils::EthHeader;
+using bess::utils::Ipv4Header;
+using bess::utils::Ipv6Header;
+using bess::utils::be16_t;
+
+namespace {
+
+const int kNumFlows = 10000;
+
+struct Flow {
+  bool ipv6;
+  uint64_t src;  // The last 64 bits of IPv6 addresses
+  uint64_t dst;
+  uint8_t protocol;
+  uint16_t src_port;
+  uint16_t dst_port;
+
+  Flow Reverse() const {
+    return {ipv6, dst, src, protocol, dst_port, src_port};
+  }
+};
+
+class HashLBTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() { rng_.SetSeed(0); }
+
+  int Init(const std::string &mode, const std::vector<gate_idx_t> &gates,
+           const std::vector<uint64_t> &weights = {},
+           uint64_t table_size = 0) {
+    bess::pb::HashLBArg arg;
+    arg.set_mode(mode);
+    for (gate_idx_t gate : gates) {
+      arg.add_gates(gate);
+    }
+    for (uint64_t weight : weights) {
+      arg.add_weights(weight);
+    }
+    arg.set_table_size(table_size);
+    return lb_.Init(arg).err();
+  }
+
+  int SetGates(const std::vector<gate_idx_t> &gates,
+               const std::vector<uint64_t> &weights = {}) {
+    bess::pb::HashLBCommandSetGatesArg arg;
+    for (gate_idx_t gate : gates) {
+      arg.add_gates(gate);
+    }
+    for (uint64_t weight : weights) {
+      arg.add_weights(weight);
+    }
+    return lb_.CommandSetGates(arg).error().err();
+  }
+
+  Flow RandomFlow(bool ipv6) {
+    return {ipv6, rng_.Get() | (uint64_t{rng_.Get()} << 32),
+            rng_.Get() | (uint64_t{rng_.Get()} << 32),
+            rng_.GetRange(2) ? uint8_t{IPPROTO_TCP} : uint8_t{IPPROTO_UDP},
+            static_cast<uint16_t>(rng_.GetRange(65536)),
+            static_cast<uint16_t>(rng_.GetRange(65536))};
+  }
+
+  // A packet of the flow, with random fields that are not of the flow
+  bess::Packet *MakePacket(const Flow &flow) {
+    bess::Packet *pkt = new bess::Packet();
+    memset(pkt, 0, sizeof(*pkt));
+    pkt->set_buffer(pkt->data());
+
+    EthHeader *eth = pkt->head_data<EthHeader *>();
+    uint16_t *ports;
+
+    for (size_t i = 0; i < sizeof(eth->dst_addr.bytes); i++) {
+      eth->dst_addr.bytes[i] = flow.dst >> (i * 8);
+      eth->src_addr.bytes[i] = flow.src >> (i * 8);
+    }
+
+    if (flow.ipv6) {
+      Ipv6Header *ip = reinterpret_cast<Ipv6Header *>(eth + 1);
+      eth->ether_type = be16_t(htons(0x86dd));
+      ip->vtc_flow = htonl((6 << 28) | rng_.GetRange(1 << 20));
+      ip->next_header = flow.protocol;
+      ip->hop_limit = rng_.Get();
+      ip->src[0] = ip->dst[0] = 0x20;
+      memcpy(ip->src + 8, &flow.src, 8);
+      memcpy(ip->dst + 8, &flow.dst, 8);
+      ports = reinterpret_cast<uint16_t *>(ip + 1);
+    } else {
+      Ipv4Header *ip = reinterpret_cast<Ipv4Header *>(eth + 1);
+      eth->ether_type = be16_t(htons(0x0800));
+      ip->version = 4;
+      ip->header_length = 5;
+      ip->id = rng_.Get();
+      ip->ttl = rng_.Get();
+      ip->checksum = rng_.Get();
+      ip->protocol = flow.protocol;
+      ip->src = flow.src;
+      ip->dst = flow.dst;
+      ports = reinterpret_cast<uint16_t *>(ip + 1);
+    }
+
+    ports[0] = htons(flow.src_port);
+    ports[1] = htons(flow.dst_port);
+    ports[2] = rng_.Get();  // e.g., the sequence number of TCP
+    return pkt;
+  }
+
+  std::vector<gate_idx_t> Classify(const std::vector<Flow> &flows) {
+    std::vector<gate_idx_t> gates(flows.size());
+
+    for (size_t i = 0; i < flows.size(); i += bess::PacketBatch::kMaxBurst) {
+      bess::PacketBatch batch;
+      batch.clear();
+      for (size_t j = i; j < flows.size() && !batch.full(); j++) {
+        batch.add(MakePacket(flows[j]));
+      }
+      lb_.Classify(&batch, &gates[i]);
+
+      for (int j = 0; j < batch.cnt(); j++) {
+        delete batch.pkts()[j];
+      }
+    }
+    return gates;
+  }
+
+  gate_idx_t Classify(const Flow &flow) {
+    return Classify(std::vector<Flow>{flow})[0];
+  }
+
+  std::vector<Flow> RandomFlows(bool ipv6) {
+    std::vector<Flow> flows;
+    for (int i = 0; i < kNumFlows; i++) {
+      flows.push_back(RandomFlow(ipv6));
+    }
+    return flows;
+  }
+
+  Random rng_;
+  HashLB lb_;
+};
+
+TEST_F(HashLBTest, InvalidArgs) {
+  EXPECT_EQ(EINVAL, Init("l5", {0, 1}));
+  EXPECT_EQ(EINVAL, Init("l4", {0, 1}, {1}));
+  EXPECT_EQ(EINVAL, Init("l4", {0, 1}, {1, 101}));
+  EXPECT_EQ(EINVAL, Init("l4", {0, MAX_GATES + 1}));
+  EXPECT_EQ(EINVAL, Init("l4", {0, 1}, {}, 65536));
+  EXPECT_EQ(EINVAL, Init("l4", {0, 1, 2}, {}, 2));
+  EXPECT_EQ(EINVAL, Init("l4", {0, 1}, {}, 1048583));
+  EXPECT_EQ(0, Init("l4", {0, 1}, {}, 3));
+
+  bess::pb::HashLBCommandSetModeArg arg;
+  arg.set_mode("l5");
+  EXPECT_EQ(EINVAL, lb_.CommandSetMode(arg).error().err());
+}
+
+// Packets of a flow go to the same gate, whatever the fields of the headers
+// that are not of the flow (IP ID, TTL, checksum, ...)
+TEST_F(HashLBTest, Flows) {
+  for (bool ipv6 : {false, true}) {
+    for (std::string mode : {"l2", "l3", "l4", "l3_sym", "l4_sym"}) {
+      ASSERT_EQ(0, Init(mode, {0, 1, 2, 3}));
+      std::vector<Flow> flows = RandomFlows(ipv6);
+      EXPECT_EQ(Classify(flows), Classify(flows)) << mode;
+
+      // Spread evenly
+      std::vector<int> per_gate(4);
+      for (gate_idx_t gate : Classify(flows)) {
+        per_gate[gate]++;
+      }
+      for (int n : per_gate) {
+        EXPECT_NEAR(kNumFlows / 4, n, kNumFlows / 20) << mode;
+      }
+    }
+  }
+}
+
+TEST_F(HashLBTest, Modes) {
+  const std::vector<gate_idx_t> gates = {0, 1, 2, 3};
+
+  for (bool ipv6 : {false, true}) {
+    std::vector<Flow> flows = RandomFlows(ipv6);
+    std::vector<Flow> reversed;
+    std::vector<Flow> other_ports;
+    std::vector<Flow> other_addrs;
+
+    for (const Flow &flow : flows) {
+      reversed.push_back(flow.Reverse());
+      other_ports.push_back(flow);
+      other_ports.back().src_port++;
+      other_addrs.push_back(flow);
+      other_addrs.back().src++;
+    }
+
+    // Flows that differ in the hashed fields mostly go to other gates
+    auto differ = [](const std::vector<gate_idx_t> &a,
+                     const std::vector<gate_idx_t> &b) {
+      int n = 0;
+      for (size_t i = 0; i < a.size(); i++) {
+        n += a[i] != b[i];
+      }
+      return n;
+    };
+
+    ASSERT_EQ(0, Init("l3", gates));
+    std::vector<gate_idx_t> l3 = Classify(flows);
+    EXPECT_EQ(l3, Classify(other_ports));
+    EXPECT_LT(kNumFlows / 2, differ(l3, Classify(other_addrs)));
+
+    ASSERT_EQ(0, Init("l4", gates));
+    std::vector<gate_idx_t> l4 = Classify(flows);
+    EXPECT_LT(kNumFlows / 2, differ(l4, Classify(other_ports)));
+    EXPECT_LT(kNumFlows / 2, differ(l4, Classify(reversed)));
+
+    ASSERT_EQ(0, Init("l3_sym", gates));
+    std::vector<gate_idx_t> l3_sym = Classify(flows);
+    EXPECT_EQ(l3_sym, Classify(reversed));
+    EXPECT_EQ(l3_sym, Classify(other_ports));
+    EXPECT_LT(kNumFlows / 2, differ(l3_sym, Classify(other_addrs)));
+
+    ASSERT_EQ(0, Init("l4_sym", gates));
+    std::vector<gate_idx_t> l4_sym = Classify(flows);
+    EXPECT_EQ(l4_sym, Classify(reversed));
+    EXPECT_LT(kNumFlows / 2, differ(l4_sym, Classify(other_ports)));
+  }
+}
+
+// Changes of the gates move only about the flows that have to move, unlike
+// spreading the hash over the gates directly, which moves (n - 1) / n of them
+TEST_F(HashLBTest, Disruption) {
+  const int kNumGates = 10;
+  std::vector<gate_idx_t> gates;
+  for (gate_idx_t gate = 0; gate < kNumGates; gate++) {
+    gates.push_back(gate);
+  }
+  ASSERT_EQ(0, Init("l4", gates));
+
+  std::vector<Flow> flows = RandomFlows(false);
+  std::vector<gate_idx_t> before = Classify(flows);
+
+  auto moved = [&](const std::vector<gate_idx_t> &after) {
+    int n = 0;
+    for (int i = 0; i < kNumFlows; i++) {
+      n += before[i] != after[i];
+    }
+    return static_cast<double>(n) / kNumFlows;
+  };
+
+  // Removing a gate moves its flows, and about no others
+  std::vector<gate_idx_t> fewer = gates;
+  fewer.erase(fewer.begin() + 3);
+  ASSERT_EQ(0, SetGates(fewer));
+  std::vector<gate_idx_t> after = Classify(flows);
+  for (int i = 0; i < kNumFlows; i++) {
+    EXPECT_NE(3, after[i]);
+  }
+  EXPECT_NEAR(1.0 / kNumGates, moved(after), 0.25 / kNumGates);
+
+  // All flows go back to their gates
+  ASSERT_EQ(0, SetGates(gates));
+  EXPECT_EQ(before, Classify(flows));
+
+  // A new gate takes about its share
+  std::vector<gate_idx_t> more = gates;
+  more.push_back(kNumGates);
+  ASSERT_EQ(0, SetGates(more));
+  EXPECT_NEAR(1.0 / (kNumGates + 1), moved(Classify(flows)),
+              0.25 / (kNumGates + 1));
+
+  // Tripling the weight of a gate moves flows to it only
+  std::vector<uint64_t> weights(kNumGates, 1);
+  weights[0] = 3;
+  ASSERT_EQ(0, SetGates(gates, weights));
+  after = Classify(flows);
+  EXPECT_NEAR(3.0 / (kNumGates + 2) - 1.0 / kNumGates, moved(after),
+              0.25 / kNumGates);
+
+  int on_gate0 = 0;
+  for (gate_idx_t gate : after) {
+    on_gate0 += (gate == 0);
+  }
+  EXPECT_NEAR(kNumFlows * 3 / (kNumGates + 2), on_gate0, kNumFlows / 50);
+
+  // A gate listed twice gets two shares, as with weight 2
+  std::vector<gate_idx_t> twice = gates;
+  twice.push_back(0);
+  ASSERT_EQ(0, SetGates(twice));
+  on_gate0 = 0;
+  for (gate_idx_t gate : Classify(flows)) {
+    on_gate0 += (gate == 0);
+  }
+  EXPECT_NEAR(kNumFlows * 2 / (kNumGates + 1), on_gate0, kNumFlows / 50);
+
+  ASSERT_EQ(0, SetGates({}));
+  for (gate_idx_t gate : Classify(flows)) {
+    ASSERT_EQ(DROP_GATE, gate);
+  }
+}
+
+}  // namespace (unnamed)
@@ -1,185 +1,411 @@
 #include "ip_lookup.h"
 
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <x86intrin.h>
 
-#include <rte_byteorder.h>
+#include <unordered_map>
+
+#if !(__SSE4_2__ && __x86_64)
 #include <rte_config.h>
-#include <rte_errno.h>
-#include <rte_ether.h>
-#include <rte_ip.h>
-#include <rte_lpm.h>
+#include <rte_hash_crc.h>
+#endif
+
+#include "../utils/ether.h"
+#include "../utils/ip.h"
+#include "../utils/rcu.h"
+
+using bess::utils::EthHeader;
+using bess::utils::Ipv4Header;
+using bess::utils::Lpm4;
+using bess::utils::Rcu;
 
-#define VECTOR_OPTIMIZATION 1
+// Differs from that of HashLB, so that the gates of a group do not depend on
+// which gate of an upstream HashLB the flow took
+static const uint32_t kHashSeed = 0x9e3779b9;
 
 static inline int is_valid_gate(gate_idx_t gate) {
   return (gate < MAX_GATES || gate == DROP_GATE);
 }
 
-const Commands IPLookup::cmds = {
-    {"add", "IPLookupCommandAddArg", MODULE_CMD_FUNC(&IPLookup::CommandAdd), 0},
-    {"clear", "EmptyArg", MODULE_CMD_FUNC(&IPLookup::CommandClear), 0}};
+// Hashes the addresses, the protocol, and the ports of TCP and UDP packets
+// (but not of fragments, as only the first one has them)
+static inline uint32_t FlowHash(const Ipv4Header *ip) {
+  const char *p = reinterpret_cast<const char *>(ip);
+  uint64_t addrs = (static_cast<uint64_t>(ip->dst) << 32) | ip->src;
+  uint32_t v = ip->protocol ^ kHashSeed;
 
-pb_error_t IPLookup::Init(const bess::pb::EmptyArg &) {
-  struct rte_lpm_config conf = {
-      .max_rules = 1024, .number_tbl8s = 128, .flags = 0,
-  };
+  if ((ip->protocol == IPPROTO_TCP || ip->protocol == IPPROTO_UDP) &&
+      !(ntohs(ip->fragment_offset) & 0x3fff)) {
+    v ^= *reinterpret_cast<const uint32_t *>(p + (ip->header_length << 2));
+  }
 
-  default_gate_ = DROP_GATE;
+#if __SSE4_2__ && __x86_64
+  return _mm_crc32_u64(v, addrs);
+#else
+  return crc32c_2words(addrs, v);
+#endif
+}
 
-  lpm_ = rte_lpm_create(name().c_str(), /* socket_id = */ 0, &conf);
+const Commands IPLookup::cmds = {
+    {"add", "IPLookupCommandAddArg", MODULE_CMD_FUNC(&IPLookup::CommandAdd), 0},
+    {"delete", "IPLookupCommandDeleteArg",
+     MODULE_CMD_FUNC(&IPLookup::CommandDelete), 0},
+    {"clear", "EmptyArg", MODULE_CMD_FUNC(&IPLookup::CommandClear), 0},
+    {"set_group", "IPLookupCommandSetGroupArg",
+     MODULE_CMD_FUNC(&IPLookup::CommandSetGroup), 0},
+    {"update", "IPLookupCommandUpdateArg",
+     MODULE_CMD_FUNC(&IPLookup::CommandUpdate), 1}};
 
-  if (!lpm_) {
-    return pb_error(rte_errno, "DPDK error: %s", rte_strerror(rte_errno));
-  }
+pb_error_t IPLookup::Init(const bess::pb::EmptyArg &) {
+  fibs_[0].reset(new Fib());
+  fib_ = fibs_[0].get();
 
   return pb_errno(0);
 }
 
-void IPLookup::DeInit() {
-  rte_lpm_free(lpm_);
-}
-
 void IPLookup::ProcessBatch(bess::PacketBatch *batch) {
+  const void *ip_headers[bess::PacketBatch::kMaxBurst];
   gate_idx_t out_gates[bess::PacketBatch::kMaxBurst];
-  gate_idx_t default_gate = default_gate_;
-
   int cnt = batch->cnt();
-  int i;
 
-#if VECTOR_OPTIMIZATION
-  const __m128i bswap_mask =
-      _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+  for (int i = 0; i < cnt; i++) {
+    ip_headers[i] = batch->pkts()[i]->head_data<EthHeader *>() + 1;
+  }
 
-  /* 4 at a time */
-  for (i = 0; i + 3 < cnt; i += 4) {
-    struct ether_hdr *eth;
-    struct ipv4_hdr *ip;
+  Classify(ip_headers, cnt, out_gates);
 
-    uint32_t a0, a1, a2, a3;
-    uint32_t next_hops[4];
+  RunSplit(out_gates, batch);
+}
 
-    __m128i ip_addr;
+void IPLookup::Classify(const void *const *ip_headers, int cnt,
+                        gate_idx_t *out_gates) {
+  const Fib *fib = fib_.load(std::memory_order_acquire);
+  uint32_t addrs[bess::PacketBatch::kMaxBurst];
+  uint32_t next_hops[bess::PacketBatch::kMaxBurst];
 
-    eth = batch->pkts()[i]->head_data<struct ether_hdr *>();
-    ip = (struct ipv4_hdr *)(eth + 1);
-    a0 = ip->dst_addr;
+  if (cnt <= 0) {
+    return;
+  }
 
-    eth = batch->pkts()[i + 1]->head_data<struct ether_hdr *>();
-    ip = (struct ipv4_hdr *)(eth + 1);
-    a1 = ip->dst_addr;
+  for (int i = 0; i < cnt; i++) {
+    addrs[i] = ntohl(static_cast<const Ipv4Header *>(ip_headers[i])->dst);
+  }
 
-    eth = batch->pkts()[i + 2]->head_data<struct ether_hdr *>();
-    ip = (struct ipv4_hdr *)(eth + 1);
-    a2 = ip->dst_addr;
+  fib->lpm.LookupBulk(addrs, cnt, fib->default_next_hop, next_hops);
 
-    eth = batch->pkts()[i + 3]->head_data<struct ether_hdr *>();
-    ip = (struct ipv4_hdr *)(eth + 1);
-    a3 = ip->dst_addr;
+  for (int i = 0; i < cnt; i++) {
+    uint32_t next_hop = next_hops[i];
 
-    ip_addr = _mm_set_epi32(a3, a2, a1, a0);
-    ip_addr = _mm_shuffle_epi8(ip_addr, bswap_mask);
+    if (next_hop & kGroupFlag) {
+      const Group &group = groups_[next_hop & ~kGroupFlag];
+      const Ipv4Header *ip = static_cast<const Ipv4Header *>(ip_headers[i]);
+      out_gates[i] = group[FlowHash(ip) % kGroupBuckets];
+    } else {
+      out_gates[i] = next_hop;
+    }
+  }
+}
 
-    rte_lpm_lookupx4(lpm_, ip_addr, next_hops, default_gate);
+pb_error_t IPLookup::ParseRoute(const std::string &prefix,
+                                uint64_t prefix_len, RouteOp *op) {
+  struct in_addr ip_addr_be;
 
-    out_gates[i + 0] = next_hops[0];
-    out_gates[i + 1] = next_hops[1];
-    out_gates[i + 2] = next_hops[2];
-    out_gates[i + 3] = next_hops[3];
+  if (!prefix.length()) {
+    return pb_error(EINVAL, "prefix' is missing");
+  }
+
+  if (!inet_aton(prefix.c_str(), &ip_addr_be)) {
+    return pb_error(EINVAL, "Invalid IP prefix: %s", prefix.c_str());
   }
-#endif
 
-  /* process the rest one by one */
-  for (; i < cnt; i++) {
-    struct ether_hdr *eth;
-    struct ipv4_hdr *ip;
+  if (prefix_len > 32) {
+    return pb_error(EINVAL, "Invalid prefix length: %lu", prefix_len);
+  }
 
-    uint32_t next_hop;
-    int ret;
+  uint32_t ip_addr = ntohl(ip_addr_be.s_addr);
+  uint32_t netmask = prefix_len ? ~0u << (32 - prefix_len) : 0;
 
-    eth = batch->pkts()[i]->head_data<struct ether_hdr *>();
-    ip = (struct ipv4_hdr *)(eth + 1);
+  if (ip_addr & ~netmask) {
+    return pb_error(EINVAL, "Invalid IP prefix %s/%lu %x %x", prefix.c_str(),
+                    prefix_len, ip_addr, netmask);
+  }
 
-    ret = rte_lpm_lookup(lpm_, rte_be_to_cpu_32(ip->dst_addr), &next_hop);
+  op->prefix = ip_addr;
+  op->len = prefix_len;
+  return pb_errno(0);
+}
 
-    if (ret == 0) {
-      out_gates[i] = next_hop;
-    } else {
-      out_gates[i] = default_gate;
+pb_error_t IPLookup::ParseNextHop(const bess::pb::IPLookupCommandAddArg &arg,
+                                  RouteOp *op) {
+  if (arg.group()) {
+    if (arg.group() >= groups_.size()) {
+      return pb_error(ENOENT, "No such group: %lu", arg.group());
     }
+    op->next_hop = kGroupFlag | arg.group();
+    return pb_errno(0);
   }
 
-  RunSplit(out_gates, batch);
+  gate_idx_t gate = arg.gate();
+  if (!is_valid_gate(gate)) {
+    return pb_error(EINVAL, "Invalid gate: %hu", gate);
+  }
+
+  op->next_hop = gate;
+  return pb_errno(0);
 }
 
 pb_cmd_response_t IPLookup::CommandAdd(
     const bess::pb::IPLookupCommandAddArg &arg) {
   pb_cmd_response_t response;
+  RouteOp op = {RouteOp::kAdd, 0, 0, 0};
+  pb_error_t err;
 
-  struct in_addr ip_addr_be;
-  uint32_t ip_addr; /* in cpu order */
-  uint32_t netmask;
-  int ret;
-  gate_idx_t gate = arg.gate();
+  std::lock_guard<std::mutex> guard(fib_lock_);
 
-  if (!arg.prefix().length()) {
-    set_cmd_response_error(&response, pb_error(EINVAL, "prefix' is missing"));
+  if ((err = ParseRoute(arg.prefix(), arg.prefix_len(), &op)).err() != 0 ||
+      (err = ParseNextHop(arg, &op)).err() != 0) {
+    set_cmd_response_error(&response, err);
     return response;
   }
 
-  const char *prefix = arg.prefix().c_str();
-  uint64_t prefix_len = arg.prefix_len();
+  ApplyInPlace(op);
 
-  ret = inet_aton(prefix, &ip_addr_be);
-  if (!ret) {
-    set_cmd_response_error(&response,
-                           pb_error(EINVAL, "Invalid IP prefix: %s", prefix));
+  set_cmd_response_error(&response, pb_errno(0));
+  return response;
+}
+
+pb_cmd_response_t IPLookup::CommandDelete(
+    const bess::pb::IPLookupCommandDeleteArg &arg) {
+  pb_cmd_response_t response;
+  RouteOp op = {RouteOp::kDelete, 0, 0, 0};
+  pb_error_t err;
+
+  if ((err = ParseRoute(arg.prefix(), arg.prefix_len(), &op)).err() != 0) {
+    set_cmd_response_error(&response, err);
     return response;
   }
 
-  if (prefix_len > 32) {
+  std::lock_guard<std::mutex> guard(fib_lock_);
+
+  int ret = ApplyInPlace(op);
+  if (ret < 0) {
     set_cmd_response_error(
-        &response, pb_error(EINVAL, "Invalid prefix length: %lu", prefix_len));
+        &response, pb_error(-ret, "No such route: %s/%lu",
+                            arg.prefix().c_str(), arg.prefix_len()));
     return response;
   }
 
-  ip_addr = rte_be_to_cpu_32(ip_addr_be.s_addr);
-  netmask = ~0 ^ ((1 << (32 - prefix_len)) - 1);
+  set_cmd_response_error(&response, pb_errno(0));
+  return response;
+}
 
-  if (ip_addr & ~netmask) {
+pb_cmd_response_t IPLookup::CommandClear(const bess::pb::EmptyArg &) {
+  pb_cmd_response_t response;
+
+  std::lock_guard<std::mutex> guard(fib_lock_);
+
+  ApplyInPlace({RouteOp::kClear, 0, 0, 0});
+
+  set_cmd_response_error(&response, pb_errno(0));
+  return response;
+}
+
+pb_cmd_response_t IPLookup::CommandSetGroup(
+    const bess::pb::IPLookupCommandSetGroupArg &arg) {
+  pb_cmd_response_t response;
+  std::vector<gate_idx_t> gates;
+
+  if (arg.group() == 0 || arg.group() > kMaxGroups) {
     set_cmd_response_error(
-        &response, pb_error(EINVAL, "Invalid IP prefix %s/%lu %x %x", prefix,
-                            prefix_len, ip_addr, netmask));
+        &response, pb_error(EINVAL, "group must be 1-%lu", kMaxGroups));
     return response;
   }
 
-  if (!is_valid_gate(gate)) {
-    set_cmd_response_error(&response,
-                           pb_error(EINVAL, "Invalid gate: %hu", gate));
+  if (arg.gates_size() > kGroupBuckets) {
+    set_cmd_response_error(
+        &response, pb_error(EINVAL, "no more than %d gates", kGroupBuckets));
     return response;
   }
 
-  if (prefix_len == 0) {
-    default_gate_ = gate;
-  } else {
-    ret = rte_lpm_add(lpm_, ip_addr, prefix_len, gate);
-    if (ret) {
-      set_cmd_response_error(&response, pb_error(-ret, "rpm_lpm_add() failed"));
+  for (int i = 0; i < arg.gates_size(); i++) {
+    gate_idx_t gate = arg.gates(i);
+    if (!is_valid_gate(gate)) {
+      set_cmd_response_error(&response,
+                             pb_error(EINVAL, "Invalid gate: %hu", gate));
       return response;
     }
+    gates.push_back(gate);
+  }
+
+  std::lock_guard<std::mutex> guard(fib_lock_);
+
+  if (groups_.size() <= arg.group()) {
+    Group empty;
+    empty.fill(DROP_GATE);
+    groups_.resize(arg.group() + 1, empty);
   }
 
+  AssignBuckets(gates, &groups_[arg.group()]);
+
   set_cmd_response_error(&response, pb_errno(0));
   return response;
 }
 
-pb_cmd_response_t IPLookup::CommandClear(const bess::pb::EmptyArg &) {
+void IPLookup::AssignBuckets(const std::vector<gate_idx_t> &gates,
+                             Group *group) {
+  // Buckets left for each gate to take
+  std::unordered_map<gate_idx_t, int> quotas;
+  std::vector<int> moved;
+
+  if (gates.empty()) {
+    group->fill(DROP_GATE);
+    return;
+  }
+
+  for (size_t i = 0; i < gates.size(); i++) {
+    quotas[gates[i]] += kGroupBuckets / gates.size() +
+                        (i < kGroupBuckets % gates.size() ? 1 : 0);
+  }
+
+  // Buckets stay with their gate, up to its share
+  for (int b = 0; b < kGroupBuckets; b++) {
+    auto it = quotas.find((*group)[b]);
+    if (it != quotas.end() && it->second > 0) {
+      it->second--;
+    } else {
+      moved.push_back(b);
+    }
+  }
+
+  auto b = moved.begin();
+  for (gate_idx_t gate : gates) {
+    int &quota = quotas[gate];
+    for (; quota > 0; quota--) {
+      (*group)[*b++] = gate;
+    }
+  }
+}
+
+pb_cmd_response_t IPLookup::CommandUpdate(
+    const bess::pb::IPLookupCommandUpdateArg &arg) {
   pb_cmd_response_t response;
+  std::vector<RouteOp> ops;
+  pb_error_t err;
+
+  std::lock_guard<std::mutex> guard(fib_lock_);
+
+  if (arg.clear()) {
+    ops.push_back({RouteOp::kClear, 0, 0, 0});
+  }
+
+  for (int i = 0; i < arg.deletes_size(); i++) {
+    RouteOp op = {RouteOp::kDelete, 0, 0, 0};
+    const auto &route = arg.deletes(i);
+    if ((err = ParseRoute(route.prefix(), route.prefix_len(), &op)).err() !=
+        0) {
+      set_cmd_response_error(&response, err);
+      return response;
+    }
+    // Nothing is left to delete after a clear
+    if (!arg.clear()) {
+      ops.push_back(op);
+    }
+  }
+
+  for (int i = 0; i < arg.adds_size(); i++) {
+    RouteOp op = {RouteOp::kAdd, 0, 0, 0};
+    const auto &route = arg.adds(i);
+    if ((err = ParseRoute(route.prefix(), route.prefix_len(), &op)).err() !=
+            0 ||
+        (err = ParseNextHop(route, &op)).err() != 0) {
+      set_cmd_response_error(&response, err);
+      return response;
+    }
+    ops.push_back(op);
+  }
+
+  SyncShadow(true);
+
+  Fib *shadow = shadow_fib().get();
+  for (const RouteOp &op : ops) {
+    int ret = ApplyOp(shadow, op);
+    if (ret < 0) {
+      // The routes are unchanged, but the shadow has to be rebuilt
+      struct in_addr addr = {htonl(op.prefix)};
+      shadow_ready_ = false;
+      set_cmd_response_error(
+          &response, pb_error(-ret, "No such route: %s/%d, no routes changed",
+                              inet_ntoa(addr), op.len));
+      return response;
+    }
+  }
+
+  fib_.store(shadow, std::memory_order_release);
+  shadow_token_ = Rcu::Retire();
+  pending_ = std::move(ops);
 
-  rte_lpm_delete_all(lpm_);
-  default_gate_ = DROP_GATE;
   set_cmd_response_error(&response, pb_errno(0));
   return response;
 }
 
+int IPLookup::ApplyOp(Fib *fib, const RouteOp &op) {
+  switch (op.type) {
+    case RouteOp::kAdd:
+      if (op.len == 0) {
+        fib->default_next_hop = op.next_hop;
+      } else {
+        fib->lpm.Add(op.prefix, op.len, op.next_hop);
+      }
+      return 0;
+
+    case RouteOp::kDelete:
+      if (op.len == 0) {
+        fib->default_next_hop = DROP_GATE;
+        return 0;
+      }
+      return fib->lpm.Delete(op.prefix, op.len) ? 0 : -ENOENT;
+
+    default:
+      fib->lpm.Clear();
+      fib->default_next_hop = DROP_GATE;
+      return 0;
+  }
+}
+
+int IPLookup::ApplyInPlace(const RouteOp &op) {
+  int ret = ApplyOp(fib_.load(std::memory_order_relaxed), op);
+
+  if (ret >= 0 && shadow_ready_) {
+    pending_.push_back(op);
+    SyncShadow(false);
+  }
+  return ret;
+}
+
+void IPLookup::SyncShadow(bool wait) {
+  if (!Rcu::Expired(shadow_token_)) {
+    if (!wait) {
+      return;
+    }
+    Rcu::Synchronize();
+  }
+
+  Fib *shadow = shadow_fib().get();
+
+  for (const RouteOp &op : pending_) {
+    if (!shadow_ready_ || ApplyOp(shadow, op) < 0) {
+      shadow_ready_ = false;
+      break;
+    }
+  }
+  pending_.clear();
+
+  if (!shadow_ready_) {
+    shadow_fib().reset(new Fib(*fib_.load(std::memory_order_relaxed)));
+    shadow_ready_ = true;
+  }
+}
+
 ADD_MODULE(IPLookup, "ip_lookup",
            "performs Longest Prefix Match on IPv4 packets")
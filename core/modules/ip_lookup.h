@@ -1,29 +1,122 @@
 #ifndef BESS_MODULES_IPLOOKUP_H_
 #define BESS_MODULES_IPLOOKUP_H_
 
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
 #include "../module.h"
 #include "../module_msg.pb.h"
+#include "../utils/lpm4.h"
 
+// Longest prefix match on the destination address of IPv4 packets. A route
+// leads to a gate, or to an ECMP group of gates that packets are spread over
+// by the hash of their flow. A group has kGroupBuckets buckets, each of a
+// gate. When the gates of a group change, only the buckets that must move
+// to other gates do (resilient hashing), so most flows keep their gate.
 class IPLookup final : public Module {
  public:
   static const gate_idx_t kNumOGates = MAX_GATES;
 
+  static const uint64_t kMaxGroups = 1024;
+  static const int kGroupBuckets = 256;
+
   static const Commands cmds;
 
-  IPLookup() : Module(), lpm_(), default_gate_() {}
+  IPLookup()
+      : Module(),
+        fibs_(),
+        fib_(),
+        shadow_ready_(),
+        shadow_token_(),
+        pending_(),
+        groups_() {}
 
   pb_error_t Init(const bess::pb::EmptyArg &arg);
 
-  void DeInit() override;
-
   void ProcessBatch(bess::PacketBatch *batch) override;
 
+  // Sets out_gates[i] to the gate of the route of the packet whose IPv4
+  // header is at ip_headers[i], with cnt <= kMaxBurst
+  void Classify(const void *const *ip_headers, int cnt,
+                gate_idx_t *out_gates);
+
   pb_cmd_response_t CommandAdd(const bess::pb::IPLookupCommandAddArg &arg);
+  pb_cmd_response_t CommandDelete(
+      const bess::pb::IPLookupCommandDeleteArg &arg);
   pb_cmd_response_t CommandClear(const bess::pb::EmptyArg &arg);
+  pb_cmd_response_t CommandSetGroup(
+      const bess::pb::IPLookupCommandSetGroupArg &arg);
+  pb_cmd_response_t CommandUpdate(
+      const bess::pb::IPLookupCommandUpdateArg &arg);
 
  private:
-  struct rte_lpm *lpm_;
-  gate_idx_t default_gate_;
+  // Next hops are gates, or groups with this bit set
+  static const uint32_t kGroupFlag = 1 << 16;
+
+  typedef std::array<gate_idx_t, kGroupBuckets> Group;
+
+  // The routes that workers look up, and the next hop of the default one
+  struct Fib {
+    Fib() : lpm(), default_next_hop(DROP_GATE) {}
+
+    bess::utils::Lpm4 lpm;
+    uint32_t default_next_hop;
+  };
+
+  // A change of the routes, kept to be replayed on the shadow FIB
+  struct RouteOp {
+    enum Type { kAdd, kDelete, kClear } type;
+    uint32_t prefix;  // in host order
+    int len;
+    uint32_t next_hop;
+  };
+
+  static int ApplyOp(Fib *fib, const RouteOp &op);
+
+  // Gives each gate its share of the buckets of the group, moving as few
+  // buckets as possible
+  static void AssignBuckets(const std::vector<gate_idx_t> &gates,
+                            Group *group);
+
+  // Updates the FIB that workers look up in place, and then the shadow
+  int ApplyInPlace(const RouteOp &op);
+
+  // Brings the shadow FIB up to date with the current one, unless some
+  // worker may still be reading it and wait is false
+  void SyncShadow(bool wait);
+
+  std::unique_ptr<Fib> &shadow_fib() {
+    return fibs_[fib_.load(std::memory_order_relaxed) == fibs_[0].get()];
+  }
+
+  pb_error_t ParseRoute(const std::string &prefix, uint64_t prefix_len,
+                        RouteOp *op);
+  pb_error_t ParseNextHop(const bess::pb::IPLookupCommandAddArg &arg,
+                          RouteOp *op);
+
+  // Serializes the commands
+  std::mutex fib_lock_;
+
+  // Single changes are made to *fib_ in place, with workers paused. The
+  // update command makes its changes to the other FIB (the shadow), while
+  // workers keep running, and then swaps them atomically. Once no worker
+  // reads the old FIB anymore, it becomes the shadow, and the changes are
+  // replayed on it. There is no shadow until the first update.
+  std::unique_ptr<Fib> fibs_[2];
+  std::atomic<Fib *> fib_;
+  bool shadow_ready_;
+
+  // RCU token of the last swap
+  uint64_t shadow_token_;
+
+  // Changes to *fib_ that the shadow lacks
+  std::vector<RouteOp> pending_;
+
+  // By group ID (0 is not a group)
+  std::vector<Group> groups_;
 };
 
 #endif  // BESS_MODULES_IPLOOKUP_H_
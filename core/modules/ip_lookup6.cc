@@ -0,0 +1,155 @@
+#include "ip_lookup6.h"
+
+#include <arpa/inet.h>
+
+#include "../utils/ether.h"
+#include "../utils/ip.h"
+
+using bess::utils::EthHeader;
+using bess::utils::Ipv6Header;
+using bess::utils::Lpm6;
+
+static inline int is_valid_gate(gate_idx_t gate) {
+  return (gate < MAX_GATES || gate == DROP_GATE);
+}
+
+// Parses the prefix into addr, with no bits set past its length
+static pb_error_t ParsePrefix(const std::string &prefix, uint64_t prefix_len,
+                              struct in6_addr *addr) {
+  if (!prefix.length()) {
+    return pb_error(EINVAL, "'prefix' is missing");
+  }
+
+  if (inet_pton(AF_INET6, prefix.c_str(), addr) != 1) {
+    return pb_error(EINVAL, "Invalid IPv6 prefix: %s", prefix.c_str());
+  }
+
+  if (prefix_len > 128) {
+    return pb_error(EINVAL, "Invalid prefix length: %lu", prefix_len);
+  }
+
+  for (uint64_t i = 0; i < sizeof(addr->s6_addr); i++) {
+    uint64_t bits = (prefix_len > i * 8) ? prefix_len - i * 8 : 0;
+    uint8_t mask = (bits >= 8) ? 0xff : ~(0xff >> bits);
+
+    if (addr->s6_addr[i] & ~mask) {
+      return pb_error(EINVAL, "Invalid IPv6 prefix %s/%lu", prefix.c_str(),
+                      prefix_len);
+    }
+  }
+
+  return pb_errno(0);
+}
+
+const Commands IPLookup6::cmds = {
+    {"add", "IPLookup6CommandAddArg", MODULE_CMD_FUNC(&IPLookup6::CommandAdd),
+     0},
+    {"delete", "IPLookup6CommandDeleteArg",
+     MODULE_CMD_FUNC(&IPLookup6::CommandDelete), 0},
+    {"clear", "EmptyArg", MODULE_CMD_FUNC(&IPLookup6::CommandClear), 0}};
+
+pb_error_t IPLookup6::Init(const bess::pb::IPLookup6Arg &) {
+  default_gate_ = DROP_GATE;
+  return pb_errno(0);
+}
+
+void IPLookup6::ProcessBatch(bess::PacketBatch *batch) {
+  const void *addrs[bess::PacketBatch::kMaxBurst];
+  uint32_t next_hops[bess::PacketBatch::kMaxBurst];
+  gate_idx_t out_gates[bess::PacketBatch::kMaxBurst];
+  gate_idx_t default_gate = default_gate_;
+  int cnt = batch->cnt();
+  int n = 0;
+
+  static_assert(bess::PacketBatch::kMaxBurst <= Lpm6::kMaxBulk,
+                "a batch must fit in a bulk lookup");
+
+  // Non-IPv6 packets are left out of the lookup
+  for (int i = 0; i < cnt; i++) {
+    EthHeader *eth = batch->pkts()[i]->head_data<EthHeader *>();
+    Ipv6Header *ip = reinterpret_cast<Ipv6Header *>(eth + 1);
+
+    if (eth->ether_type.to_cpu() == 0x86dd) {
+      addrs[n++] = ip->dst;
+    }
+  }
+
+  lpm_.LookupBulk(addrs, n, default_gate, next_hops);
+
+  n = 0;
+  for (int i = 0; i < cnt; i++) {
+    EthHeader *eth = batch->pkts()[i]->head_data<EthHeader *>();
+
+    if (eth->ether_type.to_cpu() == 0x86dd) {
+      out_gates[i] = next_hops[n++];
+    } else {
+      out_gates[i] = default_gate;
+    }
+  }
+
+  RunSplit(out_gates, batch);
+}
+
+pb_cmd_response_t IPLookup6::CommandAdd(
+    const bess::pb::IPLookup6CommandAddArg &arg) {
+  pb_cmd_response_t response;
+  struct in6_addr addr;
+  gate_idx_t gate = arg.gate();
+
+  pb_error_t err = ParsePrefix(arg.prefix(), arg.prefix_len(), &addr);
+  if (err.err() != 0) {
+    set_cmd_response_error(&response, err);
+    return response;
+  }
+
+  if (!is_valid_gate(gate)) {
+    set_cmd_response_error(&response,
+                           pb_error(EINVAL, "Invalid gate: %hu", gate));
+    return response;
+  }
+
+  if (arg.prefix_len() == 0) {
+    default_gate_ = gate;
+  } else {
+    lpm_.Add(addr.s6_addr, arg.prefix_len(), gate);
+  }
+
+  set_cmd_response_error(&response, pb_errno(0));
+  return response;
+}
+
+pb_cmd_response_t IPLookup6::CommandDelete(
+    const bess::pb::IPLookup6CommandDeleteArg &arg) {
+  pb_cmd_response_t response;
+  struct in6_addr addr;
+
+  pb_error_t err = ParsePrefix(arg.prefix(), arg.prefix_len(), &addr);
+  if (err.err() != 0) {
+    set_cmd_response_error(&response, err);
+    return response;
+  }
+
+  if (arg.prefix_len() == 0) {
+    default_gate_ = DROP_GATE;
+  } else if (!lpm_.Delete(addr.s6_addr, arg.prefix_len())) {
+    set_cmd_response_error(
+        &response, pb_error(ENOENT, "No such prefix: %s/%lu",
+                            arg.prefix().c_str(), arg.prefix_len()));
+    return response;
+  }
+
+  set_cmd_response_error(&response, pb_errno(0));
+  return response;
+}
+
+pb_cmd_response_t IPLookup6::CommandClear(const bess::pb::EmptyArg &) {
+  pb_cmd_response_t response;
+
+  lpm_.Clear();
+  default_gate_ = DROP_GATE;
+  set_cmd_response_error(&response, pb_errno(0));
+  return response;
+}
+
+ADD_MODULE(IPLookup6, "ip_lookup6",
+           "performs Longest Prefix Match on IPv6 packets")
@@ -0,0 +1,32 @@
+#ifndef BESS_MODULES_IPLOOKUP6_H_
+#define BESS_MODULES_IPLOOKUP6_H_
+
+#include "../module.h"
+#include "../module_msg.pb.h"
+#include "../utils/lpm6.h"
+
+// Longest prefix match on the destination address of IPv6 packets. Packets
+// that match no prefix, and those that are not IPv6, go to the default gate.
+class IPLookup6 final : public Module {
+ public:
+  static const gate_idx_t kNumOGates = MAX_GATES;
+
+  static const Commands cmds;
+
+  IPLookup6() : Module(), lpm_(), default_gate_() {}
+
+  pb_error_t Init(const bess::pb::IPLookup6Arg &arg);
+
+  void ProcessBatch(bess::PacketBatch *batch) override;
+
+  pb_cmd_response_t CommandAdd(const bess::pb::IPLookup6CommandAddArg &arg);
+  pb_cmd_response_t CommandDelete(
+      const bess::pb::IPLookup6CommandDeleteArg &arg);
+  pb_cmd_response_t CommandClear(const bess::pb::EmptyArg &arg);
+
+ private:
+  bess::utils::Lpm6 lpm_;
+  gate_idx_t default_gate_;
+};
+
+#endif  // BESS_MODULES_IPLOOKUP6_H_
@@ -0,0 +1,238 @@
+// Benchmarks for the IPLookup module, with BGP-like tables of 100,000 to 1M
+// IPv4 prefixes, in the proportions of the prefix lengths seen in the global
+// routing table (mostly /24s), plus some longer internal routes.
+
+#include <benchmark/benchmark.h>
+#include <glog/logging.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <atomic>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "../utils/ip.h"
+#include "../utils/random.h"
+#include "../utils/rcu.h"
+#include "ip_lookup.h"
+
+using bess::utils::Ipv4Header;
+using bess::utils::Rcu;
+
+namespace {
+
+// Prefix lengths, with their share of the table in percent
+const std::pair<int, int> kLenShares[] = {
+    {24, 58}, {22, 11}, {23, 9}, {21, 5}, {20, 5}, {19, 3}, {16, 2},
+    {18, 2},  {17, 1},  {28, 1}, {30, 1}, {32, 1}, {15, 1},
+};
+
+const int kNumPackets = 1 << 16;
+
+// Routes to move to other gates in each update under churn
+const int kChurnPerUpdate = 1000;
+
+struct[[gnu::packed]] Headers {
+  Ipv4Header ip;
+  uint16_t src_port;
+  uint16_t dst_port;
+};
+
+int RandomLen(Random *rng) {
+  int r = rng->GetRange(100);
+  for (const auto &share : kLenShares) {
+    if (r < share.second) {
+      return share.first;
+    }
+    r -= share.second;
+  }
+  return 24;
+}
+
+std::string ToString(uint32_t addr) {
+  struct in_addr in = {htonl(addr)};
+  return inet_ntoa(in);
+}
+
+void SetRoute(bess::pb::IPLookupCommandAddArg *arg, uint32_t prefix, int len,
+              gate_idx_t gate) {
+  arg->set_prefix(ToString(prefix));
+  arg->set_prefix_len(len);
+  arg->set_gate(gate);
+}
+
+// Distinct prefixes in unicast space (1.0.0.0 to 223.255.255.255)
+std::vector<std::pair<uint32_t, int>> GeneratePrefixes(size_t n) {
+  std::set<std::pair<uint32_t, int>> seen;
+  std::vector<std::pair<uint32_t, int>> prefixes;
+  Random rng;
+  rng.SetSeed(n);
+
+  while (prefixes.size() < n) {
+    int len = RandomLen(&rng);
+    uint32_t prefix =
+        (0x01000000 + rng.GetRange(0xdf000000)) & (~0u << (32 - len));
+    if (seen.emplace(prefix, len).second) {
+      prefixes.emplace_back(prefix, len);
+    }
+  }
+  return prefixes;
+}
+
+class IPLookupFixture : public benchmark::Fixture {
+ public:
+  void SetUp(benchmark::State &state) override {
+    prefixes_ = GeneratePrefixes(state.range(0));
+    lookup_.reset(new IPLookup());
+    CHECK_EQ(lookup_->Init(bess::pb::EmptyArg()).err(), 0);
+
+    bess::pb::IPLookupCommandUpdateArg arg;
+    for (size_t i = 0; i < prefixes_.size(); i++) {
+      SetRoute(arg.add_adds(), prefixes_[i].first, prefixes_[i].second,
+               i % MAX_GATES);
+    }
+    CHECK_EQ(lookup_->CommandUpdate(arg).error().err(), 0);
+
+    // The next update would replay the whole table on the shadow FIB first
+    arg.Clear();
+    CHECK_EQ(lookup_->CommandUpdate(arg).error().err(), 0);
+
+    // Destinations within random prefixes (which longer ones may cover)
+    Random rng;
+    rng.SetSeed(0);
+    headers_.resize(kNumPackets);
+    for (Headers &h : headers_) {
+      const auto &prefix = prefixes_[rng.GetRange(prefixes_.size())];
+      uint32_t host = rng.Get() & ~(~0u << (32 - prefix.second));
+      h = {};
+      h.ip.version = 4;
+      h.ip.header_length = 5;
+      h.ip.protocol = IPPROTO_UDP;
+      h.ip.src = rng.Get();
+      h.ip.dst = htonl(prefix.first | host);
+      h.src_port = rng.GetRange(65536);
+      h.dst_port = htons(53);
+      ip_headers_.push_back(&h);
+    }
+  }
+
+  void TearDown(benchmark::State &) override {
+    lookup_.reset();
+    Rcu::Synchronize();
+    prefixes_.clear();
+    headers_.clear();
+    ip_headers_.clear();
+  }
+
+ protected:
+  void Classify(benchmark::State &state) {
+    const int burst = bess::PacketBatch::kMaxBurst;
+    gate_idx_t out_gates[burst];
+    size_t i = 0;
+
+    while (state.KeepRunning()) {
+      lookup_->Classify(&ip_headers_[i], burst, out_gates);
+      benchmark::DoNotOptimize(out_gates[0]);
+      Rcu::Quiescent();
+
+      i += burst;
+      if (i + burst > ip_headers_.size()) {
+        i = 0;
+      }
+    }
+
+    state.SetItemsProcessed(state.iterations() * burst);
+  }
+
+  std::vector<std::pair<uint32_t, int>> prefixes_;
+  std::unique_ptr<IPLookup> lookup_;
+  std::vector<Headers> headers_;
+  std::vector<const void *> ip_headers_;
+};
+
+}  // namespace (unnamed)
+
+BENCHMARK_DEFINE_F(IPLookupFixture, Classify)(benchmark::State &state) {
+  Rcu::RegisterThread();
+  Classify(state);
+  Rcu::UnregisterThread();
+}
+
+// While another thread keeps moving routes to other gates with the update
+// command, kChurnPerUpdate routes at a time
+BENCHMARK_DEFINE_F(IPLookupFixture, ClassifyChurn)(benchmark::State &state) {
+  std::atomic<bool> stop(false);
+  std::atomic<uint64_t> updates(0);
+
+  Rcu::RegisterThread();
+  std::thread updater([&]() {
+    Random rng;
+    bess::pb::IPLookupCommandUpdateArg arg;
+
+    while (!stop.load(std::memory_order_relaxed)) {
+      size_t first = rng.GetRange(prefixes_.size());
+      gate_idx_t gate = rng.GetRange(MAX_GATES);
+
+      arg.Clear();
+      for (int i = 0; i < kChurnPerUpdate; i++) {
+        const auto &prefix = prefixes_[(first + i) % prefixes_.size()];
+        auto *del = arg.add_deletes();
+        del->set_prefix(ToString(prefix.first));
+        del->set_prefix_len(prefix.second);
+        SetRoute(arg.add_adds(), prefix.first, prefix.second, gate);
+      }
+      CHECK_EQ(lookup_->CommandUpdate(arg).error().err(), 0);
+      updates++;
+    }
+  });
+
+  Classify(state);
+
+  // The updater may be waiting for this thread to pass a quiescent state
+  stop = true;
+  Rcu::UnregisterThread();
+  updater.join();
+
+  state.counters["routes/s"] = benchmark::Counter(
+      updates * kChurnPerUpdate * 2, benchmark::Counter::kIsRate);
+}
+
+// Loading the full table with a single update, into an empty module
+static void BM_IPLookupLoad(benchmark::State &state) {
+  std::vector<std::pair<uint32_t, int>> prefixes =
+      GeneratePrefixes(state.range(0));
+  bess::pb::IPLookupCommandUpdateArg arg;
+
+  for (size_t i = 0; i < prefixes.size(); i++) {
+    SetRoute(arg.add_adds(), prefixes[i].first, prefixes[i].second,
+             i % MAX_GATES);
+  }
+
+  while (state.KeepRunning()) {
+    IPLookup lookup;
+    CHECK_EQ(lookup.Init(bess::pb::EmptyArg()).err(), 0);
+    CHECK_EQ(lookup.CommandUpdate(arg).error().err(), 0);
+  }
+
+  Rcu::Synchronize();
+  state.SetItemsProcessed(state.iterations() * prefixes.size());
+}
+
+BENCHMARK_REGISTER_F(IPLookupFixture, Classify)
+    ->RangeMultiplier(10)
+    ->Range(100000, 1000000);
+BENCHMARK_REGISTER_F(IPLookupFixture, ClassifyChurn)
+    ->RangeMultiplier(10)
+    ->Range(100000, 1000000)
+    ->UseRealTime();
+BENCHMARK(BM_IPLookupLoad)
+    ->RangeMultiplier(10)
+    ->Range(100000, 1000000)
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
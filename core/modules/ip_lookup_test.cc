@@ -0,0 +1,332 @@
+#include "ip_lookup.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../utils/ip.h"
+#include "../utils/random.h"
+#include "../utils/rcu.h"
+
+using bess::utils::Ipv4Header;
+using bess::utils::Rcu;
+
+namespace {
+
+struct[[gnu::packed]] Headers {
+  Ipv4Header ip;
+  uint16_t src_port;
+  uint16_t dst_port;
+};
+
+Headers MakeHeaders(uint32_t dst, uint32_t src = 0x01020304,
+                    uint16_t src_port = 1234) {
+  Headers h = {};
+  h.ip.version = 4;
+  h.ip.header_length = 5;
+  h.ip.protocol = IPPROTO_TCP;
+  h.ip.src = htonl(src);
+  h.ip.dst = htonl(dst);
+  h.src_port = htons(src_port);
+  h.dst_port = htons(80);
+  return h;
+}
+
+std::string ToString(uint32_t addr) {
+  struct in_addr in = {htonl(addr)};
+  return inet_ntoa(in);
+}
+
+class IPLookupTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    lookup_.reset(new IPLookup());
+    ASSERT_EQ(0, lookup_->Init(bess::pb::EmptyArg()).err());
+  }
+
+  virtual void TearDown() {
+    lookup_.reset();
+    Rcu::Synchronize();
+  }
+
+  static void SetRoute(bess::pb::IPLookupCommandAddArg *arg, uint32_t prefix,
+                       int len, gate_idx_t gate, uint64_t group = 0) {
+    arg->set_prefix(ToString(prefix));
+    arg->set_prefix_len(len);
+    arg->set_gate(gate);
+    arg->set_group(group);
+  }
+
+  int Add(uint32_t prefix, int len, gate_idx_t gate, uint64_t group = 0) {
+    bess::pb::IPLookupCommandAddArg arg;
+    SetRoute(&arg, prefix, len, gate, group);
+    return lookup_->CommandAdd(arg).error().err();
+  }
+
+  int Delete(uint32_t prefix, int len) {
+    bess::pb::IPLookupCommandDeleteArg arg;
+    arg.set_prefix(ToString(prefix));
+    arg.set_prefix_len(len);
+    return lookup_->CommandDelete(arg).error().err();
+  }
+
+  int SetGroup(uint64_t group, const std::vector<gate_idx_t> &gates) {
+    bess::pb::IPLookupCommandSetGroupArg arg;
+    arg.set_group(group);
+    for (gate_idx_t gate : gates) {
+      arg.add_gates(gate);
+    }
+    return lookup_->CommandSetGroup(arg).error().err();
+  }
+
+  gate_idx_t Classify(const Headers &h) {
+    const void *ip = &h;
+    gate_idx_t gate;
+
+    lookup_->Classify(&ip, 1, &gate);
+    return gate;
+  }
+
+  gate_idx_t Classify(uint32_t dst) { return Classify(MakeHeaders(dst)); }
+
+  std::unique_ptr<IPLookup> lookup_;
+};
+
+TEST_F(IPLookupTest, Routes) {
+  EXPECT_EQ(0, Add(0x0a000000, 8, 1));
+  EXPECT_EQ(0, Add(0x0a010000, 16, 2));
+  EXPECT_EQ(0, Add(0x0a010180, 25, 3));
+  EXPECT_EQ(1, Classify(0x0a020304));
+  EXPECT_EQ(2, Classify(0x0a010101));
+  EXPECT_EQ(3, Classify(0x0a0101ff));
+  EXPECT_EQ(DROP_GATE, Classify(0x0b000000));
+
+  EXPECT_EQ(0, Add(0, 0, 4));
+  EXPECT_EQ(4, Classify(0x0b000000));
+
+  bess::pb::IPLookupCommandAddArg arg;
+  SetRoute(&arg, 0x0a010101, 24, 5);
+  EXPECT_EQ(EINVAL, lookup_->CommandAdd(arg).error().err());
+  SetRoute(&arg, 0x0a010100, 33, 5);
+  EXPECT_EQ(EINVAL, lookup_->CommandAdd(arg).error().err());
+  EXPECT_EQ(ENOENT, Add(0x0a010100, 24, 0, 1));
+
+  EXPECT_EQ(0, Delete(0x0a010000, 16));
+  EXPECT_EQ(ENOENT, Delete(0x0a010000, 16));
+  EXPECT_EQ(1, Classify(0x0a010101));
+  EXPECT_EQ(3, Classify(0x0a0101ff));
+
+  bess::pb::EmptyArg empty;
+  EXPECT_EQ(0, lookup_->CommandClear(empty).error().err());
+  EXPECT_EQ(DROP_GATE, Classify(0x0a0101ff));
+  EXPECT_EQ(DROP_GATE, Classify(0x0b000000));
+}
+
+TEST_F(IPLookupTest, Update) {
+  EXPECT_EQ(0, Add(0x0a000000, 8, 1));
+
+  bess::pb::IPLookupCommandUpdateArg arg;
+  SetRoute(arg.add_adds(), 0x0a010000, 16, 2);
+  SetRoute(arg.add_adds(), 0, 0, 3);
+  ASSERT_EQ(0, lookup_->CommandUpdate(arg).error().err());
+  EXPECT_EQ(1, Classify(0x0a020304));
+  EXPECT_EQ(2, Classify(0x0a010101));
+  EXPECT_EQ(3, Classify(0x0b000000));
+
+  // A single change made in place must reach the shadow too
+  EXPECT_EQ(0, Add(0x0b000000, 8, 4));
+
+  arg.Clear();
+  SetRoute(arg.add_adds(), 0x0c000000, 8, 5);
+  ASSERT_EQ(0, lookup_->CommandUpdate(arg).error().err());
+  EXPECT_EQ(4, Classify(0x0b000000));
+  EXPECT_EQ(5, Classify(0x0c000000));
+
+  // Nothing changes if any of the changes fails
+  arg.Clear();
+  SetRoute(arg.add_adds(), 0x0d000000, 8, 6);
+  auto *del = arg.add_deletes();
+  del->set_prefix("10.2.0.0");
+  del->set_prefix_len(16);
+  EXPECT_EQ(ENOENT, lookup_->CommandUpdate(arg).error().err());
+  EXPECT_EQ(3, Classify(0x0d000000));
+
+  arg.Clear();
+  arg.set_clear(true);
+  SetRoute(arg.add_adds(), 0x0d000000, 8, 6);
+  ASSERT_EQ(0, lookup_->CommandUpdate(arg).error().err());
+  EXPECT_EQ(DROP_GATE, Classify(0x0a010101));
+  EXPECT_EQ(DROP_GATE, Classify(0x0b000000));
+  EXPECT_EQ(6, Classify(0x0d000000));
+
+  arg.Clear();
+  SetRoute(arg.add_adds(), 0x0e000000, 8, 7);
+  ASSERT_EQ(0, lookup_->CommandUpdate(arg).error().err());
+  EXPECT_EQ(DROP_GATE, Classify(0x0c000000));
+  EXPECT_EQ(6, Classify(0x0d000000));
+  EXPECT_EQ(7, Classify(0x0e000000));
+
+  // Deletes are no-ops after a clear, not missing routes
+  arg.Clear();
+  arg.set_clear(true);
+  del = arg.add_deletes();
+  del->set_prefix("13.0.0.0");
+  del->set_prefix_len(8);
+  del = arg.add_deletes();
+  del->set_prefix("15.0.0.0");
+  del->set_prefix_len(8);
+  SetRoute(arg.add_adds(), 0x0f000000, 8, 8);
+  ASSERT_EQ(0, lookup_->CommandUpdate(arg).error().err());
+  EXPECT_EQ(DROP_GATE, Classify(0x0d000000));
+  EXPECT_EQ(DROP_GATE, Classify(0x0e000000));
+  EXPECT_EQ(8, Classify(0x0f000000));
+}
+
+// Flows of a group spread evenly over its gates, and when a gate leaves or
+// joins, only the flows that must move do
+TEST_F(IPLookupTest, ResilientGroups) {
+  const int kNumFlows = 10000;
+  std::vector<Headers> flows;
+  std::vector<gate_idx_t> gates(kNumFlows);
+  Random rng;
+  rng.SetSeed(0);
+
+  for (int i = 0; i < kNumFlows; i++) {
+    flows.push_back(MakeHeaders(0x0a000000 | rng.GetRange(1 << 24),
+                                rng.Get(), rng.GetRange(65536)));
+  }
+
+  auto classify_all = [&](std::vector<int> *per_gate) {
+    int moved = 0;
+    per_gate->assign(8, 0);
+    for (int i = 0; i < kNumFlows; i++) {
+      gate_idx_t gate = Classify(flows[i]);
+      EXPECT_LT(gate, 8);
+      (*per_gate)[gate]++;
+      moved += (gate != gates[i]);
+      gates[i] = gate;
+    }
+    return moved;
+  };
+
+  std::vector<int> per_gate;
+  ASSERT_EQ(0, SetGroup(1, {0, 1, 2, 3}));
+  ASSERT_EQ(0, Add(0x0a000000, 8, 0, 1));
+  classify_all(&per_gate);
+  for (int gate = 0; gate < 4; gate++) {
+    EXPECT_NEAR(kNumFlows / 4, per_gate[gate], kNumFlows / 20);
+  }
+
+  // Only the flows of gate 2 move
+  int on_gate2 = per_gate[2];
+  ASSERT_EQ(0, SetGroup(1, {0, 1, 3}));
+  EXPECT_EQ(on_gate2, classify_all(&per_gate));
+  EXPECT_EQ(0, per_gate[2]);
+
+  // A new gate takes about a fourth of the flows, and only those move
+  ASSERT_EQ(0, SetGroup(1, {0, 1, 3, 4}));
+  int moved = classify_all(&per_gate);
+  EXPECT_EQ(per_gate[4], moved);
+  EXPECT_NEAR(kNumFlows / 4, moved, kNumFlows / 20);
+
+  // Gates get buckets in proportion to their weights
+  ASSERT_EQ(0, SetGroup(1, {0, 0, 0, 1}));
+  classify_all(&per_gate);
+  EXPECT_NEAR(kNumFlows * 3 / 4, per_gate[0], kNumFlows / 20);
+
+  ASSERT_EQ(0, SetGroup(1, {}));
+  EXPECT_EQ(DROP_GATE, Classify(flows[0]));
+
+  EXPECT_EQ(EINVAL, SetGroup(0, {1}));
+  EXPECT_EQ(EINVAL, SetGroup(IPLookup::kMaxGroups + 1, {1}));
+}
+
+// Streams 1M route changes while a worker looks up addresses covered by a
+// stable set of /24s. Each update moves half of them to other gates by
+// deleting and adding their routes again, so no lookup may miss if updates
+// are atomic.
+TEST_F(IPLookupTest, HitlessUpdates) {
+  const uint32_t kStable = 1000;
+  const uint32_t kBase = 0x0a000000;
+  const int kChangesPerUpdate = 1000;
+  const int kNumChanges = 1000000;
+
+  bess::pb::IPLookupCommandUpdateArg arg;
+  for (uint32_t i = 0; i < kStable; i++) {
+    SetRoute(arg.add_adds(), kBase + (i << 8), 24, 0);
+  }
+  ASSERT_EQ(0, lookup_->CommandUpdate(arg).error().err());
+
+  std::atomic<bool> stop(false);
+  std::atomic<uint64_t> packets(0);
+  std::atomic<uint64_t> lost(0);
+
+  std::thread worker([&]() {
+    const int burst = bess::PacketBatch::kMaxBurst;
+    Headers headers[burst];
+    const void *ip_headers[burst];
+    gate_idx_t out_gates[burst];
+    Random rng;
+    uint64_t n = 0;
+
+    Rcu::RegisterThread();
+    while (!stop.load(std::memory_order_relaxed)) {
+      for (int i = 0; i < burst; i++) {
+        headers[i] = MakeHeaders(kBase + (rng.GetRange(kStable) << 8) +
+                                 rng.GetRange(256));
+        ip_headers[i] = &headers[i];
+      }
+
+      lookup_->Classify(ip_headers, burst, out_gates);
+      for (int i = 0; i < burst; i++) {
+        if (out_gates[i] == DROP_GATE) {
+          lost++;
+        }
+      }
+
+      n += burst;
+      Rcu::Quiescent();
+    }
+
+    packets += n;
+    Rcu::UnregisterThread();
+  });
+
+  Random rng;
+  for (int changes = 0; changes < kNumChanges;
+       changes += kChangesPerUpdate) {
+    gate_idx_t gate = changes / kChangesPerUpdate % MAX_GATES;
+
+    // Distinct routes, as each can only be deleted once
+    uint32_t first = rng.GetRange(kStable);
+    arg.Clear();
+    for (int i = 0; i < kChangesPerUpdate / 2; i++) {
+      uint32_t prefix = kBase + (((first + i) % kStable) << 8);
+      auto *del = arg.add_deletes();
+      del->set_prefix(ToString(prefix));
+      del->set_prefix_len(24);
+      SetRoute(arg.add_adds(), prefix, 24, gate);
+    }
+
+    int err = lookup_->CommandUpdate(arg).error().err();
+    EXPECT_EQ(0, err);
+    if (err) {
+      break;
+    }
+  }
+
+  stop = true;
+  worker.join();
+
+  EXPECT_LT(0, packets);
+  EXPECT_EQ(0, lost);
+}
+
+}  // namespace (unnamed)
@@ -29,28 +29,46 @@ std::string Flow::ToString() const {
 }
 
 pb_error_t NAT::Init(const bess::pb::NATArg &arg) {
-  flow_hash_.Init(sizeof(Flow), sizeof(FlowRecord *));
-
   InitRules(arg);
+  ReserveFlows();
   return pb_errno(0);
 }
 
 void NAT::DeInit() {
-  flow_hash_.Close();
+  flows_.Clear();
 }
 
 pb_cmd_response_t NAT::CommandAdd(const bess::pb::NATArg &arg) {
   InitRules(arg);
+  ReserveFlows();
   return pb_cmd_response_t();
 }
 
 pb_cmd_response_t NAT::CommandClear(const bess::pb::EmptyArg &) {
   rules_.clear();
-  flow_hash_.Clear();
+  flows_.Clear();
 
   return pb_cmd_response_t();
 }
 
+void NAT::ReserveFlows() {
+  size_t total = 0;
+
+  for (const auto &rule : rules_) {
+    total += rule.second.size();
+  }
+
+  // A flow can't outlive its IP/port pair, so the table never fills up
+  flows_.Reserve(total);
+}
+
+void NAT::FreeFlow(const flow_table_t::Record *record) {
+  const Flow &external = record->key(1);  // reversed
+
+  rules_[record->value].second.FreeAllocated(
+      std::make_tuple(external.dst_ip, external.dst_port));
+}
+
 // Recompute IP and TCP/UDP/ICMP checksum
 static inline void compute_cksum(struct Ipv4Header *ip, void *l4) {
   struct TcpHeader *tcp = reinterpret_cast<struct TcpHeader *>(l4);
@@ -154,6 +172,26 @@ void NAT::ProcessBatch(bess::PacketBatch *batch) {
   int cnt = batch->cnt();
   uint64_t now = ctx.current_ns();
 
+  // Bounded, so that expiry is spread over batches
+  auto free_flow = [this](flow_table_t::Record *r) { FreeFlow(r); };
+  flows_.Expire(now, 2 * bess::PacketBatch::kMaxBurst, free_flow);
+
+  // All flows are looked up at once, so that their cache misses overlap. The
+  // results stay valid until a flow is added or removed.
+  Flow flows[bess::PacketBatch::kMaxBurst];
+  flow_table_t::Record *results[bess::PacketBatch::kMaxBurst];
+  bool modified = false;
+
+  for (int i = 0; i < cnt; i++) {
+    struct EthHeader *eth = batch->pkts()[i]->head_data<struct EthHeader *>();
+    struct Ipv4Header *ip = reinterpret_cast<struct Ipv4Header *>(eth + 1);
+    size_t ip_bytes = (ip->header_length) << 2;
+
+    flows[i] = parse_flow(ip, reinterpret_cast<uint8_t *>(ip) + ip_bytes);
+  }
+
+  flows_.FindBulk(flows, cnt, results);
+
   for (int i = 0; i < cnt; i++) {
     bess::Packet *pkt = batch->pkts()[i];
 
@@ -163,7 +201,7 @@ void NAT::ProcessBatch(bess::PacketBatch *batch) {
 
     void *l4 = reinterpret_cast<uint8_t *>(ip) + ip_bytes;
 
-    Flow flow = parse_flow(ip, l4);
+    Flow flow = flows[i];
 
     // L4 protocol must be TCP, UDP, or ICMP
     if (ip->protocol != TCP && ip->protocol != UDP && ip->protocol != ICMP) {
@@ -171,41 +209,24 @@ void NAT::ProcessBatch(bess::PacketBatch *batch) {
       continue;
     }
 
-    const auto rule_it =
-        std::find_if(rules_.begin(), rules_.end(),
-                     [&ip](const std::pair<CIDRNetwork, AvailablePorts> &rule) {
-                       return rule.first.Match(ip->src);
-                     });
-
     {
-      FlowRecord **res = flow_hash_.Get(&flow);
-      if (res != nullptr) {
-        FlowRecord *record = *res;
-        DCHECK_EQ(record->external_flow.src_port, record->port);
-        if (now - record->time < TIME_OUT_NS) {
+      flow_table_t::Record *record = modified ? flows_.Find(flow) : results[i];
+      if (record != nullptr) {
+        if (now < record->expiry()) {
           // Entry exists and does not exceed timeout
-          record->time = now;
+          flows_.SetExpiry(record, now + TIME_OUT_NS);
           if (incoming_gate == 0) {
-            stamp_flow(ip, l4, record->external_flow);
+            stamp_flow(ip, l4, record->key(1).ReverseFlow());
           } else {
-            stamp_flow(ip, l4, record->internal_flow.ReverseFlow());
+            stamp_flow(ip, l4, record->key(0).ReverseFlow());
           }
           out_batch.add(pkt);
           continue;
         } else {
-          // Reclaim expired record
-          record->time = 0;
-          if (incoming_gate == 0) {
-            flow_hash_.Del(&flow);
-            Flow rev_flow = record->external_flow.ReverseFlow();
-            flow_hash_.Del(&rev_flow);
-          } else {
-            flow_hash_.Del(&flow);
-            flow_hash_.Del(&(record->internal_flow));
-          }
-          AvailablePorts &available_ports = rule_it->second;
-          available_ports.FreeAllocated(std::make_tuple(
-              record->external_flow.src_ip, record->port, record));
+          // Reclaim expired record, which Expire() has not caught up with
+          FreeFlow(record);
+          flows_.Remove(record);
+          modified = true;
         }
       }
     }
@@ -220,6 +241,12 @@ void NAT::ProcessBatch(bess::PacketBatch *batch) {
 
     // The flow must be a new flow if we have gotten this far.  So look for a
     // rule that tells us what external prefix this packet's flow maps to.
+    const auto rule_it =
+        std::find_if(rules_.begin(), rules_.end(),
+                     [&ip](const std::pair<CIDRNetwork, AvailablePorts> &rule) {
+                       return rule.first.Match(ip->src);
+                     });
+
     if (rule_it == rules_.end()) {
       // No rules found for this source IP address, drop.
       free_batch.add(pkt);
@@ -228,33 +255,10 @@ void NAT::ProcessBatch(bess::PacketBatch *batch) {
 
     AvailablePorts &available_ports = rule_it->second;
 
-    // Garbage collect.
-    if (available_ports.empty() && now >= available_ports.next_expiry()) {
-      uint64_t expiry = UINT64_MAX;
-
-      uint32_t next = 0;
-      void *key;
-      while ((key = flow_hash_.Iterate(&next))) {
-        FlowRecord **res = flow_hash_.Get((Flow *)key);
-        if (res == nullptr) {
-          continue;
-        }
-        FlowRecord *record = *res;
-        if (record->time != 0 && (now - record->time) >= TIME_OUT_NS) {
-          // Found expired flow entry.
-          record->time = 0;
-          flow_hash_.Del(&(record->internal_flow));
-          Flow rev_flow = record->external_flow.ReverseFlow();
-          flow_hash_.Del(&rev_flow);
-          available_ports.FreeAllocated(
-              std::make_tuple(record->external_flow.src_ip,
-                              record->external_flow.src_port, record));
-        } else if (record->time != 0) {
-          expiry = std::min(expiry, record->time + TIME_OUT_NS);
-        }
-      }
-
-      available_ports.set_next_expiry(expiry);
+    // Catch up with expired flows, as they may hold the ports we need
+    if (available_ports.empty()) {
+      modified |=
+          flows_.Expire(now, bess::PacketBatch::kMaxBurst, free_flow) > 0;
     }
 
     // Still no available ports, so drop.
@@ -265,20 +269,25 @@ void NAT::ProcessBatch(bess::PacketBatch *batch) {
 
     IPAddress new_ip;
     uint16_t new_port;
-    FlowRecord *record;
-    std::tie(new_ip, new_port, record) = available_ports.RandomFreeIPAndPort();
-
-    record->port = new_port;
-    record->time = now;
-    record->internal_flow = flow;    // Copy
-    flow_hash_.Set(&flow, &record);  // Copy
+    std::tie(new_ip, new_port) = available_ports.RandomFreeIPAndPort();
 
+    Flow keys[2];
+    keys[0] = flow;
     flow.src_ip = new_ip;
     flow.src_port = new_port;
-
-    record->external_flow = flow;
-    Flow rev_flow = flow.ReverseFlow();  // Copy
-    flow_hash_.Set(&rev_flow, &record);  // Copy
+    keys[1] = flow.ReverseFlow();
+
+    flow_table_t::Record *record =
+        flows_.Insert(keys, now, now + TIME_OUT_NS);
+    if (record == nullptr) {
+      // The external flow is taken (by a flow of another rule with an
+      // overlapping external network), drop.
+      available_ports.FreeAllocated(std::make_tuple(new_ip, new_port));
+      free_batch.add(pkt);
+      continue;
+    }
+    record->value = rule_it - rules_.begin();
+    modified = true;
 
     stamp_flow(ip, l4, flow);
     out_batch.add(pkt);
@@ -13,13 +13,13 @@
 
 #include "../module.h"
 #include "../module_msg.pb.h"
-#include "../utils/htable.h"
+#include "../utils/flow_table.h"
 #include "../utils/ip.h"
 #include "../utils/random.h"
 
 using bess::utils::IPAddress;
 using bess::utils::CIDRNetwork;
-using bess::utils::HTable;
+using bess::utils::FlowTable;
 
 const uint16_t MIN_PORT = 1024;
 const uint16_t MAX_PORT = 65535;
@@ -76,22 +76,13 @@ class alignas(16) Flow {
     return e1 != other.e1 || e2 != other.e2;
   }
 
+  bool operator==(const Flow &other) const { return !(*this != other); }
+
   std::string ToString() const;
 };
 
 static_assert(sizeof(Flow) == 2 * sizeof(uint64_t), "Flow must be 16 bytes.");
 
-// Stores flow information
-class FlowRecord {
- public:
-  Flow internal_flow;
-  Flow external_flow;
-  uint64_t time;
-  uint16_t port;
-
-  FlowRecord() : internal_flow(), external_flow(), time(), port() {}
-};
-
 // A data structure to track available ports for a given subnet of external IPs
 // for the NAT.  Encapsulates the subnet and the mapping from IPs in that subnet
 // to free ports.
@@ -99,53 +90,45 @@ class AvailablePorts {
  public:
   // Tracks available ports within the given IP prefix.
   explicit AvailablePorts(const CIDRNetwork &prefix)
-      : prefix_(prefix), free_list_(), next_expiry_() {
+      : prefix_(prefix), free_list_() {
     uint32_t min = ntohl(prefix_.addr & prefix_.mask);
     uint32_t max = ntohl(prefix_.addr | (~prefix_.mask));
 
     for (uint32_t ip = min; ip <= max; ip++) {
       for (uint32_t port = MIN_PORT; port <= MAX_PORT; port++) {
-        free_list_.emplace_back(htonl(ip), htons((uint16_t)port),
-                                new FlowRecord());
+        free_list_.emplace_back(htonl(ip), htons((uint16_t)port));
       }
     }
     std::random_shuffle(free_list_.begin(), free_list_.end());
   }
 
-  ~AvailablePorts() {
-    for (auto &i : free_list_) {
-      FlowRecord *r = std::get<2>(i);
-      delete r;
-    }
-  }
-
   // Returns a random free IP/port pair within the network and removes it from
   // the free list.
-  std::tuple<IPAddress, uint16_t, FlowRecord *> RandomFreeIPAndPort() {
-    std::tuple<IPAddress, uint16_t, FlowRecord *> r = free_list_.back();
+  std::tuple<IPAddress, uint16_t> RandomFreeIPAndPort() {
+    std::tuple<IPAddress, uint16_t> r = free_list_.back();
     free_list_.pop_back();
     return r;
   }
 
-  // Adds the given IP/port pair back to the list of available ports.  Takes
-  // back ownership of the tuple and the FlowRecord object in it.
-  void FreeAllocated(const std::tuple<IPAddress, uint16_t, FlowRecord *> &a) {
+  // Adds the given IP/port pair back to the list of available ports.
+  void FreeAllocated(const std::tuple<IPAddress, uint16_t> &a) {
     free_list_.push_back(a);
   }
 
   // Returns true if there are no free remaining IP/port pairs.
   bool empty() const { return free_list_.empty(); }
 
-  const CIDRNetwork &prefix() const { return prefix_; }
-
-  uint64_t next_expiry() const { return next_expiry_; }
+  // Returns the number of IP/port pairs in the network.
+  size_t size() const {
+    return (static_cast<size_t>(~ntohl(prefix_.mask)) + 1) *
+           (MAX_PORT - MIN_PORT + 1);
+  }
 
-  void set_next_expiry(uint64_t next_expiry) { next_expiry_ = next_expiry; }
+  const CIDRNetwork &prefix() const { return prefix_; }
 
  private:
   CIDRNetwork prefix_;
-  std::vector<std::tuple<IPAddress, uint16_t, FlowRecord *>> free_list_;
-  uint64_t next_expiry_;
+  std::vector<std::tuple<IPAddress, uint16_t>> free_list_;
 };
 
 struct FlowHash {
@@ -189,25 +172,24 @@ class NAT final : public Module {
     }
   }
 
-  static inline int flow_keycmp(const void *key, const void *key_stored,
-                                size_t) {
-    return *(const Flow *)key != *(const Flow *)key_stored;
+  static size_t flow_hash(const Flow &flow, size_t) {
+    return FlowHash()(flow);
   }
 
-  static inline uint32_t flow_hash(const void *key, uint32_t,
-                                   uint32_t init_val) {
-#if __SSE4_2__ && __x86_64
-    const Flow *flow = reinterpret_cast<const Flow *>(key);
-    init_val = crc32c_sse42_u64(flow->e1, init_val);
-    init_val = crc32c_sse42_u64(flow->e2, init_val);
-#else
-    init_val = rte_hash_crc(key, sizeof(Flow), init_val);
-#endif
-    return init_val;
-  }
+  static bool flow_eq(const Flow &lhs, const Flow &rhs) { return lhs == rhs; }
+
+  // A flow is found by its internal flow (key 0) and by the reverse of its
+  // external flow (key 1). The value is the index of its rule.
+  typedef FlowTable<Flow, uint32_t, 2, flow_hash, flow_eq> flow_table_t;
+
+  // Reserves a flow for every IP/port pair of the rules
+  void ReserveFlows();
+
+  // Returns the IP/port pair of an expired or removed flow to its rule
+  void FreeFlow(const flow_table_t::Record *record);
 
   std::vector<std::pair<CIDRNetwork, AvailablePorts>> rules_;
-  HTable<Flow, FlowRecord *, flow_keycmp, flow_hash> flow_hash_;
+  flow_table_t flows_;
   Random rng_;
 };
 
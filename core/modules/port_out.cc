@@ -49,6 +49,11 @@ void PortOut::ProcessBatch(bess::PacketBatch *batch) {
   uint64_t sent_bytes = 0;
   int sent_pkts;
 
+  // The port is not accounted for: it may free the packets at any time
+  if (unlikely(bess::packet_accounting.enabled())) {
+    bess::packet_accounting.Release(batch->pkts(), batch->cnt());
+  }
+
   sent_pkts = p->SendPackets(qid, batch->pkts(), batch->cnt());
 
   if (!(p->GetFlags() & DRIVER_FLAG_SELF_OUT_STATS)) {
@@ -14,6 +14,14 @@ using bess::utils::TcpHeader;
 
 const uint64_t TIME_OUT_NS = 10L * 1000 * 1000 * 1000;  // 10 seconds
 
+// Flows that are not blocked are forgotten once idle for this long
+const uint64_t IDLE_TIME_OUT_NS = 60L * 1000 * 1000 * 1000;  // 1 minute
+
+// The flow table starts with room for kMinFlows and doubles when full, up to
+// kMaxFlows. Flows beyond that are passed without inspection.
+const size_t kMinFlows = 4096;
+const size_t kMaxFlows = 4 * 1024 * 1024;
+
 const Commands UrlFilter::cmds = {
     {"add", "UrlFilterArg", MODULE_CMD_FUNC(&UrlFilter::CommandAdd), 0},
     {"clear", "EmptyArg", MODULE_CMD_FUNC(&UrlFilter::CommandClear), 0}};
@@ -133,6 +141,8 @@ inline static bess::Packet *GenerateResetPacket(
 }
 
 pb_error_t UrlFilter::Init(const bess::pb::UrlFilterArg &arg) {
+  flows_.Reserve(kMinFlows);
+
   for (const auto &url : arg.blacklist()) {
     if (blacklist_.find(url.host()) == blacklist_.end()) {
       blacklist_.emplace(url.host(), Trie());
@@ -154,6 +164,32 @@ pb_cmd_response_t UrlFilter::CommandClear(const bess::pb::EmptyArg &) {
   return pb_cmd_response_t();
 }
 
+UrlFilter::flow_table_t::Record *UrlFilter::FindOrInsertFlow(const Flow &flow,
+                                                             uint64_t now) {
+  flow_table_t::Record *record = flows_.Find(flow);
+
+  // Expired, but Expire() has not caught up with it yet
+  if (record && now >= record->expiry()) {
+    flows_.Remove(record);
+    record = nullptr;
+  }
+
+  if (record) {
+    if (!record->value.blocked()) {
+      flows_.SetExpiry(record, now + IDLE_TIME_OUT_NS);
+    }
+    return record;
+  }
+
+  record = flows_.Insert(&flow, now, now + IDLE_TIME_OUT_NS);
+  if (!record && flows_.Capacity() < kMaxFlows) {
+    flows_.Reserve(std::min(flows_.Capacity() * 2, kMaxFlows));
+    record = flows_.Insert(&flow, now, now + IDLE_TIME_OUT_NS);
+  }
+
+  return record;
+}
+
 void UrlFilter::ProcessBatch(bess::PacketBatch *batch) {
   gate_idx_t igate = get_igate();
 
@@ -178,6 +214,11 @@ void UrlFilter::ProcessBatch(bess::PacketBatch *batch) {
   out_batches[3].clear();
 
   int cnt = batch->cnt();
+  uint64_t now = ctx.current_ns();
+
+  // Bounded, so that expiry is spread over batches
+  flows_.Expire(now, 2 * bess::PacketBatch::kMaxBurst,
+                [](flow_table_t::Record *) {});
 
   for (int i = 0; i < cnt; i++) {
     bess::Packet *pkt = batch->pkts()[i];
@@ -200,26 +241,21 @@ void UrlFilter::ProcessBatch(bess::PacketBatch *batch) {
     flow.src_port = tcp->src_port;
     flow.dst_port = tcp->dst_port;
 
-    uint64_t now = ctx.current_ns();
+    flow_table_t::Record *record = FindOrInsertFlow(flow, now);
 
-    // Check if the flow is already blocked
-    std::unordered_map<Flow, FlowRecord, FlowHash>::iterator it =
-        flow_cache_.find(flow);
-
-    if (it != flow_cache_.end()) {
-      if (now < it->second.ExpiryTime()) {
-        free_batch.add(pkt);
-        continue;
-      } else {
-        flow_cache_.erase(it);
-      }
+    // Too many flows to keep track of this one, so let it pass
+    if (!record) {
+      out_batches[0].add(pkt);
+      continue;
     }
 
-    std::tie(it, std::ignore) = flow_cache_.emplace(
-        std::piecewise_construct, std::make_tuple(flow), std::make_tuple());
+    // Check if the flow is already blocked
+    if (record->value.blocked()) {
+      free_batch.add(pkt);
+      continue;
+    }
 
-    FlowRecord &record = it->second;
-    TcpFlowReconstruct &buffer = record.GetBuffer();
+    TcpFlowReconstruct &buffer = record->value.GetBuffer();
 
     // If the reconstruct code indicates failure, treat it as a flow to pass.
     // No need to parse the headers if the reconstruct code tells us it failed.
@@ -262,11 +298,12 @@ void UrlFilter::ProcessBatch(bess::PacketBatch *batch) {
       // NOTE: if FIN is lost on its way to destination, this will simply pass
       // the retransmitted packet
       if (tcp->flags & TCP_FLAG_FIN) {
-        flow_cache_.erase(it);
+        flows_.Remove(record);
       }
     } else {
       // Block this flow for TIME_OUT_NS nanoseconds
-      record.SetExpiryTime(now + TIME_OUT_NS);
+      record->value.Block();
+      flows_.SetExpiry(record, now + TIME_OUT_NS);
 
       // Inject RST to destination
       out_batches[1].add(GenerateResetPacket(
@@ -5,6 +5,7 @@
 #include <rte_hash_crc.h>
 
 #include <map>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
@@ -12,9 +13,11 @@
 #include "../module.h"
 #include "../module_msg.pb.h"
 #include "../packet.h"
+#include "../utils/flow_table.h"
 #include "../utils/tcp_flow_reconstruct.h"
 #include "../utils/trie.h"
 
+using bess::utils::FlowTable;
 using bess::utils::TcpFlowReconstruct;
 using bess::utils::Trie;
 
@@ -59,17 +62,29 @@ struct FlowHash {
   }
 };
 
+// State of a flow, kept until it ends or expires
 class FlowRecord {
  public:
-  FlowRecord() : buffer_(128), expiry_time_(0) {}
+  FlowRecord() : buffer_(), blocked_(false) {}
+
+  // Allocated on first use, so that blocked flows don't hold one
+  TcpFlowReconstruct &GetBuffer() {
+    if (!buffer_) {
+      buffer_.reset(new TcpFlowReconstruct(128));
+    }
+    return *buffer_;
+  }
 
-  TcpFlowReconstruct &GetBuffer() { return buffer_; }
-  uint64_t ExpiryTime() { return expiry_time_; }
-  void SetExpiryTime(uint64_t time) { expiry_time_ = time; }
+  // Packets of a blocked flow are dropped until it expires
+  bool blocked() const { return blocked_; }
+  void Block() {
+    blocked_ = true;
+    buffer_.reset();
+  }
 
  private:
-  TcpFlowReconstruct buffer_;
-  uint64_t expiry_time_;
+  std::unique_ptr<TcpFlowReconstruct> buffer_;
+  bool blocked_;
 };
 
 // A module of HTTP URL filtering. Ends an HTTP connection if the Host field
@@ -92,8 +107,20 @@ class UrlFilter final : public Module {
   pb_cmd_response_t CommandClear(const bess::pb::EmptyArg &arg);
 
  private:
+  static size_t flow_hash(const Flow &flow, size_t) {
+    return FlowHash()(flow);
+  }
+
+  static bool flow_eq(const Flow &lhs, const Flow &rhs) { return lhs == rhs; }
+
+  typedef FlowTable<Flow, FlowRecord, 1, flow_hash, flow_eq> flow_table_t;
+
+  // Returns the record of the flow, a new one if none. Returns nullptr if the
+  // table is full.
+  flow_table_t::Record *FindOrInsertFlow(const Flow &flow, uint64_t now);
+
   std::unordered_map<std::string, Trie> blacklist_;
-  std::unordered_map<Flow, FlowRecord, FlowHash> flow_cache_;
+  flow_table_t flows_;
 };
 
 #endif  // BESS_MODULES_URL_FILTER_H_
@@ -1,37 +1,17 @@
 #include "wildcard_match.h"
 
+#include <algorithm>
+
 #include "../utils/endian.h"
 #include "../utils/format.h"
 
 using bess::metadata::Attribute;
 
-/* k1 = k2 & mask */
-static void mask(void *k1, const void *k2, const void *mask, int key_size) {
-  uint64_t *a = static_cast<uint64_t *>(k1);
-  const uint64_t *b = reinterpret_cast<const uint64_t *>(k2);
-  const uint64_t *m = reinterpret_cast<const uint64_t *>(mask);
-
-  switch (key_size >> 3) {
-    default:
-      promise_unreachable();
-    case 8:
-      a[7] = b[7] & m[7];
-    case 7:
-      a[6] = b[6] & m[6];
-    case 6:
-      a[5] = b[5] & m[5];
-    case 5:
-      a[4] = b[4] & m[4];
-    case 4:
-      a[3] = b[3] & m[3];
-    case 3:
-      a[2] = b[2] & m[2];
-    case 2:
-      a[1] = b[1] & m[1];
-    case 1:
-      a[0] = b[0] & m[0];
-  }
-}
+using bess::utils::HashKeyMask;
+
+static_assert(bess::PacketBatch::kMaxBurst <=
+                  FlowCache<gate_idx_t>::kMaxBulk,
+              "a batch does not fit in a bulk lookup");
 
 // XXX: this is repeated in many modules. get rid of them when converting .h to
 // .hh, etc... it's in defined in some old header
@@ -46,7 +26,9 @@ const Commands WildcardMatch::cmds = {
      MODULE_CMD_FUNC(&WildcardMatch::CommandDelete), 0},
     {"clear", "EmptyArg", MODULE_CMD_FUNC(&WildcardMatch::CommandClear), 0},
     {"set_default_gate", "WildcardMatchCommandSetDefaultGateArg",
-     MODULE_CMD_FUNC(&WildcardMatch::CommandSetDefaultGate), 1}};
+     MODULE_CMD_FUNC(&WildcardMatch::CommandSetDefaultGate), 1},
+    {"get_cache_stats", "EmptyArg",
+     MODULE_CMD_FUNC(&WildcardMatch::CommandGetCacheStats), 0}};
 
 pb_error_t WildcardMatch::AddFieldOne(
     const bess::pb::WildcardMatchArg_Field &field, struct WmField *f) {
@@ -88,6 +70,10 @@ pb_error_t WildcardMatch::AddFieldOne(
 pb_error_t WildcardMatch::Init(const bess::pb::WildcardMatchArg &arg) {
   int size_acc = 0;
 
+  if (arg.fields_size() > MAX_FIELDS) {
+    return pb_error(EINVAL, "must have at most %d fields", MAX_FIELDS);
+  }
+
   for (int i = 0; i < arg.fields_size(); i++) {
     const auto &field = arg.fields(i);
     pb_error_t err;
@@ -106,6 +92,7 @@ pb_error_t WildcardMatch::Init(const bess::pb::WildcardMatchArg &arg) {
 
   default_gate_ = DROP_GATE;
   total_key_size_ = align_ceil(size_acc, sizeof(uint64_t));
+  cache_size_ = arg.cache_size();
 
   return pb_errno(0);
 }
@@ -116,40 +103,13 @@ void WildcardMatch::DeInit() {
   }
 }
 
-gate_idx_t WildcardMatch::LookupEntry(wm_hkey_t *key, gate_idx_t def_gate) {
-  struct WmData result = {
-      .priority = INT_MIN, .ogate = def_gate,
-  };
-
-  const int key_size = total_key_size_;
-
-  wm_hkey_t key_masked;
-
-  for (const auto &tuple : tuples_) {
-    struct WmData *cand;
-
-    mask(&key_masked, key, &tuple.mask, key_size);
-
-    cand = static_cast<struct WmData *>(tuple.ht.Get(&key_masked));
-
-    if (cand && cand->priority >= result.priority) {
-      result = *cand;
-    }
-  }
-
-  return result.ogate;
-}
-
 void WildcardMatch::ProcessBatch(bess::PacketBatch *batch) {
-  gate_idx_t default_gate;
   gate_idx_t out_gates[bess::PacketBatch::kMaxBurst];
-
-  char keys[bess::PacketBatch::kMaxBurst][HASH_KEY_SIZE] __ymm_aligned;
+  char keys[bess::PacketBatch::kMaxBurst][kKeyStride] __ymm_aligned;
+  const void *key_ptrs[bess::PacketBatch::kMaxBurst];
 
   int cnt = batch->cnt();
 
-  default_gate = ACCESS_ONCE(default_gate_);
-
   for (const auto &field : fields_) {
     int offset;
     int pos = field.pos;
@@ -163,7 +123,7 @@ void WildcardMatch::ProcessBatch(bess::PacketBatch *batch) {
 
     char *key = keys[0] + pos;
 
-    for (int j = 0; j < cnt; j++, key += HASH_KEY_SIZE) {
+    for (int j = 0; j < cnt; j++, key += kKeyStride) {
       char *buf_addr = batch->pkts()[j]->buffer<char *>();
 
       /* for offset-based attrs we use relative offset */
@@ -176,43 +136,159 @@ void WildcardMatch::ProcessBatch(bess::PacketBatch *batch) {
     }
   }
 
-#if 1
   for (int i = 0; i < cnt; i++) {
-    out_gates[i] =
-        LookupEntry(reinterpret_cast<wm_hkey_t *>(keys[i]), default_gate);
+    key_ptrs[i] = keys[i];
+  }
+
+  Classify(key_ptrs, cnt, out_gates);
+
+  RunSplit(out_gates, batch);
+}
+
+void WildcardMatch::Classify(const void *const *keys, int cnt,
+                             gate_idx_t *out_gates) {
+  gate_idx_t default_gate = ACCESS_ONCE(default_gate_);
+  const int key_size = total_key_size_;
+
+  if (cache_size_ == 0) {
+    LookupBulk(keys, cnt, default_gate, out_gates);
+    return;
+  }
+
+  std::unique_ptr<flow_cache_t> &cache = caches_[ctx.wid()];
+  if (!cache) {
+    cache.reset(new flow_cache_t(key_size, cache_size_));
+  }
+
+  // Masking off the bits that no tuple looks at does not change the results
+  wm_hkey_t cache_keys[bess::PacketBatch::kMaxBurst];
+  const void *cache_key_ptrs[bess::PacketBatch::kMaxBurst];
+  uint32_t hashes[bess::PacketBatch::kMaxBurst];
+
+  for (int i = 0; i < cnt; i++) {
+    HashKeyMask(&cache_keys[i], keys[i], &cache_mask_, key_size);
+    cache_key_ptrs[i] = &cache_keys[i];
+  }
+
+  uint64_t hits =
+      cache->FindBulk(cache_key_ptrs, cnt, generation_, hashes, out_gates);
+
+  // The default gate may change without invalidating the cache, so packets
+  // that match no rule are cached as such
+  const void *miss_keys[bess::PacketBatch::kMaxBurst];
+  int misses[bess::PacketBatch::kMaxBurst];
+  int num_misses = 0;
+
+  for (int i = 0; i < cnt; i++) {
+    if (!(hits & (1ULL << i))) {
+      misses[num_misses] = i;
+      miss_keys[num_misses++] = &cache_keys[i];
+    }
+  }
+
+  if (num_misses > 0) {
+    gate_idx_t miss_gates[bess::PacketBatch::kMaxBurst];
+
+    LookupBulk(miss_keys, num_misses, INVALID_GATE, miss_gates);
+    for (int j = 0; j < num_misses; j++) {
+      int i = misses[j];
+      cache->Insert(miss_keys[j], hashes[i], generation_, miss_gates[j]);
+      out_gates[i] = miss_gates[j];
+    }
+  }
+
+  for (int i = 0; i < cnt; i++) {
+    if (out_gates[i] == INVALID_GATE) {
+      out_gates[i] = default_gate;
+    }
   }
-#else
-  /* A version with an outer loop for tuples and an inner loop for pkts.
-   * Significantly slower. */
+}
 
-  int priorities[bess::PacketBatch::kMaxBurst];
+void WildcardMatch::LookupBulk(const void *const *keys, int cnt,
+                               gate_idx_t default_gate,
+                               gate_idx_t *out_gates) const {
   const int key_size = total_key_size_;
 
+  // Priorities are ints, so INT64_MIN is below any rule
+  int64_t priorities[bess::PacketBatch::kMaxBurst];
+
+  // Packets that a later tuple may still match with a higher priority
+  int active[bess::PacketBatch::kMaxBurst];
+  int num_active = cnt;
+
   for (int i = 0; i < cnt; i++) {
-    priorities[i] = INT_MIN;
+    priorities[i] = INT64_MIN;
     out_gates[i] = default_gate;
+    active[i] = i;
+  }
+
+  // Tuple by tuple, so that the lookups of all packets in the batch can be
+  // overlapped with GetBulk()
+  static_assert(bess::PacketBatch::kMaxBurst <= htable_t::kMaxBulk,
+                "a batch does not fit in a bulk lookup");
+  wm_hkey_t keys_masked[bess::PacketBatch::kMaxBurst];
+  const wm_hkey_t *key_ptrs[bess::PacketBatch::kMaxBurst];
+  struct WmData *cands[bess::PacketBatch::kMaxBurst];
+
+  for (int i = 0; i < cnt; i++) {
+    key_ptrs[i] = &keys_masked[i];
   }
 
+  // The highest priority matched by an active packet. No packet can be done
+  // before a tuple of no higher max_priority, so until then (all along if
+  // priorities are unrelated to tuples) active[] is left as it is.
+  int64_t max_matched = INT64_MIN;
+
   for (const auto &tuple : tuples_) {
-    const wm_hkey_t *tuple_mask = &tuple.mask;
+    // As tuples come in the order of max_priority, a packet that this tuple
+    // cannot improve on is done
+    if (tuple.max_priority <= max_matched) {
+      int n = 0;
+      max_matched = INT64_MIN;
+      for (int j = 0; j < num_active; j++) {
+        int i = active[j];
+        if (tuple.max_priority > priorities[i]) {
+          active[n++] = i;
+          max_matched = std::max(max_matched, priorities[i]);
+        }
+      }
+
+      num_active = n;
+      if (num_active == 0) {
+        break;
+      }
+    }
+
+    // While no packet is done, active[] is the identity. Masking the keys
+    // through it would cost more than pruning a few packets saves.
+    const bool all_active = (num_active == cnt);
 
-    for (int j = 0; j < cnt; j++) {
-      wm_hkey_t key_masked;
-      struct WmData *cand;
+    if (all_active) {
+      for (int i = 0; i < cnt; i++) {
+        HashKeyMask(&keys_masked[i], keys[i], &tuple.mask, key_size);
+      }
+    } else {
+      for (int j = 0; j < num_active; j++) {
+        HashKeyMask(&keys_masked[j], keys[active[j]], &tuple.mask, key_size);
+      }
+    }
 
-      mask(&key_masked, keys[j], tuple_mask, key_size);
+    if (!tuple.ht.GetBulk(key_ptrs, num_active, cands, nullptr)) {
+      continue;
+    }
 
-      cand = tuple.ht.Get(&key_masked);
+    for (int j = 0; j < num_active; j++) {
+      struct WmData *cand = cands[j];
+      int i = all_active ? j : active[j];
 
-      if (cand && cand->priority >= priorities[j]) {
-        out_gates[j] = cand->ogate;
-        priorities[j] = cand->priority;
+      // Of the rules of the same priority, the one in an earlier tuple wins
+      if (cand && cand->priority > priorities[i]) {
+        out_gates[i] = cand->ogate;
+        priorities[i] = cand->priority;
+        max_matched = std::max(max_matched, priorities[i]);
       }
     }
   }
-#endif
-
-  RunSplit(out_gates, batch);
 }
 
 std::string WildcardMatch::GetDesc() const {
@@ -308,18 +384,48 @@ int WildcardMatch::AddTuple(wm_hkey_t *mask) {
 
 int WildcardMatch::DelEntry(int idx, wm_hkey_t *key) {
   struct WmTuple &tuple = tuples_[idx];
+  struct WmData *data = tuple.ht.Get(key);
+  if (!data) {
+    return -ENOENT;
+  }
+
+  int priority = data->priority;
   int ret = tuple.ht.Del(key);
   if (ret) {
     return ret;
   }
 
+  int old_max = tuple.max_priority;
+  tuple.DelPriority(priority);
   if (tuple.ht.Count() == 0) {
+    tuple.ht.Close();
     tuples_.erase(tuples_.begin() + idx);
+  } else if (tuple.max_priority != old_max) {
+    SortTuples();
   }
 
+  RulesChanged();
   return 0;
 }
 
+void WildcardMatch::SortTuples() {
+  std::stable_sort(tuples_.begin(), tuples_.end(),
+                   [](const WmTuple &a, const WmTuple &b) {
+                     return a.max_priority > b.max_priority;
+                   });
+}
+
+void WildcardMatch::RulesChanged() {
+  generation_++;
+
+  memset(&cache_mask_, 0, sizeof(cache_mask_));
+  for (const auto &tuple : tuples_) {
+    for (int i = 0; i < MAX_FIELDS; i++) {
+      cache_mask_.u64_arr[i] |= tuple.mask.u64_arr[i];
+    }
+  }
+}
+
 pb_cmd_response_t WildcardMatch::CommandAdd(
     const bess::pb::WildcardMatchCommandAddArg &arg) {
   pb_cmd_response_t response;
@@ -357,12 +463,26 @@ pb_cmd_response_t WildcardMatch::CommandAdd(
     }
   }
 
-  int ret = tuples_[idx].ht.Set(&key, &data);
+  struct WmTuple &tuple = tuples_[idx];
+  const struct WmData *old = tuple.ht.Get(&key);
+  int old_priority = old ? old->priority : 0;
+
+  int ret = tuple.ht.Set(&key, &data);
   if (ret < 0) {
     set_cmd_response_error(&response, pb_error(-ret, "failed to add a rule"));
     return response;
   }
 
+  int old_max = tuple.max_priority;
+  if (old) {
+    tuple.DelPriority(old_priority);
+  }
+  tuple.AddPriority(priority);
+  if (tuple.max_priority != old_max) {
+    SortTuples();
+  }
+  RulesChanged();
+
   set_cmd_response_error(&response, pb_errno(0));
   return response;
 }
@@ -400,8 +520,10 @@ pb_cmd_response_t WildcardMatch::CommandDelete(
 
 pb_cmd_response_t WildcardMatch::CommandClear(const bess::pb::EmptyArg &) {
   for (auto &tuple : tuples_) {
-    tuple.ht.Clear();
+    tuple.ht.Close();
   }
+  tuples_.clear();
+  RulesChanged();
 
   pb_cmd_response_t response;
 
@@ -421,5 +543,23 @@ pb_cmd_response_t WildcardMatch::CommandSetDefaultGate(
   return response;
 }
 
+pb_cmd_response_t WildcardMatch::CommandGetCacheStats(
+    const bess::pb::EmptyArg &) {
+  bess::pb::FlowCacheStats r;
+
+  for (const auto &cache : caches_) {
+    if (cache) {
+      r.set_hits(r.hits() + cache->stats().hits);
+      r.set_misses(r.misses() + cache->stats().misses);
+      r.set_evictions(r.evictions() + cache->stats().evictions);
+    }
+  }
+
+  pb_cmd_response_t response;
+  response.mutable_error()->set_err(0);
+  response.mutable_other()->PackFrom(r);
+  return response;
+}
+
 ADD_MODULE(WildcardMatch, "wm",
            "Multi-field classifier with a wildcard match table")
@@ -1,23 +1,30 @@
 #ifndef BESS_MODULES_WILDCARDMATCH_H_
 #define BESS_MODULES_WILDCARDMATCH_H_
 
-#include "../module.h"
+#include <climits>
+#include <map>
+#include <memory>
 
-#include <rte_config.h>
-#include <rte_hash_crc.h>
+#include "../module.h"
 
 #include "../module_msg.pb.h"
+#include "../utils/flow_cache.h"
+#include "../utils/hash_key.h"
 #include "../utils/htable.h"
+#include "../worker.h"
 
+using bess::utils::FlowCache;
 using bess::utils::HTable;
 
-#define MAX_TUPLES 8
-#define MAX_FIELDS 8
+#define MAX_TUPLES 1024
+#define MAX_FIELDS 16
 #define MAX_FIELD_SIZE 8
 static_assert(MAX_FIELD_SIZE <= sizeof(uint64_t),
               "field cannot be larger than 8 bytes");
 
 #define HASH_KEY_SIZE (MAX_FIELDS * MAX_FIELD_SIZE)
+static_assert(HASH_KEY_SIZE <= bess::utils::kMaxHashKeySize,
+              "key cannot be larger than 128 bytes");
 
 #if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
 #error this code assumes little endian architecture (x86)
@@ -44,6 +51,13 @@ struct wm_hkey_t {
   uint64_t u64_arr[MAX_FIELDS];
 };
 
+// Tuple space search: rules with the same set of masks form a tuple, a hash
+// table of their masked values. Tuples are kept in the order of the highest
+// priority of their rules, so a lookup ends once no remaining tuple can have
+// a rule of higher priority than the best match so far.
+//
+// With cache_size, each worker has a FlowCache of the results in front of the
+// tuples, keyed by the fields with the bits that no rule looks at masked off.
 class WildcardMatch final : public Module {
  public:
   static const gate_idx_t kNumOGates = MAX_GATES;
@@ -51,7 +65,15 @@ class WildcardMatch final : public Module {
   static const Commands cmds;
 
   WildcardMatch()
-      : Module(), default_gate_(), total_key_size_(), fields_(), tuples_() {}
+      : Module(),
+        default_gate_(),
+        total_key_size_(),
+        fields_(),
+        tuples_(),
+        cache_size_(),
+        generation_(1),
+        cache_mask_(),
+        caches_() {}
 
   pb_error_t Init(const bess::pb::WildcardMatchArg &arg);
 
@@ -59,6 +81,11 @@ class WildcardMatch final : public Module {
 
   void ProcessBatch(bess::PacketBatch *batch) override;
 
+  // Sets out_gates[i] to the gate of the rule of the highest priority that
+  // matches keys[i] (or to the default gate). A key is total_key_size_ bytes
+  // of fields, and cnt <= kMaxBurst.
+  void Classify(const void *const *keys, int cnt, gate_idx_t *out_gates);
+
   std::string GetDesc() const override;
 
   pb_cmd_response_t CommandAdd(const bess::pb::WildcardMatchCommandAddArg &arg);
@@ -67,83 +94,42 @@ class WildcardMatch final : public Module {
   pb_cmd_response_t CommandClear(const bess::pb::EmptyArg &arg);
   pb_cmd_response_t CommandSetDefaultGate(
       const bess::pb::WildcardMatchCommandSetDefaultGateArg &arg);
+  pb_cmd_response_t CommandGetCacheStats(const bess::pb::EmptyArg &arg);
 
  private:
-  static int wm_keycmp(const void *key, const void *key_stored,
-                       size_t key_len) {
-    const uint64_t *a = ((wm_hkey_t *)key)->u64_arr;
-    const uint64_t *b = ((wm_hkey_t *)key_stored)->u64_arr;
-
-    switch (key_len >> 3) {
-      default:
-        promise_unreachable();
-      case 8:
-        if (unlikely(a[7] != b[7]))
-          return 1;
-      case 7:
-        if (unlikely(a[6] != b[6]))
-          return 1;
-      case 6:
-        if (unlikely(a[5] != b[5]))
-          return 1;
-      case 5:
-        if (unlikely(a[4] != b[4]))
-          return 1;
-      case 4:
-        if (unlikely(a[3] != b[3]))
-          return 1;
-      case 3:
-        if (unlikely(a[2] != b[2]))
-          return 1;
-      case 2:
-        if (unlikely(a[1] != b[1]))
-          return 1;
-      case 1:
-        if (unlikely(a[0] != b[0]))
-          return 1;
-    }
+  // Each field is gathered with an 8-byte store, which may spill over the end
+  // of the last field into the room after the key
+  static const int kKeyStride = HASH_KEY_SIZE + sizeof(uint64_t);
 
-    return 0;
-  }
-
-  static uint32_t wm_hash(const void *key, uint32_t key_len,
-                          uint32_t init_val) {
-#if __SSE4_2__ && __x86_64
-    const uint64_t *a = ((wm_hkey_t *)key)->u64_arr;
-
-    switch (key_len >> 3) {
-      default:
-        promise_unreachable();
-      case 8:
-        init_val = crc32c_sse42_u64(*a++, init_val);
-      case 7:
-        init_val = crc32c_sse42_u64(*a++, init_val);
-      case 6:
-        init_val = crc32c_sse42_u64(*a++, init_val);
-      case 5:
-        init_val = crc32c_sse42_u64(*a++, init_val);
-      case 4:
-        init_val = crc32c_sse42_u64(*a++, init_val);
-      case 3:
-        init_val = crc32c_sse42_u64(*a++, init_val);
-      case 2:
-        init_val = crc32c_sse42_u64(*a++, init_val);
-      case 1:
-        init_val = crc32c_sse42_u64(*a++, init_val);
-    }
+  typedef HTable<wm_hkey_t, struct WmData, bess::utils::HashKeyCmp,
+                 bess::utils::HashKeyHash>
+      htable_t;
 
-    return init_val;
-#else
-    return rte_hash_crc(key, key_len, init_val);
-#endif
-  }
+  typedef FlowCache<gate_idx_t> flow_cache_t;
 
   struct WmTuple {
-    HTable<wm_hkey_t, struct WmData, wm_keycmp, wm_hash> ht;
+    WmTuple() : ht(), mask(), max_priority(INT_MIN), priorities() {}
+
+    void AddPriority(int priority) {
+      priorities[priority]++;
+      max_priority = priorities.rbegin()->first;
+    }
+
+    void DelPriority(int priority) {
+      auto it = priorities.find(priority);
+      if (--it->second == 0) {
+        priorities.erase(it);
+      }
+      max_priority = priorities.empty() ? INT_MIN : priorities.rbegin()->first;
+    }
+
+    htable_t ht;
     wm_hkey_t mask;
-  };
 
-  gate_idx_t LookupEntry(wm_hkey_t *key, gate_idx_t def_gate);
+    // No rule in the tuple has a higher priority than max_priority
+    int max_priority;
+    std::map<int, int> priorities;  // The number of rules of each priority
+  };
 
   pb_error_t AddFieldOne(const bess::pb::WildcardMatchArg_Field &field,
                          struct WmField *f);
@@ -155,6 +141,16 @@ class WildcardMatch final : public Module {
   int AddTuple(wm_hkey_t *mask);
   int DelEntry(int idx, wm_hkey_t *key);
 
+  // Restores the order of tuples_, the highest max_priority first
+  void SortTuples();
+
+  // Invalidates the cached results, after the rules have changed
+  void RulesChanged();
+
+  // As Classify(), with the tuples only
+  void LookupBulk(const void *const *keys, int cnt, gate_idx_t default_gate,
+                  gate_idx_t *out_gates) const;
+
   gate_idx_t default_gate_;
 
   int total_key_size_; /* a multiple of sizeof(uint64_t) */
@@ -162,6 +158,11 @@ class WildcardMatch final : public Module {
   std::vector<struct WmField> fields_;
 
   std::vector<struct WmTuple> tuples_;
+
+  uint64_t cache_size_;  // entries per worker, or 0 for no cache
+  uint64_t generation_;  // of the rules, for cached results
+  wm_hkey_t cache_mask_;  // OR of the masks of all tuples
+  std::unique_ptr<flow_cache_t> caches_[MAX_WORKERS];
 };
 
 #endif  // BESS_MODULES_WILDCARDMATCH_H_
@@ -0,0 +1,208 @@
+// Benchmark for WildcardMatch module.
+
+#include <benchmark/benchmark.h>
+#include <glog/logging.h>
+
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "wildcard_match.h"
+
+namespace {
+
+enum PriorityDistribution {
+  kRandom,    // Priorities of rules are unrelated to their tuples
+  kByTuple,   // All the rules of a tuple have the same priority
+  kFewHighs,  // As kByTuple, with 1% of the rules of top priority
+};
+
+const int kRulesPerTuple = 64;
+const int kNumKeys = 1 << 14;
+const int kNumPackets = 1 << 16;
+const double kZipfExponent = 1.0;
+
+// IPv4 5-tuple rules (without the protocol), where the tuples differ in the
+// prefix lengths of the addresses and whether the ports are wildcards.
+// Flows match a random rule, and maybe others of lower priority. Packets
+// are of flows chosen uniformly, or with a Zipf distribution.
+class WildcardMatchFixture : public benchmark::Fixture {
+ public:
+  void SetUp(benchmark::State &state) override {
+    int num_tuples = state.range(0);
+    PriorityDistribution dist =
+        static_cast<PriorityDistribution>(state.range(1));
+    std::mt19937 rng(42);
+
+    bess::pb::WildcardMatchArg arg;
+    arg.set_cache_size(state.range(2));
+    for (int offset : {26, 30}) {
+      auto *field = arg.add_fields();
+      field->set_offset(offset);
+      field->set_size(4);
+    }
+    for (int offset : {34, 36}) {
+      auto *field = arg.add_fields();
+      field->set_offset(offset);
+      field->set_size(2);
+    }
+    wm_.reset(new WildcardMatch());
+    CHECK_EQ(wm_->Init(arg).err(), 0);
+
+    // Distinct (src length, dst length, port wildcards) combinations
+    std::vector<std::array<int, 3>> masks;
+    for (int src_len = 32; src_len >= 0; src_len--) {
+      for (int dst_len = 32; dst_len >= 0; dst_len--) {
+        for (int ports = 0; ports < 2; ports++) {
+          masks.push_back({{src_len, dst_len, ports}});
+        }
+      }
+    }
+    std::shuffle(masks.begin(), masks.end(), rng);
+    masks.resize(num_tuples);
+
+    for (int t = 0; t < num_tuples; t++) {
+      uint32_t src_mask = masks[t][0] ? ~0u << (32 - masks[t][0]) : 0;
+      uint32_t dst_mask = masks[t][1] ? ~0u << (32 - masks[t][1]) : 0;
+      uint32_t port_mask = masks[t][2] ? 0xffff : 0;
+
+      for (int r = 0; r < kRulesPerTuple; r++) {
+        uint32_t src = rng() & src_mask;
+        uint32_t dst = rng() & dst_mask;
+        uint32_t sport = rng() & port_mask;
+        uint32_t dport = rng() & port_mask;
+
+        int priority;
+        switch (dist) {
+          case kRandom:
+            priority = rng() % (num_tuples * kRulesPerTuple);
+            break;
+          case kByTuple:
+            priority = t;
+            break;
+          default:
+            priority = (rng() % 100 == 0) ? num_tuples : t;
+            break;
+        }
+
+        bess::pb::WildcardMatchCommandAddArg add;
+        add.set_gate(r % MAX_GATES);
+        add.set_priority(priority);
+        for (uint32_t v : {src, dst, sport, dport}) {
+          add.add_values(v);
+        }
+        for (uint32_t m : {src_mask, dst_mask, port_mask, port_mask}) {
+          add.add_masks(m);
+        }
+        CHECK_EQ(wm_->CommandAdd(add).error().err(), 0);
+
+        // A packet of the rule, with random bits where it has wildcards
+        for (int k = 0; k < kNumKeys / (num_tuples * kRulesPerTuple) + 1;
+             k++) {
+          keys_.emplace_back();
+          uint32_t *key = reinterpret_cast<uint32_t *>(&keys_.back());
+          key[0] = htonl(src | (rng() & ~src_mask));
+          key[1] = htonl(dst | (rng() & ~dst_mask));
+          key[2] = htons(sport | (rng() & ~port_mask)) |
+                   static_cast<uint32_t>(htons(dport | (rng() & ~port_mask)))
+                       << 16;
+        }
+      }
+    }
+
+    std::shuffle(keys_.begin(), keys_.end(), rng);
+    keys_.resize(kNumKeys);
+
+    // Flow i is the (i + 1)-th most popular one
+    std::vector<double> cdf;
+    double sum = 0;
+    for (int i = 0; i < kNumKeys; i++) {
+      sum += 1.0 / pow(i + 1, kZipfExponent);
+      cdf.push_back(sum);
+    }
+
+    std::uniform_real_distribution<double> uniform(0, sum);
+    std::uniform_int_distribution<int> uniform_flow(0, kNumKeys - 1);
+    for (int i = 0; i < kNumPackets; i++) {
+      uniform_pkts_.push_back(&keys_[uniform_flow(rng)]);
+      zipf_pkts_.push_back(
+          &keys_[std::lower_bound(cdf.begin(), cdf.end(), uniform(rng)) -
+                 cdf.begin()]);
+    }
+  }
+
+  void TearDown(benchmark::State &) override {
+    wm_->DeInit();
+    wm_.reset();
+    keys_.clear();
+    uniform_pkts_.clear();
+    zipf_pkts_.clear();
+  }
+
+ protected:
+  void Classify(benchmark::State &state,
+                const std::vector<const void *> &pkts) {
+    const int burst = bess::PacketBatch::kMaxBurst;
+    gate_idx_t out_gates[burst];
+    size_t i = 0;
+
+    while (state.KeepRunning()) {
+      wm_->Classify(&pkts[i], burst, out_gates);
+      benchmark::DoNotOptimize(out_gates[0]);
+
+      i += burst;
+      if (i + burst > pkts.size()) {
+        i = 0;
+      }
+    }
+
+    state.SetItemsProcessed(state.iterations() * burst);
+  }
+
+  std::unique_ptr<WildcardMatch> wm_;
+  std::vector<wm_hkey_t> keys_;
+  std::vector<const void *> uniform_pkts_;
+  std::vector<const void *> zipf_pkts_;
+};
+
+}  // namespace (unnamed)
+
+BENCHMARK_DEFINE_F(WildcardMatchFixture, Uniform)
+(benchmark::State &state) {
+  Classify(state, uniform_pkts_);
+}
+
+BENCHMARK_DEFINE_F(WildcardMatchFixture, Zipf)(benchmark::State &state) {
+  Classify(state, zipf_pkts_);
+}
+
+// Tuples x priority distribution, without a cache
+BENCHMARK_REGISTER_F(WildcardMatchFixture, Uniform)
+    ->Args({8, kRandom, 0})
+    ->Args({8, kByTuple, 0})
+    ->Args({8, kFewHighs, 0})
+    ->Args({64, kRandom, 0})
+    ->Args({64, kByTuple, 0})
+    ->Args({64, kFewHighs, 0})
+    ->Args({512, kRandom, 0})
+    ->Args({512, kByTuple, 0})
+    ->Args({512, kFewHighs, 0});
+
+// Tuples x priority distribution x cache entries
+BENCHMARK_REGISTER_F(WildcardMatchFixture, Zipf)
+    ->Args({64, kRandom, 0})
+    ->Args({64, kRandom, 1 << 10})
+    ->Args({64, kRandom, 1 << 14})
+    ->Args({512, kRandom, 0})
+    ->Args({512, kRandom, 1 << 10})
+    ->Args({512, kRandom, 1 << 14})
+    ->Args({512, kByTuple, 0})
+    ->Args({512, kByTuple, 1 << 14});
+
+BENCHMARK_MAIN();
@@ -0,0 +1,87 @@
+#include "wildcard_match.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+
+// The rule of a key of num_fields 8-byte fields, with the value v * (i + 1) in
+// the i-th field (in network order). It matches the first field exactly, the
+// lowest byte of the last one, and any value of the others.
+template <typename T>
+static void set_rule(int num_fields, uint64_t v, T *arg) {
+  for (int i = 0; i < num_fields; i++) {
+    uint64_t mask = 0;
+    if (i == 0) {
+      mask = ~0ull;
+    } else if (i == num_fields - 1) {
+      mask = 0xff;
+    }
+    arg->add_values(v * (i + 1) & mask);
+    arg->add_masks(mask);
+  }
+}
+
+// Keys of 32 bytes or more, which HashKeyHash() hashes otherwise than the
+// default hash of HTable: rules must be added and looked up with the same
+TEST(WildcardMatchLargeKeyTest, AddDelete) {
+  const int burst = bess::PacketBatch::kMaxBurst;
+  const int kNumRules = 1000;
+
+  // 32, 40, 64 and 128-byte keys
+  for (int num_fields : {4, 5, 8, MAX_FIELDS}) {
+    bess::pb::WildcardMatchArg init_arg;
+    for (int i = 0; i < num_fields; i++) {
+      auto *field = init_arg.add_fields();
+      field->set_offset(i * 8);
+      field->set_size(8);
+    }
+
+    WildcardMatch wm;
+    ASSERT_EQ(0, wm.Init(init_arg).err());
+
+    for (int i = 0; i < kNumRules; i++) {
+      bess::pb::WildcardMatchCommandAddArg arg;
+      arg.set_gate(i);
+      arg.set_priority(i);
+      set_rule(num_fields, i + 1, &arg);
+      ASSERT_EQ(0, wm.CommandAdd(arg).error().err());
+    }
+
+    for (int i = 0; i < kNumRules * 2; i += burst) {
+      wm_hkey_t keys[burst];
+      const void *key_ptrs[burst];
+      gate_idx_t gates[burst];
+
+      for (int j = 0; j < burst; j++) {
+        uint64_t v = i + j + 1;
+        for (int k = 0; k < num_fields; k++) {
+          keys[j].u64_arr[k] = __builtin_bswap64(v * (k + 1));
+        }
+        key_ptrs[j] = &keys[j];
+      }
+      wm.Classify(key_ptrs, burst, gates);
+
+      for (int j = 0; j < burst; j++) {
+        EXPECT_EQ((i + j < kNumRules) ? i + j : DROP_GATE, gates[j])
+            << num_fields * 8 << "-byte keys";
+      }
+    }
+
+    for (int i = 0; i < kNumRules; i++) {
+      bess::pb::WildcardMatchCommandDeleteArg arg;
+      set_rule(num_fields, i + 1, &arg);
+      ASSERT_EQ(0, wm.CommandDelete(arg).error().err());
+    }
+
+    wm_hkey_t key = {};
+    key.u64_arr[0] = __builtin_bswap64(1);
+    const void *key_ptr = &key;
+    gate_idx_t gate;
+    wm.Classify(&key_ptr, 1, &gate);
+    EXPECT_EQ(DROP_GATE, gate);
+
+    wm.DeInit();
+  }
+}
+
+}  // namespace (unnamed)
@@ -57,3 +57,18 @@ static bool ValidateMegabytesPerSocket(const char *, int32_t value) {
 DEFINE_int32(m, 2048, "Specifies how many megabytes to use per socket");
 static const bool _m_dummy[[maybe_unused]] =
     google::RegisterFlagValidator(&FLAGS_m, &ValidateMegabytesPerSocket);
+
+static bool ValidateHugeMemMegabytes(const char *, int32_t value) {
+  if (value < 0) {
+    LOG(ERROR) << "Invalid memory size: " << value;
+    return false;
+  }
+
+  return true;
+}
+DEFINE_int32(huge_mem_mb, 0,
+             "Specifies how many megabytes of hugepages, not used by DPDK, "
+             "module tables may take per socket");
+static const bool _huge_mem_mb_dummy[[maybe_unused]] =
+    google::RegisterFlagValidator(&FLAGS_huge_mem_mb,
+                                  &ValidateHugeMemMegabytes);
@@ -13,6 +13,7 @@ DECLARE_bool(a);
 DECLARE_int32(c);
 DECLARE_int32(p);
 DECLARE_int32(m);
+DECLARE_int32(huge_mem_mb);
 DECLARE_bool(no_huge);
 
 #endif  // BESS_OPTS_H_
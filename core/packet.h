@@ -11,6 +11,7 @@
 #include <type_traits>
 
 #include "metadata.h"
+#include "packet_accounting.h"
 #include "worker.h"
 
 #include "snbuf_layout.h"
@@ -75,6 +76,12 @@ class alignas(64) Packet {
   uint32_t index() const { return index_; }
   void set_index(uint32_t index) { index_ = index; }
 
+  // The module holding this packet, if packet accounting is enabled
+  const Module *owner() const {
+    return static_cast<const Module *>(userdata_);
+  }
+  void set_owner(const Module *m) { userdata_ = const_cast<Module *>(m); }
+
   template <typename T = char *>
   T reserve() {
     return reinterpret_cast<T>(reserve_);
@@ -147,6 +154,15 @@ class alignas(64) Packet {
 
   void reset() { rte_pktmbuf_reset(&as_rte_mbuf()); }
 
+  struct rte_mempool *pool() const { return pool_; }
+
+  // Turns this (freshly allocated) packet into an indirect one that points to
+  // the data of src. The data buffer is kept alive by a reference until this
+  // packet is freed.
+  void attach(Packet *src) {
+    rte_pktmbuf_attach(&as_rte_mbuf(), &src->as_rte_mbuf());
+  }
+
   void *prepend(uint16_t len) {
     if (unlikely(data_off_ < len))
       return nullptr;
@@ -207,11 +223,20 @@ class alignas(64) Packet {
   static Packet *Alloc() {
     Packet *pkt = __packet_alloc();
 
+    if (unlikely(!pkt)) {
+      ctx.incr_alloc_failures();
+    }
+
     return pkt;
   }
   static inline int Alloc(Packet **pkts, size_t cnt, uint16_t len);
 
   static void Free(Packet *pkt) {
+    if (unlikely(packet_accounting.enabled())) {
+      for (Packet *seg = pkt; seg; seg = seg->next_) {
+        packet_accounting.Release(&seg, 1);
+      }
+    }
     rte_pktmbuf_free(reinterpret_cast<struct rte_mbuf *>(pkt));
   }
   static inline void Free(Packet **pkts, int cnt);
@@ -369,8 +394,10 @@ int Packet::Alloc(Packet **pkts, size_t cnt, uint16_t len) {
 
   ret = rte_mempool_get_bulk(ctx.pframe_pool(), reinterpret_cast<void **>(pkts),
                              cnt);
-  if (ret != 0)
+  if (ret != 0) {
+    ctx.incr_alloc_failures();
     return 0;
+  }
 
   for (i = 0; i < cnt; i++) {
     Packet *pkt = pkts[i];
@@ -392,12 +419,16 @@ void Packet::Free(Packet **pkts, int cnt) {
   for (i = 0; i < cnt; i++) {
     Packet *pkt = pkts[i];
 
-    if (unlikely(pkt->pool_ != pool || pkt->is_simple() ||
+    if (unlikely(pkt->pool_ != pool || !pkt->is_simple() ||
                  pkt->refcnt() != 1)) {
       goto slow_path;
     }
   }
 
+  if (unlikely(packet_accounting.enabled())) {
+    packet_accounting.Release(pkts, cnt);
+  }
+
   /* NOTE: it seems that zeroing the refcnt of mbufs is not necessary.
    *   (allocators will reset them) */
   rte_mempool_put_bulk(pool, reinterpret_cast<void **>(pkts), cnt);
@@ -0,0 +1,203 @@
+#include "packet_accounting.h"
+
+#include <rte_mempool.h>
+
+#include "module.h"
+#include "packet.h"
+#include "worker.h"
+
+namespace bess {
+
+PacketAccounting packet_accounting;
+
+// Packets freed while accounting is off would keep their stamps
+static void clear_owner(struct rte_mempool *, void *, void *obj, unsigned) {
+  static_cast<Packet *>(obj)->set_owner(nullptr);
+}
+
+static void count_owner(struct rte_mempool *, void *arg, void *obj,
+                        unsigned) {
+  auto *held = static_cast<std::map<const Module *, uint64_t> *>(arg);
+  const Module *m = static_cast<const Packet *>(obj)->owner();
+
+  if (m) {
+    (*held)[m]++;
+  }
+}
+
+static void forget_owner(struct rte_mempool *, void *arg, void *obj,
+                         unsigned) {
+  Packet *pkt = static_cast<Packet *>(obj);
+
+  if (pkt->owner() == arg) {
+    pkt->set_owner(nullptr);
+  }
+}
+
+// Workers count in their own slots of Module::pkts_held_, and all other
+// threads (e.g., the control thread, with workers paused) in the last one.
+static inline int held_slot() {
+  int wid = ctx.wid();
+  return (wid >= 0 && wid < MAX_WORKERS) ? wid : MAX_WORKERS;
+}
+
+// Consecutive packets mostly come from the same module, so owners are
+// counted in runs.
+void PacketAccounting::Unstamp(Packet **pkts, int cnt, int slot) {
+  const Module *prev = nullptr;
+  int64_t run = 0;
+
+  for (int i = 0; i < cnt; i++) {
+    const Module *m = pkts[i]->owner();
+    if (m != prev) {
+      if (prev) {
+        prev->pkts_held_[slot].cnt -= run;
+      }
+      prev = m;
+      run = 0;
+    }
+    run++;
+  }
+
+  if (prev) {
+    prev->pkts_held_[slot].cnt -= run;
+  }
+}
+
+void PacketAccounting::Enable() {
+  for (int i = 0; i < RTE_MAX_NUMA_NODES; i++) {
+    high_watermarks_[i] = 0;
+  }
+  enabled_ = true;
+  SamplePools();
+}
+
+void PacketAccounting::Disable() {
+  enabled_ = false;
+
+  for (int i = 0; i < RTE_MAX_NUMA_NODES; i++) {
+    struct rte_mempool *pool = get_pframe_pool_socket(i);
+    if (pool) {
+      rte_mempool_obj_iter(pool, clear_owner, nullptr);
+    }
+  }
+
+  for (const auto &it : ModuleBuilder::all_modules()) {
+    for (auto &held : it.second->pkts_held_) {
+      held.cnt = 0;
+    }
+  }
+}
+
+void PacketAccounting::Forget(const Module *m) {
+  for (int i = 0; i < RTE_MAX_NUMA_NODES; i++) {
+    struct rte_mempool *pool = get_pframe_pool_socket(i);
+    if (pool) {
+      rte_mempool_obj_iter(pool, forget_owner, const_cast<Module *>(m));
+    }
+  }
+}
+
+void PacketAccounting::StampBatch(const Module *m, PacketBatch *batch) {
+  int slot = held_slot();
+  int cnt = batch->cnt();
+
+  Unstamp(batch->pkts(), cnt, slot);
+  for (int i = 0; i < cnt; i++) {
+    batch->pkts()[i]->set_owner(m);
+  }
+  m->pkts_held_[slot].cnt += cnt;
+}
+
+void PacketAccounting::Release(Packet **pkts, int cnt) {
+  Unstamp(pkts, cnt, held_slot());
+  for (int i = 0; i < cnt; i++) {
+    pkts[i]->set_owner(nullptr);
+  }
+}
+
+void PacketAccounting::SamplePools() {
+  for (int i = 0; i < RTE_MAX_NUMA_NODES; i++) {
+    struct rte_mempool *pool = get_pframe_pool_socket(i);
+    if (!pool) {
+      continue;
+    }
+
+    uint64_t in_use = rte_mempool_in_use_count(pool);
+    uint64_t prev = high_watermarks_[i].load(std::memory_order_relaxed);
+    while (in_use > prev &&
+           !high_watermarks_[i].compare_exchange_weak(prev, in_use)) {
+    }
+  }
+}
+
+std::vector<PacketAccounting::PoolStats> PacketAccounting::GetPoolStats() {
+  std::vector<PoolStats> ret;
+
+  if (enabled_) {
+    SamplePools();
+  }
+
+  for (int i = 0; i < RTE_MAX_NUMA_NODES; i++) {
+    struct rte_mempool *pool = get_pframe_pool_socket(i);
+    if (!pool) {
+      continue;
+    }
+
+    PoolStats stats = {};
+    stats.socket = i;
+    stats.size = pool->size;
+    stats.avail = rte_mempool_avail_count(pool);
+    stats.high_watermark = high_watermarks_[i];
+
+    for (int wid = 0; wid < MAX_WORKERS; wid++) {
+      if (is_worker_active(wid) && workers[wid]->socket() == i) {
+        stats.alloc_failures += workers[wid]->alloc_failures();
+      }
+    }
+
+    if (enabled_) {
+      std::map<const Module *, uint64_t> held;
+      CountHeld(pool, &held);
+      for (const auto &it : held) {
+        stats.attributed += it.second;
+      }
+    }
+
+    ret.push_back(stats);
+  }
+
+  return ret;
+}
+
+std::map<const Module *, uint64_t> PacketAccounting::CountHeld() const {
+  std::map<const Module *, uint64_t> held;
+
+  for (int i = 0; i < RTE_MAX_NUMA_NODES; i++) {
+    struct rte_mempool *pool = get_pframe_pool_socket(i);
+    if (pool) {
+      CountHeld(pool, &held);
+    }
+  }
+
+  return held;
+}
+
+uint64_t PacketAccounting::CountHeld(const Module *m) const {
+  int64_t held = 0;
+
+  // A packet may be released by another worker than the one that stamped it,
+  // so single slots, or a racy sum of them, can go below zero.
+  for (const auto &it : m->pkts_held_) {
+    held += it.cnt;
+  }
+
+  return held > 0 ? held : 0;
+}
+
+void PacketAccounting::CountHeld(struct rte_mempool *pool,
+                                 std::map<const Module *, uint64_t> *held) {
+  rte_mempool_obj_iter(pool, count_owner, held);
+}
+
+}  // namespace bess
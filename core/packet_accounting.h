@@ -0,0 +1,90 @@
+#ifndef BESS_PACKET_ACCOUNTING_H_
+#define BESS_PACKET_ACCOUNTING_H_
+
+#include <rte_config.h>
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+struct rte_mempool;
+
+class Module;
+
+namespace bess {
+
+class Packet;
+class PacketBatch;
+
+// PacketAccounting finds the modules that hold on to packet buffers (e.g., a
+// Queue, or a pending reorder) when the pframe pools run low. While enabled,
+// every packet is stamped with the module it was last delivered to, and the
+// stamp is cleared when the packet is freed or handed to a port. Each module
+// also keeps a count of the packets stamped with it, per worker, so that the
+// datapath takes no lock and shares no cache line to update it. Walks over
+// the pools are left to GetPoolStats() and the other explicit pool queries.
+//
+// Packets held since before accounting was enabled are not attributed until
+// they move, so enable it early when hunting for a leak.
+class PacketAccounting {
+ public:
+  struct PoolStats {
+    int socket;
+    uint64_t size;            // buffers in the pool
+    uint64_t avail;           // free, including the per-core caches
+    uint64_t high_watermark;  // most buffers seen in use since enabled
+    uint64_t alloc_failures;  // Packet::Alloc() calls that came back empty
+    uint64_t attributed;      // in use and held by a module
+  };
+
+  PacketAccounting() : enabled_(), high_watermarks_() {}
+
+  // Both must be called while workers are paused
+  void Enable();
+  void Disable();
+
+  // Clears the stamps of m, which is about to be destroyed, so that its
+  // packets are not attributed to a module created later at the same
+  // address. Must be called while workers are paused.
+  void Forget(const Module *m);
+
+  // The only cost of accounting in the datapath while it is off
+  bool enabled() const { return enabled_; }
+
+  // Called from Module::RunChooseModule() when accounting is enabled
+  void StampBatch(const Module *m, PacketBatch *batch);
+
+  // Called by ports and modules for packets leaving the module graph, other
+  // than through Packet::Free(), e.g., sent to a port.
+  void Release(Packet **pkts, int cnt);
+
+  // Called by the workers every now and then, to update the watermarks
+  void SamplePools();
+
+  std::vector<PoolStats> GetPoolStats();
+
+  // Live packets held by each module, in all pframe pools
+  std::map<const Module *, uint64_t> CountHeld() const;
+
+  // Live packets held by m alone, from its counters. Cheap enough for every
+  // GetModuleInfo() call.
+  uint64_t CountHeld(const Module *m) const;
+
+  // Adds the packets held by each module in pool to held.
+  static void CountHeld(struct rte_mempool *pool,
+                        std::map<const Module *, uint64_t> *held);
+
+ private:
+  // Takes the packets off the counters of their previous owners
+  static void Unstamp(Packet **pkts, int cnt, int slot);
+
+  bool enabled_;
+  std::atomic<uint64_t> high_watermarks_[RTE_MAX_NUMA_NODES];
+};
+
+extern PacketAccounting packet_accounting;
+
+}  // namespace bess
+
+#endif  // BESS_PACKET_ACCOUNTING_H_
@@ -0,0 +1,165 @@
+#include "packet_accounting.h"
+
+#include <rte_mbuf.h>
+#include <rte_mempool.h>
+
+#include <cstring>
+#include <map>
+
+#include <gtest/gtest.h>
+
+#include "dpdk.h"
+#include "module.h"
+
+namespace {
+
+class HolderModule : public Module {};
+
+class PacketAccountingTest : public ::testing::Test {
+ protected:
+  // Owners are counted by walking a real mempool
+  static void SetUpTestCase() {
+    init_dpdk("packet_accounting_test", 0, 0, true);
+
+    if (!pool_) {
+      pool_ = rte_pktmbuf_pool_create("accounting_test", 1023, 0,
+                                      SNBUF_RESERVE,
+                                      SNBUF_HEADROOM + SNBUF_DATA,
+                                      SOCKET_ID_ANY);
+      ASSERT_NE(nullptr, pool_);
+    }
+  }
+
+  virtual void SetUp() { bess::packet_accounting.Enable(); }
+
+  virtual void TearDown() { bess::packet_accounting.Disable(); }
+
+  static bess::Packet *Alloc() {
+    return reinterpret_cast<bess::Packet *>(rte_pktmbuf_alloc(pool_));
+  }
+
+  static std::map<const Module *, uint64_t> CountHeld() {
+    std::map<const Module *, uint64_t> held;
+    bess::PacketAccounting::CountHeld(pool_, &held);
+    return held;
+  }
+
+  static struct rte_mempool *pool_;
+
+  HolderModule m1_;
+  HolderModule m2_;
+};
+
+struct rte_mempool *PacketAccountingTest::pool_;
+
+TEST_F(PacketAccountingTest, Stamp) {
+  bess::Packet pkts[4];
+  bess::PacketBatch batch;
+
+  memset(pkts, 0, sizeof(pkts));
+  batch.clear();
+  for (int i = 0; i < 4; i++) {
+    batch.add(&pkts[i]);
+  }
+
+  bess::packet_accounting.StampBatch(&m1_, &batch);
+  for (int i = 0; i < 4; i++) {
+    EXPECT_EQ(&m1_, pkts[i].owner());
+  }
+
+  // e.g., sent to a port
+  bess::packet_accounting.Release(batch.pkts(), 2);
+  EXPECT_EQ(nullptr, pkts[0].owner());
+  EXPECT_EQ(nullptr, pkts[1].owner());
+  EXPECT_EQ(&m1_, pkts[2].owner());
+  EXPECT_EQ(2, bess::packet_accounting.CountHeld(&m1_));
+
+  // Passed on downstream
+  bess::packet_accounting.StampBatch(&m2_, &batch);
+  EXPECT_EQ(0, bess::packet_accounting.CountHeld(&m1_));
+  EXPECT_EQ(4, bess::packet_accounting.CountHeld(&m2_));
+}
+
+TEST_F(PacketAccountingTest, CountHeld) {
+  bess::PacketBatch b1;
+  bess::PacketBatch b2;
+
+  b1.clear();
+  b2.clear();
+  for (int i = 0; i < 32; i++) {
+    bess::Packet *pkt = Alloc();
+    ASSERT_NE(nullptr, pkt);
+    (i < 24 ? b1 : b2).add(pkt);
+  }
+
+  bess::packet_accounting.StampBatch(&m1_, &b1);
+  bess::packet_accounting.StampBatch(&m2_, &b2);
+
+  std::map<const Module *, uint64_t> held = CountHeld();
+  EXPECT_EQ(2, held.size());
+  EXPECT_EQ(24, held[&m1_]);
+  EXPECT_EQ(8, held[&m2_]);
+  EXPECT_EQ(24, bess::packet_accounting.CountHeld(&m1_));
+  EXPECT_EQ(8, bess::packet_accounting.CountHeld(&m2_));
+
+  // Packets are no longer held once freed, in bulk or one by one
+  bess::Packet::Free(b1.pkts(), 20);
+  bess::Packet::Free(b1.pkts()[20]);
+
+  held = CountHeld();
+  EXPECT_EQ(3, held[&m1_]);
+  EXPECT_EQ(8, held[&m2_]);
+  EXPECT_EQ(3, bess::packet_accounting.CountHeld(&m1_));
+
+  bess::Packet::Free(b1.pkts() + 21, 3);
+  bess::Packet::Free(&b2);
+
+  EXPECT_TRUE(CountHeld().empty());
+  EXPECT_EQ(0, bess::packet_accounting.CountHeld(&m1_));
+  EXPECT_EQ(0, bess::packet_accounting.CountHeld(&m2_));
+}
+
+TEST_F(PacketAccountingTest, Forget) {
+  bess::PacketBatch batch;
+
+  batch.clear();
+  for (int i = 0; i < 8; i++) {
+    bess::Packet *pkt = Alloc();
+    ASSERT_NE(nullptr, pkt);
+    batch.add(pkt);
+  }
+
+  bess::packet_accounting.StampBatch(&m1_, &batch);
+  bess::packet_accounting.StampBatch(&m2_, &batch);
+  bess::packet_accounting.StampBatch(&m1_, &batch);
+
+  // e.g., m1_ destroyed with its packets still queued
+  bess::packet_accounting.Forget(&m1_);
+  EXPECT_TRUE(CountHeld().empty());
+
+  bess::Packet::Free(&batch);
+}
+
+TEST_F(PacketAccountingTest, Chain) {
+  bess::Packet *head = Alloc();
+  bess::Packet *tail = Alloc();
+  ASSERT_NE(nullptr, head);
+  ASSERT_NE(nullptr, tail);
+
+  bess::PacketBatch batch;
+  batch.clear();
+  batch.add(head);
+  batch.add(tail);
+  bess::packet_accounting.StampBatch(&m1_, &batch);
+
+  // e.g., merged by GRO: the stamp of a segment must not outlive it
+  head->set_next(tail);
+  head->set_nb_segs(2);
+  EXPECT_EQ(2, CountHeld()[&m1_]);
+
+  bess::Packet::Free(head);
+  EXPECT_TRUE(CountHeld().empty());
+  EXPECT_EQ(0, bess::packet_accounting.CountHeld(&m1_));
+}
+
+}  // namespace (unnamed)
@@ -24,8 +24,10 @@ int Packet::Alloc(Packet **pkts, size_t cnt, uint16_t len) {
 
   ret = rte_mempool_get_bulk(ctx.pframe_pool(), reinterpret_cast<void **>(pkts),
                              cnt);
-  if (ret != 0)
+  if (ret != 0) {
+    ctx.incr_alloc_failures();
     return 0;
+  }
 
   mbuf_template = *(reinterpret_cast<__m128i *>(&pframe_template.buf_len_));
 
@@ -119,6 +121,10 @@ void Packet::Free(Packet **pkts, int cnt) {
     }
   }
 
+  if (unlikely(packet_accounting.enabled())) {
+    packet_accounting.Release(pkts, cnt);
+  }
+
   /* NOTE: it seems that zeroing the refcnt of mbufs is not necessary.
    *   (allocators will reset them) */
   rte_mempool_put_bulk(_pool, reinterpret_cast<void **>(pkts), cnt);
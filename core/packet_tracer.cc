@@ -0,0 +1,144 @@
+#include "packet_tracer.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "module.h"
+#include "utils/time.h"
+
+namespace bess {
+
+const uint64_t PacketTracer::kMarkFlag;
+const size_t PacketTracer::kRingSize;
+
+PacketTracer packet_tracer;
+
+PacketTracer::~PacketTracer() {
+  pcap_freecode(&filter_);
+  for (int wid = 0; wid < MAX_WORKERS; wid++) {
+    delete rings_[wid];
+  }
+}
+
+int PacketTracer::Start(const std::string &filter, uint64_t max_pkts) {
+  struct bpf_program code;
+
+  if (filter.length() &&
+      pcap_compile_nopcap(0xffff, DLT_EN10MB, &code, filter.c_str(), 1,
+                          PCAP_NETMASK_UNKNOWN) == -1) {
+    return -EINVAL;
+  }
+
+  pcap_freecode(&filter_);
+  if (filter.length()) {
+    filter_ = code;
+  }
+
+  for (int wid = 0; wid < MAX_WORKERS; wid++) {
+    if (!rings_[wid]) {
+      rings_[wid] = new Ring();
+    }
+    rings_[wid]->head = 0;
+  }
+
+  max_pkts_ = max_pkts;
+  marked_ = 0;
+  enabled_ = true;
+  return 0;
+}
+
+void PacketTracer::Stop() {
+  enabled_ = false;
+}
+
+bool PacketTracer::Match(Packet *pkt) const {
+  if (!filter_.bf_insns) {
+    return true;
+  }
+
+  return bpf_filter(filter_.bf_insns, pkt->head_data<u_char *>(),
+                    pkt->total_len(), pkt->head_len()) != 0;
+}
+
+void PacketTracer::MarkPackets(PacketBatch *batch) {
+  for (int i = 0; i < batch->cnt(); i++) {
+    Packet *pkt = batch->pkts()[i];
+
+    if (is_marked(pkt) || !Match(pkt)) {
+      continue;
+    }
+
+    if (max_pkts_ && marked_.load(std::memory_order_relaxed) >= max_pkts_) {
+      return;
+    }
+
+    marked_++;
+    set_mark(pkt);
+  }
+}
+
+void PacketTracer::TraceBatch(const Module *m, gate_idx_t ogate_idx,
+                              const OGate *ogate, PacketBatch *batch) {
+  Ring *ring = rings_[ctx.wid()];
+
+  if (!ring) {
+    return;
+  }
+
+  if (m->igates().empty()) {
+    MarkPackets(batch);
+  }
+
+  uint64_t tsc = rdtsc();
+  uint64_t head = ring->head.load(std::memory_order_relaxed);
+
+  for (int i = 0; i < batch->cnt(); i++) {
+    Packet *pkt = batch->pkts()[i];
+
+    if (!is_marked(pkt)) {
+      continue;
+    }
+
+    TraceRecord *r = &ring->records[head % kRingSize];
+    r->tsc = tsc;
+    r->pkt = pkt;
+    r->from = m;
+    r->to = ogate ? ogate->igate()->module() : nullptr;
+    r->ogate = ogate_idx;
+    r->igate = ogate ? ogate->igate_idx() : 0;
+    memcpy(r->metadata, pkt->metadata(), TraceRecord::kMetadataSize);
+
+    // Publish one record at a time, so that a reader never sees a
+    // partially written one as valid.
+    ring->head.store(++head, std::memory_order_release);
+  }
+}
+
+void PacketTracer::Read(int wid, std::vector<TraceRecord> *records) const {
+  const Ring *ring = rings_[wid];
+
+  if (!ring) {
+    return;
+  }
+
+  uint64_t end = ring->head.load(std::memory_order_acquire);
+  uint64_t begin = end > kRingSize ? end - kRingSize : 0;
+  size_t old_size = records->size();
+
+  for (uint64_t i = begin; i < end; i++) {
+    records->push_back(ring->records[i % kRingSize]);
+  }
+
+  // The writer may have lapped us while we were copying. Discard the records
+  // that might have been overwritten in the meantime, including the slot it
+  // may be writing right now.
+  std::atomic_thread_fence(std::memory_order_acquire);
+  uint64_t head = ring->head.load(std::memory_order_relaxed) + 1;
+  if (head > begin + kRingSize) {
+    uint64_t overwritten = std::min(head - kRingSize - begin, end - begin);
+    records->erase(records->begin() + old_size,
+                   records->begin() + old_size + overwritten);
+  }
+}
+
+}  // namespace bess
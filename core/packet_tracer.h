@@ -0,0 +1,101 @@
+#ifndef BESS_PACKET_TRACER_H_
+#define BESS_PACKET_TRACER_H_
+
+#include <pcap/pcap.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "gate.h"
+#include "packet.h"
+#include "worker.h"
+
+class Module;
+
+namespace bess {
+
+// One gate traversal of a traced packet
+struct TraceRecord {
+  static const size_t kMetadataSize = 32;
+
+  uint64_t tsc;
+  const Packet *pkt;   // identifies the packet while it is alive
+  const Module *from;  // the module that sent the packet
+  const Module *to;    // nullptr if the packet was dropped at the ogate
+  gate_idx_t ogate;
+  gate_idx_t igate;
+  char metadata[kMetadataSize];  // first bytes of the per-packet metadata
+};
+
+// PacketTracer follows selected packets through the module graph at runtime.
+// Packets leaving an ingress module (one without input gates) are matched
+// against a BPF filter and marked; from then on, every gate they go through
+// is appended to a ring of the worker. The rings are single-producer and can
+// be read by the control thread while the workers run, so old records may be
+// overwritten but are never torn.
+class PacketTracer {
+ public:
+  // A bit of rte_mbuf.ol_flags left unused by DPDK (PKT_LAST_FREE). It is
+  // cleared whenever the packet is allocated or received.
+  static const uint64_t kMarkFlag = 1ULL << 39;
+
+  static const size_t kRingSize = 4096;  // records per worker, power of 2
+
+  PacketTracer() : enabled_(), filter_(), max_pkts_(), marked_(), rings_() {}
+
+  ~PacketTracer();
+
+  // Starts marking packets that match filter (in pcap syntax, empty for all),
+  // at most max_pkts of them if nonzero. Old records are discarded.
+  // Must be called while workers are paused. Returns 0 or -errno.
+  int Start(const std::string &filter, uint64_t max_pkts);
+
+  // Stops recording. Records can still be read.
+  void Stop();
+
+  // The only cost of tracing in the datapath while it is off
+  bool enabled() const { return enabled_; }
+
+  uint64_t marked() const { return marked_; }
+
+  // Called from Module::RunChooseModule() when tracing is enabled.
+  // ogate is nullptr if the packets are about to be dropped.
+  void TraceBatch(const Module *m, gate_idx_t ogate_idx, const OGate *ogate,
+                  PacketBatch *batch);
+
+  // Appends the records of worker wid to records, oldest first
+  void Read(int wid, std::vector<TraceRecord> *records) const;
+
+  static bool is_marked(const Packet *pkt) {
+    return pkt->as_rte_mbuf().ol_flags & kMarkFlag;
+  }
+  static void set_mark(Packet *pkt) {
+    pkt->as_rte_mbuf().ol_flags |= kMarkFlag;
+  }
+
+ private:
+  struct Ring {
+    std::atomic<uint64_t> head;  // total number of records ever written
+    TraceRecord records[kRingSize];
+  };
+
+  bool Match(Packet *pkt) const;
+
+  void MarkPackets(PacketBatch *batch);
+
+  bool enabled_;
+  struct bpf_program filter_; /* bf_insns is nullptr if everything matches */
+  uint64_t max_pkts_;         /* 0 if unlimited */
+  std::atomic<uint64_t> marked_;
+
+  Ring *rings_[MAX_WORKERS];
+
+  DISALLOW_COPY_AND_ASSIGN(PacketTracer);
+};
+
+extern PacketTracer packet_tracer;
+
+}  // namespace bess
+
+#endif  // BESS_PACKET_TRACER_H_
@@ -0,0 +1,87 @@
+#include "packet_tracer.h"
+
+#include <cstring>
+
+#include <gtest/gtest.h>
+
+#include "module.h"
+
+namespace {
+
+class IngressModule : public Module {};
+
+class PacketTracerTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    memset(pkts_, 0, sizeof(pkts_));
+    batch_.clear();
+    for (int i = 0; i < kNumPkts; i++) {
+      pkts_[i].metadata<uint32_t *>()[0] = i;
+      batch_.add(&pkts_[i]);
+    }
+  }
+
+  virtual void TearDown() { tracer_.Stop(); }
+
+  static const int kNumPkts = 4;
+
+  bess::PacketTracer tracer_;
+  IngressModule m_;
+  bess::Packet pkts_[kNumPkts];
+  bess::PacketBatch batch_;
+};
+
+TEST_F(PacketTracerTest, InvalidFilter) {
+  ASSERT_EQ(-EINVAL, tracer_.Start("not a (valid filter", 0));
+  ASSERT_FALSE(tracer_.enabled());
+}
+
+TEST_F(PacketTracerTest, MarkAtIngress) {
+  ASSERT_EQ(0, tracer_.Start("", 2));
+  ASSERT_TRUE(tracer_.enabled());
+
+  tracer_.TraceBatch(&m_, 3, nullptr, &batch_);
+  ASSERT_EQ(2, tracer_.marked());
+  ASSERT_TRUE(bess::PacketTracer::is_marked(&pkts_[0]));
+  ASSERT_TRUE(bess::PacketTracer::is_marked(&pkts_[1]));
+  ASSERT_FALSE(bess::PacketTracer::is_marked(&pkts_[2]));
+
+  std::vector<bess::TraceRecord> records;
+  tracer_.Read(0, &records);
+  ASSERT_EQ(2, records.size());
+  EXPECT_EQ(&pkts_[0], records[0].pkt);
+  EXPECT_EQ(&m_, records[0].from);
+  EXPECT_EQ(nullptr, records[0].to);
+  EXPECT_EQ(3, records[0].ogate);
+  EXPECT_EQ(1, *reinterpret_cast<const uint32_t *>(records[1].metadata));
+
+  // Packets already marked are followed but not counted again
+  tracer_.TraceBatch(&m_, 0, nullptr, &batch_);
+  ASSERT_EQ(2, tracer_.marked());
+  records.clear();
+  tracer_.Read(0, &records);
+  ASSERT_EQ(4, records.size());
+}
+
+TEST_F(PacketTracerTest, RingWrapsAround) {
+  ASSERT_EQ(0, tracer_.Start("", 0));
+
+  const size_t n = bess::PacketTracer::kRingSize + 10;
+  for (size_t i = 0; i < n; i++) {
+    tracer_.TraceBatch(&m_, i % 2, nullptr, &batch_);
+  }
+
+  std::vector<bess::TraceRecord> records;
+  tracer_.Read(0, &records);
+  ASSERT_EQ(bess::PacketTracer::kRingSize, records.size());
+  EXPECT_EQ(&pkts_[0], records[0].pkt);
+  EXPECT_EQ(&pkts_[kNumPkts - 1], records.back().pkt);
+
+  // Starting again discards old records
+  ASSERT_EQ(0, tracer_.Start("", 0));
+  records.clear();
+  tracer_.Read(1, &records);
+  ASSERT_EQ(0, records.size());
+}
+
+}  // namespace (unnamed)
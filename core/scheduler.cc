@@ -1,8 +1,10 @@
 #include "scheduler.h"
 
 #include "opts.h"
+#include "packet_accounting.h"
 #include "traffic_class.h"
 #include "utils/common.h"
+#include "utils/rcu.h"
 #include "worker.h"
 
 namespace bess {
@@ -20,11 +22,18 @@ void Scheduler::ScheduleLoop() {
   for (uint64_t round = 0;; ++round) {
     // Periodic check, to mitigate expensive operations.
     if ((round & accounting_mask) == 0) {
+      // No references to lock-free tables (e.g., HTable) survive a round
+      utils::Rcu::Quiescent();
+
       if (ctx.is_pause_requested()) {
         if (ctx.BlockWorker()) {
           break;
         }
       }
+
+      if (unlikely(packet_accounting.enabled())) {
+        packet_accounting.SamplePools();
+      }
     }
 
     ScheduleOnce();
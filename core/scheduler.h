@@ -68,6 +68,11 @@ class Scheduler final {
       LeafTrafficClass *leaf = static_cast<LeafTrafficClass *>(c);
       struct task_result ret = leaf->RunTasks();
 
+      // Deliver batches that coalescing input gates have held long enough.
+      if (unlikely(ctx.has_coalesced_batches())) {
+        ctx.FlushCoalescedBatches(rdtsc());
+      }
+
       now = rdtsc();
 
       // Account.
@@ -89,6 +94,10 @@ class Scheduler final {
       // blocking/unblocking.
       ++stats_.cnt_idle;
 
+      if (unlikely(ctx.has_coalesced_batches())) {
+        ctx.FlushCoalescedBatches(rdtsc());
+      }
+
       now = rdtsc();
       stats_.cycles_idle += (now - checkpoint_);
     }
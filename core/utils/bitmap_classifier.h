@@ -0,0 +1,208 @@
+/* Packet classifier for a list of rules with first-match semantics, after the
+ * bit vector scheme of Lakshman and Stiliadis (with aggregated bit vectors).
+ *
+ * A rule is a range of values for each of Fields fields (a prefix, a port,
+ * a wildcard...), and the rules are ordered by priority. Each field is split
+ * into elementary intervals, in which the set of matching rules does not
+ * change, and each interval has a bitmap of those rules. Classifying a packet
+ * takes a binary search per field, then the bitmaps of all fields are ANDed a
+ * word at a time, from the highest priority, until a bit is set. A summary
+ * bitmap (one bit per nonzero word) skips the words that are zero in any
+ * field, so the cost hardly depends on the number of rules that don't match.
+ *
+ * Intervals with identical bitmaps share them, which bounds memory by the
+ * number of distinct rule sets rather than of intervals.
+ *
+ * Immutable once built; rule updates build a new classifier. Thread-safe. */
+
+#ifndef BESS_UTILS_BITMAP_CLASSIFIER_H_
+#define BESS_UTILS_BITMAP_CLASSIFIER_H_
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "../mem_alloc.h"
+
+namespace bess {
+namespace utils {
+
+template <int Fields>
+class BitmapClassifier {
+ public:
+  // Inclusive range of field values
+  struct Range {
+    uint32_t lo;
+    uint32_t hi;
+  };
+
+  typedef std::array<Range, Fields> Rule;
+  typedef std::array<uint32_t, Fields> Values;
+
+  static Range Any() { return {0, std::numeric_limits<uint32_t>::max()}; }
+
+  // The values of a prefix, in host order
+  static Range Prefix(uint32_t addr, int len) {
+    uint32_t mask = len ? ~0u << (32 - len) : 0;
+    return {addr & mask, (addr & mask) | ~mask};
+  }
+
+  // Rules are in the order of priority, the first one being the highest
+  explicit BitmapClassifier(const std::vector<Rule> &rules)
+      : num_rules_(rules.size()),
+        words_((rules.size() + 63) / 64),
+        summary_words_((words_ + 63) / 64) {
+    CHECK_LT(rules.size(), static_cast<size_t>(INT32_MAX));
+
+    for (int f = 0; f < Fields; f++) {
+      BuildField(rules, f);
+    }
+  }
+
+  size_t NumRules() const { return num_rules_; }
+
+  // Returns the index of the first rule that matches, or -1 if none
+  int Match(const Values &values) const {
+    const uint64_t *bitmaps[Fields];
+
+    if (num_rules_ == 0) {
+      return -1;
+    }
+
+    // Branchless binary search for the last interval starting at or below
+    // the value
+    for (int f = 0; f < Fields; f++) {
+      const Field &field = fields_[f];
+      const uint32_t *base = field.bounds.data();
+      size_t n = field.bounds.size();
+
+      while (n > 1) {
+        size_t half = n / 2;
+        base = (base[half] <= values[f]) ? base + half : base;
+        n -= half;
+      }
+      size_t i = base - field.bounds.data();
+      bitmaps[f] = field.bitmaps.data() + field.offsets[i];
+    }
+
+    for (size_t s = 0; s < summary_words_; s++) {
+      uint64_t summary = bitmaps[0][s];
+      for (int f = 1; f < Fields; f++) {
+        summary &= bitmaps[f][s];
+      }
+
+      while (summary) {
+        size_t w = s * 64 + __builtin_ctzll(summary);
+        uint64_t bits = bitmaps[0][summary_words_ + w];
+        for (int f = 1; f < Fields; f++) {
+          bits &= bitmaps[f][summary_words_ + w];
+        }
+
+        if (bits) {
+          return w * 64 + __builtin_ctzll(bits);
+        }
+        summary &= summary - 1;
+      }
+    }
+
+    return -1;
+  }
+
+  // Bytes used by the bitmaps and intervals
+  size_t MemoryUsage() const {
+    size_t bytes = 0;
+    for (const Field &field : fields_) {
+      bytes += field.bounds.size() * sizeof(uint32_t) +
+               field.offsets.size() * sizeof(uint32_t) +
+               field.bitmaps.size() * sizeof(uint64_t);
+    }
+    return bytes;
+  }
+
+ private:
+  struct Field {
+    // Elementary interval i is [bounds[i], bounds[i + 1]), and its bitmap
+    // starts at bitmaps[offsets[i]]. bounds[0] is always 0.
+    std::vector<uint32_t> bounds;
+    std::vector<uint32_t> offsets;
+
+    // Per distinct set of rules, summary_words_ words of summary, then
+    // words_ words of rules
+    std::vector<uint64_t, bess::memory::Allocator<uint64_t>> bitmaps;
+  };
+
+  // Sweeps the field from 0 up, adding and removing rules from the bitmap as
+  // their ranges start and end
+  void BuildField(const std::vector<Rule> &rules, int f) {
+    Field &field = fields_[f];
+
+    // (value, rule index) for a start, (value, ~rule index) for an end
+    std::vector<std::pair<uint32_t, int>> events;
+    for (size_t r = 0; r < rules.size(); r++) {
+      const Range &range = rules[r][f];
+      DCHECK_LE(range.lo, range.hi);
+
+      events.emplace_back(range.lo, static_cast<int>(r));
+      if (range.hi != std::numeric_limits<uint32_t>::max()) {
+        events.emplace_back(range.hi + 1, ~static_cast<int>(r));
+      }
+    }
+    std::sort(events.begin(), events.end());
+
+    std::vector<uint64_t> bits(words_);
+    std::map<std::vector<uint64_t>, uint32_t> offsets;
+    uint32_t start = 0;
+    size_t i = 0;
+
+    while (true) {
+      for (; i < events.size() && events[i].first == start; i++) {
+        int r = events[i].second;
+        if (r >= 0) {
+          bits[r / 64] |= 1ULL << (r % 64);
+        } else {
+          bits[~r / 64] &= ~(1ULL << (~r % 64));
+        }
+      }
+
+      auto it = offsets.find(bits);
+      if (it == offsets.end()) {
+        it = offsets.emplace(bits, field.bitmaps.size()).first;
+        CHECK_LE(field.bitmaps.size() + summary_words_ + words_,
+                 std::numeric_limits<uint32_t>::max());
+
+        field.bitmaps.resize(field.bitmaps.size() + summary_words_ + words_);
+        uint64_t *bitmap = field.bitmaps.data() + it->second;
+        for (size_t w = 0; w < words_; w++) {
+          if (bits[w]) {
+            bitmap[w / 64] |= 1ULL << (w % 64);
+          }
+          bitmap[summary_words_ + w] = bits[w];
+        }
+      }
+
+      field.bounds.push_back(start);
+      field.offsets.push_back(it->second);
+
+      if (i == events.size()) {
+        break;
+      }
+      start = events[i].first;
+    }
+  }
+
+  size_t num_rules_;
+  size_t words_;          // per bitmap of rules
+  size_t summary_words_;  // per summary bitmap
+  Field fields_[Fields];
+};
+
+}  // namespace utils
+}  // namespace bess
+
+#endif  // BESS_UTILS_BITMAP_CLASSIFIER_H_
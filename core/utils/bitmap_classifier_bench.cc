@@ -0,0 +1,150 @@
+// Benchmarks for BitmapClassifier against a linear scan of the rules, with
+// ACL-like rule sets of 10 to 10,000 rules generated in the manner of
+// ClassBench: addresses are prefixes drawn from a few nested address blocks,
+// and ports are mostly wildcards, well-known ports, or the ephemeral range.
+
+#include "bitmap_classifier.h"
+
+#include <memory>
+
+#include <benchmark/benchmark.h>
+
+#include "random.h"
+
+using bess::utils::BitmapClassifier;
+
+namespace {
+
+// src IP, dst IP, src port, dst port
+typedef BitmapClassifier<4> classifier_t;
+typedef classifier_t::Rule Rule;
+typedef classifier_t::Range Range;
+typedef classifier_t::Values Values;
+
+const uint16_t kWellKnownPorts[] = {20, 21, 22, 23, 25, 53, 80, 110,
+                                    123, 143, 161, 443, 993, 3306, 8080};
+
+uint32_t RandomAddress(Random *rng) {
+  // A few /8 networks, each with a few /16 subnets
+  return ((10 + rng->GetRange(4)) << 24) | (rng->GetRange(16) << 16) |
+         rng->GetRange(1 << 16);
+}
+
+Range RandomPrefix(Random *rng, bool dst) {
+  // Destinations are mostly hosts and subnets, sources mostly large blocks
+  static const int kDstLens[] = {32, 32, 32, 28, 24, 24, 16, 16};
+  static const int kSrcLens[] = {0, 0, 8, 16, 16, 24, 24, 32};
+  int len = dst ? kDstLens[rng->GetRange(8)] : kSrcLens[rng->GetRange(8)];
+  return classifier_t::Prefix(RandomAddress(rng), len);
+}
+
+Range RandomPort(Random *rng, bool dst) {
+  uint32_t r = rng->GetRange(8);
+  if (r < (dst ? 1 : 7)) {
+    return {0, 0xffff};
+  } else if (dst && r < 6) {
+    uint16_t port = kWellKnownPorts[rng->GetRange(15)];
+    return {port, port};
+  } else {
+    return {1024, 0xffff};
+  }
+}
+
+std::vector<Rule> GenerateRules(size_t n) {
+  Random rng;
+  rng.SetSeed(n);
+
+  std::vector<Rule> rules;
+  for (size_t i = 0; i + 1 < n; i++) {
+    rules.push_back({{RandomPrefix(&rng, false), RandomPrefix(&rng, true),
+                      RandomPort(&rng, false), RandomPort(&rng, true)}});
+  }
+
+  // Default deny
+  rules.push_back({{classifier_t::Any(), classifier_t::Any(),
+                    classifier_t::Any(), classifier_t::Any()}});
+  return rules;
+}
+
+// Headers of packets, each within the ranges of a random rule (which may be
+// shadowed by another one)
+std::vector<Values> GenerateHeaders(const std::vector<Rule> &rules,
+                                    size_t n) {
+  Random rng;
+  rng.SetSeed(0);
+
+  std::vector<Values> headers;
+  for (size_t i = 0; i < n; i++) {
+    const Rule &rule = rules[rng.GetRange(rules.size())];
+    Values values;
+    for (int f = 0; f < 4; f++) {
+      uint64_t span = static_cast<uint64_t>(rule[f].hi) - rule[f].lo + 1;
+      values[f] = rule[f].lo + (rng.Get() % span);
+    }
+    headers.push_back(values);
+  }
+  return headers;
+}
+
+int LinearMatch(const std::vector<Rule> &rules, const Values &values) {
+  for (size_t r = 0; r < rules.size(); r++) {
+    const Rule &rule = rules[r];
+    if (rule[0].lo <= values[0] && values[0] <= rule[0].hi &&
+        rule[1].lo <= values[1] && values[1] <= rule[1].hi &&
+        rule[2].lo <= values[2] && values[2] <= rule[2].hi &&
+        rule[3].lo <= values[3] && values[3] <= rule[3].hi) {
+      return r;
+    }
+  }
+  return -1;
+}
+
+const size_t kNumHeaders = 4096;
+
+}  // namespace (unnamed)
+
+static void BM_LinearScan(benchmark::State &state) {
+  std::vector<Rule> rules = GenerateRules(state.range(0));
+  std::vector<Values> headers = GenerateHeaders(rules, kNumHeaders);
+  size_t i = 0;
+
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(LinearMatch(rules, headers[i++ % kNumHeaders]));
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_BitmapClassifier(benchmark::State &state) {
+  std::vector<Rule> rules = GenerateRules(state.range(0));
+  std::vector<Values> headers = GenerateHeaders(rules, kNumHeaders);
+  classifier_t classifier(rules);
+  size_t i = 0;
+
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(classifier.Match(headers[i++ % kNumHeaders]));
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  state.counters["MB"] = classifier.MemoryUsage() / 1e6;
+}
+
+static void BM_BitmapClassifierBuild(benchmark::State &state) {
+  std::vector<Rule> rules = GenerateRules(state.range(0));
+
+  while (state.KeepRunning()) {
+    classifier_t classifier(rules);
+    benchmark::DoNotOptimize(classifier.NumRules());
+  }
+
+  state.SetItemsProcessed(state.iterations() * rules.size());
+}
+
+BENCHMARK(BM_LinearScan)->RangeMultiplier(10)->Range(10, 10000);
+BENCHMARK(BM_BitmapClassifier)->RangeMultiplier(10)->Range(10, 10000);
+BENCHMARK(BM_BitmapClassifierBuild)
+    ->RangeMultiplier(10)
+    ->Range(10, 10000)
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
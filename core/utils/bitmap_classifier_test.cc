@@ -0,0 +1,96 @@
+#include "bitmap_classifier.h"
+
+#include <gtest/gtest.h>
+
+#include "random.h"
+
+using bess::utils::BitmapClassifier;
+
+namespace {
+
+typedef BitmapClassifier<3> classifier_t;
+typedef classifier_t::Rule Rule;
+typedef classifier_t::Range Range;
+
+bool Contains(const Range &range, uint32_t value) {
+  return range.lo <= value && value <= range.hi;
+}
+
+// The first rule that matches, by a linear scan
+int LinearMatch(const std::vector<Rule> &rules,
+                const classifier_t::Values &values) {
+  for (size_t r = 0; r < rules.size(); r++) {
+    bool match = true;
+    for (int f = 0; f < 3; f++) {
+      match = match && Contains(rules[r][f], values[f]);
+    }
+    if (match) {
+      return r;
+    }
+  }
+  return -1;
+}
+
+TEST(BitmapClassifierTest, Empty) {
+  classifier_t c({});
+  EXPECT_EQ(-1, c.Match({{0, 1, 2}}));
+}
+
+TEST(BitmapClassifierTest, FirstMatch) {
+  std::vector<Rule> rules = {
+      {{classifier_t::Prefix(0x0a000000, 8), {80, 80}, classifier_t::Any()}},
+      {{classifier_t::Prefix(0x0a000000, 16), classifier_t::Any(), {6, 6}}},
+      {{classifier_t::Any(), classifier_t::Any(), classifier_t::Any()}},
+  };
+  classifier_t c(rules);
+
+  EXPECT_EQ(0, c.Match({{0x0a000001, 80, 6}}));
+  EXPECT_EQ(1, c.Match({{0x0a000001, 81, 6}}));
+  EXPECT_EQ(2, c.Match({{0x0a010001, 81, 6}}));
+  EXPECT_EQ(2, c.Match({{0, 0, 0}}));
+  EXPECT_EQ(2, c.Match({{UINT32_MAX, UINT32_MAX, UINT32_MAX}}));
+}
+
+// Random rules (prefixes, ranges, wildcards) across several bitmap words, and
+// values near the edges of the ranges
+TEST(BitmapClassifierTest, Random) {
+  Random rng;
+  rng.SetSeed(0);
+
+  for (size_t num_rules : {1, 63, 64, 65, 500, 5000}) {
+    std::vector<Rule> rules;
+    for (size_t r = 0; r < num_rules; r++) {
+      Rule rule;
+      rule[0] = classifier_t::Prefix(rng.Get(), rng.GetRange(33));
+      uint32_t lo = rng.GetRange(1000);
+      rule[1] = {lo, lo + rng.GetRange(100)};
+      rule[2] = rng.GetRange(4) ? classifier_t::Any()
+                                : Range{lo % 8, lo % 8};
+      rules.push_back(rule);
+    }
+    classifier_t c(rules);
+
+    for (int i = 0; i < 20000; i++) {
+      const Rule &near = rules[rng.GetRange(num_rules)];
+      classifier_t::Values values;
+      for (int f = 0; f < 3; f++) {
+        switch (rng.GetRange(4)) {
+          case 0:
+            values[f] = near[f].lo;
+            break;
+          case 1:
+            values[f] = near[f].hi;
+            break;
+          case 2:
+            values[f] = near[f].hi + 1;
+            break;
+          default:
+            values[f] = rng.Get() % (f ? 1100 : UINT32_MAX);
+        }
+      }
+      ASSERT_EQ(LinearMatch(rules, values), c.Match(values)) << num_rules;
+    }
+  }
+}
+
+}  // namespace (unnamed)
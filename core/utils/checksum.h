@@ -0,0 +1,112 @@
+#ifndef BESS_UTILS_CHECKSUM_H_
+#define BESS_UTILS_CHECKSUM_H_
+
+#include <endian.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace bess {
+namespace utils {
+
+// Internet checksum (RFC 1071) helpers. All values are taken as they are laid
+// out in the packet (network order), and partial sums are returned folded to
+// 16 bits, so the sums of up to 65536 buffers can simply be added together
+// before calling ChecksumFinish().
+
+// Folds a 32-bit sum into 16 bits with end-around carry
+static inline uint32_t ChecksumFold(uint32_t sum) {
+  sum = (sum & 0xffff) + (sum >> 16);
+  return (sum & 0xffff) + (sum >> 16);
+}
+
+// Returns the one's complement sum of len bytes at buf, folded to 16 bits.
+// An odd trailing byte is padded with a zero byte.
+static inline uint32_t ChecksumPartial(const void *buf, size_t len) {
+  const uint8_t *p = static_cast<const uint8_t *>(buf);
+  uint64_t sum = 0;
+
+  // One's complement addition is word-size agnostic as long as carries wrap
+  // around, so add 8 bytes at a time.
+  while (len >= sizeof(uint64_t)) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    sum += v;
+    sum += (sum < v);
+    p += sizeof(v);
+    len -= sizeof(v);
+  }
+
+  if (len >= sizeof(uint32_t)) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    sum += v;
+    sum += (sum < v);
+    p += sizeof(v);
+    len -= sizeof(v);
+  }
+
+  if (len >= sizeof(uint16_t)) {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    sum += v;
+    sum += (sum < v);
+    p += sizeof(v);
+    len -= sizeof(v);
+  }
+
+  if (len) {
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+    uint64_t v = *p;
+#else
+    uint64_t v = static_cast<uint64_t>(*p) << 8;
+#endif
+    sum += v;
+    sum += (sum < v);
+  }
+
+  uint32_t sum32 = (sum & 0xffffffff) + (sum >> 32);
+  sum32 += (sum32 < (sum & 0xffffffff));
+  return ChecksumFold(sum32);
+}
+
+// The sum of a buffer that starts at an odd offset of the checksummed data
+static inline uint32_t ChecksumSwap(uint32_t folded) {
+  return ((folded & 0xff) << 8) | (folded >> 8);
+}
+
+// Returns the checksum field value for a (possibly unfolded) sum
+static inline uint16_t ChecksumFinish(uint32_t sum) {
+  return ~ChecksumFold(sum);
+}
+
+// Sum of the IPv4 pseudo header for TCP/UDP. src and dst are in network
+// order, l4_len (the TCP/UDP header plus payload) in host order.
+static inline uint32_t PseudoHeaderSum(uint32_t src, uint32_t dst,
+                                       uint8_t proto, uint16_t l4_len) {
+  uint32_t sum = (src & 0xffff) + (src >> 16) + (dst & 0xffff) + (dst >> 16);
+  return ChecksumFold(sum + htobe16(proto) + htobe16(l4_len));
+}
+
+// Updates a checksum field after a 16-bit word of the data changed from
+// old_val to new_val (RFC 1624, eqn. 3). All values in network order.
+static inline uint16_t ChecksumUpdate16(uint16_t cksum, uint16_t old_val,
+                                        uint16_t new_val) {
+  uint32_t sum = static_cast<uint16_t>(~cksum) +
+                 static_cast<uint16_t>(~old_val) + new_val;
+  return ChecksumFinish(sum);
+}
+
+// Same as above, for an aligned 32-bit field
+static inline uint16_t ChecksumUpdate32(uint16_t cksum, uint32_t old_val,
+                                        uint32_t new_val) {
+  uint32_t sum = static_cast<uint16_t>(~cksum) + (~old_val & 0xffff) +
+                 (~old_val >> 16) + (new_val & 0xffff) + (new_val >> 16);
+  return ChecksumFinish(sum);
+}
+
+}  // namespace utils
+}  // namespace bess
+
+#endif  // BESS_UTILS_CHECKSUM_H_
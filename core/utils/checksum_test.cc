@@ -0,0 +1,109 @@
+#include "checksum.h"
+
+#include <arpa/inet.h>
+
+#include <gtest/gtest.h>
+
+#include "random.h"
+
+namespace {
+
+using namespace bess::utils;
+
+// Straightforward RFC 1071 sum over big-endian 16-bit words
+uint16_t NaiveChecksum(const uint8_t *buf, size_t len) {
+  uint32_t sum = 0;
+
+  for (size_t i = 0; i + 1 < len; i += 2) {
+    sum += (buf[i] << 8) | buf[i + 1];
+  }
+  if (len & 1) {
+    sum += buf[len - 1] << 8;
+  }
+
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return htons(~sum & 0xffff);
+}
+
+TEST(ChecksumTest, Ipv4Header) {
+  // Example from https://en.wikipedia.org/wiki/IPv4_header_checksum
+  const uint8_t hdr[] = {0x45, 0x00, 0x00, 0x73, 0x00, 0x00, 0x40,
+                         0x00, 0x40, 0x11, 0x00, 0x00, 0xc0, 0xa8,
+                         0x00, 0x01, 0xc0, 0xa8, 0x00, 0xc7};
+  EXPECT_EQ(htons(0xb861), ChecksumFinish(ChecksumPartial(hdr, sizeof(hdr))));
+}
+
+TEST(ChecksumTest, MatchesNaive) {
+  Random rd;
+  uint8_t buf[1501];
+
+  for (size_t i = 0; i < sizeof(buf); i++) {
+    buf[i] = rd.Get();
+  }
+
+  for (size_t len = 0; len <= sizeof(buf); len++) {
+    ASSERT_EQ(NaiveChecksum(buf, len),
+              ChecksumFinish(ChecksumPartial(buf, len)))
+        << "len " << len;
+  }
+}
+
+TEST(ChecksumTest, Concatenation) {
+  Random rd;
+  uint8_t buf[1000];
+
+  for (size_t i = 0; i < sizeof(buf); i++) {
+    buf[i] = rd.Get();
+  }
+
+  // Sums of pieces starting at odd offsets must be swapped
+  for (size_t split = 0; split <= sizeof(buf); split += 7) {
+    uint32_t tail = ChecksumPartial(buf + split, sizeof(buf) - split);
+    if (split & 1) {
+      tail = ChecksumSwap(tail);
+    }
+    ASSERT_EQ(NaiveChecksum(buf, sizeof(buf)),
+              ChecksumFinish(ChecksumPartial(buf, split) + tail))
+        << "split " << split;
+  }
+}
+
+TEST(ChecksumTest, IncrementalUpdate) {
+  Random rd;
+  uint8_t buf[64];
+
+  for (size_t i = 0; i < sizeof(buf); i++) {
+    buf[i] = rd.Get();
+  }
+
+  for (int i = 0; i < 1000; i++) {
+    uint16_t cksum = ChecksumFinish(ChecksumPartial(buf, sizeof(buf)));
+    size_t off = (rd.Get() % (sizeof(buf) / 4)) * 4;
+
+    uint16_t *p16 = reinterpret_cast<uint16_t *>(buf + off);
+    uint16_t old16 = *p16;
+    *p16 = rd.Get();
+    cksum = ChecksumUpdate16(cksum, old16, *p16);
+    ASSERT_EQ(ChecksumFinish(ChecksumPartial(buf, sizeof(buf))), cksum);
+
+    uint32_t *p32 = reinterpret_cast<uint32_t *>(buf + off);
+    uint32_t old32 = *p32;
+    *p32 = rd.Get();
+    cksum = ChecksumUpdate32(cksum, old32, *p32);
+    ASSERT_EQ(ChecksumFinish(ChecksumPartial(buf, sizeof(buf))), cksum);
+  }
+}
+
+TEST(ChecksumTest, PseudoHeader) {
+  const uint8_t phdr[] = {10, 0, 0, 1, 192, 168, 1, 2, 0, 6, 0x05, 0xdc};
+  uint32_t src, dst;
+  memcpy(&src, phdr, 4);
+  memcpy(&dst, phdr + 4, 4);
+
+  EXPECT_EQ(ChecksumFinish(ChecksumPartial(phdr, sizeof(phdr))),
+            ChecksumFinish(PseudoHeaderSum(src, dst, 6, 1500)));
+}
+
+}  // namespace (unnamed)
@@ -0,0 +1,269 @@
+/* Connection tracking, for stateful filtering (e.g., admitting the return
+ * traffic of connections opened from inside).
+ *
+ * A connection is found by the 5-tuples of both directions. TCP connections
+ * follow a simplified version of the state machine of Linux conntrack; UDP
+ * flows and ICMP echo exchanges have a pseudo-state, whether a reply has been
+ * seen. Each state has its own timeout, after which the connection is
+ * forgotten.
+ *
+ * Connections are kept in a FlowTable. A ConnTracker is not thread-safe, so
+ * that workers have one each, and both directions of a connection must be
+ * steered to the same worker (e.g., with a symmetric flow hash).
+ */
+
+#ifndef BESS_UTILS_CONN_TRACKER_H_
+#define BESS_UTILS_CONN_TRACKER_H_
+
+#include <x86intrin.h>
+
+#include <cstdint>
+
+#include "flow_table.h"
+
+namespace bess {
+namespace utils {
+
+// The state of a connection, as seen by a packet. Published to other modules
+// as the "conn_state" metadata attribute (1 byte).
+enum class ConnState : uint8_t {
+  kUntracked = 0,    // Not tracked (protocol, or the table is full)
+  kNew = 1,          // No reply has been seen yet
+  kEstablished = 2,  // Both directions have been seen
+  kInvalid = 3,      // No connection (e.g., TCP without SYN)
+};
+
+// The 5-tuple of a packet. For ICMP echo, both ports are the identifier.
+struct ConnTuple {
+  union {
+    struct {
+      uint32_t src_ip;
+      uint32_t dst_ip;
+      uint16_t src_port;
+      uint16_t dst_port;
+      uint8_t proto;
+    };
+
+    struct {
+      uint64_t e1;
+      uint64_t e2;
+    };
+  };
+
+  ConnTuple() : e1(0), e2(0) {}
+
+  ConnTuple Reverse() const {
+    ConnTuple ret;
+    ret.src_ip = dst_ip;
+    ret.dst_ip = src_ip;
+    ret.src_port = dst_port;
+    ret.dst_port = src_port;
+    ret.proto = proto;
+    return ret;
+  }
+
+  bool operator==(const ConnTuple &other) const {
+    return e1 == other.e1 && e2 == other.e2;
+  }
+};
+
+static_assert(sizeof(ConnTuple) == 16, "ConnTuple must be 16 bytes");
+
+class ConnTracker {
+ public:
+  static const uint8_t kProtoIcmp = 1;
+  static const uint8_t kProtoTcp = 6;
+  static const uint8_t kProtoUdp = 17;
+
+  static const uint8_t kTcpFin = 0x01;
+  static const uint8_t kTcpSyn = 0x02;
+  static const uint8_t kTcpRst = 0x04;
+  static const uint8_t kTcpAck = 0x10;
+
+  struct Stats {
+    uint64_t created;
+    uint64_t expired;     // including closed ones
+    uint64_t invalid;     // packets of no connection
+    uint64_t table_full;  // packets of connections that did not fit
+  };
+
+  // Up to max_conns connections, all of which are allocated upfront
+  explicit ConnTracker(size_t max_conns) : table_(), stats_() {
+    table_.Reserve(max_conns);
+  }
+
+  size_t Count() const { return table_.Count(); }
+
+  const Stats &stats() const { return stats_; }
+
+  // Tracks n packets (tcp_flags is ignored for other protocols), and returns
+  // their states. Connections that expired by now are removed first, as many
+  // as a bounded amount of work allows.
+  void TrackBulk(const ConnTuple *tuples, const uint8_t *tcp_flags, int n,
+                 uint64_t now, ConnState *states) {
+    static const int kMaxBulk = 64;
+    table_t::Record *records[kMaxBulk];
+
+    Expire(now, 2 * kMaxBulk);
+
+    for (int i = 0; i < n; i += kMaxBulk) {
+      int cnt = std::min(n - i, kMaxBulk);
+      bool modified = false;
+
+      table_.FindBulk(tuples + i, cnt, records);
+
+      // The results stay valid until a connection is added or removed
+      for (int j = 0; j < cnt; j++) {
+        table_t::Record *record =
+            modified ? table_.Find(tuples[i + j]) : records[j];
+        states[i + j] = Track(record, tuples[i + j], tcp_flags[i + j], now,
+                              &modified);
+      }
+    }
+  }
+
+  ConnState Track(const ConnTuple &tuple, uint8_t tcp_flags, uint64_t now) {
+    ConnState state;
+    TrackBulk(&tuple, &tcp_flags, 1, now, &state);
+    return state;
+  }
+
+  void Clear() { table_.Clear(); }
+
+ private:
+  // TCP connection states, after Linux
+  enum TcpState : uint8_t {
+    kSynSent,
+    kSynRecv,
+    kTcpEstablished,
+    kFinWait,  // One side has sent a FIN
+    kTimeWait,
+    kClose,
+  };
+
+  struct Conn {
+    uint8_t tcp_state;
+    uint8_t fin_dirs;  // Bit per direction that has sent a FIN
+    bool replied;
+  };
+
+  static size_t Hash(const ConnTuple &tuple, size_t init_val) {
+    init_val = _mm_crc32_u64(init_val, tuple.e1);
+    return _mm_crc32_u64(init_val, tuple.e2);
+  }
+
+  static bool Eq(const ConnTuple &lhs, const ConnTuple &rhs) {
+    return lhs == rhs;
+  }
+
+  // Key 0 is the tuple of the original direction, key 1 of the reply
+  typedef FlowTable<ConnTuple, Conn, 2, Hash, Eq> table_t;
+
+  static uint64_t Timeout(uint8_t proto, const Conn &conn) {
+    static const uint64_t kSec = 1000000000ULL;
+    static const uint64_t kTcpTimeouts[] = {
+        120 * kSec,             // kSynSent
+        60 * kSec,              // kSynRecv
+        5 * 24 * 3600 * kSec,   // kTcpEstablished
+        120 * kSec,             // kFinWait
+        120 * kSec,             // kTimeWait
+        10 * kSec,              // kClose
+    };
+
+    switch (proto) {
+      case kProtoTcp:
+        return kTcpTimeouts[conn.tcp_state];
+      case kProtoUdp:
+        return conn.replied ? 180 * kSec : 30 * kSec;
+      default:
+        return 30 * kSec;
+    }
+  }
+
+  static void UpdateTcp(Conn *conn, int dir, uint8_t flags) {
+    if (flags & kTcpRst) {
+      conn->tcp_state = kClose;
+    } else if ((flags & (kTcpSyn | kTcpAck)) == kTcpSyn) {
+      // A new connection reusing the tuple
+      if (dir == 0 &&
+          (conn->tcp_state == kTimeWait || conn->tcp_state == kClose)) {
+        conn->tcp_state = kSynSent;
+        conn->fin_dirs = 0;
+        conn->replied = false;
+      }
+    } else if (flags & kTcpSyn) {
+      if (dir == 1 && conn->tcp_state == kSynSent) {
+        conn->tcp_state = kSynRecv;
+      }
+    } else if (flags & kTcpFin) {
+      if (conn->tcp_state == kSynRecv || conn->tcp_state == kTcpEstablished ||
+          conn->tcp_state == kFinWait) {
+        conn->fin_dirs |= 1 << dir;
+        conn->tcp_state = (conn->fin_dirs == 3) ? kTimeWait : kFinWait;
+      }
+    } else if (flags & kTcpAck) {
+      if (dir == 0 && conn->tcp_state == kSynRecv) {
+        conn->tcp_state = kTcpEstablished;
+      }
+    }
+  }
+
+  ConnState Track(table_t::Record *record, const ConnTuple &tuple,
+                  uint8_t tcp_flags, uint64_t now, bool *modified) {
+    bool is_tcp = tuple.proto == kProtoTcp;
+
+    // Expired, but Expire() has not caught up with it yet
+    if (record && now >= record->expiry()) {
+      table_.Remove(record);
+      stats_.expired++;
+      record = nullptr;
+      *modified = true;
+    }
+
+    if (!record) {
+      // Only a SYN opens a TCP connection
+      if (is_tcp && (tcp_flags & (kTcpSyn | kTcpAck | kTcpRst)) != kTcpSyn) {
+        stats_.invalid++;
+        return ConnState::kInvalid;
+      }
+
+      ConnTuple keys[2] = {tuple, tuple.Reverse()};
+      Conn conn = {kSynSent, 0, false};
+      record = table_.Insert(keys, now, now + Timeout(tuple.proto, conn));
+      if (!record) {
+        stats_.table_full++;
+        return ConnState::kUntracked;
+      }
+
+      record->value = conn;
+      stats_.created++;
+      *modified = true;
+      return ConnState::kNew;
+    }
+
+    Conn &conn = record->value;
+    int dir = (record->key(0) == tuple) ? 0 : 1;
+
+    if (is_tcp) {
+      UpdateTcp(&conn, dir, tcp_flags);
+    }
+    if (dir == 1) {
+      conn.replied = true;
+    }
+
+    table_.SetExpiry(record, now + Timeout(tuple.proto, conn));
+    return conn.replied ? ConnState::kEstablished : ConnState::kNew;
+  }
+
+  void Expire(uint64_t now, int budget) {
+    stats_.expired += table_.Expire(now, budget, [](table_t::Record *) {});
+  }
+
+  table_t table_;
+  Stats stats_;
+};
+
+}  // namespace utils
+}  // namespace bess
+
+#endif  // BESS_UTILS_CONN_TRACKER_H_
@@ -0,0 +1,103 @@
+// Benchmarks for ConnTracker: how many connections it sets up per second (in
+// steady state, as old ones expire), and how many packets of established
+// connections it looks up per second.
+
+#include "conn_tracker.h"
+
+#include <memory>
+
+#include <benchmark/benchmark.h>
+#include <glog/logging.h>
+
+#include "random.h"
+
+using bess::utils::ConnState;
+using bess::utils::ConnTracker;
+using bess::utils::ConnTuple;
+
+namespace {
+
+const int kBatch = 32;
+const uint64_t kSec = 1000000000ULL;
+
+ConnTuple MakeTuple(uint64_t i) {
+  ConnTuple t;
+  t.src_ip = 0x0a000000 + (i >> 16);
+  t.dst_ip = 0xc0a80001 + (i & 0xff);
+  t.src_port = i & 0xffff;
+  t.dst_port = 443;
+  t.proto = ConnTracker::kProtoTcp;
+  return t;
+}
+
+}  // namespace (unnamed)
+
+// Every packet is a SYN of a new connection. Half-open connections time out
+// after 120s, so the table holds state.range(0) of them once the clock moves
+// by 120s / state.range(0) per connection. The headroom is for expiry, which
+// lags behind when the timing wheel cascades a slot of its top level.
+static void BM_Setup(benchmark::State &state) {
+  uint64_t n = state.range(0);
+  ConnTracker ct(n + n / 4);
+  uint64_t interval = 121 * kSec / n;
+  uint64_t now = 0;
+  uint64_t next = 0;
+
+  ConnTuple tuples[kBatch];
+  uint8_t flags[kBatch];
+  ConnState states[kBatch];
+
+  for (int i = 0; i < kBatch; i++) {
+    flags[i] = ConnTracker::kTcpSyn;
+  }
+
+  while (state.KeepRunning()) {
+    for (int i = 0; i < kBatch; i++) {
+      tuples[i] = MakeTuple(next++);
+    }
+
+    now += interval * kBatch;
+    ct.TrackBulk(tuples, flags, kBatch, now, states);
+    DCHECK(states[0] == ConnState::kNew);
+  }
+
+  state.SetItemsProcessed(state.iterations() * kBatch);
+  state.counters["conns"] = ct.Count();
+  state.counters["full"] = ct.stats().table_full;
+}
+
+// Packets of random established connections, out of state.range(0)
+static void BM_Lookup(benchmark::State &state) {
+  uint64_t n = state.range(0);
+  ConnTracker ct(n);
+  Random rng;
+
+  for (uint64_t i = 0; i < n; i++) {
+    ConnTuple t = MakeTuple(i);
+    ct.Track(t, ConnTracker::kTcpSyn, 0);
+    ct.Track(t.Reverse(), ConnTracker::kTcpSyn | ConnTracker::kTcpAck, 0);
+    ct.Track(t, ConnTracker::kTcpAck, 0);
+  }
+
+  ConnTuple tuples[kBatch];
+  uint8_t flags[kBatch];
+  ConnState states[kBatch];
+
+  while (state.KeepRunning()) {
+    for (int i = 0; i < kBatch; i++) {
+      ConnTuple t = MakeTuple(rng.GetRange(n));
+      tuples[i] = (i & 1) ? t.Reverse() : t;
+      flags[i] = ConnTracker::kTcpAck;
+    }
+
+    ct.TrackBulk(tuples, flags, kBatch, kSec, states);
+    DCHECK(states[0] == ConnState::kEstablished);
+  }
+
+  state.SetItemsProcessed(state.iterations() * kBatch);
+}
+
+BENCHMARK(BM_Setup)->Arg(1 << 16)->Arg(1 << 20)->Arg(4 << 20);
+BENCHMARK(BM_Lookup)->Arg(1 << 16)->Arg(1 << 20)->Arg(4 << 20);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,147 @@
+#include "conn_tracker.h"
+
+#include <gtest/gtest.h>
+
+using bess::utils::ConnState;
+using bess::utils::ConnTracker;
+using bess::utils::ConnTuple;
+
+namespace {
+
+const uint64_t kSec = 1000000000ULL;
+
+const uint8_t kSyn = ConnTracker::kTcpSyn;
+const uint8_t kAck = ConnTracker::kTcpAck;
+const uint8_t kFin = ConnTracker::kTcpFin;
+const uint8_t kRst = ConnTracker::kTcpRst;
+
+ConnTuple MakeTuple(uint8_t proto, uint32_t i = 0) {
+  ConnTuple t;
+  t.src_ip = 0x0a000001 + i;
+  t.dst_ip = 0xc0a80001;
+  t.src_port = 10000 + i;
+  t.dst_port = 80;
+  t.proto = proto;
+  return t;
+}
+
+TEST(ConnTrackerTest, TcpHandshake) {
+  ConnTracker ct(16);
+  ConnTuple orig = MakeTuple(ConnTracker::kProtoTcp);
+  ConnTuple reply = orig.Reverse();
+
+  // No connection without SYN
+  EXPECT_EQ(ConnState::kInvalid, ct.Track(orig, kAck, 0));
+  EXPECT_EQ(ConnState::kInvalid, ct.Track(reply, kSyn | kAck, 0));
+  EXPECT_EQ(0, ct.Count());
+
+  EXPECT_EQ(ConnState::kNew, ct.Track(orig, kSyn, 0));
+  EXPECT_EQ(ConnState::kNew, ct.Track(orig, kSyn, 1 * kSec));  // retransmit
+  EXPECT_EQ(ConnState::kEstablished, ct.Track(reply, kSyn | kAck, 2 * kSec));
+  EXPECT_EQ(ConnState::kEstablished, ct.Track(orig, kAck, 3 * kSec));
+  EXPECT_EQ(1, ct.Count());
+  EXPECT_EQ(1, ct.stats().created);
+  EXPECT_EQ(2, ct.stats().invalid);
+
+  // Established connections last long
+  EXPECT_EQ(ConnState::kEstablished, ct.Track(reply, kAck, 3600 * kSec));
+  EXPECT_EQ(ConnState::kEstablished, ct.Track(orig, kAck, 7200 * kSec));
+}
+
+TEST(ConnTrackerTest, TcpClose) {
+  ConnTracker ct(16);
+  ConnTuple orig = MakeTuple(ConnTracker::kProtoTcp);
+  ConnTuple reply = orig.Reverse();
+  uint64_t now = 100 * kSec;
+
+  ct.Track(orig, kSyn, now);
+  ct.Track(reply, kSyn | kAck, now);
+  ct.Track(orig, kAck, now);
+
+  EXPECT_EQ(ConnState::kEstablished, ct.Track(orig, kFin | kAck, now));
+  EXPECT_EQ(ConnState::kEstablished, ct.Track(reply, kFin | kAck, now));
+  EXPECT_EQ(ConnState::kEstablished, ct.Track(orig, kAck, now));
+
+  // Forgotten after TIME_WAIT
+  EXPECT_EQ(ConnState::kInvalid, ct.Track(orig, kAck, now + 121 * kSec));
+  EXPECT_EQ(0, ct.Count());
+  EXPECT_EQ(1, ct.stats().expired);
+
+  // Reset, and the tuple reused right away
+  now += 200 * kSec;
+  ct.Track(orig, kSyn, now);
+  ct.Track(reply, kSyn | kAck, now);
+  EXPECT_EQ(ConnState::kEstablished, ct.Track(reply, kRst, now));
+  EXPECT_EQ(ConnState::kNew, ct.Track(orig, kSyn, now + kSec));
+  EXPECT_EQ(1, ct.Count());
+
+  // Reset connections are forgotten quickly
+  ct.Track(orig, kRst, now + kSec);
+  EXPECT_EQ(ConnState::kInvalid, ct.Track(orig, kAck, now + 12 * kSec));
+}
+
+TEST(ConnTrackerTest, Timeouts) {
+  ConnTracker ct(16);
+  ConnTuple syn = MakeTuple(ConnTracker::kProtoTcp, 1);
+  ConnTuple udp = MakeTuple(ConnTracker::kProtoUdp, 2);
+  ConnTuple udp_replied = MakeTuple(ConnTracker::kProtoUdp, 3);
+
+  ct.Track(syn, kSyn, 0);
+  ct.Track(udp, 0, 0);
+  ct.Track(udp_replied, 0, 0);
+  EXPECT_EQ(ConnState::kEstablished, ct.Track(udp_replied.Reverse(), 0, 0));
+  EXPECT_EQ(3, ct.Count());
+
+  // Expired connections are removed in the background, too
+  ct.Track(MakeTuple(ConnTracker::kProtoIcmp, 4), 0, 31 * kSec);
+  EXPECT_EQ(3, ct.Count());
+  EXPECT_EQ(ConnState::kNew, ct.Track(udp, 0, 31 * kSec));  // a new one
+
+  // Only the replied UDP flow is left, and the ICMP one is new again
+  ct.Track(MakeTuple(ConnTracker::kProtoIcmp, 4), 0, 121 * kSec);
+  EXPECT_EQ(2, ct.Count());
+  EXPECT_EQ(ConnState::kEstablished, ct.Track(udp_replied, 0, 121 * kSec));
+}
+
+TEST(ConnTrackerTest, TableFull) {
+  ConnTracker ct(2);
+
+  EXPECT_EQ(ConnState::kNew, ct.Track(MakeTuple(ConnTracker::kProtoUdp, 1),
+                                      0, 0));
+  EXPECT_EQ(ConnState::kNew, ct.Track(MakeTuple(ConnTracker::kProtoUdp, 2),
+                                      0, 0));
+  EXPECT_EQ(ConnState::kUntracked,
+            ct.Track(MakeTuple(ConnTracker::kProtoUdp, 3), 0, 0));
+  EXPECT_EQ(1, ct.stats().table_full);
+
+  // Room again once they expire
+  EXPECT_EQ(ConnState::kNew, ct.Track(MakeTuple(ConnTracker::kProtoUdp, 3),
+                                      0, 31 * kSec));
+}
+
+// Both directions of a new connection in the same batch, and more packets
+// than a bulk lookup takes
+TEST(ConnTrackerTest, Bulk) {
+  const int kNum = 100;
+  ConnTracker ct(kNum);
+  ConnTuple tuples[3 * kNum];
+  uint8_t flags[3 * kNum] = {};
+  ConnState states[3 * kNum];
+
+  for (int i = 0; i < kNum; i++) {
+    tuples[3 * i] = MakeTuple(ConnTracker::kProtoUdp, i);
+    tuples[3 * i + 1] = tuples[3 * i];
+    tuples[3 * i + 2] = tuples[3 * i].Reverse();
+  }
+
+  ct.TrackBulk(tuples, flags, 3 * kNum, 0, states);
+
+  for (int i = 0; i < kNum; i++) {
+    EXPECT_EQ(ConnState::kNew, states[3 * i]);
+    EXPECT_EQ(ConnState::kNew, states[3 * i + 1]);
+    EXPECT_EQ(ConnState::kEstablished, states[3 * i + 2]);
+  }
+  EXPECT_EQ(kNum, ct.Count());
+}
+
+}  // namespace (unnamed)
@@ -1,9 +1,21 @@
 /* Streamlined hash table implementation, with emphasis on lookup performance.
- * Key and value sizes are fixed. Lookup is thread-safe, but update is not. */
+ * Key and value sizes are fixed. Lookup is thread-safe, but update is not.
+ *
+ * A bucket is a cache line with 8 slots, each of which has a 16-bit tag (a
+ * signature of the hash value of the key, or 0 if the slot is empty) and the
+ * index of its entry. A probe compares the tags of all slots at once with SSE,
+ * and only reads the entries whose tag matches. The alternative bucket of an
+ * entry is derived from its current bucket and its tag (partial-key cuckoo
+ * hashing), so that entries can be moved without hashing their keys again.
+ *
+ * Buckets and entries are allocated with bess::memory::Allocator, so large
+ * tables are backed by huge pages. */
 
 #ifndef BESS_UTILS_CUCKOOMAP_H_
 #define BESS_UTILS_CUCKOOMAP_H_
 
+#include <x86intrin.h>
+
 #include <algorithm>
 #include <limits>
 #include <stack>
@@ -43,6 +55,9 @@ class CuckooMap {
  public:
   typedef std::pair<K, V> Entry;
 
+  // FindBulk() looks up this many keys at a time
+  static const int kMaxBulk = 64;
+
   CuckooMap()
       : bucket_mask_(kInitNumBucket - 1),
         num_entries_(0),
@@ -65,20 +80,25 @@ class CuckooMap {
   // Insert/update a key value pair
   // Return the pointer to the inserted entry
   Entry* Insert(const K& key, const V& value) {
-    size_t primary = Hash(key);
+    size_t hash = Hash(key);
 
-    Entry* entry = GetHash(primary, key);
+    Entry* entry = GetHash(hash, key);
     if (entry) {
       entry->second = value;
       return entry;
     }
 
-    size_t secondary = HashSecondary(primary);
+    uint32_t idx = PopFreeKeyIndex();
+    entry = &entries_[idx];
+    entry->first = key;
+    entry->second = value;
 
-    while ((entry = AddEntry(primary, secondary, key, value)) == nullptr) {
+    while (!AddEntry(hash, idx)) {
       // expand the table as the last resort
-      ExpandBuckets();
+      ExpandBuckets(buckets_.size() * 2);
     }
+
+    num_entries_++;
     return entry;
   }
 
@@ -86,15 +106,32 @@ class CuckooMap {
   // Return nullptr if not exist.
   Entry* Find(const K& key) { return GetHash(Hash(key), key); }
 
+  // Find the entries of n keys, storing the pointer to the entry of keys[i]
+  // (or nullptr) in entries[i]. Faster than Find() for large tables, as the
+  // buckets and entries of many keys are fetched from memory in parallel.
+  // Return the number of keys found.
+  int FindBulk(const K* keys, int n, Entry** entries) {
+    int hits = 0;
+
+    for (int i = 0; i < n; i += kMaxBulk) {
+      int cnt = std::min(n - i, kMaxBulk);
+      hits += FindBulkOnce(keys + i, cnt, entries + i);
+    }
+
+    return hits;
+  }
+
   // Remove the stored entry by the key
   // Return false if not exist.
   bool Remove(const K& key) {
-    size_t pri = Hash(key);
-    if (RemoveFromBucket(pri, pri & bucket_mask_, key)) {
+    size_t hash = Hash(key);
+    uint16_t tag = Tag(hash);
+    size_t pri = hash & bucket_mask_;
+
+    if (RemoveFromBucket(pri, tag, key)) {
       return true;
     }
-    size_t sec = HashSecondary(pri);
-    if (RemoveFromBucket(pri, sec & bucket_mask_, key)) {
+    if (RemoveFromBucket(AltBucket(pri, tag), tag, key)) {
       return true;
     }
     return false;
@@ -103,13 +140,38 @@ class CuckooMap {
   // Return the number of stored entries
   size_t Count() const { return num_entries_; }
 
+  // Preallocate space for n entries in total, so that inserting them does not
+  // allocate memory (unless their hash values are badly skewed)
+  void Reserve(size_t n) {
+    size_t old_size = entries_.size();
+
+    if (n > old_size) {
+      CHECK_LE(n, std::numeric_limits<uint32_t>::max());
+      entries_.resize(n);
+
+      for (size_t i = n; i-- > old_size;) {
+        free_entry_indices_.push(i);
+      }
+    }
+
+    // Up to 90% full
+    size_t new_size = buckets_.size();
+    while (new_size * kEntriesPerBucket * 9 / 10 < n) {
+      new_size *= 2;
+    }
+
+    if (new_size > buckets_.size()) {
+      ExpandBuckets(new_size);
+    }
+  }
+
  private:
   // Tunable macros
   static const int kInitNumBucket = 4;
   static const int kInitNumEntries = 16;
-  static const int kEntriesPerBucket = 4;  // 4-way set associative
+  static const int kEntriesPerBucket = 8;  // 8-way set associative
 
-  // 4^kMaxCuckooPath buckets will be considered to make a empty slot,
+  // 8^kMaxCuckooPath buckets will be considered to make a empty slot,
   // before giving up and expand the table.
   // Higher number will yield better occupancy, but the worst case performance
   // of insertion will grow exponentially, so be careful.
@@ -118,127 +180,114 @@ class CuckooMap {
   // non-tunable macros
   static const size_t kHashInitval = UINT64_MAX;
 
-  struct Bucket {
-    size_t hash_values[kEntriesPerBucket];
-    size_t key_indices[kEntriesPerBucket];
+  struct alignas(64) Bucket {
+    uint16_t tags[kEntriesPerBucket];
+    uint32_t key_indices[kEntriesPerBucket];
 
-    Bucket() : hash_values(), key_indices() {}
+    Bucket() : tags(), key_indices() {}
   };
 
+  static_assert(sizeof(Bucket::tags) == sizeof(__m128i),
+                "tags must fill a SSE register");
+
   // Push an unused entry index back to the  stack
-  void PushFreeKeyIndex(size_t idx) { free_entry_indices_.push(idx); }
+  void PushFreeKeyIndex(uint32_t idx) { free_entry_indices_.push(idx); }
 
   // Pop a free entry index from stack and return the index
-  size_t PopFreeKeyIndex() {
+  uint32_t PopFreeKeyIndex() {
     if (free_entry_indices_.empty()) {
       ExpandEntries();
     }
-    size_t idx = free_entry_indices_.top();
+    uint32_t idx = free_entry_indices_.top();
     free_entry_indices_.pop();
     return idx;
   }
 
-  // Try to add (key, value) to the bucket indexed by bucket_idx
-  // Return the pointer to the entry if success. Otherwise return nullptr.
-  Entry* AddToBucket(size_t bucket_idx, const K& key, const V& value) {
-    Bucket& bucket = buckets_[bucket_idx];
-    int slot_idx = FindSlot(bucket, 0);
-
-    if (slot_idx == -1) {
-      return nullptr;
-    }
-
-    size_t free_idx = PopFreeKeyIndex();
-
-    bucket.hash_values[slot_idx] = Hash(key);
-    bucket.key_indices[slot_idx] = free_idx;
+  // Return the bitmask of the slots in the bucket with the tag
+  static uint32_t MatchTags(const Bucket& bucket, uint16_t tag) {
+    __m128i tags =
+        _mm_load_si128(reinterpret_cast<const __m128i*>(bucket.tags));
+    __m128i eq = _mm_cmpeq_epi16(tags, _mm_set1_epi16(tag));
+    return _mm_movemask_epi8(_mm_packs_epi16(eq, _mm_setzero_si128()));
+  }
 
-    Entry& entry = entries_[free_idx];
-    entry.first = key;
-    entry.second = value;
+  // Return the index of an empty slot in the bucket, or -1 if full
+  static int FindEmptySlot(const Bucket& bucket) {
+    uint32_t mask = MatchTags(bucket, 0);
+    return mask ? __builtin_ctz(mask) : -1;
+  }
 
-    num_entries_++;
-    return &entry;
+  // Return the slot index of the key in the bucket, or -1 if not found
+  int FindSlot(const Bucket& bucket, uint16_t tag, const K& key) const {
+    for (uint32_t mask = MatchTags(bucket, tag); mask; mask &= mask - 1) {
+      int slot_idx = __builtin_ctz(mask);
+      if (E(entries_[bucket.key_indices[slot_idx]].first, key)) {
+        return slot_idx;
+      }
+    }
+    return -1;
   }
 
   // Remove key from the bucket indexed by bucket_idx
   // Return true if success.
-  bool RemoveFromBucket(size_t primary, size_t bucket_idx, const K& key) {
+  bool RemoveFromBucket(size_t bucket_idx, uint16_t tag, const K& key) {
     Bucket& bucket = buckets_[bucket_idx];
 
-    int slot_idx = FindSlot(bucket, primary);
+    int slot_idx = FindSlot(bucket, tag, key);
     if (slot_idx == -1) {
       return false;
     }
 
-    size_t idx = bucket.key_indices[slot_idx];
-    Entry& entry = entries_[idx];
-    if (E(entry.first, key)) {
-      bucket.hash_values[slot_idx] = 0;
-      entry = Entry();
-      PushFreeKeyIndex(idx);
-      num_entries_--;
-      return true;
-    }
-
-    return false;
+    uint32_t idx = bucket.key_indices[slot_idx];
+    bucket.tags[slot_idx] = 0;
+    entries_[idx] = Entry();
+    PushFreeKeyIndex(idx);
+    num_entries_--;
+    return true;
   }
 
-  // Remove key from the bucket indexed by bucket_idx
+  // Get the entry of the key from the bucket indexed by bucket_idx
   // Return the pointer to the entry if success. Otherwise return nullptr.
-  Entry* GetFromBucket(size_t primary, size_t bucket_idx, const K& key) {
-    Bucket& bucket = buckets_[bucket_idx];
+  Entry* GetFromBucket(size_t bucket_idx, uint16_t tag, const K& key) {
+    const Bucket& bucket = buckets_[bucket_idx];
 
-    int slot_idx = FindSlot(bucket, primary);
+    int slot_idx = FindSlot(bucket, tag, key);
     if (slot_idx == -1) {
       return nullptr;
     }
 
-    size_t idx = bucket.key_indices[slot_idx];
-    if (E(entries_[idx].first, key)) {
-      return &entries_[idx];
-    }
-
-    return nullptr;
+    return &entries_[bucket.key_indices[slot_idx]];
   }
 
-  // Try to add the entry (key, value)
-  // Return the pointer to the entry if success. Otherwise return nullptr.
-  Entry* AddEntry(size_t primary, size_t secondary, const K& key,
-                  const V& value) {
-    uint32_t primary_bucket_index, secondary_bucket_index;
-    Entry* entry = nullptr;
-  again:
-    primary_bucket_index = primary & bucket_mask_;
-    if ((entry = AddToBucket(primary_bucket_index, key, value)) != nullptr) {
-      return entry;
-    }
-
-    secondary_bucket_index = secondary & bucket_mask_;
-    if ((entry = AddToBucket(secondary_bucket_index, key, value)) != nullptr) {
-      return entry;
-    }
-
-    if (MakeSpace(primary_bucket_index, 0) >= 0) {
-      goto again;
-    }
-
-    if (MakeSpace(secondary_bucket_index, 0) >= 0) {
-      goto again;
+  // Try to put the entry at idx (whose key has the hash value) in one of its
+  // two buckets, making space with cuckoo moves if both are full.
+  // Return false if failed.
+  bool AddEntry(size_t hash, uint32_t idx) {
+    uint16_t tag = Tag(hash);
+    size_t bucket_idx[2];
+
+    bucket_idx[0] = hash & bucket_mask_;
+    bucket_idx[1] = AltBucket(bucket_idx[0], tag);
+
+    for (int k = 0; k < 2; k++) {
+      int slot_idx = FindEmptySlot(buckets_[bucket_idx[k]]);
+      if (slot_idx != -1) {
+        buckets_[bucket_idx[k]].tags[slot_idx] = tag;
+        buckets_[bucket_idx[k]].key_indices[slot_idx] = idx;
+        return true;
+      }
     }
 
-    return nullptr;
-  }
-
-  // Return the slot index in the bucket that matches the hash_value
-  // -1 if not found.
-  int FindSlot(const Bucket& bucket, size_t hash_value) {
-    for (int i = 0; i < kEntriesPerBucket; i++) {
-      if (bucket.hash_values[i] == hash_value) {
-        return i;
+    for (int k = 0; k < 2; k++) {
+      int slot_idx = MakeSpace(bucket_idx[k], 0);
+      if (slot_idx != -1) {
+        buckets_[bucket_idx[k]].tags[slot_idx] = tag;
+        buckets_[bucket_idx[k]].key_indices[slot_idx] = idx;
+        return true;
       }
     }
-    return -1;
+
+    return false;
   }
 
   // Recursively try making an empty slot in the bucket
@@ -252,31 +301,20 @@ class CuckooMap {
     Bucket& bucket = buckets_[index];
 
     for (int i = 0; i < kEntriesPerBucket; i++) {
-      const K& key = bucket.key_indices[i];
-      size_t pri = Hash(key);
-      size_t sec = HashSecondary(pri);
-
-      size_t alt_index;
-
-      // this entry is in its primary bucket?
-      if (pri == bucket.hash_values[i]) {
-        alt_index = sec & bucket_mask_;
-      } else if (sec == bucket.hash_values[i]) {
-        alt_index = pri & bucket_mask_;
-      } else {
-        return -1;
-      }
+      size_t alt_index = AltBucket(index, bucket.tags[i]);
 
       // Find empty slot
-      int j = FindSlot(buckets_[alt_index], 0);
+      int j = FindEmptySlot(buckets_[alt_index]);
       if (j == -1) {
         j = MakeSpace(alt_index, depth + 1);
       }
       if (j >= 0) {
+        // The slot may have been refilled by the recursive call, with another
+        // entry that belongs to both buckets as well
         Bucket& alt_bucket = buckets_[alt_index];
-        alt_bucket.hash_values[j] = bucket.hash_values[i];
+        alt_bucket.tags[j] = bucket.tags[i];
         alt_bucket.key_indices[j] = bucket.key_indices[i];
-        bucket.hash_values[i] = 0;
+        bucket.tags[i] = 0;
         return i;
       }
     }
@@ -284,42 +322,132 @@ class CuckooMap {
     return -1;
   }
 
-  // Get the entry given the primary hash value of the key.
+  // Get the entry given the hash value of the key.
   // Returns the pointer to the entry or nullptr if failed.
-  Entry* GetHash(size_t primary, const K& key) {
-    Entry* ret = GetFromBucket(primary, primary & bucket_mask_, key);
+  Entry* GetHash(size_t hash, const K& key) {
+    uint16_t tag = Tag(hash);
+    size_t pri = hash & bucket_mask_;
+
+    Entry* ret = GetFromBucket(pri, tag, key);
     if (ret) {
       return ret;
     }
-    return GetFromBucket(primary, HashSecondary(primary) & bucket_mask_, key);
+    return GetFromBucket(AltBucket(pri, tag), tag, key);
   }
 
-  // Secondary hash value
-  static size_t HashSecondary(uint32_t primary) {
-    size_t tag = primary >> 12;
-    return primary ^ ((tag + 1) * 0x5bd1e995);
+  // Look up to kMaxBulk keys in three passes, each of which prefetches what
+  // the next one needs: buckets, then entries with a matching tag.
+  int FindBulkOnce(const K* keys, int n, Entry** entries) {
+    const Bucket* buckets[kMaxBulk][2];
+    uint32_t masks[kMaxBulk][2];
+    int hits = 0;
+
+    for (int i = 0; i < n; i++) {
+      size_t hash = Hash(keys[i]);
+      size_t pri = hash & bucket_mask_;
+
+      masks[i][0] = Tag(hash);
+      buckets[i][0] = &buckets_[pri];
+      buckets[i][1] = &buckets_[AltBucket(pri, masks[i][0])];
+      __builtin_prefetch(buckets[i][0]);
+      __builtin_prefetch(buckets[i][1]);
+    }
+
+    for (int i = 0; i < n; i++) {
+      uint16_t tag = masks[i][0];
+
+      // Only the first match, without branching (slot 0 if none), since
+      // more than one is rare
+      for (int k = 0; k < 2; k++) {
+        masks[i][k] = MatchTags(*buckets[i][k], tag);
+        int slot_idx = __builtin_ctz(masks[i][k] | 1);
+        __builtin_prefetch(&entries_[buckets[i][k]->key_indices[slot_idx]]);
+      }
+    }
+
+    for (int i = 0; i < n; i++) {
+      entries[i] = nullptr;
+
+      for (int k = 0; k < 2 && !entries[i]; k++) {
+        for (uint32_t mask = masks[i][k]; mask; mask &= mask - 1) {
+          Entry* entry =
+              &entries_[buckets[i][k]->key_indices[__builtin_ctz(mask)]];
+          if (E(entry->first, keys[i])) {
+            entries[i] = entry;
+            hits++;
+            break;
+          }
+        }
+      }
+    }
+
+    return hits;
   }
 
-  // Primary hash value
-  static size_t Hash(const K& key) { return H(key, kHashInitval); }
+  // The other bucket of an entry in the bucket, with the tag.
+  // Never the same bucket, and the function is its own inverse.
+  size_t AltBucket(size_t index, uint16_t tag) const {
+    size_t delta = (tag * 0x5bd1e995UL) & bucket_mask_;
+    return index ^ (delta ? delta : 1);
+  }
+
+  // 16-bit signature of the hash value, never 0 (empty slot)
+  static uint16_t Tag(size_t hash) {
+    uint16_t tag = hash >> 48;
+    return tag ? tag : 1;
+  }
+
+  // Hash value. Bits are mixed, since tags and bucket indices need many
+  // independent bits, but hash codes may be weak (e.g., std::hash<int>).
+  static size_t Hash(const K& key) {
+    uint64_t h = H(key, kHashInitval);
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+  }
 
   // Resize the space of entries. Grow less aggressively than buckets.
   void ExpandEntries() {
-    size_t old_size = num_entries_;
+    size_t old_size = entries_.size();
     size_t new_size = old_size + old_size / 2;
 
+    CHECK_LE(new_size, std::numeric_limits<uint32_t>::max());
     entries_.resize(new_size);
 
-    for (size_t i = new_size - 1; i >= old_size; --i) {
+    for (size_t i = new_size; i-- > old_size;) {
       free_entry_indices_.push(i);
     }
   }
 
-  // Resize the space of buckets.
-  void ExpandBuckets() {
-    size_t new_size = (bucket_mask_ + 1) * 2;
-    buckets_.resize(new_size);
+  // Resize the space of buckets to new_size (or more, if it takes), and move
+  // every entry to the buckets of its hash value in the new space.
+  void ExpandBuckets(size_t new_size) {
+    std::vector<Bucket, bess::memory::Allocator<Bucket>> old_buckets(
+        buckets_.get_allocator());
+
+    old_buckets.swap(buckets_);
+
+  again:
+    buckets_.assign(new_size, Bucket());
     bucket_mask_ = new_size - 1;
+
+    for (const Bucket& bucket : old_buckets) {
+      for (int i = 0; i < kEntriesPerBucket; i++) {
+        if (!bucket.tags[i]) {
+          continue;
+        }
+
+        uint32_t idx = bucket.key_indices[i];
+        if (!AddEntry(Hash(entries_[idx].first), idx)) {
+          new_size *= 2;
+          goto again;
+        }
+      }
+    }
   }
 
   // # of buckets == mask + 1
@@ -328,14 +456,18 @@ class CuckooMap {
   // # of entries
   size_t num_entries_;
 
-  // bucket and entry arrays grow independently
-  std::vector<Bucket> buckets_;
-  std::vector<Entry> entries_;
+  // bucket and entry arrays grow independently, in the slabs of the owner
+  // (module) that created the map
+  std::vector<Bucket, bess::memory::Allocator<Bucket>> buckets_;
+  std::vector<Entry, bess::memory::Allocator<Entry>> entries_;
 
   // Stack of free entries
   std::stack<size_t> free_entry_indices_;
 };
 
+template <typename K, typename V, HashFunc<K> H, EqFunc<K> E>
+const int CuckooMap<K, V, H, E>::kMaxBulk;
+
 }  // namespace utils
 }  // namespace bess
 
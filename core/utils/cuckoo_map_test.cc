@@ -72,4 +72,82 @@ TEST(CuckooMapTest, Count) {
   EXPECT_EQ(cuckoo.Count(), 0);
 }
 
+// The map must hold many more entries than it starts with
+TEST(CuckooMapTest, Grow) {
+  CuckooMap<uint32_t, value_t> cuckoo;
+
+  for (uint32_t i = 0; i < 100000; i++) {
+    cuckoo.Insert(i, i * 3);
+  }
+  EXPECT_EQ(cuckoo.Count(), 100000);
+
+  for (uint32_t i = 0; i < 100000; i++) {
+    auto *entry = cuckoo.Find(i);
+    ASSERT_NE(entry, nullptr) << i;
+    EXPECT_EQ(entry->second, static_cast<value_t>(i * 3));
+  }
+
+  for (uint32_t i = 0; i < 100000; i += 2) {
+    EXPECT_TRUE(cuckoo.Remove(i));
+  }
+  EXPECT_EQ(cuckoo.Count(), 50000);
+
+  for (uint32_t i = 0; i < 100000; i++) {
+    EXPECT_EQ(cuckoo.Find(i) != nullptr, i % 2 == 1) << i;
+  }
+}
+
+static size_t zero_hash(const uint32_t &, size_t) {
+  return 0;
+}
+
+// A hash value of 0 is as good as any other
+TEST(CuckooMapTest, ZeroHash) {
+  CuckooMap<uint32_t, value_t, zero_hash> cuckoo;
+
+  for (uint32_t i = 0; i < 10; i++) {
+    cuckoo.Insert(i, i);
+  }
+
+  for (uint32_t i = 0; i < 10; i++) {
+    ASSERT_NE(cuckoo.Find(i), nullptr);
+    EXPECT_EQ(cuckoo.Find(i)->second, i);
+  }
+  EXPECT_EQ(cuckoo.Find(10), nullptr);
+
+  EXPECT_TRUE(cuckoo.Remove(0));
+  EXPECT_FALSE(cuckoo.Remove(0));
+  EXPECT_EQ(cuckoo.Find(0), nullptr);
+  EXPECT_EQ(cuckoo.Count(), 9);
+}
+
+// Test FindBulk function, with more keys than it looks up at a time
+TEST(CuckooMapTest, FindBulk) {
+  typedef CuckooMap<uint32_t, value_t> map_t;
+  map_t cuckoo;
+
+  for (uint32_t i = 0; i < 1000; i += 2) {
+    cuckoo.Insert(i, i + 1);
+  }
+
+  uint32_t keys[1000];
+  map_t::Entry *entries[1000];
+
+  for (uint32_t i = 0; i < 1000; i++) {
+    keys[i] = i;
+  }
+
+  EXPECT_EQ(cuckoo.FindBulk(keys, 1000, entries), 500);
+
+  for (uint32_t i = 0; i < 1000; i++) {
+    EXPECT_EQ(entries[i], cuckoo.Find(i));
+    if (i % 2 == 0) {
+      ASSERT_NE(entries[i], nullptr);
+      EXPECT_EQ(entries[i]->second, i + 1);
+    }
+  }
+
+  EXPECT_EQ(cuckoo.FindBulk(keys, 0, entries), 0);
+}
+
 }  // namespace (unnamed)
@@ -0,0 +1,173 @@
+/* A cache of classification results by exact key, in front of classifiers
+ * that take much longer than a hash lookup (WildcardMatch, ACL), for traffic
+ * where most packets belong to a few flows.
+ *
+ * Keys are hash keys (see hash_key.h) of the fields that the classifier looks
+ * at. If the classifier masks off the bits that none of its rules look at,
+ * an entry covers all the flows that only differ in those ("megaflow").
+ *
+ * Entries are tagged with the generation of the rules they were classified
+ * with, and only hit for that generation: bumping the generation whenever
+ * the rules change invalidates all of them at once.
+ *
+ * The cache is 4-way set associative, and the entries of a full set are
+ * evicted in turn. Not thread-safe: workers should have one each. */
+
+#ifndef BESS_UTILS_FLOW_CACHE_H_
+#define BESS_UTILS_FLOW_CACHE_H_
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "../mem_alloc.h"
+#include "hash_key.h"
+
+namespace bess {
+namespace utils {
+
+template <typename V>
+class FlowCache {
+ public:
+  // As many as the bits of the hit mask of FindBulk()
+  static const int kMaxBulk = 64;
+
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;  // of entries of the current generation
+  };
+
+  // Caches the results of keys of key_size bytes (a multiple of 8), in
+  // num_entries entries (rounded up to a power of 2, at least a set)
+  FlowCache(size_t key_size, size_t num_entries)
+      : key_size_(key_size),
+        entry_size_(sizeof(Entry) + key_size),
+        set_mask_(),
+        next_victim_(),
+        entries_(),
+        stats_() {
+    CHECK_EQ(key_size % 8, 0);
+    CHECK_LE(key_size, kMaxHashKeySize);
+
+    size_t num_sets = 1;
+    while (num_sets * kWays < num_entries) {
+      num_sets *= 2;
+    }
+    set_mask_ = num_sets - 1;
+
+    // Generation 0 is never valid, so all entries start empty
+    entries_.resize(num_sets * kWays * entry_size_ / sizeof(uint64_t));
+  }
+
+  size_t key_size() const { return key_size_; }
+
+  const Stats &stats() const { return stats_; }
+
+  // Looks up n keys (n <= kMaxBulk) for rules of the given (nonzero)
+  // generation. Sets values[i] if keys[i] is found, and returns the mask of
+  // those that are. hashes[i] is set to the hash of keys[i], for Insert().
+  uint64_t FindBulk(const void *const *keys, int n, uint64_t generation,
+                    uint32_t *hashes, V *values) {
+    uint64_t hits = 0;
+
+    DCHECK_LE(n, kMaxBulk);
+
+    for (int i = 0; i < n; i++) {
+      hashes[i] = HashKeyHash(keys[i], key_size_, kHashInitval);
+      char *set = set_of(hashes[i]);
+      __builtin_prefetch(set);
+      __builtin_prefetch(set + kWays * entry_size_ - 1);
+    }
+
+    for (int i = 0; i < n; i++) {
+      const Entry *entry = Find(keys[i], hashes[i], generation);
+      if (entry) {
+        values[i] = entry->value;
+        hits |= 1ULL << i;
+      }
+    }
+
+    int num_hits = __builtin_popcountll(hits);
+    stats_.hits += num_hits;
+    stats_.misses += n - num_hits;
+    return hits;
+  }
+
+  // Caches the value of the key, with its hash from FindBulk()
+  void Insert(const void *key, uint32_t hash, uint64_t generation,
+              const V &value) {
+    DCHECK_NE(generation, 0);
+
+    // Another packet of the flow may have inserted it already
+    Entry *victim = Find(key, hash, generation);
+
+    for (int w = 0; !victim && w < kWays; w++) {
+      Entry *entry = entry_of(set_of(hash), w);
+      if (entry->generation != generation) {
+        victim = entry;  // Empty or stale
+      }
+    }
+
+    if (!victim) {
+      victim = entry_of(set_of(hash), next_victim_++ % kWays);
+      stats_.evictions++;
+    }
+
+    victim->generation = generation;
+    victim->hash = hash;
+    victim->value = value;
+    memcpy(victim + 1, key, key_size_);
+  }
+
+ private:
+  static const int kWays = 4;
+  static const uint32_t kHashInitval = UINT32_MAX;
+
+  // Followed by key_size_ bytes of key
+  struct alignas(8) Entry {
+    uint64_t generation;
+    uint32_t hash;
+    V value;
+  };
+
+  char *set_of(uint32_t hash) {
+    return reinterpret_cast<char *>(entries_.data()) +
+           (hash & set_mask_) * kWays * entry_size_;
+  }
+
+  Entry *entry_of(char *set, int way) {
+    return reinterpret_cast<Entry *>(set + way * entry_size_);
+  }
+
+  Entry *Find(const void *key, uint32_t hash, uint64_t generation) {
+    char *set = set_of(hash);
+
+    for (int w = 0; w < kWays; w++) {
+      Entry *entry = entry_of(set, w);
+      if (entry->hash == hash && entry->generation == generation &&
+          HashKeyCmp(key, entry + 1, key_size_) == 0) {
+        return entry;
+      }
+    }
+    return nullptr;
+  }
+
+  const size_t key_size_;
+  const size_t entry_size_;
+  size_t set_mask_;
+  uint32_t next_victim_;
+
+  std::vector<uint64_t, bess::memory::Allocator<uint64_t>> entries_;
+  Stats stats_;
+};
+
+template <typename V>
+const int FlowCache<V>::kMaxBulk;
+
+}  // namespace utils
+}  // namespace bess
+
+#endif  // BESS_UTILS_FLOW_CACHE_H_
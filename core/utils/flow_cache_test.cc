@@ -0,0 +1,132 @@
+#include "flow_cache.h"
+
+#include <gtest/gtest.h>
+
+#include <array>
+
+using bess::utils::FlowCache;
+
+namespace {
+
+const size_t kKeySize = sizeof(uint64_t) * 2;
+
+// Keys are kKeySize bytes long, in zeroed buffers of the maximum key size.
+// HashKeyHash() and HashKeyCmp() are inlined with a key size the compiler
+// cannot see, and it would warn about their wide paths on a 16-byte object.
+typedef std::array<uint64_t, bess::utils::kMaxHashKeySize / sizeof(uint64_t)>
+    Key;
+
+Key MakeKey(uint64_t a, uint64_t b) {
+  Key key = {};
+  key[0] = a;
+  key[1] = b;
+  return key;
+}
+
+// Looks up a single key, and inserts it with the value v if not found.
+// Returns whether it was found.
+bool FindOrInsert(FlowCache<int> *cache, const Key &key, uint64_t generation,
+                  int v, int *found) {
+  const void *keys[] = {key.data()};
+  uint32_t hash;
+
+  if (cache->FindBulk(keys, 1, generation, &hash, found)) {
+    return true;
+  }
+  cache->Insert(key.data(), hash, generation, v);
+  return false;
+}
+
+TEST(FlowCacheTest, FindInsert) {
+  FlowCache<int> cache(kKeySize, 1024);
+  int v = 0;
+
+  for (uint64_t i = 0; i < 100; i++) {
+    EXPECT_FALSE(FindOrInsert(&cache, MakeKey(i, i * 2), 1, i * 10, &v));
+  }
+  for (uint64_t i = 0; i < 100; i++) {
+    ASSERT_TRUE(FindOrInsert(&cache, MakeKey(i, i * 2), 1, -1, &v));
+    EXPECT_EQ(i * 10, v);
+  }
+  EXPECT_FALSE(FindOrInsert(&cache, MakeKey(0, 1), 1, 0, &v));
+
+  EXPECT_EQ(100, cache.stats().hits);
+  EXPECT_EQ(101, cache.stats().misses);
+}
+
+// A new generation invalidates all entries
+TEST(FlowCacheTest, Generation) {
+  FlowCache<int> cache(kKeySize, 1024);
+  int v = 0;
+
+  for (uint64_t i = 0; i < 100; i++) {
+    FindOrInsert(&cache, MakeKey(i, 0), 1, 1, &v);
+  }
+  for (uint64_t i = 0; i < 100; i++) {
+    EXPECT_FALSE(FindOrInsert(&cache, MakeKey(i, 0), 2, 2, &v));
+  }
+  for (uint64_t i = 0; i < 100; i++) {
+    ASSERT_TRUE(FindOrInsert(&cache, MakeKey(i, 0), 2, 3, &v));
+    EXPECT_EQ(2, v);
+  }
+
+  // Stale entries are replaced without counting as evictions
+  EXPECT_EQ(0, cache.stats().evictions);
+}
+
+// A set holds 4 entries, and a full one evicts them in turn
+TEST(FlowCacheTest, Evict) {
+  FlowCache<int> cache(kKeySize, 4);
+  int v = 0;
+
+  for (uint64_t i = 0; i < 4; i++) {
+    FindOrInsert(&cache, MakeKey(i, 0), 1, i, &v);
+  }
+  for (uint64_t i = 0; i < 4; i++) {
+    EXPECT_TRUE(FindOrInsert(&cache, MakeKey(i, 0), 1, i, &v));
+  }
+  EXPECT_EQ(0, cache.stats().evictions);
+
+  // Reinserting a cached key does not take a new entry
+  const Key key = MakeKey(0, 0);
+  const void *keys[] = {key.data()};
+  uint32_t hash;
+  cache.FindBulk(keys, 1, 1, &hash, &v);
+  cache.Insert(key.data(), hash, 1, 100);
+  EXPECT_EQ(0, cache.stats().evictions);
+
+  for (uint64_t i = 4; i < 8; i++) {
+    EXPECT_FALSE(FindOrInsert(&cache, MakeKey(i, 0), 1, i, &v));
+  }
+  EXPECT_EQ(4, cache.stats().evictions);
+  for (uint64_t i = 0; i < 4; i++) {
+    EXPECT_FALSE(FindOrInsert(&cache, MakeKey(i, 0), 1, i, &v));
+  }
+}
+
+TEST(FlowCacheTest, FindBulk) {
+  FlowCache<int> cache(kKeySize, 1 << 16);
+  const int n = FlowCache<int>::kMaxBulk;
+  Key keys[n];
+  const void *key_ptrs[n];
+  uint32_t hashes[n];
+  int values[n];
+
+  for (int i = 0; i < n; i++) {
+    keys[i] = MakeKey(i, 42);
+    key_ptrs[i] = keys[i].data();
+  }
+
+  EXPECT_EQ(0, cache.FindBulk(key_ptrs, n, 1, hashes, values));
+  for (int i = 0; i < n; i += 2) {
+    cache.Insert(keys[i].data(), hashes[i], 1, i);
+  }
+
+  uint64_t hits = cache.FindBulk(key_ptrs, n, 1, hashes, values);
+  EXPECT_EQ(0x5555555555555555ULL, hits);
+  for (int i = 0; i < n; i += 2) {
+    EXPECT_EQ(i, values[i]);
+  }
+}
+
+}  // namespace (unnamed)
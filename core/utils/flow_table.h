@@ -0,0 +1,436 @@
+/* A table of flows (e.g., connections) that expire, for stateful modules.
+ *
+ * A flow has a fixed number of keys (e.g., the 5-tuples of both directions,
+ * for a NAT), all of which find it, and a time at which it expires. Records
+ * are preallocated with Reserve(), and keys are indexed with a CuckooMap.
+ *
+ * Expiry is driven by a hierarchical timing wheel (4 levels of 256 slots), so
+ * that the table is never scanned. Expire() is meant to be called once per
+ * batch with a bound on the work it may do, which amortizes expiry to O(1) per
+ * packet. Extending the expiry time of a flow, e.g., for every packet, only
+ * updates the record: the wheel reschedules the flow once it reaches the old
+ * expiry time.
+ *
+ * Pointers to records stay valid until the flow is removed (or expires), or
+ * Reserve() is called. Not thread-safe.
+ */
+
+#ifndef BESS_UTILS_FLOW_TABLE_H_
+#define BESS_UTILS_FLOW_TABLE_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "../mem_alloc.h"
+#include "cuckoo_map.h"
+
+namespace bess {
+namespace utils {
+
+template <typename K, typename V, int Keys = 1,
+          HashFunc<K> H = DefaultHashFunc, EqFunc<K> E = DefaultEqFunc>
+class FlowTable {
+ public:
+  class Record {
+   public:
+    // Default-constructed when the flow is inserted
+    V value;
+
+    const K &key(int i) const { return keys_[i]; }
+    uint64_t expiry() const { return expiry_; }
+
+   private:
+    friend class FlowTable;
+
+    K keys_[Keys];
+    uint64_t expiry_;
+  };
+
+  static const uint64_t kDefaultTickNs = 1000000;  // 1ms
+
+  // Expiry times are rounded up to a multiple of tick_ns
+  explicit FlowTable(uint64_t tick_ns = kDefaultTickNs)
+      : tick_ns_(tick_ns),
+        tick_(0),
+        count_(0),
+        bitmaps_(),
+        map_(),
+        records_(),
+        links_(kNumSentinels),
+        free_() {
+    for (uint32_t i = 0; i < kNumSentinels; i++) {
+      links_[i].prev = links_[i].next = i;
+    }
+  }
+
+  FlowTable(FlowTable &) = delete;
+  FlowTable &operator=(FlowTable &) = delete;
+
+  // Number of flows
+  size_t Count() const { return count_; }
+
+  // Number of flows that fit without Reserve()
+  size_t Capacity() const { return records_.size(); }
+
+  // Grows the table to hold up to capacity flows
+  void Reserve(size_t capacity) {
+    size_t old_capacity = records_.size();
+
+    if (capacity <= old_capacity) {
+      return;
+    }
+
+    CHECK_LE(capacity, std::numeric_limits<uint32_t>::max() - kNumSentinels);
+    records_.resize(capacity);
+    links_.resize(kNumSentinels + capacity);
+
+    for (size_t i = capacity; i-- > old_capacity;) {
+      free_.push_back(i);
+    }
+
+    map_.Reserve(capacity * Keys);
+  }
+
+  // Returns the flow with the key, or nullptr if none. The flow may have
+  // expired already, if Expire() has not caught up with it yet.
+  Record *Find(const K &key) {
+    auto *entry = map_.Find(key);
+    return entry ? &records_[entry->second] : nullptr;
+  }
+
+  // Same as Find(), for n keys at once. The memory accesses of all keys are
+  // overlapped. Returns the number of keys found.
+  int FindBulk(const K *keys, int n, Record **records) {
+    typename map_t::Entry *entries[map_t::kMaxBulk];
+    int hits = 0;
+
+    for (int i = 0; i < n; i += map_t::kMaxBulk) {
+      int cnt = std::min(n - i, map_t::kMaxBulk);
+
+      hits += map_.FindBulk(keys + i, cnt, entries);
+
+      for (int j = 0; j < cnt; j++) {
+        if (entries[j]) {
+          records[i + j] = &records_[entries[j]->second];
+          __builtin_prefetch(records[i + j]);
+        } else {
+          records[i + j] = nullptr;
+        }
+      }
+    }
+
+    return hits;
+  }
+
+  // Adds a flow with the keys (Keys of them), which expires at expiry (in the
+  // same unit as now, nanoseconds). Returns nullptr if the table is full, or
+  // any of the keys is taken.
+  Record *Insert(const K *keys, uint64_t now, uint64_t expiry) {
+    if (free_.empty()) {
+      return nullptr;
+    }
+
+    for (int i = 0; i < Keys; i++) {
+      if (map_.Find(keys[i])) {
+        return nullptr;
+      }
+      for (int j = 0; j < i; j++) {
+        if (E(keys[i], keys[j])) {
+          return nullptr;
+        }
+      }
+    }
+
+    // The wheel does not move while empty
+    if (count_ == 0) {
+      tick_ = std::max(tick_, now / tick_ns_);
+    }
+
+    uint32_t idx = free_.back();
+    free_.pop_back();
+
+    Record &record = records_[idx];
+    for (int i = 0; i < Keys; i++) {
+      record.keys_[i] = keys[i];
+      map_.Insert(keys[i], idx);
+    }
+    record.expiry_ = expiry;
+
+    Schedule(kNumSentinels + idx);
+    count_++;
+    return &record;
+  }
+
+  // Changes when the flow expires. Cheaper if the time is not moved earlier.
+  void SetExpiry(Record *record, uint64_t expiry) {
+    bool earlier = expiry < record->expiry_;
+
+    record->expiry_ = expiry;
+    if (earlier) {
+      uint32_t node = NodeOf(record);
+      Unlink(node);
+      Schedule(node);
+    }
+  }
+
+  void Remove(Record *record) {
+    uint32_t node = NodeOf(record);
+
+    Unlink(node);
+    Release(node);
+  }
+
+  // Removes all flows
+  void Clear() {
+    for (uint32_t s = 0; s < kNumSentinels; s++) {
+      while (links_[s].next != s) {
+        uint32_t node = links_[s].next;
+        Unlink(node);
+        Release(node);
+      }
+    }
+  }
+
+  // Removes flows that expired by now, calling fn(Record *) for each before
+  // it is removed. At most budget flows are processed, expired or
+  // rescheduled, and the wheel is advanced by at most budget steps, so the
+  // rest is left to later calls. Returns the number of expired flows.
+  template <typename F>
+  int Expire(uint64_t now, int budget, F fn) {
+    uint64_t target = now / tick_ns_;
+    int expired = 0;
+
+    if (count_ == 0) {
+      tick_ = std::max(tick_, target);
+      return 0;
+    }
+
+    while (budget-- > 0) {
+      uint32_t node = links_[kDue].next;
+
+      if (node == kDue) {
+        if (!Advance(target)) {
+          break;
+        }
+        continue;
+      }
+
+      Unlink(node);
+
+      Record &record = records_[node - kNumSentinels];
+      if (TickOf(record.expiry_) > tick_) {
+        Schedule(node);  // extended since scheduled
+        continue;
+      }
+
+      fn(&record);
+      Release(node);
+      expired++;
+    }
+
+    return expired;
+  }
+
+ private:
+  typedef CuckooMap<K, uint32_t, H, E> map_t;
+
+  static const int kLevelBits = 8;
+  static const int kSlots = 1 << kLevelBits;
+  static const int kLevels = 4;
+
+  // Nodes of the circular lists: a sentinel per slot, then a sentinel of the
+  // list of flows that are due (to be checked by Expire()), then the records
+  static const uint32_t kDue = kLevels * kSlots;
+  static const uint32_t kNumSentinels = kDue + 1;
+
+  struct Link {
+    uint32_t prev;
+    uint32_t next;
+  };
+
+  uint32_t NodeOf(const Record *record) const {
+    return kNumSentinels + (record - records_.data());
+  }
+
+  uint64_t TickOf(uint64_t time) const {
+    return time / tick_ns_ + (time % tick_ns_ != 0);
+  }
+
+  void LinkTail(uint32_t head, uint32_t node) {
+    uint32_t tail = links_[head].prev;
+
+    links_[node].prev = tail;
+    links_[node].next = head;
+    links_[tail].next = node;
+    links_[head].prev = node;
+  }
+
+  void Unlink(uint32_t node) {
+    uint32_t prev = links_[node].prev;
+    uint32_t next = links_[node].next;
+
+    links_[prev].next = next;
+    links_[next].prev = prev;
+
+    // The slot became empty?
+    if (prev == next && prev < kDue) {
+      bitmaps_[prev / kSlots][prev % kSlots / 64] &= ~(1ULL << (prev % 64));
+    }
+  }
+
+  // Puts the node in the slot of the lowest level that covers its expiry
+  // time, or in the due list if it is past
+  void Schedule(uint32_t node) {
+    uint64_t tick = TickOf(records_[node - kNumSentinels].expiry_);
+
+    if (tick <= tick_) {
+      LinkTail(kDue, node);
+      return;
+    }
+
+    for (int level = 0; level < kLevels; level++) {
+      uint64_t block = tick >> (level * kLevelBits);
+      uint64_t cur = tick_ >> (level * kLevelBits);
+
+      if (block - cur < kSlots || level == kLevels - 1) {
+        // Beyond the range of the wheel, it is rescheduled when it comes back
+        block = std::min(block, cur + kSlots - 1);
+
+        int slot = block % kSlots;
+        LinkTail(level * kSlots + slot, node);
+        bitmaps_[level][slot / 64] |= 1ULL << (slot % 64);
+        return;
+      }
+    }
+  }
+
+  // Returns the number of slots from cur to the next non-empty slot of the
+  // level (cyclic, 1 to kSlots), or 0 if all are empty
+  int NextSlot(int level, int cur) const {
+    const uint64_t *bitmap = bitmaps_[level];
+    int from = (cur + 1) % kSlots;
+
+    for (int i = 0; i <= kSlots / 64; i++) {
+      int w = (from / 64 + i) % (kSlots / 64);
+      uint64_t bits = bitmap[w];
+
+      if (i == 0) {
+        bits &= ~0ULL << (from % 64);
+      } else if (i == kSlots / 64) {
+        bits &= (1ULL << (from % 64)) - 1;
+      }
+
+      if (bits) {
+        int slot = w * 64 + __builtin_ctzll(bits);
+        return (slot - cur + kSlots - 1) % kSlots + 1;
+      }
+    }
+
+    return 0;
+  }
+
+  // Moves the wheel to the next tick at which any slot is due, unless it is
+  // after target, and moves the flows of those slots to the due list.
+  // Returns false if there is no such tick.
+  bool Advance(uint64_t target) {
+    uint64_t next = std::numeric_limits<uint64_t>::max();
+
+    // A slot of a level is due when the tick reaches the start of its span
+    for (int level = 0; level < kLevels; level++) {
+      int shift = level * kLevelBits;
+      uint64_t cur = tick_ >> shift;
+      int d = NextSlot(level, cur % kSlots);
+
+      if (d) {
+        next = std::min(next, (cur + d) << shift);
+      }
+    }
+
+    if (next > target) {
+      tick_ = std::max(tick_, target);
+      return false;
+    }
+
+    tick_ = next;
+
+    for (int level = 0; level < kLevels; level++) {
+      int shift = level * kLevelBits;
+
+      if (level > 0 && (tick_ & ((1ULL << shift) - 1))) {
+        break;
+      }
+
+      int slot = (tick_ >> shift) % kSlots;
+      SpliceToDue(level * kSlots + slot);
+      bitmaps_[level][slot / 64] &= ~(1ULL << (slot % 64));
+    }
+
+    return true;
+  }
+
+  // Moves all nodes of the slot to the end of the due list
+  void SpliceToDue(uint32_t head) {
+    uint32_t first = links_[head].next;
+    uint32_t last = links_[head].prev;
+
+    if (first == head) {
+      return;
+    }
+
+    uint32_t tail = links_[kDue].prev;
+    links_[tail].next = first;
+    links_[first].prev = tail;
+    links_[last].next = kDue;
+    links_[kDue].prev = last;
+
+    links_[head].prev = links_[head].next = head;
+  }
+
+  // Frees the record of an unlinked node
+  void Release(uint32_t node) {
+    uint32_t idx = node - kNumSentinels;
+    Record &record = records_[idx];
+
+    for (int i = 0; i < Keys; i++) {
+      map_.Remove(record.keys_[i]);
+    }
+    record.value = V();
+
+    free_.push_back(idx);
+    count_--;
+  }
+
+  const uint64_t tick_ns_;
+
+  // The wheel has processed all slots due by this tick
+  uint64_t tick_;
+
+  size_t count_;
+
+  // Non-empty slots of each level
+  uint64_t bitmaps_[kLevels][kSlots / 64];
+
+  map_t map_;
+
+  std::vector<Record, bess::memory::Allocator<Record>> records_;
+  std::vector<Link, bess::memory::Allocator<Link>> links_;
+  std::vector<uint32_t, bess::memory::Allocator<uint32_t>> free_;
+};
+
+template <typename K, typename V, int Keys, HashFunc<K> H, EqFunc<K> E>
+const uint64_t FlowTable<K, V, Keys, H, E>::kDefaultTickNs;
+
+template <typename K, typename V, int Keys, HashFunc<K> H, EqFunc<K> E>
+const uint32_t FlowTable<K, V, Keys, H, E>::kDue;
+
+template <typename K, typename V, int Keys, HashFunc<K> H, EqFunc<K> E>
+const uint32_t FlowTable<K, V, Keys, H, E>::kNumSentinels;
+
+}  // namespace utils
+}  // namespace bess
+
+#endif  // BESS_UTILS_FLOW_TABLE_H_
@@ -0,0 +1,144 @@
+// Benchmarks for FlowTable, up to 10M concurrent flows.
+
+#include "flow_table.h"
+
+#include <x86intrin.h>
+
+#include <memory>
+
+#include <benchmark/benchmark.h>
+#include <glog/logging.h>
+
+#include "random.h"
+
+using bess::utils::FlowTable;
+
+namespace {
+
+// A 5-tuple (IPv4)
+struct alignas(16) FlowKey {
+  uint64_t e1;
+  uint64_t e2;
+
+  bool operator==(const FlowKey &o) const { return e1 == o.e1 && e2 == o.e2; }
+};
+
+size_t flow_key_hash(const FlowKey &key, size_t init_val) {
+  init_val = _mm_crc32_u64(init_val, key.e1);
+  return _mm_crc32_u64(init_val, key.e2);
+}
+
+bool flow_key_eq(const FlowKey &lhs, const FlowKey &rhs) {
+  return lhs == rhs;
+}
+
+typedef FlowTable<FlowKey, uint64_t, 1, flow_key_hash, flow_key_eq> table_t;
+
+FlowKey make_key(uint64_t i) {
+  return {0x0a000000c0a80000ULL + i, (i * 0x9e3779b97f4a7c15ULL) | 6};
+}
+
+const uint64_t kTimeoutNs = 30ULL * 1000 * 1000 * 1000;
+
+// The table is kept across runs of a benchmark, as building it takes long
+std::unique_ptr<table_t> table;
+uint64_t num_keys;  // make_key(0) ... make_key(num_keys - 1) were inserted
+uint64_t now;
+
+// Fills the table with n flows, inserted one per (timeout / n), as if they
+// arrived at a steady rate and the oldest ones are about to expire
+void build_table(uint64_t n) {
+  if (table && table->Count() == n) {
+    return;
+  }
+
+  table.reset(new table_t());
+  table->Reserve(n + n / 8);
+
+  uint64_t interval = kTimeoutNs / n;
+  now = kTimeoutNs;
+
+  for (num_keys = 0; num_keys < n; num_keys++) {
+    FlowKey key = make_key(num_keys);
+    uint64_t start = num_keys * interval;
+    CHECK(table->Insert(&key, start, start + kTimeoutNs));
+  }
+}
+
+class FlowTableFixture : public benchmark::Fixture {
+ public:
+  virtual void SetUp(benchmark::State &state) { build_table(state.range(0)); }
+};
+
+}  // namespace (unnamed)
+
+// Finds a random flow and extends its expiry time, per packet
+BENCHMARK_DEFINE_F(FlowTableFixture, Lookup)(benchmark::State &state) {
+  Random rng(0);
+  uint64_t n = state.range(0);
+
+  while (state.KeepRunning()) {
+    FlowKey key = make_key(num_keys - 1 - rng.GetRange(n));
+    table_t::Record *record = table->Find(key);
+    DCHECK(record);
+    table->SetExpiry(record, now + kTimeoutNs);
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Same as above, 32 packets at a time
+BENCHMARK_DEFINE_F(FlowTableFixture, LookupBulk)(benchmark::State &state) {
+  const int kBatch = 32;
+  Random rng(0);
+  uint64_t n = state.range(0);
+  FlowKey keys[kBatch];
+  table_t::Record *records[kBatch];
+
+  while (state.KeepRunning()) {
+    for (int i = 0; i < kBatch; i++) {
+      keys[i] = make_key(num_keys - 1 - rng.GetRange(n));
+    }
+
+    table->FindBulk(keys, kBatch, records);
+
+    for (int i = 0; i < kBatch; i++) {
+      DCHECK(records[i]);
+      table->SetExpiry(records[i], now + kTimeoutNs);
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * kBatch);
+}
+
+// A new flow per packet, and the oldest one expires (with a bounded amount of
+// expiry work per packet, as modules do per batch)
+BENCHMARK_DEFINE_F(FlowTableFixture, Churn)(benchmark::State &state) {
+  uint64_t interval = kTimeoutNs / state.range(0);
+  uint64_t expired = 0;
+
+  while (state.KeepRunning()) {
+    now += interval;
+    expired += table->Expire(now, 4, [](table_t::Record *) {});
+
+    FlowKey key = make_key(num_keys++);
+    CHECK(table->Insert(&key, now, now + kTimeoutNs));
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  state.counters["expired"] = expired;
+}
+
+BENCHMARK_REGISTER_F(FlowTableFixture, Lookup)
+    ->Arg(1 << 20)
+    ->Arg(10000000);
+
+BENCHMARK_REGISTER_F(FlowTableFixture, LookupBulk)
+    ->Arg(1 << 20)
+    ->Arg(10000000);
+
+BENCHMARK_REGISTER_F(FlowTableFixture, Churn)
+    ->Arg(1 << 20)
+    ->Arg(10000000);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,192 @@
+#include "flow_table.h"
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "random.h"
+
+using bess::utils::FlowTable;
+
+namespace {
+
+const uint64_t kTick = 1000;
+
+typedef FlowTable<uint32_t, uint64_t> table_t;
+typedef FlowTable<uint32_t, uint64_t, 2> table2_t;
+
+template <typename T>
+std::vector<uint32_t> expire_all(T *t, uint64_t now) {
+  std::vector<uint32_t> expired;
+
+  t->Expire(now, 1 << 30, [&expired](typename T::Record *r) {
+    expired.push_back(r->key(0));
+  });
+  return expired;
+}
+
+TEST(FlowTableTest, InsertFindRemove) {
+  table_t t(kTick);
+  t.Reserve(4);
+
+  uint32_t keys[] = {1, 2, 3, 4, 5};
+
+  for (int i = 0; i < 4; i++) {
+    auto *r = t.Insert(&keys[i], 0, 1000000);
+    ASSERT_NE(nullptr, r);
+    r->value = keys[i] * 10;
+  }
+
+  // Full, or the key is taken
+  EXPECT_EQ(nullptr, t.Insert(&keys[4], 0, 1000000));
+  EXPECT_EQ(4, t.Count());
+
+  t.Remove(t.Find(2));
+  EXPECT_EQ(nullptr, t.Insert(&keys[0], 0, 1000000));
+  ASSERT_NE(nullptr, t.Insert(&keys[4], 0, 1000000));
+
+  EXPECT_EQ(nullptr, t.Find(2));
+  ASSERT_NE(nullptr, t.Find(3));
+  EXPECT_EQ(30, t.Find(3)->value);
+
+  // Values are reset for new flows
+  EXPECT_EQ(0, t.Find(5)->value);
+
+  t.Clear();
+  EXPECT_EQ(0, t.Count());
+  EXPECT_EQ(nullptr, t.Find(1));
+}
+
+TEST(FlowTableTest, TwoKeys) {
+  table2_t t(kTick);
+  t.Reserve(16);
+
+  uint32_t keys[] = {1, 2};
+  uint32_t dup_keys[] = {3, 3};
+  uint32_t taken_keys[] = {4, 2};
+
+  auto *r = t.Insert(keys, 0, 1000000);
+  ASSERT_NE(nullptr, r);
+  EXPECT_EQ(r, t.Find(1));
+  EXPECT_EQ(r, t.Find(2));
+  EXPECT_EQ(nullptr, t.Insert(dup_keys, 0, 1000000));
+  EXPECT_EQ(nullptr, t.Insert(taken_keys, 0, 1000000));
+  EXPECT_EQ(nullptr, t.Find(4));
+
+  EXPECT_EQ(std::vector<uint32_t>{1}, expire_all(&t, 1000000));
+  EXPECT_EQ(nullptr, t.Find(1));
+  EXPECT_EQ(nullptr, t.Find(2));
+}
+
+// Flows expire once (and only once) their time has come, whichever level of
+// the wheel they are in, including after the wheel skips long idle periods.
+TEST(FlowTableTest, Expire) {
+  table_t t(kTick);
+  t.Reserve(1000);
+
+  Random rng;
+  rng.SetSeed(0);
+
+  const uint64_t start = 123456789;
+  std::multimap<uint64_t, uint32_t> expiry;
+
+  for (uint32_t i = 0; i < 1000; i++) {
+    // Up to 2^30 ticks, across all levels
+    uint64_t delay =
+        rng.GetRange(1u << (i % 31)) * kTick + rng.GetRange(kTick);
+    ASSERT_NE(nullptr, t.Insert(&i, start, start + delay));
+
+    // Rounded up to a tick
+    expiry.emplace((start + delay + kTick - 1) / kTick * kTick, i);
+  }
+
+  uint64_t now = start;
+  while (!expiry.empty()) {
+    std::set<uint32_t> expected;
+    for (auto it = expiry.begin(); it != expiry.end() && it->first <= now;) {
+      expected.insert(it->second);
+      it = expiry.erase(it);
+    }
+
+    std::vector<uint32_t> expired = expire_all(&t, now);
+    EXPECT_EQ(expected, std::set<uint32_t>(expired.begin(), expired.end()))
+        << now;
+    EXPECT_EQ(expired.size(), expected.size());
+
+    if (!expiry.empty()) {
+      uint64_t next = expiry.begin()->first;
+      // Sometimes right at the next expiry, sometimes a bit before or past it
+      now = std::max(now + 1, next + rng.GetRange(3 * kTick) - kTick);
+    }
+  }
+
+  EXPECT_EQ(0, t.Count());
+}
+
+// Extending the expiry time (lazily rescheduled) and moving it earlier
+TEST(FlowTableTest, SetExpiry) {
+  table_t t(kTick);
+  t.Reserve(16);
+
+  uint32_t keys[] = {1, 2, 3};
+  auto *r1 = t.Insert(&keys[0], 0, 10 * kTick);
+  auto *r2 = t.Insert(&keys[1], 0, 10 * kTick);
+  auto *r3 = t.Insert(&keys[2], 0, 100000 * kTick);
+
+  t.SetExpiry(r1, 20 * kTick);
+  t.SetExpiry(r1, 30000 * kTick);
+  t.SetExpiry(r3, 5 * kTick);
+  (void)r2;
+
+  EXPECT_EQ(std::vector<uint32_t>{3}, expire_all(&t, 5 * kTick));
+  EXPECT_EQ(std::vector<uint32_t>{2}, expire_all(&t, 10 * kTick));
+  EXPECT_TRUE(expire_all(&t, 30000 * kTick - 1).empty());
+  EXPECT_EQ(std::vector<uint32_t>{1}, expire_all(&t, 30000 * kTick));
+}
+
+// Expire() does no more than it is allowed to, and catches up later
+TEST(FlowTableTest, Budget) {
+  table_t t(kTick);
+  t.Reserve(1000);
+
+  for (uint32_t i = 0; i < 1000; i++) {
+    ASSERT_NE(nullptr, t.Insert(&i, 0, (i % 10 + 1) * kTick));
+  }
+
+  int total = 0;
+  int calls = 0;
+  while (t.Count()) {
+    int n = t.Expire(100 * kTick, 32, [](table_t::Record *) {});
+    EXPECT_LE(n, 32);
+    total += n;
+    calls++;
+  }
+
+  EXPECT_EQ(1000, total);
+  EXPECT_LE(calls, 1000 / 32 + 11);
+}
+
+TEST(FlowTableTest, FindBulk) {
+  table_t t(kTick);
+  t.Reserve(1000);
+
+  for (uint32_t i = 0; i < 1000; i += 2) {
+    ASSERT_NE(nullptr, t.Insert(&i, 0, kTick));
+  }
+
+  uint32_t keys[1000];
+  table_t::Record *records[1000];
+
+  for (uint32_t i = 0; i < 1000; i++) {
+    keys[i] = i;
+  }
+
+  EXPECT_EQ(500, t.FindBulk(keys, 1000, records));
+  for (uint32_t i = 0; i < 1000; i++) {
+    EXPECT_EQ(t.Find(i), records[i]);
+  }
+}
+
+}  // namespace (unnamed)
@@ -0,0 +1,158 @@
+// Comparison, hashing, and masking of the multi-field keys used by classifier
+// hash tables (ExactMatch, WildcardMatch). A key is a multiple of 8 bytes long,
+// up to kMaxHashKeySize bytes, so that IPv6 5-tuples can be matched along with
+// VLAN and tunnel IDs. The functions are compatible with HTable's KeyCmpFunc
+// and HashFunc, and never touch memory beyond key_len.
+
+#ifndef BESS_UTILS_HASH_KEY_H_
+#define BESS_UTILS_HASH_KEY_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include <x86intrin.h>
+
+#if !(__SSE4_2__ && __x86_64)
+#include <rte_config.h>
+#include <rte_hash_crc.h>
+#endif
+
+namespace bess {
+namespace utils {
+
+static const size_t kMaxHashKeySize = 128;
+
+static const uint64_t kHashKeyMul = 0x9e3779b97f4a7c15ull;  // golden ratio
+
+#if __AVX2__
+// Loads the first len bytes at p (len < 32, a multiple of 8). The rest of the
+// 32 bytes is neither read nor faulted on, and comes back as zeros.
+inline __m256i HashKeyLoadTail(const void *p, size_t len) {
+  __m256i mask = _mm256_cmpgt_epi64(_mm256_set1_epi64x(len >> 3),
+                                    _mm256_setr_epi64x(0, 1, 2, 3));
+  return _mm256_maskload_epi64(static_cast<const long long *>(p), mask);
+}
+#endif
+
+// Returns 0 if the keys are identical
+inline int HashKeyCmp(const void *key, const void *key_stored,
+                      size_t key_len) {
+#if __AVX2__
+  const char *a = static_cast<const char *>(key);
+  const char *b = static_cast<const char *>(key_stored);
+  __m256i diff = _mm256_setzero_si256();
+  size_t i = 0;
+
+  // No early exit: a mismatch is rare, and a branch per 32 bytes costs more
+  for (; i + 32 <= key_len; i += 32) {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+    __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+    diff = _mm256_or_si256(diff, _mm256_xor_si256(x, y));
+  }
+
+  if (i < key_len) {
+    __m256i x = HashKeyLoadTail(a + i, key_len - i);
+    __m256i y = HashKeyLoadTail(b + i, key_len - i);
+    diff = _mm256_or_si256(diff, _mm256_xor_si256(x, y));
+  }
+
+  return !_mm256_testz_si256(diff, diff);
+#else
+  const uint64_t *a = static_cast<const uint64_t *>(key);
+  const uint64_t *b = static_cast<const uint64_t *>(key_stored);
+  uint64_t diff = 0;
+
+  for (size_t i = 0; i < key_len / 8; i++) {
+    diff |= a[i] ^ b[i];
+  }
+
+  return diff != 0;
+#endif
+}
+
+inline uint32_t HashKeyHash(const void *key, uint32_t key_len,
+                            uint32_t init_val) {
+#if __SSE4_2__ && __x86_64
+  const uint64_t *a = static_cast<const uint64_t *>(key);
+  const size_t n = key_len / 8;
+  size_t i = 0;
+
+  if (n < 4) {
+    for (; i < n; i++) {
+      init_val = _mm_crc32_u64(init_val, a[i]);
+    }
+    return init_val;
+  }
+
+  // CRC32 takes 3 cycles but can start every cycle, so longer keys are hashed
+  // in four interleaved lanes. CRC is linear, so the lanes are folded with a
+  // multiplication: otherwise, a change in one lane could cancel out with the
+  // same change in another one, shifted by a different number of rounds.
+  uint64_t h0 = init_val;
+  uint64_t h1 = init_val;
+  uint64_t h2 = init_val;
+  uint64_t h3 = init_val;
+
+  for (; i + 4 <= n; i += 4) {
+    h0 = _mm_crc32_u64(h0, a[i]);
+    h1 = _mm_crc32_u64(h1, a[i + 1]);
+    h2 = _mm_crc32_u64(h2, a[i + 2]);
+    h3 = _mm_crc32_u64(h3, a[i + 3]);
+  }
+
+  if (i < n) {
+    h0 = _mm_crc32_u64(h0, a[i]);
+  }
+  if (i + 1 < n) {
+    h1 = _mm_crc32_u64(h1, a[i + 1]);
+  }
+  if (i + 2 < n) {
+    h2 = _mm_crc32_u64(h2, a[i + 2]);
+  }
+
+  uint64_t h = _mm_crc32_u64(init_val, (h0 | (h1 << 32)) * kHashKeyMul);
+  return _mm_crc32_u64(h, (h2 | (h3 << 32)) * kHashKeyMul);
+#else
+  return rte_hash_crc(key, key_len, init_val);
+#endif
+}
+
+// dst = src & mask, for key_len bytes
+inline void HashKeyMask(void *dst, const void *src, const void *mask,
+                        size_t key_len) {
+#if __AVX2__
+  char *d = static_cast<char *>(dst);
+  const char *s = static_cast<const char *>(src);
+  const char *m = static_cast<const char *>(mask);
+  size_t i = 0;
+
+  for (; i + 32 <= key_len; i += 32) {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i));
+    __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(m + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(d + i),
+                        _mm256_and_si256(x, y));
+  }
+
+  if (i < key_len) {
+    __m256i store_mask = _mm256_cmpgt_epi64(
+        _mm256_set1_epi64x((key_len - i) >> 3), _mm256_setr_epi64x(0, 1, 2, 3));
+    __m256i x = HashKeyLoadTail(s + i, key_len - i);
+    __m256i y = HashKeyLoadTail(m + i, key_len - i);
+    _mm256_maskstore_epi64(reinterpret_cast<long long *>(d + i), store_mask,
+                           _mm256_and_si256(x, y));
+  }
+#else
+  uint64_t *d = static_cast<uint64_t *>(dst);
+  const uint64_t *s = static_cast<const uint64_t *>(src);
+  const uint64_t *m = static_cast<const uint64_t *>(mask);
+
+  for (size_t i = 0; i < key_len / 8; i++) {
+    d[i] = s[i] & m[i];
+  }
+#endif
+}
+
+}  // namespace utils
+}  // namespace bess
+
+#endif  // BESS_UTILS_HASH_KEY_H_
@@ -0,0 +1,108 @@
+#include "hash_key.h"
+
+#include <cstring>
+#include <set>
+
+#include <gtest/gtest.h>
+
+#include "random.h"
+
+namespace {
+
+using bess::utils::HashKeyCmp;
+using bess::utils::HashKeyHash;
+using bess::utils::HashKeyMask;
+using bess::utils::kMaxHashKeySize;
+
+// Keys sit at the end of a page-sized buffer, so that reading past key_len
+// would be caught by ASan
+struct KeyBuf {
+  uint64_t buf[512];
+
+  uint64_t *key(size_t len) { return buf + 512 - len / 8; }
+};
+
+class HashKeyTest : public ::testing::Test {
+ protected:
+  void Fill(uint64_t *key, size_t len) {
+    for (size_t i = 0; i < len / 8; i++) {
+      key[i] = (static_cast<uint64_t>(rng_.Get()) << 32) | rng_.Get();
+    }
+  }
+
+  Random rng_;
+};
+
+TEST_F(HashKeyTest, Cmp) {
+  for (size_t len = 8; len <= kMaxHashKeySize; len += 8) {
+    KeyBuf x;
+    KeyBuf y;
+    uint64_t *a = x.key(len);
+    uint64_t *b = y.key(len);
+
+    Fill(a, len);
+    memcpy(b, a, len);
+    EXPECT_EQ(0, HashKeyCmp(a, b, len)) << len;
+
+    // Any single bit counts
+    for (size_t bit = 0; bit < len * 8; bit += 7) {
+      b[bit / 64] ^= 1ull << (bit % 64);
+      EXPECT_NE(0, HashKeyCmp(a, b, len)) << len << " " << bit;
+      b[bit / 64] ^= 1ull << (bit % 64);
+    }
+  }
+}
+
+TEST_F(HashKeyTest, Hash) {
+  for (size_t len = 8; len <= kMaxHashKeySize; len += 8) {
+    KeyBuf x;
+    uint64_t *a = x.key(len);
+    std::set<uint32_t> hashes;
+
+    Fill(a, len);
+    uint32_t h = HashKeyHash(a, len, UINT32_MAX);
+    EXPECT_EQ(h, HashKeyHash(a, len, UINT32_MAX));
+    hashes.insert(h);
+
+    // Every word counts, wherever it lands among the lanes
+    for (size_t i = 0; i < len / 8; i++) {
+      a[i]++;
+      hashes.insert(HashKeyHash(a, len, UINT32_MAX));
+      a[i]--;
+    }
+    EXPECT_EQ(len / 8 + 1, hashes.size()) << len;
+
+    // Swapping words across lanes changes the hash
+    if (len >= 16) {
+      std::swap(a[0], a[1]);
+      EXPECT_NE(h, HashKeyHash(a, len, UINT32_MAX)) << len;
+    }
+  }
+}
+
+TEST_F(HashKeyTest, Mask) {
+  for (size_t len = 8; len <= kMaxHashKeySize; len += 8) {
+    KeyBuf x;
+    KeyBuf m;
+    KeyBuf d;
+    uint64_t *src = x.key(len);
+    uint64_t *mask = m.key(len);
+    uint64_t *dst = d.key(len);
+
+    Fill(src, len);
+    Fill(mask, len);
+    for (size_t i = 0; i < 512; i++) {
+      d.buf[i] = 0x5a5a5a5a5a5a5a5aull;
+    }
+
+    HashKeyMask(dst, src, mask, len);
+    for (size_t i = 0; i < len / 8; i++) {
+      EXPECT_EQ(src[i] & mask[i], dst[i]) << len << " " << i;
+    }
+
+    // Nothing before the key is touched
+    EXPECT_EQ(0x5a5a5a5a5a5a5a5aull, dst[-1]) << len;
+  }
+}
+
+}  // namespace (unnamed)
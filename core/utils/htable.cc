@@ -8,6 +8,8 @@
 
 #include <glog/logging.h>
 
+#include "rcu.h"
+
 namespace bess {
 namespace utils {
 
@@ -71,20 +73,25 @@ uint32_t HTableBase::hash_nonzero(const void *key) const {
 }
 
 /* entry array grows much more gently (50%) than bucket array (100%),
- * since space efficiency may be important for large keys and/or values. */
+ * since space efficiency may be important for large keys and/or values.
+ * Readers may still be using the old array, so it is freed after them. */
 int HTableBase::expand_entries() {
   KeyIndex old_size = num_entries_;
   KeyIndex new_size = old_size + old_size / 2;
+  void *old_entries = entries_;
 
-  void *new_entries;
-
-  new_entries = mem_realloc(entries_, new_size * entry_size_);
+  void *new_entries =
+      bess::memory::Alloc(new_size * entry_size_, 0, -1, owner_);
   if (!new_entries) {
     return -ENOMEM;
   }
 
+  memcpy(new_entries, old_entries, old_size * entry_size_);
+  STORE_BARRIER();
+  ACCESS_ONCE(entries_) = new_entries;
   num_entries_ = new_size;
-  entries_ = new_entries;
+
+  Rcu::Defer([old_entries]() { mem_free(old_entries); });
 
   for (KeyIndex i = new_size - 1; i-- > old_size;) {
     push_free_keyidx(i);
@@ -97,23 +104,41 @@ HTableBase::KeyIndex HTableBase::get_next(KeyIndex curr) const {
   return *(KeyIndex *)keyidx_to_ptr(curr);
 }
 
+/* returns kInvalidKeyIdx if out of memory */
 HTableBase::KeyIndex HTableBase::pop_free_keyidx() {
-  KeyIndex ret = free_keyidx_;
-
-  if (ret == kInvalidKeyIdx) {
-    ret = expand_entries();
-    if (ret) {
-      return ret;
-    }
+  if (free_keyidx_ == kInvalidKeyIdx) {
+    recycle_keyidx();
+  }
 
-    ret = free_keyidx_;
+  if (free_keyidx_ == kInvalidKeyIdx && expand_entries() < 0) {
+    return kInvalidKeyIdx;
   }
 
+  KeyIndex ret = free_keyidx_;
   free_keyidx_ = get_next(ret);
 
   return ret;
 }
 
+/* Readers may still be looking at the entry of a deleted key */
+void HTableBase::retire_keyidx(KeyIndex idx) {
+  retired_keyidx_.emplace_back(Rcu::Retire(), idx);
+}
+
+void HTableBase::recycle_keyidx() {
+  if (retired_keyidx_.empty()) {
+    return;
+  }
+
+  uint64_t horizon = Rcu::Horizon();
+
+  while (!retired_keyidx_.empty() &&
+         retired_keyidx_.front().first <= horizon) {
+    push_free_keyidx(retired_keyidx_.front().second);
+    retired_keyidx_.pop_front();
+  }
+}
+
 /* returns an empty slot ID, or -ENOSPC */
 int HTableBase::find_empty_slot(const Bucket *bucket) {
   for (int i = 0; i < kEntriesPerBucket; i++) {
@@ -158,10 +183,24 @@ int HTableBase::make_space(Bucket *bucket, int depth) {
     }
 
     if (j >= 0) {
-      /* Yay, we found one. Push recursively... */
-      alt_bucket->hv[j] = bucket->hv[i];
-      alt_bucket->keyidx[j] = bucket->keyidx[i];
-      bucket->hv[i] = 0;
+      /* Yay, we found one. Push recursively...
+       * The entry is copied before it is removed, but a reader may still miss
+       * it in both buckets, so the versions tell the readers to retry. */
+      bump_version(bucket);
+      if (alt_bucket != bucket) {
+        bump_version(alt_bucket);
+      }
+
+      ACCESS_ONCE(alt_bucket->keyidx[j]) = bucket->keyidx[i];
+      STORE_BARRIER();
+      ACCESS_ONCE(alt_bucket->hv[j]) = bucket->hv[i];
+      STORE_BARRIER();
+      ACCESS_ONCE(bucket->hv[i]) = 0;
+
+      bump_version(bucket);
+      if (alt_bucket != bucket) {
+        bump_version(alt_bucket);
+      }
       return i;
     }
   }
@@ -170,43 +209,34 @@ int HTableBase::make_space(Bucket *bucket, int depth) {
 }
 
 /* -ENOSPC if the bucket is full, 0 for success */
-int HTableBase::add_to_bucket(Bucket *bucket, const void *key,
-                              const void *value) {
-  for (int i = 0; i < kEntriesPerBucket; i++) {
-    if (bucket->hv[i] == 0) {
-      void *entry;
-      KeyIndex k_idx = pop_free_keyidx();
-
-      bucket->hv[i] = hash_nonzero(key);
-      bucket->keyidx[i] = k_idx;
-
-      entry = keyidx_to_ptr(k_idx);
-      memcpy(entry, key, key_size_);
-      memcpy((void *)((uintptr_t)entry + value_offset_), value, value_size_);
-
-      cnt_++;
-      return 0;
-    }
+int HTableBase::add_to_bucket(Bucket *bucket, uint32_t hv, KeyIndex idx) {
+  int i = find_empty_slot(bucket);
+  if (i < 0) {
+    return i;
   }
 
-  return -ENOSPC;
+  /* readers look at keyidx only if hv matches */
+  ACCESS_ONCE(bucket->keyidx[i]) = idx;
+  STORE_BARRIER();
+  ACCESS_ONCE(bucket->hv[i]) = hv;
+
+  return 0;
 }
 
 /* the key must not already exist in the hash table */
-int HTableBase::add_entry(uint32_t pri, uint32_t sec, const void *key,
-                          const void *value) {
+int HTableBase::add_entry(uint32_t pri, uint32_t sec, KeyIndex idx) {
   Bucket *pri_bucket;
   Bucket *sec_bucket;
 
 again:
   pri_bucket = hv_to_bucket(pri);
-  if (add_to_bucket(pri_bucket, key, value) == 0) {
+  if (add_to_bucket(pri_bucket, pri, idx) == 0) {
     return 0;
   }
 
   /* empty space in the secondary bucket? */
   sec_bucket = hv_to_bucket(sec);
-  if (add_to_bucket(sec_bucket, key, value) == 0) {
+  if (add_to_bucket(sec_bucket, pri, idx) == 0) {
     return 0;
   }
 
@@ -223,52 +253,75 @@ again:
   return -ENOSPC;
 }
 
-void *HTableBase::get_from_bucket(uint32_t pri, uint32_t hv,
-                                  const void *key) const {
-  Bucket *bucket = hv_to_bucket(hv);
+/* For the updater. Returns the slot ID in *bucket, or -ENOENT */
+int HTableBase::find_slot(uint32_t pri, const void *key,
+                          Bucket **bucket) const {
+  const uint32_t hvs[] = {pri, hash_secondary(pri)};
 
-  for (int i = 0; i < kEntriesPerBucket; i++) {
-    KeyIndex k_idx;
-    void *key_stored;
+  for (uint32_t hv : hvs) {
+    Bucket *b = hv_to_bucket(hv);
 
-    if (pri != bucket->hv[i]) {
-      continue;
-    }
-
-    k_idx = bucket->keyidx[i];
-    key_stored = keyidx_to_ptr(k_idx);
+    for (int i = 0; i < kEntriesPerBucket; i++) {
+      if (pri != b->hv[i]) {
+        continue;
+      }
 
-    if (keycmp_func_(key, key_stored, key_size_) == 0) {
-      return (void *)((uintptr_t)key_stored + value_offset_);
+      if (keycmp_func_(key, keyidx_to_ptr(b->keyidx[i]), key_size_) == 0) {
+        *bucket = b;
+        return i;
+      }
     }
   }
 
-  return nullptr;
+  return -ENOENT;
 }
 
-int HTableBase::del_from_bucket(uint32_t pri, uint32_t hv, const void *key) {
-  Bucket *bucket = hv_to_bucket(hv);
-
-  for (int i = 0; i < kEntriesPerBucket; i++) {
-    KeyIndex k_idx;
-    void *key_stored;
+/* Readers must see either the old or the new value as a whole */
+int HTableBase::update_value(Bucket *bucket, int slot, const void *value) {
+  KeyIndex idx = bucket->keyidx[slot];
+  void *old_value = (void *)((uintptr_t)keyidx_to_ptr(idx) + value_offset_);
 
-    if (pri != bucket->hv[i]) {
-      continue;
-    }
-
-    k_idx = bucket->keyidx[i];
-    key_stored = keyidx_to_ptr(k_idx);
+  if (value_size_ == 0) {
+    return 0;
+  }
 
-    if (keycmp_func_(key, key_stored, key_size_) == 0) {
-      bucket->hv[i] = 0;
-      push_free_keyidx(k_idx);
-      cnt_--;
+  /* a single, aligned store will do */
+  if (value_offset_ % value_size_ == 0 && entry_size_ % value_size_ == 0) {
+    if (value_size_ == 1) {
+      ACCESS_ONCE(*(uint8_t *)old_value) = *(const uint8_t *)value;
+      return 0;
+    } else if (value_size_ == 2) {
+      uint16_t v;
+      memcpy(&v, value, sizeof(v));
+      ACCESS_ONCE(*(uint16_t *)old_value) = v;
+      return 0;
+    } else if (value_size_ == 4) {
+      uint32_t v;
+      memcpy(&v, value, sizeof(v));
+      ACCESS_ONCE(*(uint32_t *)old_value) = v;
+      return 0;
+    } else if (value_size_ == 8) {
+      uint64_t v;
+      memcpy(&v, value, sizeof(v));
+      ACCESS_ONCE(*(uint64_t *)old_value) = v;
       return 0;
     }
   }
 
-  return -ENOENT;
+  /* otherwise the entry is replaced with a new one */
+  KeyIndex new_idx = pop_free_keyidx();
+  if (new_idx == kInvalidKeyIdx) {
+    return -ENOMEM;
+  }
+
+  void *new_entry = keyidx_to_ptr(new_idx);
+  memcpy(new_entry, keyidx_to_ptr(idx), key_size_);
+  memcpy((void *)((uintptr_t)new_entry + value_offset_), value, value_size_);
+  STORE_BARRIER();
+  ACCESS_ONCE(bucket->keyidx[slot]) = new_idx;
+
+  retire_keyidx(idx);
+  return 0;
 }
 
 int HTableBase::InitEx(struct ht_params *params) {
@@ -309,24 +362,29 @@ int HTableBase::InitEx(struct ht_params *params) {
 
   bucket_mask_ = params->num_buckets - 1;
 
+  layout_version_ = 0;
   cnt_ = 0;
   num_entries_ = params->num_entries;
   free_keyidx_ = kInvalidKeyIdx;
+  retired_keyidx_.clear();
+  owner_ = bess::memory::CurrentOwner();
 
   key_size_ = params->key_size;
   value_size_ = params->value_size;
   value_offset_ = align_ceil(key_size_, std::max(1ul, params->value_align));
   entry_size_ = align_ceil(value_offset_ + value_size_, params->key_align);
 
-  buckets_ = (Bucket *)mem_alloc((bucket_mask_ + 1) * sizeof(Bucket));
+  buckets_ = (Bucket *)bess::memory::Alloc(
+      (bucket_mask_ + 1) * sizeof(Bucket), alignof(Bucket), -1, owner_);
 
   if (!buckets_) {
     return -ENOMEM;
   }
 
-  entries_ = mem_alloc(num_entries_ * entry_size_);
+  entries_ = bess::memory::Alloc(num_entries_ * entry_size_, 0, -1, owner_);
   if (!entries_) {
     mem_free(buckets_);
+    buckets_ = nullptr;
     return -ENOMEM;
   }
 
@@ -339,6 +397,11 @@ int HTableBase::InitEx(struct ht_params *params) {
 }
 
 int HTableBase::Init(size_t key_size, size_t value_size) {
+  return Init(key_size, value_size, nullptr, nullptr);
+}
+
+int HTableBase::Init(size_t key_size, size_t value_size, HashFunc hash_func,
+                     KeyCmpFunc keycmp_func) {
   struct ht_params params;
 
   params.key_size = key_size;
@@ -359,8 +422,8 @@ int HTableBase::Init(size_t key_size, size_t value_size) {
   params.num_buckets = kInitNumBucket;
   params.num_entries = kInitNumEntries;
 
-  params.hash_func = nullptr;
-  params.keycmp_func = nullptr;
+  params.hash_func = hash_func;
+  params.keycmp_func = keycmp_func;
 
   return InitEx(&params);
 }
@@ -374,6 +437,7 @@ void HTableBase::Close() {
     mem_free(entries_);
     entries_ = nullptr;
   }
+  retired_keyidx_.clear();
 }
 
 void HTableBase::Clear() {
@@ -392,120 +456,128 @@ void *HTableBase::Get(const void *key) const {
 }
 
 void *HTableBase::GetHash(uint32_t pri, const void *key) const {
-  void *ret;
+  KeyCmpFunc keycmp = keycmp_func_;
+  size_t key_size = key_size_;
 
-  pri = make_nonzero(pri);
-
-  /* check primary bucket */
-  ret = get_from_bucket(pri, pri, key);
-  if (ret) {
-    return ret;
-  }
-
-  /* check secondary bucket */
-  return get_from_bucket(pri, hash_secondary(pri), key);
+  return lookup(make_nonzero(pri), key,
+                [keycmp, key_size](const void *a, const void *b) {
+                  return keycmp(a, b, key_size);
+                });
 }
 
-int HTableBase::clone_table(HTableBase *t_old, uint32_t num_buckets,
-                            KeyIndex num_entries) {
-  uint32_t next = 0;
-  void *key;
-
-  *this = *t_old;
+/* Builds a bucket array twice as large (or more, if it takes) and swaps it
+ * in. The entries stay where they are, and readers may keep using the old
+ * array until they are quiescent. */
+int HTableBase::expand_buckets() {
+  HTableBase t;
+  uint32_t num_buckets = (bucket_mask_ + 1) * 2;
+  int ret = 0;
 
-  buckets_ = (Bucket *)mem_alloc(num_buckets * sizeof(Bucket));
+  DCHECK_EQ(num_buckets, align_ceil_pow2(num_buckets));
 
-  if (!buckets_) {
-    return -ENOMEM;
-  }
+  /* t has the entries of this table, but buckets of its own */
+  t = *this;
+  t.buckets_ = (Bucket *)bess::memory::Alloc(num_buckets * sizeof(Bucket),
+                                             alignof(Bucket), -1, owner_);
+  t.bucket_mask_ = num_buckets - 1;
 
-  entries_ = mem_alloc(num_entries * entry_size_);
-  if (!entries_) {
-    mem_free(buckets_);
-    return -ENOMEM;
+  if (!t.buckets_) {
+    ret = -ENOMEM;
   }
 
-  bucket_mask_ = num_buckets - 1;
-  cnt_ = 0;
-  num_entries_ = num_entries;
-  free_keyidx_ = kInvalidKeyIdx;
+  for (uint32_t i = 0; ret == 0 && i < bucket_mask_ + 1; i++) {
+    for (int j = 0; ret == 0 && j < kEntriesPerBucket; j++) {
+      uint32_t pri = buckets_[i].hv[j];
+      if (!pri) {
+        continue;
+      }
 
-  // beware of underflow
-  for (KeyIndex i = num_entries_ - 1; i-- > 0;) {
-    push_free_keyidx(i);
+      /* may be called recursively */
+      while ((ret = t.add_entry(pri, hash_secondary(pri),
+                                buckets_[i].keyidx[j])) < 0) {
+        ret = t.expand_buckets();
+        if (ret < 0) {
+          break;
+        }
+      }
+    }
   }
 
-  while ((key = t_old->Iterate(&next))) {
-    void *value = t_old->key_to_value(key);
-    int ret = Set(key, value);
+  /* not ours to free */
+  t.entries_ = nullptr;
 
-    if (ret) {
-      Close();
-      return ret;
-    }
+  if (ret < 0) {
+    return ret;
   }
 
-  return 0;
-}
-
-/* may be called recursively */
-int HTableBase::expand_buckets() {
-  HTableBase *t = new HTableBase();
-  uint32_t num_buckets = (bucket_mask_ + 1) * 2;
+  Bucket *old_buckets = buckets_;
 
-  DCHECK_EQ(num_buckets, align_ceil_pow2(num_buckets));
+  /* see lookup() */
+  ACCESS_ONCE(layout_version_) = layout_version_ + 1;
+  STORE_BARRIER();
+  ACCESS_ONCE(buckets_) = t.buckets_;
+  STORE_BARRIER();
+  ACCESS_ONCE(bucket_mask_) = t.bucket_mask_;
+  STORE_BARRIER();
+  ACCESS_ONCE(layout_version_) = layout_version_ + 1;
 
-  int ret = t->clone_table(this, num_buckets, num_entries_);
-  if (ret == 0) {
-    Close();
-    *this = *t;
-  }
+  t.buckets_ = nullptr;
+  Rcu::Defer([old_buckets]() { mem_free(old_buckets); });
 
-  return ret;
+  return 0;
 }
 
 int HTableBase::Set(const void *key, const void *value) {
-  uint32_t pri = hash(key);
-  uint32_t sec = hash_secondary(pri);
-
-  int ret = 0;
+  uint32_t pri = hash_nonzero(key);
+  Bucket *bucket;
+  int ret;
 
   /* If the key already exists, its value is updated with the new one */
-  void *old_value = GetHash(pri, key);
-  if (old_value) {
-    memcpy(old_value, value, value_size_);
-    return 1;
+  int slot = find_slot(pri, key, &bucket);
+  if (slot >= 0) {
+    ret = update_value(bucket, slot, value);
+    return ret ?: 1;
   }
 
-  pri = make_nonzero(pri);
-  sec = hash_secondary(pri);
+  KeyIndex idx = pop_free_keyidx();
+  if (idx == kInvalidKeyIdx) {
+    return -ENOMEM;
+  }
 
-  while (add_entry(pri, sec, key, value) < 0) {
+  /* not visible to readers until added to a bucket */
+  void *entry = keyidx_to_ptr(idx);
+  memcpy(entry, key, key_size_);
+  memcpy((void *)((uintptr_t)entry + value_offset_), value, value_size_);
+  STORE_BARRIER();
+
+  while (add_entry(pri, hash_secondary(pri), idx) < 0) {
     /* expand the table as the last resort */
     ret = expand_buckets();
     if (ret < 0) {
-      break;
+      push_free_keyidx(idx);
+      return ret;
     }
     /* retry on the newly expanded table */
   }
 
-  return ret;
+  cnt_++;
+  return 0;
 }
 
 int HTableBase::Del(const void *key) {
   uint32_t pri = hash_nonzero(key);
-  uint32_t sec;
+  Bucket *bucket;
 
-  if (del_from_bucket(pri, pri, key) == 0) {
-    return 0;
+  int slot = find_slot(pri, key, &bucket);
+  if (slot < 0) {
+    return -ENOENT;
   }
 
-  sec = hash_secondary(pri);
-  if (del_from_bucket(pri, sec, key) == 0) {
-    return 0;
-  }
+  ACCESS_ONCE(bucket->hv[slot]) = 0;
+  retire_keyidx(bucket->keyidx[slot]);
+  cnt_--;
 
-  return -ENOENT;
+  return 0;
 }
 
 void *HTableBase::Iterate(uint32_t *next) const {
@@ -1,11 +1,28 @@
 /* Streamlined hash table implementation, with emphasis on lookup performance.
- * Key and value sizes are fixed. Lookup is thread-safe, but update is not. */
+ * Key and value sizes are fixed.
+ *
+ * Lookups are lock-free, and may run on any number of threads concurrently
+ * with a single updater (e.g., workers and the control thread):
+ *  - Cuckoo displacement bumps a version of the buckets involved, and lookups
+ *    that miss while their buckets change are retried.
+ *  - The bucket array is replaced as a whole when the table grows, and so is
+ *    the entry array. Old arrays and the entries of deleted keys are only
+ *    reused or freed once all readers are quiescent (see utils/rcu.h), so the
+ *    value pointers returned by lookups stay valid until then.
+ *  - Values of up to 8 bytes are updated in place with a single store, and
+ *    larger ones are replaced with a new entry, so readers never see a torn
+ *    value (but may keep seeing the old one until they are quiescent).
+ * Threads that keep value pointers across quiescent states must not rely on
+ * them. */
 
 #ifndef BESS_UTILS_HTABLE_H_
 #define BESS_UTILS_HTABLE_H_
 
 #include <algorithm>
 #include <cstring>
+#include <deque>
+#include <limits>
+#include <utility>
 
 #include "../mem_alloc.h"
 #include "common.h"
@@ -44,9 +61,12 @@ class HTableBase {
         bucket_mask_(),
         buckets_(),
         entries_(),
+        layout_version_(),
         cnt_(),
         num_entries_(),
         free_keyidx_(),
+        retired_keyidx_(),
+        owner_(),
         hash_func_(),
         keycmp_func_() {}
 
@@ -63,6 +83,8 @@ class HTableBase {
 
   /* -errno, or 0 for success */
   int Init(size_t key_size, size_t value_size);
+  int Init(size_t key_size, size_t value_size, HashFunc hash_func,
+           KeyCmpFunc keycmp_func);
   int InitEx(struct ht_params *params);
   void Close();
 
@@ -98,9 +120,11 @@ class HTableBase {
   /* non-tunable macros */
   static const uint32_t kHashInitval = UINT32_MAX;
 
-  struct alignas(32) Bucket {
+  /* a cache line */
+  struct alignas(64) Bucket {
     uint32_t hv[kEntriesPerBucket];
     KeyIndex keyidx[kEntriesPerBucket];
+    uint32_t version; /* odd while entries are moved from/to this bucket */
   };
 
   static uint32_t make_nonzero(uint32_t v) {
@@ -116,14 +140,39 @@ class HTableBase {
     return primary ^ ((tag + 1) * 0x5bd1e995);
   }
 
+  /* entries_ must be loaded after idx, as it may have grown in between */
   void *keyidx_to_ptr(KeyIndex idx) const {
-    return (void *)((uintptr_t)entries_ + entry_size_ * idx);
+    return (void *)((uintptr_t)ACCESS_ONCE(entries_) + entry_size_ * idx);
   }
 
+  /* for the updater only */
   Bucket *hv_to_bucket(uint32_t hv) const {
     return &buckets_[hv & bucket_mask_];
   }
 
+  /* For readers. The mask is updated after the array when the table grows,
+   * so that buckets[hv & mask] is always within the array, if not the right
+   * bucket (which layout_version_ tells). */
+  const Bucket *load_buckets(uint32_t *mask) const {
+    *mask = ACCESS_ONCE(bucket_mask_);
+    LOAD_BARRIER();
+    return ACCESS_ONCE(buckets_);
+  }
+
+  static void bump_version(Bucket *bucket) {
+    ACCESS_ONCE(bucket->version) = bucket->version + 1;
+    STORE_BARRIER();
+  }
+
+  /* The lock-free lookup shared by HTableBase and HTable. cmp(key, key_stored)
+   * returns 0 if identical. */
+  template <typename F>
+  void *lookup(uint32_t pri, const void *key, F cmp) const;
+
+  template <typename F>
+  void *find_in_bucket(const Bucket *bucket, uint32_t pri, const void *key,
+                       F cmp) const;
+
   /* in bytes */
   size_t key_size_;
   size_t value_size_;
@@ -145,19 +194,18 @@ class HTableBase {
   static const KeyIndex kInvalidKeyIdx = std::numeric_limits<KeyIndex>::max();
 
   int count_entries_in_pri_bucket() const;
-  void *get_from_bucket(uint32_t pri, uint32_t hv, const void *key) const;
-  int del_from_bucket(uint32_t pri, uint32_t hv, const void *key);
-  int add_entry(uint32_t pri, uint32_t sec, const void *key, const void *value);
-  int add_to_bucket(Bucket *bucket, const void *key, const void *value);
+  int find_slot(uint32_t pri, const void *key, Bucket **bucket) const;
+  int add_entry(uint32_t pri, uint32_t sec, KeyIndex idx);
+  int add_to_bucket(Bucket *bucket, uint32_t hv, KeyIndex idx);
   int find_empty_slot(const Bucket *bucket);
   int make_space(Bucket *bucket, int depth);
+  int update_value(Bucket *bucket, int slot, const void *value);
   KeyIndex pop_free_keyidx();
-  // XXX: clone_table() is a good candidate for a copy constructor
-  int clone_table(HTableBase *t_old, uint32_t num_buckets,
-                  KeyIndex num_entries);
   int expand_buckets();
   int expand_entries();
   void push_free_keyidx(KeyIndex idx);
+  void retire_keyidx(KeyIndex idx);
+  void recycle_keyidx();
   uint32_t hash(const void *key) const;
   uint32_t hash_nonzero(const void *key) const;
 
@@ -173,16 +221,84 @@ class HTableBase {
   Bucket *buckets_;
   void *entries_; /* entry_size * num_entries bytes */
 
+  /* odd while buckets_ and bucket_mask_ are being replaced */
+  uint32_t layout_version_;
+
   int cnt_;              /* current number of entries */
   KeyIndex num_entries_; /* current array size (# entries) */
 
   /* Linked list head for empty key slots (LIFO). kInvalidKeyIdx if empty */
   KeyIndex free_keyidx_;
 
+  /* Key slots of deleted entries, with their RCU tokens (in order) */
+  std::deque<std::pair<uint64_t, KeyIndex>> retired_keyidx_;
+
+  /* the arrays are charged to the owner at Init() */
+  bess::memory::owner_t owner_;
+
   HashFunc hash_func_;
   KeyCmpFunc keycmp_func_;
 };
 
+template <typename F>
+inline void *HTableBase::lookup(uint32_t pri, const void *key, F cmp) const {
+  uint32_t sec = hash_secondary(pri);
+
+  while (true) {
+    uint32_t layout_version = ACCESS_ONCE(layout_version_);
+    LOAD_BARRIER();
+
+    uint32_t mask;
+    const Bucket *buckets = load_buckets(&mask);
+
+    const Bucket *pri_bucket = &buckets[pri & mask];
+    const Bucket *sec_bucket = &buckets[sec & mask];
+    uint32_t pri_version = ACCESS_ONCE(pri_bucket->version);
+    uint32_t sec_version = ACCESS_ONCE(sec_bucket->version);
+    LOAD_BARRIER();
+
+    /* an entry found is good, as it is not reused until readers quiesce */
+    void *ret = find_in_bucket(pri_bucket, pri, key, cmp);
+    if (ret) {
+      return ret;
+    }
+
+    ret = find_in_bucket(sec_bucket, pri, key, cmp);
+    if (ret) {
+      return ret;
+    }
+
+    /* a miss is only good if the entry could not have been moved meanwhile */
+    LOAD_BARRIER();
+    if (likely(((layout_version | pri_version | sec_version) & 1) == 0 &&
+               layout_version == ACCESS_ONCE(layout_version_) &&
+               pri_version == ACCESS_ONCE(pri_bucket->version) &&
+               sec_version == ACCESS_ONCE(sec_bucket->version))) {
+      return nullptr;
+    }
+  }
+}
+
+template <typename F>
+inline void *HTableBase::find_in_bucket(const Bucket *bucket, uint32_t pri,
+                                        const void *key, F cmp) const {
+  for (int i = 0; i < kEntriesPerBucket; i++) {
+    if (pri != ACCESS_ONCE(bucket->hv[i])) {
+      continue;
+    }
+
+    /* keyidx is set before hv */
+    LOAD_BARRIER();
+    void *key_stored = keyidx_to_ptr(ACCESS_ONCE(bucket->keyidx[i]));
+
+    if (cmp(key, key_stored) == 0) {
+      return (void *)((uintptr_t)key_stored + value_offset_);
+    }
+  }
+
+  return nullptr;
+}
+
 // NOTE: clang does not allow pointers to be used as non-type template arguments
 //       other than of the form &identifier, as specified in C++11 standard.
 //       http://www.open-std.org/jtc1/sc22/wg21/docs/papers/2014/n4268.html
@@ -191,16 +307,40 @@ template <typename K, typename V, HTableBase::KeyCmpFunc C,
           HTableBase::HashFunc H>
 class HTable : public HTableBase {
  public:
+  /* as many as the bits in hit_mask of GetBulk() */
+  static const int kMaxBulk = 64;
+
+  /* Set() and Del() hash and compare keys with H and C as well, so that they
+   * agree with Get() even if H is not compatible with the default hash. */
+  int Init(size_t key_size, size_t value_size) {
+    return HTableBase::Init(key_size, value_size, H, C);
+  }
+
   /* returns nullptr or the pointer to the data */
   V *Get(const K *key) const;
 
   /* identical to ht_Get(), but you can supply a precomputed hash value "pri" */
   V *GetHash(uint32_t pri, const K *key) const;
 
+  /* Looks up n (<= kMaxBulk) keys at once. values[i] is set to nullptr or the
+   * pointer to the data for keys[i], and so is the i-th bit of *hit_mask
+   * (if not nullptr). Returns the number of keys found.
+   *
+   * Unlike n calls of Get(), the cache misses of all keys overlap: every key
+   * is hashed and its buckets are prefetched first, then the entries with a
+   * matching hash value are prefetched, and only then the keys are compared.
+   * This pays off once the table does not fit in the cache. */
+  int GetBulk(const K *const *keys, int n, V **values,
+              uint64_t *hit_mask) const;
+
  private:
-  V *get_from_bucket(uint32_t pri, uint32_t hv, const K *key) const;
+  void prefetch_entries(const Bucket *bucket, uint32_t pri) const;
 };
 
+template <typename K, typename V, HTableBase::KeyCmpFunc C,
+          HTableBase::HashFunc H>
+const int HTable<K, V, C, H>::kMaxBulk;
+
 template <typename K, typename V, HTableBase::KeyCmpFunc C,
           HTableBase::HashFunc H>
 inline V *HTable<K, V, C, H>::Get(const K *key) const {
@@ -212,40 +352,72 @@ inline V *HTable<K, V, C, H>::Get(const K *key) const {
 template <typename K, typename V, HTableBase::KeyCmpFunc C,
           HTableBase::HashFunc H>
 inline V *HTable<K, V, C, H>::GetHash(uint32_t pri, const K *key) const {
-  pri = make_nonzero(pri);
+  size_t key_size = key_size_;
+
+  return static_cast<V *>(lookup(
+      make_nonzero(pri), key, [key_size](const void *a, const void *b) {
+        return C(a, b, key_size);
+      }));
+}
+
+template <typename K, typename V, HTableBase::KeyCmpFunc C,
+          HTableBase::HashFunc H>
+inline int HTable<K, V, C, H>::GetBulk(const K *const *keys, int n, V **values,
+                                       uint64_t *hit_mask) const {
+  uint32_t pri[kMaxBulk];
+  uint64_t mask = 0;
+  int hits = 0;
+
+  /* only for prefetching, so it does not matter if the table grows meanwhile */
+  uint32_t bucket_mask;
+  const Bucket *buckets = load_buckets(&bucket_mask);
+
+  for (int i = 0; i < n; i++) {
+    pri[i] = make_nonzero(H(keys[i], key_size_, kHashInitval));
+    __builtin_prefetch(&buckets[pri[i] & bucket_mask]);
+    __builtin_prefetch(&buckets[hash_secondary(pri[i]) & bucket_mask]);
+  }
+
+  for (int i = 0; i < n; i++) {
+    prefetch_entries(&buckets[pri[i] & bucket_mask], pri[i]);
+    prefetch_entries(&buckets[hash_secondary(pri[i]) & bucket_mask], pri[i]);
+  }
+
+  for (int i = 0; i < n; i++) {
+    V *ret = GetHash(pri[i], keys[i]);
+
+    values[i] = ret;
+    if (ret) {
+      mask |= 1ull << i;
+      hits++;
+    }
+  }
 
-  /* check primary bucket */
-  V *ret = get_from_bucket(pri, pri, key);
-  if (ret) {
-    return ret;
+  if (hit_mask) {
+    *hit_mask = mask;
   }
 
-  /* check secondary bucket */
-  return get_from_bucket(pri, hash_secondary(pri), key);
+  return hits;
 }
 
 template <typename K, typename V, HTableBase::KeyCmpFunc C,
           HTableBase::HashFunc H>
-inline V *HTable<K, V, C, H>::get_from_bucket(uint32_t pri, uint32_t hv,
-                                              const K *key) const {
-  Bucket *bucket = hv_to_bucket(hv);
-
+inline void HTable<K, V, C, H>::prefetch_entries(const Bucket *bucket,
+                                                 uint32_t pri) const {
   for (int i = 0; i < kEntriesPerBucket; i++) {
-    KeyIndex k_idx;
-    void *key_stored;
-
-    if (pri != bucket->hv[i]) {
+    if (pri != ACCESS_ONCE(bucket->hv[i])) {
       continue;
     }
 
-    k_idx = bucket->keyidx[i];
-    key_stored = keyidx_to_ptr(k_idx);
-
-    if (C(key, key_stored, key_size_) == 0)
-      return (V *)((uintptr_t)key_stored + value_offset_);
+    /* an entry with a large key may span multiple cache lines */
+    LOAD_BARRIER();
+    const char *entry = static_cast<const char *>(
+        keyidx_to_ptr(ACCESS_ONCE(bucket->keyidx[i])));
+    for (size_t off = 0; off < entry_size_; off += 64) {
+      __builtin_prefetch(entry + off);
+    }
+    __builtin_prefetch(entry + entry_size_ - 1);
   }
-
-  return nullptr;
 }
 
 }  // namespace utils
@@ -12,6 +12,7 @@
 #include <cstdio>
 #include <functional>
 #include <unordered_map>
+#include <vector>
 
 #include <benchmark/benchmark.h>
 #include <glog/logging.h>
@@ -22,6 +23,7 @@
 
 #include "../mem_alloc.h"
 #include "common.h"
+#include "hash_key.h"
 #include "random.h"
 
 using bess::utils::HTable;
@@ -183,6 +185,79 @@ BENCHMARK_REGISTER_F(HTableFixture, CuckooMapInlinedGet)
     ->RangeMultiplier(4)
     ->Range(4, 4 << 20);
 
+// Same as above, but with keys that are (almost all) missing. Misses are
+// resolved by tags alone, without reading any entry.
+BENCHMARK_DEFINE_F(HTableFixture, CuckooMapInlinedGetMiss)
+(benchmark::State &state) {
+  while (true) {
+    const size_t n = state.range(0);
+    rng.SetSeed(1);
+
+    for (size_t i = 0; i < n; i++) {
+      uint32_t key = rng.Get();
+
+      benchmark::DoNotOptimize(cuckoo_->Find(key));
+
+      if (!state.KeepRunning()) {
+        state.SetItemsProcessed(state.iterations());
+        return;
+      }
+    }
+  }
+}
+
+BENCHMARK_REGISTER_F(HTableFixture, CuckooMapInlinedGetMiss)
+    ->RangeMultiplier(4)
+    ->Range(4, 4 << 20);
+
+// Benchmarks the FindBulk() method in CuckooMap, with a batch of 32 keys that
+// are all present (seed 0), or (almost) all missing (seed 1).
+static void CuckooMapFindBulk(benchmark::State &state,
+                              CuckooMap<uint32_t, value_t> *cuckoo,
+                              uint64_t seed) {
+  typedef CuckooMap<uint32_t, value_t> map_t;
+  const int kBatch = 32;
+  uint32_t keys[kBatch];
+  map_t::Entry *entries[kBatch];
+
+  while (true) {
+    const size_t n = state.range(0) / kBatch * kBatch;
+    rng.SetSeed(seed);
+
+    for (size_t i = 0; i < std::max<size_t>(n, kBatch); i += kBatch) {
+      for (int j = 0; j < kBatch; j++) {
+        keys[j] = rng.Get();
+      }
+
+      benchmark::DoNotOptimize(cuckoo->FindBulk(keys, kBatch, entries));
+      DCHECK(seed || entries[0]);
+
+      if (!state.KeepRunning()) {
+        state.SetItemsProcessed(state.iterations() * kBatch);
+        return;
+      }
+    }
+  }
+}
+
+BENCHMARK_DEFINE_F(HTableFixture, CuckooMapFindBulk)
+(benchmark::State &state) {
+  CuckooMapFindBulk(state, cuckoo_, 0);
+}
+
+BENCHMARK_DEFINE_F(HTableFixture, CuckooMapFindBulkMiss)
+(benchmark::State &state) {
+  CuckooMapFindBulk(state, cuckoo_, 1);
+}
+
+BENCHMARK_REGISTER_F(HTableFixture, CuckooMapFindBulk)
+    ->RangeMultiplier(4)
+    ->Range(4, 4 << 20);
+
+BENCHMARK_REGISTER_F(HTableFixture, CuckooMapFindBulkMiss)
+    ->RangeMultiplier(4)
+    ->Range(4, 4 << 20);
+
 // Benchmarks the find method on the STL unordered_map.
 BENCHMARK_DEFINE_F(HTableFixture, STLUnorderedMapGet)(benchmark::State &state) {
   while (true) {
@@ -208,4 +283,190 @@ BENCHMARK_REGISTER_F(HTableFixture, STLUnorderedMapGet)
     ->RangeMultiplier(4)
     ->Range(4, 4 << 20);
 
+// Multi-field keys of classifiers, e.g., for ExactMatch
+struct LargeKey {
+  uint64_t u64_arr[bess::utils::kMaxHashKeySize / sizeof(uint64_t)];
+};
+
+static inline int memcmp_keycmp(const void *key, const void *key_stored,
+                                size_t key_len) {
+  return memcmp(key, key_stored, key_len);
+}
+
+static inline uint32_t generic_hash(const void *key, uint32_t key_len,
+                                    uint32_t init_val) {
+  return rte_hash_crc(key, key_len, init_val);
+}
+
+// Performs setup / teardown of tables with state.range(0)-byte keys and
+// state.range(1) entries, with SIMD compare and hash (or memcmp() and DPDK's
+// generic CRC hash for the baseline).
+template <HTableBase::KeyCmpFunc C, HTableBase::HashFunc H>
+class LargeKeyFixture : public benchmark::Fixture {
+ public:
+  LargeKeyFixture() : keys_() {}
+
+  virtual void SetUp(benchmark::State &state) {
+    const size_t key_size = state.range(0);
+    const size_t n = state.range(1);
+
+    CHECK_EQ(t_.Init(key_size, sizeof(value_t)), 0);
+    rng.SetSeed(0);
+
+    keys_.resize(n);
+    for (size_t i = 0; i < n; i++) {
+      memset(&keys_[i], 0, sizeof(keys_[i]));
+      for (size_t j = 0; j < key_size / sizeof(uint64_t); j++) {
+        keys_[i].u64_arr[j] = rng.Get();
+      }
+
+      value_t val = derive_val(i);
+      CHECK_GE(t_.Set(&keys_[i], &val), 0);
+    }
+
+    // Lookups in a random order, so that they are not served from the cache
+    std::random_shuffle(keys_.begin(), keys_.end());
+  }
+
+  virtual void TearDown(benchmark::State &) {
+    t_.Close();
+    keys_.clear();
+  }
+
+ protected:
+  HTable<LargeKey, value_t, C, H> t_;
+  std::vector<LargeKey> keys_;
+};
+
+typedef LargeKeyFixture<bess::utils::HashKeyCmp, bess::utils::HashKeyHash>
+    SimdKey;
+typedef LargeKeyFixture<memcmp_keycmp, generic_hash> GenericKey;
+
+BENCHMARK_DEFINE_F(SimdKey, Get)(benchmark::State &state) {
+  while (true) {
+    for (const LargeKey &key : keys_) {
+      value_t *val;
+
+      benchmark::DoNotOptimize(val = t_.Get(&key));
+      DCHECK(val);
+
+      if (!state.KeepRunning()) {
+        state.SetItemsProcessed(state.iterations());
+        return;
+      }
+    }
+  }
+}
+
+BENCHMARK_DEFINE_F(GenericKey, Get)(benchmark::State &state) {
+  while (true) {
+    for (const LargeKey &key : keys_) {
+      value_t *val;
+
+      benchmark::DoNotOptimize(val = t_.Get(&key));
+      DCHECK(val);
+
+      if (!state.KeepRunning()) {
+        state.SetItemsProcessed(state.iterations());
+        return;
+      }
+    }
+  }
+}
+
+static void LargeKeyArgs(benchmark::internal::Benchmark *b) {
+  for (int key_size : {16, 40, 64, 128}) {
+    for (int entries : {1 << 10, 1 << 16, 1 << 20}) {
+      b->Args({key_size, entries});
+    }
+  }
+}
+
+BENCHMARK_REGISTER_F(SimdKey, Get)->Apply(LargeKeyArgs);
+BENCHMARK_REGISTER_F(GenericKey, Get)->Apply(LargeKeyArgs);
+
+typedef HTable<uint32_t, value_t, inlined_keycmp, inlined_hash> bulk_table_t;
+
+// Performs setup / teardown of a table with state.range(0) entries, whose keys
+// are looked up in a random order, a batch at a time.
+class BulkFixture : public benchmark::Fixture {
+ public:
+  static const int kBatchSize = 32;
+
+  BulkFixture() : keys_() {}
+
+  virtual void SetUp(benchmark::State &state) {
+    const size_t n = state.range(0);
+
+    CHECK_EQ(t_.Init(sizeof(uint32_t), sizeof(value_t)), 0);
+    rng.SetSeed(0);
+
+    while (keys_.size() < n) {
+      uint32_t key = rng.Get();
+      value_t val = derive_val(key);
+
+      if (t_.Set(&key, &val) == 0) {
+        keys_.push_back(key);
+      }
+    }
+
+    std::random_shuffle(keys_.begin(), keys_.end());
+  }
+
+  virtual void TearDown(benchmark::State &) {
+    t_.Close();
+    keys_.clear();
+  }
+
+ protected:
+  bulk_table_t t_;
+  std::vector<uint32_t> keys_;
+};
+
+// Benchmarks the Get() method in HTable, a batch of keys at a time.
+BENCHMARK_DEFINE_F(BulkFixture, Get)(benchmark::State &state) {
+  const size_t n = keys_.size() / kBatchSize * kBatchSize;
+
+  while (state.KeepRunning()) {
+    for (size_t i = 0; i < n; i += kBatchSize) {
+      for (int j = 0; j < kBatchSize; j++) {
+        value_t *val;
+
+        benchmark::DoNotOptimize(val = t_.Get(&keys_[i + j]));
+        DCHECK(val);
+      }
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * n);
+}
+
+// Benchmarks the GetBulk() method in HTable.
+BENCHMARK_DEFINE_F(BulkFixture, GetBulk)(benchmark::State &state) {
+  const size_t n = keys_.size() / kBatchSize * kBatchSize;
+  const uint32_t *key_ptrs[kBatchSize];
+  value_t *vals[kBatchSize];
+
+  while (state.KeepRunning()) {
+    for (size_t i = 0; i < n; i += kBatchSize) {
+      for (int j = 0; j < kBatchSize; j++) {
+        key_ptrs[j] = &keys_[i + j];
+      }
+
+      benchmark::DoNotOptimize(t_.GetBulk(key_ptrs, kBatchSize, vals, nullptr));
+      DCHECK(vals[0]);
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * n);
+}
+
+BENCHMARK_REGISTER_F(BulkFixture, Get)
+    ->RangeMultiplier(4)
+    ->Range(1 << 10, 16 << 20);
+
+BENCHMARK_REGISTER_F(BulkFixture, GetBulk)
+    ->RangeMultiplier(4)
+    ->Range(1 << 10, 16 << 20);
+
 BENCHMARK_MAIN();
@@ -0,0 +1,203 @@
+#include "htable.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "hash_key.h"
+#include "random.h"
+#include "rcu.h"
+
+using bess::utils::HTable;
+using bess::utils::Rcu;
+
+namespace {
+
+struct Key {
+  uint64_t u64_arr[6];
+};
+
+typedef HTable<Key, uint32_t, bess::utils::HashKeyCmp,
+               bess::utils::HashKeyHash>
+    htable_t;
+
+static Key make_key(uint64_t i) {
+  Key key;
+  for (int j = 0; j < 6; j++) {
+    key.u64_arr[j] = i * (j + 1);
+  }
+  return key;
+}
+
+// Set() and Del() must find entries where Get() does, even though the hash
+// function is not the default one
+TEST(HTableTest, CustomHash) {
+  htable_t t;
+  ASSERT_EQ(0, t.Init(sizeof(Key), sizeof(uint32_t)));
+
+  for (uint32_t i = 0; i < 10000; i++) {
+    Key key = make_key(i);
+    ASSERT_EQ(0, t.Set(&key, &i));
+  }
+
+  for (uint32_t i = 0; i < 10000; i++) {
+    Key key = make_key(i);
+    uint32_t *val = t.Get(&key);
+    ASSERT_NE(nullptr, val);
+    EXPECT_EQ(i, *val);
+
+    uint32_t updated = i + 1;
+    EXPECT_EQ(1, t.Set(&key, &updated));
+  }
+
+  for (uint32_t i = 0; i < 10000; i += 2) {
+    Key key = make_key(i);
+    EXPECT_EQ(0, t.Del(&key));
+  }
+
+  EXPECT_EQ(5000, t.Count());
+  t.Close();
+}
+
+TEST(HTableTest, GetBulk) {
+  htable_t t;
+  ASSERT_EQ(0, t.Init(sizeof(Key), sizeof(uint32_t)));
+
+  // Every third key is missing
+  for (uint32_t i = 0; i < 30000; i++) {
+    if (i % 3) {
+      Key key = make_key(i);
+      ASSERT_EQ(0, t.Set(&key, &i));
+    }
+  }
+
+  Key keys[htable_t::kMaxBulk];
+  const Key *key_ptrs[htable_t::kMaxBulk];
+  uint32_t *vals[htable_t::kMaxBulk];
+
+  for (uint32_t base = 0; base < 30000; base += htable_t::kMaxBulk) {
+    int n = std::min<int>(htable_t::kMaxBulk, 30000 - base);
+    uint64_t hit_mask;
+    int expected_hits = 0;
+
+    for (int i = 0; i < n; i++) {
+      keys[i] = make_key(base + i);
+      key_ptrs[i] = &keys[i];
+    }
+
+    int hits = t.GetBulk(key_ptrs, n, vals, &hit_mask);
+
+    for (int i = 0; i < n; i++) {
+      uint32_t k = base + i;
+      EXPECT_EQ(t.Get(&keys[i]), vals[i]) << k;
+      EXPECT_EQ(k % 3 != 0, (hit_mask >> i) & 1) << k;
+      if (k % 3) {
+        ASSERT_NE(nullptr, vals[i]);
+        EXPECT_EQ(k, *vals[i]);
+        expected_hits++;
+      }
+    }
+
+    EXPECT_EQ(expected_hits, hits);
+  }
+
+  EXPECT_EQ(0, t.GetBulk(key_ptrs, 0, vals, nullptr));
+  t.Close();
+}
+
+// Values larger than 8 bytes are replaced rather than updated in place
+struct WideValue {
+  uint64_t lo;
+  uint64_t hi;
+};
+
+typedef HTable<Key, WideValue, bess::utils::HashKeyCmp,
+               bess::utils::HashKeyHash>
+    wide_htable_t;
+
+// Readers at full rate while the writer churns entries (forcing cuckoo moves
+// and growth of both arrays) and updates the values of a stable set of keys,
+// which must always be found, and never with a torn value.
+TEST(HTableTest, ConcurrentReaders) {
+  const uint64_t kStable = 1000;
+  const uint64_t kChurn = 20000;
+  const int kNumReaders = 4;
+  const int kNumOps = 200000;
+
+  wide_htable_t t;
+  ASSERT_EQ(0, t.Init(sizeof(Key), sizeof(WideValue)));
+
+  for (uint64_t i = 0; i < kStable; i++) {
+    Key key = make_key(i);
+    WideValue val = {i, i};
+    ASSERT_EQ(0, t.Set(&key, &val));
+  }
+
+  std::atomic<bool> stop(false);
+  std::atomic<uint64_t> lookups(0);
+  std::atomic<uint64_t> errors(0);
+  std::vector<std::thread> readers;
+
+  for (int r = 0; r < kNumReaders; r++) {
+    readers.emplace_back([&, r]() {
+      Random rng;
+      rng.SetSeed(r);
+      Rcu::RegisterThread();
+
+      uint64_t n = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        uint64_t i = rng.GetRange(kStable + kChurn);
+        Key key = make_key(i);
+        const WideValue *val = t.Get(&key);
+
+        // Both halves are the key plus the same multiple of 2^32
+        if ((i < kStable && !val) ||
+            (val && (val->lo != val->hi ||
+                     static_cast<uint32_t>(val->lo) != i))) {
+          errors++;
+        }
+
+        if (++n % 64 == 0) {
+          Rcu::Quiescent();
+        }
+      }
+
+      lookups += n;
+      Rcu::UnregisterThread();
+    });
+  }
+
+  Random rng;
+  for (int op = 0; op < kNumOps; op++) {
+    uint64_t i = rng.GetRange(kChurn);
+    Key key = make_key(kStable + i);
+
+    if (rng.GetRange(2)) {
+      WideValue val = {kStable + i, kStable + i};
+      EXPECT_GE(t.Set(&key, &val), 0);
+    } else {
+      t.Del(&key);
+    }
+
+    uint64_t s = rng.GetRange(kStable);
+    uint64_t gen = static_cast<uint64_t>(op) << 32;
+    Key stable_key = make_key(s);
+    WideValue val = {s | gen, s | gen};
+    EXPECT_EQ(1, t.Set(&stable_key, &val));
+  }
+
+  stop = true;
+  for (auto &reader : readers) {
+    reader.join();
+  }
+
+  EXPECT_EQ(0, errors);
+  EXPECT_LT(0, lookups);
+
+  Rcu::Synchronize();
+  t.Close();
+}
+
+}  // namespace (unnamed)
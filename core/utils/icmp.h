@@ -1,17 +1,22 @@
 #ifndef BESS_UTILS_ICMP_H_
+#define BESS_UTILS_ICMP_H_
+
+#include <cstdint>
 
 namespace bess {
 namespace utils {
 
 // A basic ICMP header definition.
 struct[[gnu::packed]] IcmpHeader {
-  uint16_t type;      // ICMP packet type.
-  uint16_t code;      // ICMP packet type.
+  uint8_t type;       // ICMP packet type.
+  uint8_t code;       // ICMP packet code.
   uint16_t checksum;  // ICMP packet checksum.
   uint16_t ident;     // ICMP packet identifier.
   uint16_t seq_num;   // ICMP packet sequence number
 };
 
+static_assert(sizeof(IcmpHeader) == 8, "struct IcmpHeader is incorrect");
+
 }  // namespace utils
 }  // namespace bess
 
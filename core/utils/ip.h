@@ -45,6 +45,18 @@ struct[[gnu::packed]] Ipv4Header {
   uint32_t dst;              // Destination address.
 };
 
+// An IPv6 header, without extension headers.
+struct[[gnu::packed]] Ipv6Header {
+  uint32_t vtc_flow;        // Version, traffic class and flow label.
+  uint16_t payload_length;  // Payload length.
+  uint8_t next_header;      // Next header.
+  uint8_t hop_limit;        // Hop limit.
+  uint8_t src[16];          // Source address.
+  uint8_t dst[16];          // Destination address.
+};
+
+static_assert(sizeof(Ipv6Header) == 40, "Ipv6Header must be 40 bytes");
+
 }  // namespace utils
 }  // namespace bess
 
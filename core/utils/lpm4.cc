@@ -0,0 +1,165 @@
+#include "lpm4.h"
+
+#include <algorithm>
+
+#include <glog/logging.h>
+
+namespace bess {
+namespace utils {
+
+Lpm4::Lpm4()
+    : tbl24_(1 << 24),
+      tbl8_(),
+      group_prefixes_(),
+      free_groups_(),
+      prefixes_(),
+      count_() {}
+
+size_t Lpm4::MemoryUsage() const {
+  return (tbl24_.size() + tbl8_.capacity()) * sizeof(uint32_t);
+}
+
+void Lpm4::Fill(uint32_t *table, uint32_t first, uint32_t last, int old_len,
+                uint32_t entry) {
+  int len = entry & kLenMask;
+
+  for (uint32_t i = first; i <= last; i++) {
+    int curr = table[i] & kLenMask;
+    if (old_len < 0 ? curr <= len : curr == old_len) {
+      table[i] = entry;
+    }
+  }
+}
+
+uint32_t Lpm4::ParentEntry(uint32_t prefix, int len) const {
+  for (int l = len - 1; l > 0; l--) {
+    auto it = prefixes_[l].find(prefix & Mask(l));
+    if (it != prefixes_[l].end()) {
+      return MakeEntry(it->second, l);
+    }
+  }
+  return 0;
+}
+
+uint32_t Lpm4::AllocGroup(uint32_t entry) {
+  uint32_t group;
+
+  if (!free_groups_.empty()) {
+    group = free_groups_.back();
+    free_groups_.pop_back();
+  } else {
+    // Entries have 24 bits for the group
+    group = group_prefixes_.size();
+    CHECK_LT(group, 1u << 24);
+    group_prefixes_.push_back(0);
+    tbl8_.resize(tbl8_.size() + 256);
+  }
+
+  std::fill_n(&tbl8_[group * 256], 256, entry);
+  return group;
+}
+
+void Lpm4::Add(uint32_t prefix, int len, uint32_t next_hop) {
+  DCHECK(len >= 1 && len <= 32);
+  DCHECK_LT(next_hop, kMaxNextHop);
+
+  prefix &= Mask(len);
+  auto ret = prefixes_[len].emplace(prefix, next_hop);
+  bool added = ret.second;
+  if (added) {
+    count_++;
+  } else {
+    ret.first->second = next_hop;
+  }
+
+  uint32_t entry = MakeEntry(next_hop, len);
+
+  if (len <= 24) {
+    uint32_t first = prefix >> 8;
+    uint32_t last = first + (1 << (24 - len)) - 1;
+
+    for (uint32_t i = first; i <= last; i++) {
+      uint32_t curr = tbl24_[i];
+      if (curr & kExtended) {
+        Fill(&tbl8_[(curr >> 8) * 256], 0, 255, -1, entry);
+      } else if ((curr & kLenMask) <= static_cast<uint32_t>(len)) {
+        tbl24_[i] = entry;
+      }
+    }
+    return;
+  }
+
+  uint32_t &curr = tbl24_[prefix >> 8];
+  if (!(curr & kExtended)) {
+    // The group starts with the entries of the prefix covering the /24
+    uint32_t group = AllocGroup(curr);
+    curr = (group << 8) | kExtended;
+  }
+
+  uint32_t group = curr >> 8;
+  if (added) {
+    group_prefixes_[group]++;
+  }
+
+  uint32_t first = prefix & 0xff;
+  Fill(&tbl8_[group * 256], first, first + (1 << (32 - len)) - 1, -1, entry);
+}
+
+bool Lpm4::Delete(uint32_t prefix, int len) {
+  if (len < 1 || len > 32) {
+    return false;
+  }
+
+  prefix &= Mask(len);
+  if (!prefixes_[len].erase(prefix)) {
+    return false;
+  }
+  count_--;
+
+  uint32_t parent = ParentEntry(prefix, len);
+
+  if (len <= 24) {
+    uint32_t first = prefix >> 8;
+    uint32_t last = first + (1 << (24 - len)) - 1;
+
+    for (uint32_t i = first; i <= last; i++) {
+      uint32_t curr = tbl24_[i];
+      if (curr & kExtended) {
+        Fill(&tbl8_[(curr >> 8) * 256], 0, 255, len, parent);
+      } else if ((curr & kLenMask) == static_cast<uint32_t>(len)) {
+        tbl24_[i] = parent;
+      }
+    }
+    return true;
+  }
+
+  uint32_t &curr = tbl24_[prefix >> 8];
+  uint32_t group = curr >> 8;
+
+  if (--group_prefixes_[group] == 0) {
+    // No prefix longer than 24 bits is left, so the parent covers the /24
+    curr = parent;
+    free_groups_.push_back(group);
+    return true;
+  }
+
+  uint32_t first = prefix & 0xff;
+  Fill(&tbl8_[group * 256], first, first + (1 << (32 - len)) - 1, len,
+       parent);
+  return true;
+}
+
+void Lpm4::Clear() {
+  std::fill(tbl24_.begin(), tbl24_.end(), 0);
+  tbl8_.clear();
+  tbl8_.shrink_to_fit();
+  group_prefixes_.clear();
+  free_groups_.clear();
+  for (auto &prefixes : prefixes_) {
+    prefixes.clear();
+  }
+  count_ = 0;
+}
+
+}  // namespace utils
+}  // namespace bess
@@ -0,0 +1,109 @@
+/* Longest prefix match of IPv4 addresses, with the DIR-24-8 scheme (after
+ * Gupta et al.): a table of 2^24 entries indexed by the first 24 bits of an
+ * address, and groups of 256 entries, indexed by the last 8 bits, for the
+ * /24s that have longer prefixes.
+ *
+ * An entry has the next hop of the longest prefix that covers it, and the
+ * length of that prefix, so that adding a prefix only overwrites the entries
+ * of shorter ones, and deleting it restores those of the prefix it hid. The
+ * prefixes themselves are kept in a hash table per length, so that neither
+ * takes more than a hash lookup per length besides writing the entries
+ * (rte_lpm scans all the prefixes of the same length instead).
+ *
+ * The /0 prefix is not stored: lookups that match nothing return a default.
+ *
+ * Not thread-safe: updates must not run concurrently with lookups. */
+
+#ifndef BESS_UTILS_LPM4_H_
+#define BESS_UTILS_LPM4_H_
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "../mem_alloc.h"
+
+namespace bess {
+namespace utils {
+
+class Lpm4 {
+ public:
+  // Next hops are less than this
+  static const uint32_t kMaxNextHop = 1 << 24;
+
+  Lpm4();
+
+  // Number of prefixes
+  size_t Count() const { return count_; }
+
+  // Bytes used by the tables of entries
+  size_t MemoryUsage() const;
+
+  // Adds a prefix of len bits (1-32), in host order, or replaces its next
+  // hop. The bits of prefix past len are ignored.
+  void Add(uint32_t prefix, int len, uint32_t next_hop);
+
+  // Returns false if there is no such prefix
+  bool Delete(uint32_t prefix, int len);
+
+  void Clear();
+
+  // Returns the next hop of the longest prefix that matches addr (in host
+  // order)
+  uint32_t Lookup(uint32_t addr, uint32_t default_next_hop) const {
+    uint32_t entry = tbl24_[addr >> 8];
+
+    if (entry & kExtended) {
+      entry = tbl8_[(entry >> 8) * 256 + (addr & 0xff)];
+    }
+    return (entry & kLenMask) ? entry >> 8 : default_next_hop;
+  }
+
+  // As Lookup(), for n addresses. The lookups do not depend on each other,
+  // so their cache misses overlap (which AVX2 gathers do no better).
+  void LookupBulk(const uint32_t *addrs, int n, uint32_t default_next_hop,
+                  uint32_t *next_hops) const {
+    for (int i = 0; i < n; i++) {
+      next_hops[i] = Lookup(addrs[i], default_next_hop);
+    }
+  }
+
+ private:
+  // An entry has the next hop, or the index of a group of tbl8_, in its
+  // upper 24 bits, and the length of the prefix (0 if none) in its lower 6
+  static const uint32_t kExtended = 1 << 6;
+  static const uint32_t kLenMask = 0x3f;
+
+  static uint32_t MakeEntry(uint32_t next_hop, int len) {
+    return (next_hop << 8) | len;
+  }
+
+  static uint32_t Mask(int len) { return len ? ~0u << (32 - len) : 0; }
+
+  // Sets the entries of length old_len (or shorter, if old_len is -1) in
+  // [first, last] of the table to entry
+  static void Fill(uint32_t *table, uint32_t first, uint32_t last,
+                   int old_len, uint32_t entry);
+
+  // The entry of the longest prefix shorter than len that covers prefix
+  uint32_t ParentEntry(uint32_t prefix, int len) const;
+
+  uint32_t AllocGroup(uint32_t entry);
+
+  std::vector<uint32_t, bess::memory::Allocator<uint32_t>> tbl24_;
+  std::vector<uint32_t, bess::memory::Allocator<uint32_t>> tbl8_;
+
+  // Number of prefixes longer than 24 bits in each group of tbl8_, which is
+  // freed once there is none
+  std::vector<uint32_t> group_prefixes_;
+  std::vector<uint32_t> free_groups_;
+
+  // The prefixes of each length (masked), and their next hops
+  std::unordered_map<uint32_t, uint32_t> prefixes_[33];
+  size_t count_;
+};
+
+}  // namespace utils
+}  // namespace bess
+
+#endif  // BESS_UTILS_LPM4_H_
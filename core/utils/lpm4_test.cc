@@ -0,0 +1,159 @@
+#include "lpm4.h"
+
+#include <map>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "random.h"
+
+using bess::utils::Lpm4;
+
+namespace {
+
+uint32_t Mask(uint32_t addr, int len) {
+  return len ? addr & (~0u << (32 - len)) : 0;
+}
+
+// Longest prefix match by trying every length
+class ReferenceLpm {
+ public:
+  void Add(uint32_t prefix, int len, uint32_t next_hop) {
+    routes_[{Mask(prefix, len), len}] = next_hop;
+  }
+
+  bool Delete(uint32_t prefix, int len) {
+    return routes_.erase({Mask(prefix, len), len}) > 0;
+  }
+
+  uint32_t Lookup(uint32_t addr, uint32_t default_next_hop) const {
+    for (int len = 32; len > 0; len--) {
+      auto it = routes_.find({Mask(addr, len), len});
+      if (it != routes_.end()) {
+        return it->second;
+      }
+    }
+    return default_next_hop;
+  }
+
+  size_t Count() const { return routes_.size(); }
+
+ private:
+  std::map<std::pair<uint32_t, int>, uint32_t> routes_;
+};
+
+TEST(Lpm4Test, Basic) {
+  Lpm4 lpm;
+
+  lpm.Add(0x0a000000, 8, 1);    // 10.0.0.0/8
+  lpm.Add(0x0a010000, 16, 2);   // 10.1.0.0/16
+  lpm.Add(0x0a010180, 25, 3);   // 10.1.1.128/25
+  lpm.Add(0x0a0101fe, 31, 4);   // 10.1.1.254/31
+  EXPECT_EQ(4, lpm.Count());
+
+  EXPECT_EQ(1, lpm.Lookup(0x0a020304, 0));
+  EXPECT_EQ(2, lpm.Lookup(0x0a010001, 0));
+  EXPECT_EQ(2, lpm.Lookup(0x0a01017f, 0));
+  EXPECT_EQ(3, lpm.Lookup(0x0a010180, 0));
+  EXPECT_EQ(4, lpm.Lookup(0x0a0101ff, 0));
+  EXPECT_EQ(9, lpm.Lookup(0x0b000000, 9));
+
+  // Bits past the length do not matter
+  lpm.Add(0x0a0101ff, 24, 5);
+  EXPECT_EQ(5, lpm.Lookup(0x0a010101, 0));
+  EXPECT_EQ(3, lpm.Lookup(0x0a010180, 0));
+
+  // Shorter prefixes only show where the longer ones do not
+  lpm.Add(0x0a010100, 23, 6);
+  EXPECT_EQ(5, lpm.Lookup(0x0a010101, 0));
+  EXPECT_EQ(6, lpm.Lookup(0x0a010001, 0));
+
+  lpm.Add(0x0a010180, 25, 7);
+  EXPECT_EQ(6, lpm.Count());
+  EXPECT_EQ(7, lpm.Lookup(0x0a010180, 0));
+
+  EXPECT_TRUE(lpm.Delete(0x0a010100, 24));
+  EXPECT_FALSE(lpm.Delete(0x0a010100, 24));
+  EXPECT_FALSE(lpm.Delete(0x0a010100, 22));
+  EXPECT_EQ(6, lpm.Lookup(0x0a010101, 0));
+  EXPECT_EQ(7, lpm.Lookup(0x0a010180, 0));
+
+  EXPECT_TRUE(lpm.Delete(0x0a010180, 25));
+  EXPECT_TRUE(lpm.Delete(0x0a0101fe, 31));
+  EXPECT_EQ(6, lpm.Lookup(0x0a0101ff, 0));
+
+  lpm.Clear();
+  EXPECT_EQ(0, lpm.Count());
+  EXPECT_EQ(8, lpm.Lookup(0x0a010101, 8));
+}
+
+// Random, overlapping prefixes of all lengths (mostly 16 bits or more), with
+// deletions that leave groups of entries empty, against the reference
+TEST(Lpm4Test, Random) {
+  const int kNumBases = 16;
+  const int kBulk = 37;
+  Random rng;
+  rng.SetSeed(0);
+
+  Lpm4 lpm;
+  ReferenceLpm ref;
+  std::vector<std::pair<uint32_t, int>> prefixes;
+
+  // Prefixes are under a few bases, so that many overlap
+  std::vector<uint32_t> bases;
+  for (int i = 0; i < kNumBases; i++) {
+    bases.push_back(rng.Get());
+  }
+
+  auto random_address = [&]() {
+    int len = rng.GetRange(33);
+    return Mask(bases[rng.GetRange(kNumBases)], len) |
+           (rng.Get() & ~Mask(~0u, len));
+  };
+
+  for (int round = 0; round < 4; round++) {
+    for (int op = 0; op < 20000; op++) {
+      if (prefixes.empty() || rng.GetRange(3)) {
+        uint32_t prefix = random_address();
+        // Short prefixes cover millions of entries, so they are rare
+        int len = rng.GetRange(256) ? rng.GetRange(17) + 16
+                                    : rng.GetRange(32) + 1;
+        uint32_t next_hop = rng.GetRange(Lpm4::kMaxNextHop);
+        lpm.Add(prefix, len, next_hop);
+        ref.Add(prefix, len, next_hop);
+        prefixes.emplace_back(prefix, len);
+      } else {
+        size_t i = rng.GetRange(prefixes.size());
+        auto prefix = prefixes[i];
+        prefixes[i] = prefixes.back();
+        prefixes.pop_back();
+        EXPECT_EQ(ref.Delete(prefix.first, prefix.second),
+                  lpm.Delete(prefix.first, prefix.second));
+      }
+    }
+    ASSERT_EQ(ref.Count(), lpm.Count());
+
+    for (int i = 0; i < 20000; i += kBulk) {
+      uint32_t addrs[kBulk];
+      uint32_t next_hops[kBulk];
+
+      for (int j = 0; j < kBulk; j++) {
+        addrs[j] = random_address();
+      }
+      lpm.LookupBulk(addrs, kBulk, UINT32_MAX, next_hops);
+
+      for (int j = 0; j < kBulk; j++) {
+        ASSERT_EQ(ref.Lookup(addrs[j], UINT32_MAX), next_hops[j]);
+      }
+    }
+  }
+
+  for (const auto &prefix : prefixes) {
+    lpm.Delete(prefix.first, prefix.second);
+  }
+  EXPECT_EQ(0, lpm.Count());
+  EXPECT_EQ(UINT32_MAX, lpm.Lookup(bases[0], UINT32_MAX));
+}
+
+}  // namespace (unnamed)
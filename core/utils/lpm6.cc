@@ -0,0 +1,393 @@
+#include "lpm6.h"
+
+#include <glog/logging.h>
+
+namespace bess {
+namespace utils {
+
+namespace {
+
+// Per value of a byte, the bits of the internal bitmap of the prefixes that
+// match it, one per length
+struct MatchMasks {
+  MatchMasks() : masks() {
+    for (int b = 0; b < 256; b++) {
+      for (int l = 1; l <= 8; l++) {
+        int pos = (1 << l) - 2 + (b >> (8 - l));
+        masks[b][pos / 64] |= 1ULL << (pos % 64);
+      }
+    }
+  }
+
+  uint64_t masks[256][8];
+};
+
+const MatchMasks match_masks;
+
+int Popcount(const uint64_t *bitmap, int words) {
+  int cnt = 0;
+  for (int w = 0; w < words; w++) {
+    cnt += __builtin_popcountll(bitmap[w]);
+  }
+  return cnt;
+}
+
+}  // namespace (unnamed)
+
+template <typename T, int MaxLen>
+uint32_t Lpm6::Pool<T, MaxLen>::Alloc(int len) {
+  DCHECK_LE(len, MaxLen);
+
+  if (!free[len].empty()) {
+    uint32_t run = free[len].back();
+    free[len].pop_back();
+    return run;
+  }
+
+  size_t run = elems.size();
+  CHECK_LE(run + len, static_cast<size_t>(UINT32_MAX));
+  elems.resize(run + len);
+  return run;
+}
+
+template <typename T, int MaxLen>
+void Lpm6::Pool<T, MaxLen>::Free(uint32_t run, int len) {
+  free[len].push_back(run);
+}
+
+template <typename T, int MaxLen>
+void Lpm6::Pool<T, MaxLen>::Clear() {
+  elems.clear();
+  elems.shrink_to_fit();
+  for (auto &runs : free) {
+    runs.clear();
+  }
+}
+
+template <typename T, int MaxLen>
+uint32_t Lpm6::Pool<T, MaxLen>::Insert(uint32_t run, int len, int pos,
+                                        const T &elem) {
+  uint32_t new_run = Alloc(len + 1);
+
+  for (int i = 0; i < pos; i++) {
+    elems[new_run + i] = elems[run + i];
+  }
+  elems[new_run + pos] = elem;
+  for (int i = pos; i < len; i++) {
+    elems[new_run + i + 1] = elems[run + i];
+  }
+
+  if (len > 0) {
+    Free(run, len);
+  }
+  return new_run;
+}
+
+template <typename T, int MaxLen>
+uint32_t Lpm6::Pool<T, MaxLen>::Erase(uint32_t run, int len, int pos) {
+  uint32_t new_run = 0;
+
+  if (len > 1) {
+    new_run = Alloc(len - 1);
+    for (int i = 0; i < pos; i++) {
+      elems[new_run + i] = elems[run + i];
+    }
+    for (int i = pos + 1; i < len; i++) {
+      elems[new_run + i - 1] = elems[run + i];
+    }
+  }
+
+  Free(run, len);
+  return new_run;
+}
+
+Lpm6::Lpm6()
+    : slots_(kNumSlots, {kNone, 0, 0}),
+      short_prefixes_(),
+      nodes_(),
+      next_hops_(),
+      count_() {}
+
+size_t Lpm6::MemoryUsage() const {
+  return slots_.size() * sizeof(Slot) +
+         nodes_.elems.capacity() * sizeof(Node) +
+         next_hops_.elems.capacity() * sizeof(uint32_t);
+}
+
+int Lpm6::LongestMatch(const Node &node, uint8_t b) {
+  // The prefixes of lengths 8 and 7 are tested one by one, and all the
+  // shorter ones are in the first two words (bits 0-125)
+  int pos = 254 + b;
+  if (TestBit(node.internal, pos)) {
+    return pos;
+  }
+
+  pos = 126 + (b >> 1);
+  if (TestBit(node.internal, pos)) {
+    return pos;
+  }
+
+  const uint64_t *mask = match_masks.masks[b];
+  uint64_t bits = node.internal[1] & mask[1];
+  if (bits) {
+    return 127 - __builtin_clzll(bits);
+  }
+
+  bits = node.internal[0] & mask[0];
+  if (bits) {
+    return 63 - __builtin_clzll(bits);
+  }
+  return -1;
+}
+
+uint32_t Lpm6::AddChild(uint32_t node, uint8_t b) {
+  const Node &n = nodes_.elems[node];
+  int rank = Rank(n.external, b);
+
+  if (TestBit(n.external, b)) {
+    return n.children + rank;
+  }
+
+  // May move the nodes, so n is not valid anymore
+  uint32_t children =
+      nodes_.Insert(n.children, Popcount(n.external, 4), rank, Node());
+
+  Node &parent = nodes_.elems[node];
+  parent.children = children;
+  parent.external[b / 64] |= 1ULL << (b % 64);
+  return children + rank;
+}
+
+void Lpm6::UpdateSlots(uint16_t prefix, int len) {
+  uint32_t first = prefix;
+  uint32_t last = first + (1 << (kSlotBits - len)) - 1;
+  Slot match = {kNone, 0, 0};
+
+  auto it = short_prefixes_.find({prefix, len});
+  if (it != short_prefixes_.end()) {
+    // Added: the slots with a shorter match (or this one) now match it
+    for (uint32_t i = first; i <= last; i++) {
+      if (slots_[i].len <= len) {
+        slots_[i].next_hop = it->second;
+        slots_[i].len = len;
+      }
+    }
+    return;
+  }
+
+  // Deleted: the slots that matched it now match the longest shorter prefix,
+  // which covers all of them
+  for (int l = len - 1; l > 0; l--) {
+    uint16_t masked = prefix & (0xffff << (kSlotBits - l));
+    it = short_prefixes_.find({masked, l});
+    if (it != short_prefixes_.end()) {
+      match.next_hop = it->second;
+      match.len = l;
+      break;
+    }
+  }
+
+  for (uint32_t i = first; i <= last; i++) {
+    if (slots_[i].len == len) {
+      slots_[i].next_hop = match.next_hop;
+      slots_[i].len = match.len;
+    }
+  }
+}
+
+void Lpm6::Add(const void *prefix, int len, uint32_t next_hop) {
+  const uint8_t *bytes = static_cast<const uint8_t *>(prefix);
+  uint16_t slot_index = SlotIndex(prefix);
+
+  DCHECK(len >= 1 && len <= 128);
+
+  if (len <= kSlotBits) {
+    uint16_t masked = slot_index & (0xffff << (kSlotBits - len));
+    auto ret = short_prefixes_.emplace(std::make_pair(masked, len), next_hop);
+    if (ret.second) {
+      count_++;
+    } else {
+      ret.first->second = next_hop;
+    }
+    UpdateSlots(masked, len);
+    return;
+  }
+
+  int depth = (len - 1) / 8;
+  int l = len - depth * 8;
+  uint32_t node = slots_[slot_index].root;
+
+  if (node == kNone) {
+    node = nodes_.Alloc(1);
+    nodes_.elems[node] = Node();
+    slots_[slot_index].root = node;
+  }
+
+  for (int d = 2; d < depth; d++) {
+    node = AddChild(node, bytes[d]);
+  }
+
+  Node &n = nodes_.elems[node];
+  int pos = (1 << l) - 2 + (bytes[depth] >> (8 - l));
+  int rank = Rank(n.internal, pos);
+
+  if (TestBit(n.internal, pos)) {
+    next_hops_.elems[n.next_hops + rank] = next_hop;
+    return;
+  }
+
+  n.next_hops = next_hops_.Insert(n.next_hops, Popcount(n.internal, 8), rank,
+                                  next_hop);
+  n.internal[pos / 64] |= 1ULL << (pos % 64);
+  count_++;
+}
+
+bool Lpm6::Delete(const void *prefix, int len) {
+  const uint8_t *bytes = static_cast<const uint8_t *>(prefix);
+  uint16_t slot_index = SlotIndex(prefix);
+
+  if (len < 1 || len > 128) {
+    return false;
+  }
+
+  if (len <= kSlotBits) {
+    uint16_t masked = slot_index & (0xffff << (kSlotBits - len));
+    if (!short_prefixes_.erase({masked, len})) {
+      return false;
+    }
+    count_--;
+    UpdateSlots(masked, len);
+    return true;
+  }
+
+  int depth = (len - 1) / 8;
+  int l = len - depth * 8;
+  uint32_t path[kAddressSize];
+  uint32_t node = slots_[slot_index].root;
+
+  if (node == kNone) {
+    return false;
+  }
+
+  for (int d = 2; d < depth; d++) {
+    const Node &n = nodes_.elems[node];
+    if (!TestBit(n.external, bytes[d])) {
+      return false;
+    }
+    path[d] = node;
+    node = n.children + Rank(n.external, bytes[d]);
+  }
+
+  Node &n = nodes_.elems[node];
+  int pos = (1 << l) - 2 + (bytes[depth] >> (8 - l));
+
+  if (!TestBit(n.internal, pos)) {
+    return false;
+  }
+
+  n.next_hops = next_hops_.Erase(n.next_hops, Popcount(n.internal, 8),
+                                 Rank(n.internal, pos));
+  n.internal[pos / 64] &= ~(1ULL << (pos % 64));
+  count_--;
+
+  // Removes the nodes left empty, from the one of the prefix up
+  for (int d = depth; d >= 2; d--) {
+    const Node &child = nodes_.elems[node];
+    if (Popcount(child.internal, 8) || Popcount(child.external, 4)) {
+      break;
+    }
+
+    if (d == 2) {
+      nodes_.Free(node, 1);
+      slots_[slot_index].root = kNone;
+      break;
+    }
+
+    const Node &p = nodes_.elems[path[d - 1]];
+    uint8_t b = bytes[d - 1];
+    uint32_t children =
+        nodes_.Erase(p.children, Popcount(p.external, 4), Rank(p.external, b));
+
+    Node &parent = nodes_.elems[path[d - 1]];
+    parent.children = children;
+    parent.external[b / 64] &= ~(1ULL << (b % 64));
+    node = path[d - 1];
+  }
+
+  return true;
+}
+
+void Lpm6::Clear() {
+  slots_.assign(kNumSlots, {kNone, 0, 0});
+  short_prefixes_.clear();
+  nodes_.Clear();
+  next_hops_.Clear();
+  count_ = 0;
+}
+
+void Lpm6::LookupBulk(const void *const *addrs, int n,
+                      uint32_t default_next_hop, uint32_t *next_hops) const {
+  const Node *nodes = nodes_.elems.data();
+  uint32_t curr[kMaxBulk];
+  uint32_t best[kMaxBulk];  // node of the last match in the trees
+  int best_pos[kMaxBulk];   // and its position in the internal bitmap
+  int active[kMaxBulk];
+  int num_active = 0;
+
+  DCHECK_LE(n, kMaxBulk);
+
+  for (int i = 0; i < n; i++) {
+    __builtin_prefetch(&slots_[SlotIndex(addrs[i])]);
+  }
+
+  for (int i = 0; i < n; i++) {
+    const Slot &slot = slots_[SlotIndex(addrs[i])];
+
+    next_hops[i] = slot.len ? slot.next_hop : default_next_hop;
+    best[i] = kNone;
+    curr[i] = slot.root;
+    if (curr[i] != kNone) {
+      __builtin_prefetch(&nodes[curr[i]]);
+      __builtin_prefetch(reinterpret_cast<const char *>(&nodes[curr[i]]) + 64);
+      active[num_active++] = i;
+    }
+  }
+
+  // A level at a time, with the nodes of the next one prefetched
+  for (int d = 2; d < kAddressSize && num_active > 0; d++) {
+    int num_next = 0;
+
+    for (int j = 0; j < num_active; j++) {
+      int i = active[j];
+      const Node &node = nodes[curr[i]];
+      uint8_t b = static_cast<const uint8_t *>(addrs[i])[d];
+
+      int pos = LongestMatch(node, b);
+      if (pos >= 0) {
+        best[i] = curr[i];
+        best_pos[i] = pos;
+      }
+
+      if (TestBit(node.external, b)) {
+        curr[i] = node.children + Rank(node.external, b);
+        __builtin_prefetch(&nodes[curr[i]]);
+        __builtin_prefetch(reinterpret_cast<const char *>(&nodes[curr[i]]) +
+                           64);
+        active[num_next++] = i;
+      }
+    }
+
+    num_active = num_next;
+  }
+
+  for (int i = 0; i < n; i++) {
+    if (best[i] != kNone) {
+      const Node &node = nodes[best[i]];
+      next_hops[i] =
+          next_hops_.elems[node.next_hops + Rank(node.internal, best_pos[i])];
+    }
+  }
+}
+
+}  // namespace utils
+}  // namespace bess
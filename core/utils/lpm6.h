@@ -0,0 +1,154 @@
+/* Longest prefix match of IPv6 addresses, with an initial array indexed by
+ * the first 16 bits, and then a tree bitmap (after Eatherton et al.) of 8-bit
+ * strides.
+ *
+ * A slot of the initial array has the longest match among the prefixes of up
+ * to 16 bits, and the root of a tree for the longer prefixes under it, if
+ * any. A node at depth d (>= 2) stands for a prefix of 8d bits. Its internal
+ * bitmap has a bit per prefix of length 8d + 1 to 8d + 8 under it (510 in
+ * all), and its external bitmap a bit per child, i.e., per value of the next
+ * byte. The children of a node are contiguous, and so are its next hops, so
+ * that a node only keeps the index of the first of each; the rank of a bit in
+ * a bitmap is the offset of what it stands for. A lookup visits a node per
+ * byte of the address, as long as there is a child for it, and keeps the last
+ * match.
+ *
+ * The /0 prefix is not stored: lookups that match nothing return a default.
+ *
+ * Bulk lookups walk all the addresses a level at a time, prefetching the next
+ * node of each, so that the cache misses of a batch overlap.
+ *
+ * Not thread-safe: updates must not run concurrently with lookups. */
+
+#ifndef BESS_UTILS_LPM6_H_
+#define BESS_UTILS_LPM6_H_
+
+#include <cstdint>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "../mem_alloc.h"
+
+namespace bess {
+namespace utils {
+
+class Lpm6 {
+ public:
+  // Addresses and prefixes are 16 bytes, in network order
+  static const int kAddressSize = 16;
+  static const int kMaxBulk = 64;
+
+  Lpm6();
+
+  // Number of prefixes
+  size_t Count() const { return count_; }
+
+  // Bytes used by the initial array, the nodes and the next hops
+  size_t MemoryUsage() const;
+
+  // Adds a prefix of len bits (1-128), or replaces its next hop. The bits of
+  // prefix past len are ignored.
+  void Add(const void *prefix, int len, uint32_t next_hop);
+
+  // Returns false if there is no such prefix
+  bool Delete(const void *prefix, int len);
+
+  void Clear();
+
+  // Returns the next hop of the longest prefix that matches addr
+  uint32_t Lookup(const void *addr, uint32_t default_next_hop) const {
+    uint32_t next_hop;
+    LookupBulk(&addr, 1, default_next_hop, &next_hop);
+    return next_hop;
+  }
+
+  // As Lookup(), for n (<= kMaxBulk) addresses
+  void LookupBulk(const void *const *addrs, int n, uint32_t default_next_hop,
+                  uint32_t *next_hops) const;
+
+ private:
+  static const uint32_t kNone = UINT32_MAX;
+  static const int kSlotBits = 16;
+  static const int kNumSlots = 1 << kSlotBits;
+
+  struct Slot {
+    uint32_t root;      // index of the node at depth 2 in nodes_, or kNone
+    uint32_t next_hop;  // of the longest match of up to 16 bits
+    uint8_t len;        // of that match, or 0 if none
+  };
+
+  struct Node {
+    // Bit (1 << l) - 2 + v for the prefix of length l (1-8) and bits v
+    uint64_t internal[8];
+    // Bit b for the child of byte b
+    uint64_t external[4];
+
+    uint32_t children;  // index of the first child in nodes_
+    uint32_t next_hops;  // index of the first next hop in next_hops_
+  };
+
+  // Runs of contiguous elements of any length up to MaxLen, with a free list
+  // per length
+  template <typename T, int MaxLen>
+  struct Pool {
+    Pool() : elems(), free(MaxLen + 1) {}
+
+    uint32_t Alloc(int len);
+    void Free(uint32_t run, int len);
+    void Clear();
+
+    // Returns a run with elem inserted at pos of (the freed) run
+    uint32_t Insert(uint32_t run, int len, int pos, const T &elem);
+
+    // Returns a run without the elem at pos of (the freed) run
+    uint32_t Erase(uint32_t run, int len, int pos);
+
+    std::vector<T, bess::memory::Allocator<T>> elems;
+    std::vector<std::vector<uint32_t>> free;
+  };
+
+  static bool TestBit(const uint64_t *bitmap, int pos) {
+    return bitmap[pos / 64] & (1ULL << (pos % 64));
+  }
+
+  // Number of bits set below pos
+  static int Rank(const uint64_t *bitmap, int pos) {
+    int rank = 0;
+    for (int w = 0; w < pos / 64; w++) {
+      rank += __builtin_popcountll(bitmap[w]);
+    }
+    return rank + __builtin_popcountll(bitmap[pos / 64] &
+                                       ((1ULL << (pos % 64)) - 1));
+  }
+
+  static uint16_t SlotIndex(const void *addr) {
+    const uint8_t *bytes = static_cast<const uint8_t *>(addr);
+    return (bytes[0] << 8) | bytes[1];
+  }
+
+  // Position of the longest prefix in the node that matches byte b, or -1
+  static int LongestMatch(const Node &node, uint8_t b);
+
+  // Updates the longest matches of the slots under the (masked) prefix of up
+  // to 16 bits, after it was added or deleted
+  void UpdateSlots(uint16_t prefix, int len);
+
+  // Returns the index of the child of the node for byte b, adding it if
+  // there is none
+  uint32_t AddChild(uint32_t node, uint8_t b);
+
+  std::vector<Slot, bess::memory::Allocator<Slot>> slots_;
+
+  // The prefixes of up to 16 bits (masked), by length
+  std::map<std::pair<uint16_t, int>, uint32_t> short_prefixes_;
+
+  Pool<Node, 256> nodes_;
+  Pool<uint32_t, 510> next_hops_;
+  size_t count_;
+};
+
+}  // namespace utils
+}  // namespace bess
+
+#endif  // BESS_UTILS_LPM6_H_
@@ -0,0 +1,186 @@
+// Benchmarks for Lpm6, with BGP-like tables of 10,000 to 1M IPv6 prefixes:
+// providers get /29 or /32 allocations out of a few /12 blocks of registries,
+// and announce them along with more specifics, mostly /48s, in the proportions
+// of the prefix lengths seen in the global routing table. Some providers
+// announce far more prefixes than others.
+
+#include "lpm6.h"
+
+#include <algorithm>
+#include <array>
+#include <map>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "random.h"
+
+using bess::utils::Lpm6;
+
+namespace {
+
+typedef std::array<uint8_t, Lpm6::kAddressSize> Address;
+
+struct Prefix {
+  Address addr;
+  int len;
+};
+
+// Prefix lengths, with their share of the table in percent
+const std::pair<int, int> kLenShares[] = {
+    {48, 46}, {32, 12}, {44, 8}, {40, 7}, {36, 4}, {29, 4}, {46, 3},
+    {47, 2},  {42, 2},  {45, 2}, {33, 2}, {34, 2}, {38, 2}, {28, 1},
+    {30, 1},  {64, 1},  {56, 1},
+};
+
+// Registry blocks: 2001::/16, and 2400::/12 to 2c00::/12
+const uint16_t kBlocks[] = {0x2001, 0x2400, 0x2600, 0x2800, 0x2a00, 0x2c00};
+
+// Sets bits [from, to) of addr to random ones
+void RandomBits(Random *rng, Address *addr, int from, int to) {
+  for (int bit = from; bit < to; bit++) {
+    uint8_t mask = 0x80 >> (bit % 8);
+    if (rng->GetRange(2)) {
+      (*addr)[bit / 8] |= mask;
+    } else {
+      (*addr)[bit / 8] &= ~mask;
+    }
+  }
+}
+
+int RandomLen(Random *rng) {
+  int r = rng->GetRange(100);
+  for (const auto &share : kLenShares) {
+    if (r < share.second) {
+      return share.first;
+    }
+    r -= share.second;
+  }
+  return 48;
+}
+
+const std::vector<Prefix> &GeneratePrefixes(size_t n) {
+  static std::map<size_t, std::vector<Prefix>> cache;
+  std::vector<Prefix> &prefixes = cache[n];
+  if (!prefixes.empty()) {
+    return prefixes;
+  }
+
+  Random rng;
+  rng.SetSeed(n);
+
+  // About one allocation per 8 prefixes
+  std::vector<Prefix> allocs(n / 8 + 1);
+  for (Prefix &alloc : allocs) {
+    uint16_t block = kBlocks[rng.GetRange(6)];
+    alloc.addr = {};
+    alloc.addr[0] = block >> 8;
+    alloc.addr[1] = block & 0xff;
+    alloc.len = rng.GetRange(4) ? 32 : 29;
+    RandomBits(&rng, &alloc.addr, (block == 0x2001) ? 16 : 12, alloc.len);
+  }
+
+  while (prefixes.size() < n) {
+    // Skewed towards the first allocations
+    uint32_t r = rng.GetRange(allocs.size());
+    const Prefix &alloc = allocs[static_cast<uint64_t>(r) * r / allocs.size()];
+
+    Prefix prefix = alloc;
+    prefix.len = RandomLen(&rng);
+    RandomBits(&rng, &prefix.addr, alloc.len, std::max(prefix.len, alloc.len));
+    prefixes.push_back(prefix);
+  }
+
+  return prefixes;
+}
+
+// Destinations within random prefixes (which more specific ones may cover)
+std::vector<Address> GenerateAddresses(const std::vector<Prefix> &prefixes,
+                                       size_t n) {
+  Random rng;
+  rng.SetSeed(0);
+
+  std::vector<Address> addrs;
+  for (size_t i = 0; i < n; i++) {
+    Address addr = prefixes[rng.GetRange(prefixes.size())].addr;
+    RandomBits(&rng, &addr, 64, 128);
+    addrs.push_back(addr);
+  }
+  return addrs;
+}
+
+void Build(const std::vector<Prefix> &prefixes, Lpm6 *lpm) {
+  for (size_t i = 0; i < prefixes.size(); i++) {
+    lpm->Add(prefixes[i].addr.data(), prefixes[i].len, i);
+  }
+}
+
+const size_t kNumAddresses = 1 << 16;
+
+}  // namespace (unnamed)
+
+static void BM_Lpm6Lookup(benchmark::State &state) {
+  const std::vector<Prefix> &prefixes = GeneratePrefixes(state.range(0));
+  std::vector<Address> addrs = GenerateAddresses(prefixes, kNumAddresses);
+  Lpm6 lpm;
+  Build(prefixes, &lpm);
+  size_t i = 0;
+
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(
+        lpm.Lookup(addrs[i++ % kNumAddresses].data(), UINT32_MAX));
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  state.counters["MB"] = lpm.MemoryUsage() / 1e6;
+}
+
+// In batches of 32
+static void BM_Lpm6LookupBulk(benchmark::State &state) {
+  const int kBatch = 32;
+  const std::vector<Prefix> &prefixes = GeneratePrefixes(state.range(0));
+  std::vector<Address> addrs = GenerateAddresses(prefixes, kNumAddresses);
+  std::vector<const void *> addr_ptrs;
+  uint32_t next_hops[kBatch];
+  Lpm6 lpm;
+  Build(prefixes, &lpm);
+  size_t i = 0;
+
+  for (const Address &addr : addrs) {
+    addr_ptrs.push_back(addr.data());
+  }
+
+  while (state.KeepRunning()) {
+    lpm.LookupBulk(&addr_ptrs[i], kBatch, UINT32_MAX, next_hops);
+    benchmark::DoNotOptimize(next_hops[0]);
+    i = (i + kBatch) % kNumAddresses;
+  }
+
+  state.SetItemsProcessed(state.iterations() * kBatch);
+  state.counters["MB"] = lpm.MemoryUsage() / 1e6;
+}
+
+// Adding all the prefixes, then deleting them
+static void BM_Lpm6Update(benchmark::State &state) {
+  const std::vector<Prefix> &prefixes = GeneratePrefixes(state.range(0));
+
+  while (state.KeepRunning()) {
+    Lpm6 lpm;
+    Build(prefixes, &lpm);
+    for (const Prefix &prefix : prefixes) {
+      lpm.Delete(prefix.addr.data(), prefix.len);
+    }
+    benchmark::DoNotOptimize(lpm.Count());
+  }
+
+  state.SetItemsProcessed(state.iterations() * prefixes.size() * 2);
+}
+
+BENCHMARK(BM_Lpm6Lookup)->RangeMultiplier(10)->Range(10000, 1000000);
+BENCHMARK(BM_Lpm6LookupBulk)->RangeMultiplier(10)->Range(10000, 1000000);
+BENCHMARK(BM_Lpm6Update)
+    ->RangeMultiplier(10)
+    ->Range(10000, 1000000)
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
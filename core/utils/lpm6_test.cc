@@ -0,0 +1,180 @@
+#include "lpm6.h"
+
+#include <algorithm>
+#include <array>
+#include <initializer_list>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "random.h"
+
+using bess::utils::Lpm6;
+
+namespace {
+
+typedef std::array<uint8_t, 16> Address;
+
+Address MakeAddress(std::initializer_list<uint8_t> bytes) {
+  Address addr = {};
+  std::copy(bytes.begin(), bytes.end(), addr.begin());
+  return addr;
+}
+
+Address Mask(Address addr, int len) {
+  for (int i = 0; i < 16; i++) {
+    int bits = std::min(std::max(len - i * 8, 0), 8);
+    addr[i] &= bits ? 0xff << (8 - bits) : 0;
+  }
+  return addr;
+}
+
+// Longest prefix match by trying every length
+class ReferenceLpm {
+ public:
+  void Add(const Address &prefix, int len, uint32_t next_hop) {
+    routes_[{Mask(prefix, len), len}] = next_hop;
+  }
+
+  bool Delete(const Address &prefix, int len) {
+    return routes_.erase({Mask(prefix, len), len}) > 0;
+  }
+
+  uint32_t Lookup(const Address &addr, uint32_t default_next_hop) const {
+    for (int len = 128; len > 0; len--) {
+      auto it = routes_.find({Mask(addr, len), len});
+      if (it != routes_.end()) {
+        return it->second;
+      }
+    }
+    return default_next_hop;
+  }
+
+  size_t Count() const { return routes_.size(); }
+
+ private:
+  std::map<std::pair<Address, int>, uint32_t> routes_;
+};
+
+TEST(Lpm6Test, Basic) {
+  Lpm6 lpm;
+  Address p32 = MakeAddress({0x20, 0x01, 0x0d, 0xb8});
+  Address p48 = MakeAddress({0x20, 0x01, 0x0d, 0xb8, 0x00, 0x01});
+  Address p127 = MakeAddress({0x20, 0x01, 0x0d, 0xb8, 0x00, 0x01, 0, 0, 0, 0,
+                              0, 0, 0, 0, 0, 0xfe});
+
+  lpm.Add(p32.data(), 32, 1);
+  lpm.Add(p48.data(), 48, 2);
+  lpm.Add(p127.data(), 127, 3);
+  EXPECT_EQ(3, lpm.Count());
+
+  EXPECT_EQ(2, lpm.Lookup(p48.data(), 0));
+  EXPECT_EQ(3, lpm.Lookup(p127.data(), 0));
+  p127[15] = 0xff;
+  EXPECT_EQ(3, lpm.Lookup(p127.data(), 0));
+  p127[15] = 0xfd;
+  EXPECT_EQ(2, lpm.Lookup(p127.data(), 0));
+  Address other48 = p48;
+  other48[5] = 2;
+  EXPECT_EQ(1, lpm.Lookup(other48.data(), 0));
+  EXPECT_EQ(9, lpm.Lookup(MakeAddress({0x20, 0x02}).data(), 9));
+
+  // Bits past the length do not matter
+  Address p1 = MakeAddress({0xff});
+  lpm.Add(p1.data(), 1, 4);
+  EXPECT_EQ(4, lpm.Lookup(MakeAddress({0x80}).data(), 0));
+  EXPECT_EQ(1, lpm.Lookup(p32.data(), 0));
+
+  lpm.Add(p32.data(), 32, 5);
+  EXPECT_EQ(4, lpm.Count());
+  EXPECT_EQ(5, lpm.Lookup(p32.data(), 0));
+
+  EXPECT_TRUE(lpm.Delete(p48.data(), 48));
+  EXPECT_FALSE(lpm.Delete(p48.data(), 48));
+  EXPECT_FALSE(lpm.Delete(p48.data(), 47));
+  EXPECT_EQ(5, lpm.Lookup(MakeAddress({0x20, 0x01, 0x0d, 0xb8, 0, 1}).data(),
+                          0));
+
+  lpm.Clear();
+  EXPECT_EQ(0, lpm.Count());
+  EXPECT_EQ(7, lpm.Lookup(p32.data(), 7));
+}
+
+// Random, overlapping prefixes of all lengths, with deletions that leave
+// nodes empty, against the reference
+TEST(Lpm6Test, Random) {
+  const int kNumBases = 16;
+  Random rng;
+  rng.SetSeed(0);
+
+  Lpm6 lpm;
+  ReferenceLpm ref;
+  std::vector<std::pair<Address, int>> prefixes;
+
+  // Prefixes are under a few bases, so that many overlap
+  std::vector<Address> bases;
+  for (int i = 0; i < kNumBases; i++) {
+    Address base;
+    for (auto &byte : base) {
+      byte = rng.GetRange(256);
+    }
+    bases.push_back(base);
+  }
+
+  auto random_address = [&]() {
+    Address addr = bases[rng.GetRange(kNumBases)];
+    int len = rng.GetRange(129);
+    for (int i = len / 8; i < 16; i++) {
+      addr[i] = rng.GetRange(256);
+    }
+    return addr;
+  };
+
+  for (int round = 0; round < 4; round++) {
+    for (int op = 0; op < 20000; op++) {
+      if (prefixes.empty() || rng.GetRange(3)) {
+        Address prefix = random_address();
+        int len = rng.GetRange(128) + 1;
+        uint32_t next_hop = rng.Get();
+        lpm.Add(prefix.data(), len, next_hop);
+        ref.Add(prefix, len, next_hop);
+        prefixes.emplace_back(prefix, len);
+      } else {
+        size_t i = rng.GetRange(prefixes.size());
+        auto prefix = prefixes[i];
+        prefixes[i] = prefixes.back();
+        prefixes.pop_back();
+        EXPECT_EQ(ref.Delete(prefix.first, prefix.second),
+                  lpm.Delete(prefix.first.data(), prefix.second));
+      }
+    }
+    ASSERT_EQ(ref.Count(), lpm.Count());
+
+    for (int i = 0; i < 20000; i += Lpm6::kMaxBulk) {
+      Address addrs[Lpm6::kMaxBulk];
+      const void *addr_ptrs[Lpm6::kMaxBulk];
+      uint32_t next_hops[Lpm6::kMaxBulk];
+      int n = rng.GetRange(Lpm6::kMaxBulk) + 1;
+
+      for (int j = 0; j < n; j++) {
+        addrs[j] = random_address();
+        addr_ptrs[j] = addrs[j].data();
+      }
+      lpm.LookupBulk(addr_ptrs, n, UINT32_MAX, next_hops);
+
+      for (int j = 0; j < n; j++) {
+        ASSERT_EQ(ref.Lookup(addrs[j], UINT32_MAX), next_hops[j]);
+      }
+    }
+  }
+
+  for (const auto &prefix : prefixes) {
+    lpm.Delete(prefix.first.data(), prefix.second);
+  }
+  EXPECT_EQ(0, lpm.Count());
+  EXPECT_EQ(UINT32_MAX, lpm.Lookup(bases[0].data(), UINT32_MAX));
+}
+
+}  // namespace (unnamed)
@@ -0,0 +1,91 @@
+#include "maglev.h"
+
+#include <algorithm>
+
+#include <glog/logging.h>
+
+namespace bess {
+namespace utils {
+
+// Seeds of the hashes of backend IDs that decide their permutations
+static const uint64_t kOffsetSeed = 0x5851f42d4c957f2dull;
+static const uint64_t kSkipSeed = 0x14057b7ef767814full;
+
+// The finalizer of SplitMix64, so that consecutive IDs (e.g., gate numbers)
+// get unrelated permutations
+static inline uint64_t Mix(uint64_t v) {
+  v = (v ^ (v >> 30)) * 0xbf58476d1ce4e5b9ull;
+  v = (v ^ (v >> 27)) * 0x94d049bb133111ebull;
+  return v ^ (v >> 31);
+}
+
+bool Maglev::IsPrime(uint64_t n) {
+  if (n < 2) {
+    return false;
+  }
+
+  for (uint64_t d = 2; d * d <= n; d++) {
+    if (n % d == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void Maglev::Populate(const std::vector<Backend> &backends,
+                      std::vector<int> *table) {
+  const uint64_t size = table->size();
+  const size_t n = backends.size();
+
+  DCHECK(IsPrime(size));
+  DCHECK_GE(size, n);
+
+  std::fill(table->begin(), table->end(), -1);
+
+  uint32_t max_weight = 0;
+  for (const Backend &backend : backends) {
+    DCHECK_LE(backend.weight, kMaxWeight);
+    max_weight = std::max(max_weight, backend.weight);
+  }
+  if (max_weight == 0) {
+    return;
+  }
+
+  // The permutation of backend i is next[i] + j * skip[i] (mod size), for
+  // j = 0, 1, ... As size is a prime, it goes through every entry.
+  std::vector<uint64_t> next(n);
+  std::vector<uint64_t> skip(n);
+  for (size_t i = 0; i < n; i++) {
+    next[i] = Mix(backends[i].id ^ kOffsetSeed) % size;
+    skip[i] = Mix(backends[i].id ^ kSkipSeed) % (size - 1) + 1;
+  }
+
+  // A backend takes its turn whenever it has gathered max_weight credits
+  std::vector<uint32_t> credits(n);
+  uint64_t filled = 0;
+
+  while (true) {
+    for (size_t i = 0; i < n; i++) {
+      credits[i] += backends[i].weight;
+      if (credits[i] < max_weight) {
+        continue;
+      }
+      credits[i] -= max_weight;
+
+      while ((*table)[next[i]] >= 0) {
+        next[i] += skip[i];
+        if (next[i] >= size) {
+          next[i] -= size;
+        }
+      }
+
+      (*table)[next[i]] = i;
+      if (++filled == size) {
+        return;
+      }
+    }
+  }
+}
+
+}  // namespace utils
+}  // namespace bess
@@ -0,0 +1,45 @@
+/* Maglev consistent hashing (after Eisenbud et al., NSDI '16): a lookup
+ * table of a prime number of entries, each of a backend, that flows index by
+ * their hash. Every backend has its own permutation of the entries, and
+ * backends take turns to claim the next free entry of their permutation
+ * until the table is full. Since the permutation of a backend depends only on
+ * its ID, adding or removing a backend changes few entries of the others, and
+ * every backend gets about the same number of entries (or in proportion to
+ * its weight, as backends with lower weights skip some of their turns).
+ *
+ * The table needs to be much larger than the number of backends for the
+ * shares to be even: with 100 times as many entries, they are within about
+ * 1% of each other. */
+
+#ifndef BESS_UTILS_MAGLEV_H_
+#define BESS_UTILS_MAGLEV_H_
+
+#include <cstdint>
+#include <vector>
+
+namespace bess {
+namespace utils {
+
+class Maglev {
+ public:
+  struct Backend {
+    uint64_t id;      // Decides the permutation, so must be unique
+    uint32_t weight;  // 0 for no entries
+  };
+
+  // Backends must not weigh more than this
+  static const uint32_t kMaxWeight = 100;
+
+  static bool IsPrime(uint64_t n);
+
+  // Fills *table with the indices of backends. Its size must be a prime,
+  // and not less than the number of backends. Entries are -1 if all backends
+  // weigh 0.
+  static void Populate(const std::vector<Backend> &backends,
+                       std::vector<int> *table);
+};
+
+}  // namespace utils
+}  // namespace bess
+
+#endif  // BESS_UTILS_MAGLEV_H_
@@ -0,0 +1,123 @@
+#include "maglev.h"
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using bess::utils::Maglev;
+
+namespace {
+
+const int kTableSize = 65537;
+
+std::vector<Maglev::Backend> MakeBackends(int n) {
+  std::vector<Maglev::Backend> backends;
+  for (int i = 0; i < n; i++) {
+    backends.push_back({static_cast<uint64_t>(i), 1});
+  }
+  return backends;
+}
+
+std::vector<int> Populate(const std::vector<Maglev::Backend> &backends) {
+  std::vector<int> table(kTableSize);
+  Maglev::Populate(backends, &table);
+  return table;
+}
+
+// Entries per backend
+std::vector<int> Shares(const std::vector<int> &table, int n) {
+  std::vector<int> shares(n);
+  for (int backend : table) {
+    shares[backend]++;
+  }
+  return shares;
+}
+
+// Fraction of entries that changed backend (by ID)
+double Disruption(const std::vector<Maglev::Backend> &old_backends,
+                  const std::vector<int> &old_table,
+                  const std::vector<Maglev::Backend> &new_backends,
+                  const std::vector<int> &new_table) {
+  int changed = 0;
+  for (int i = 0; i < kTableSize; i++) {
+    changed += old_backends[old_table[i]].id != new_backends[new_table[i]].id;
+  }
+  return static_cast<double>(changed) / kTableSize;
+}
+
+TEST(MaglevTest, IsPrime) {
+  EXPECT_FALSE(Maglev::IsPrime(0));
+  EXPECT_FALSE(Maglev::IsPrime(1));
+  EXPECT_TRUE(Maglev::IsPrime(2));
+  EXPECT_TRUE(Maglev::IsPrime(251));
+  EXPECT_FALSE(Maglev::IsPrime(65536));
+  EXPECT_TRUE(Maglev::IsPrime(65537));
+  EXPECT_FALSE(Maglev::IsPrime(65537ull * 65537));
+}
+
+TEST(MaglevTest, Balance) {
+  for (int n : {1, 3, 10, 100}) {
+    std::vector<int> shares = Shares(Populate(MakeBackends(n)), n);
+    for (int share : shares) {
+      EXPECT_NEAR(kTableSize / n, share, 1) << n << " backends";
+    }
+  }
+
+  // As many backends as entries
+  std::vector<int> table(251);
+  Maglev::Populate(MakeBackends(251), &table);
+  for (int share : Shares(table, 251)) {
+    EXPECT_EQ(1, share);
+  }
+}
+
+TEST(MaglevTest, Weights) {
+  std::vector<Maglev::Backend> backends = {
+      {10, 1}, {11, 2}, {12, Maglev::kMaxWeight}, {13, 0}, {14, 7}};
+  std::vector<int> shares = Shares(Populate(backends), backends.size());
+  const int total = 1 + 2 + Maglev::kMaxWeight + 7;
+
+  for (size_t i = 0; i < backends.size(); i++) {
+    EXPECT_NEAR(kTableSize * backends[i].weight / total, shares[i], 2);
+  }
+
+  for (int backend : Populate({{10, 0}, {11, 0}})) {
+    ASSERT_EQ(-1, backend);
+  }
+}
+
+// Only about the entries of a backend that leaves move, and a new backend
+// takes about its share from the others
+TEST(MaglevTest, Disruption) {
+  const int kNumBackends = 20;
+  std::vector<Maglev::Backend> backends = MakeBackends(kNumBackends);
+  std::vector<int> table = Populate(backends);
+
+  for (int i = 0; i < kNumBackends; i += 7) {
+    std::vector<Maglev::Backend> fewer = backends;
+    fewer.erase(fewer.begin() + i);
+    std::vector<int> fewer_table = Populate(fewer);
+
+    double disruption = Disruption(backends, table, fewer, fewer_table);
+    EXPECT_LE(1.0 / kNumBackends, disruption);
+    EXPECT_GE(1.25 / kNumBackends, disruption);
+
+    // Adding it back restores the table
+    EXPECT_EQ(table, Populate(backends));
+  }
+
+  std::vector<Maglev::Backend> more = backends;
+  more.push_back({kNumBackends, 1});
+  double disruption = Disruption(backends, table, more, Populate(more));
+  EXPECT_LE(1.0 / (kNumBackends + 1), disruption);
+  EXPECT_GE(1.25 / (kNumBackends + 1), disruption);
+
+  // Doubling the weight of a backend moves about its share to it
+  std::vector<Maglev::Backend> heavier = backends;
+  heavier[0].weight = 2;
+  disruption = Disruption(backends, table, heavier, Populate(heavier));
+  EXPECT_LE(1.0 / (kNumBackends + 1), disruption);
+  EXPECT_GE(1.25 / (kNumBackends + 1), disruption);
+}
+
+}  // namespace (unnamed)
@@ -26,4 +26,52 @@ struct pcap_rec_hdr {
   uint32_t orig_len; /* actual length of packet */
 };
 
+/* pcapng, see https://github.com/pcapng/pcapng */
+#define PCAPNG_BLOCK_SHB 0x0a0d0d0a /* section header block */
+#define PCAPNG_BLOCK_IDB 0x00000001 /* interface description block */
+#define PCAPNG_BLOCK_EPB 0x00000006 /* enhanced packet block */
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1a2b3c4d
+#define PCAPNG_VERSION_MAJOR 1
+#define PCAPNG_VERSION_MINOR 0
+#define PCAPNG_OPT_ENDOFOPT 0
+#define PCAPNG_OPT_IF_TSRESOL 9
+
+struct pcapng_shb {
+  uint32_t block_type;     /* PCAPNG_BLOCK_SHB */
+  uint32_t block_len;      /* sizeof(struct pcapng_shb) */
+  uint32_t byte_order;     /* PCAPNG_BYTE_ORDER_MAGIC */
+  uint16_t version_major;  /* major version number */
+  uint16_t version_minor;  /* minor version number */
+  uint32_t section_len[2]; /* 64-bit length, all ones if unknown */
+  uint32_t block_len_trail;
+};
+
+/* Interface description block with an if_tsresol option */
+struct pcapng_idb {
+  uint32_t block_type; /* PCAPNG_BLOCK_IDB */
+  uint32_t block_len;  /* sizeof(struct pcapng_idb) */
+  uint16_t link_type;  /* data link type */
+  uint16_t reserved;
+  uint32_t snaplen;         /* max length of captured packets, in octets */
+  uint16_t tsresol_code;    /* PCAPNG_OPT_IF_TSRESOL */
+  uint16_t tsresol_len;     /* 1 */
+  uint8_t tsresol;          /* timestamp unit is 10^-tsresol seconds */
+  uint8_t tsresol_pad[3];   /* options are padded to 32 bits */
+  uint16_t endofopt_code;   /* PCAPNG_OPT_ENDOFOPT */
+  uint16_t endofopt_len;    /* 0 */
+  uint32_t block_len_trail;
+};
+
+/* Enhanced packet block, followed by the packet data padded to 32 bits and
+ * by the block length again */
+struct pcapng_epb {
+  uint32_t block_type; /* PCAPNG_BLOCK_EPB */
+  uint32_t block_len;  /* including the padded data and trailing length */
+  uint32_t interface_id;
+  uint32_t ts_high;  /* upper 32 bits of the timestamp */
+  uint32_t ts_low;   /* lower 32 bits of the timestamp */
+  uint32_t cap_len;  /* number of octets of packet saved in file */
+  uint32_t orig_len; /* actual length of packet */
+};
+
 #endif  // BESS_UTILS_PCAP_H_
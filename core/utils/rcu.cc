@@ -0,0 +1,141 @@
+#include "rcu.h"
+
+#include <unistd.h>
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+#include <glog/logging.h>
+
+namespace bess {
+namespace utils {
+
+namespace {
+
+// seen is the epoch observed at the last quiescent state, or 0 while offline
+struct alignas(64) Reader {
+  std::atomic<uint64_t> seen;
+  std::atomic<bool> used;
+};
+
+Reader readers[Rcu::kMaxReaders];
+
+// Starts from 1, as 0 means offline
+std::atomic<uint64_t> epoch(1);
+
+thread_local Reader *self = nullptr;
+
+std::mutex deferred_lock;
+std::deque<std::pair<uint64_t, std::function<void()>>> deferred;
+
+// Runs the deferred functions whose token has expired
+void Reclaim() {
+  std::deque<std::function<void()>> expired;
+
+  {
+    std::lock_guard<std::mutex> guard(deferred_lock);
+    uint64_t horizon = Rcu::Horizon();
+
+    while (!deferred.empty() && deferred.front().first <= horizon) {
+      expired.push_back(std::move(deferred.front().second));
+      deferred.pop_front();
+    }
+  }
+
+  for (auto &fn : expired) {
+    fn();
+  }
+}
+
+}  // namespace (unnamed)
+
+void Rcu::RegisterThread() {
+  CHECK(!self);
+
+  for (Reader &r : readers) {
+    bool used = false;
+    if (r.used.compare_exchange_strong(used, true)) {
+      self = &r;
+      self->seen = epoch.load();
+      return;
+    }
+  }
+
+  CHECK(false) << "Too many RCU readers";
+}
+
+void Rcu::UnregisterThread() {
+  if (self) {
+    self->seen = 0;
+    self->used = false;
+    self = nullptr;
+  }
+}
+
+void Rcu::Offline() {
+  if (self) {
+    self->seen.store(0, std::memory_order_release);
+  }
+}
+
+// Must be sequentially consistent: a writer that saw this reader offline may
+// have freed anything unlinked before it looked.
+void Rcu::Online() {
+  if (self) {
+    self->seen = epoch.load();
+  }
+}
+
+void Rcu::Quiescent() {
+  if (self) {
+    self->seen.store(epoch.load(std::memory_order_acquire),
+                     std::memory_order_release);
+  }
+}
+
+uint64_t Rcu::Retire() {
+  return ++epoch;
+}
+
+uint64_t Rcu::Horizon() {
+  uint64_t horizon = epoch.load();
+
+  for (const Reader &r : readers) {
+    if (&r == self || !r.used.load(std::memory_order_relaxed)) {
+      continue;
+    }
+
+    uint64_t seen = r.seen.load();
+    if (seen && seen < horizon) {
+      horizon = seen;
+    }
+  }
+
+  return horizon;
+}
+
+void Rcu::Defer(std::function<void()> fn) {
+  uint64_t token = Retire();
+
+  {
+    std::lock_guard<std::mutex> guard(deferred_lock);
+    deferred.emplace_back(token, std::move(fn));
+  }
+
+  Reclaim();
+}
+
+void Rcu::Synchronize() {
+  uint64_t token = Retire();
+
+  while (!Expired(token)) {
+    usleep(10);
+  }
+
+  Reclaim();
+}
+
+}  // namespace utils
+}  // namespace bess
@@ -0,0 +1,53 @@
+// Quiescent-state-based RCU, for data structures that workers read without
+// locks while the control thread updates them (e.g., HTable).
+//
+// A reader thread registers itself, and announces a quiescent state with
+// Quiescent() whenever it holds no references to shared data, e.g., between
+// scheduling rounds. A writer unlinks an object first, then gets a token with
+// Retire(), and may free the object once the token has expired, i.e., every
+// reader went through a quiescent state after the object was unlinked.
+
+#ifndef BESS_UTILS_RCU_H_
+#define BESS_UTILS_RCU_H_
+
+#include <cstdint>
+#include <functional>
+
+namespace bess {
+namespace utils {
+
+class Rcu {
+ public:
+  static const int kMaxReaders = 128;
+
+  // Reader side. All but RegisterThread() are no-ops for non-reader threads.
+  static void RegisterThread();
+  static void UnregisterThread();
+
+  // No references held until Online() (e.g., while blocked)
+  static void Offline();
+  static void Online();
+
+  static void Quiescent();
+
+  // Writer side. The calling thread is assumed to hold no references, even if
+  // it is a reader itself (e.g., a module updating its own table).
+  static uint64_t Retire();
+
+  // Every token <= Horizon() has expired
+  static uint64_t Horizon();
+  static bool Expired(uint64_t token) { return token <= Horizon(); }
+
+  // Runs fn once every reader is done with what was unlinked so far, on a
+  // thread that calls Defer() or Synchronize() later. fn must be thread-safe.
+  static void Defer(std::function<void()> fn);
+
+  // Waits for all readers to go through a quiescent state, and then runs all
+  // deferred functions.
+  static void Synchronize();
+};
+
+}  // namespace utils
+}  // namespace bess
+
+#endif  // BESS_UTILS_RCU_H_
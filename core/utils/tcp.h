@@ -1,4 +1,5 @@
 #ifndef BESS_UTILS_TCP_H_
+#define BESS_UTILS_TCP_H_
 
 // Flags used in the flags field of the TCP header.
 #define TCP_FLAG_FIN 0x01
@@ -7,6 +8,8 @@
 #define TCP_FLAG_PUSH 0x08
 #define TCP_FLAG_ACK 0x10
 #define TCP_FLAG_URG 0x20
+#define TCP_FLAG_ECE 0x40
+#define TCP_FLAG_CWR 0x80
 
 namespace bess {
 namespace utils {
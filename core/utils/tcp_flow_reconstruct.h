@@ -36,7 +36,7 @@ class TcpFlowReconstruct {
     assert(buf_ != nullptr);
   }
 
-  ~TcpFlowReconstruct() { free(buf_); }
+  ~TcpFlowReconstruct() { mem_free(buf_); }
 
   // Returns the underlying buffer of reconstructed flow bytes.  Not guaranteed
   // to return the same pointer between calls to InsertPacket().
@@ -13,10 +13,12 @@
 #include <string>
 
 #include "metadata.h"
+#include "module.h"
 #include "opts.h"
 #include "packet.h"
 #include "scheduler.h"
 #include "task.h"
+#include "utils/rcu.h"
 #include "utils/time.h"
 
 using bess::Scheduler;
@@ -167,14 +169,39 @@ void Worker::SetNonWorker() {
   }
 }
 
+void Worker::FlushCoalescedBatches(uint64_t now, bool force) {
+  bess::CoalesceBuffer **prev = &coalesce_pending_;
+
+  /* Delivering a batch may add more buffers to the list, at its head, so
+   * the list is walked with a pointer to the previous link. */
+  while (bess::CoalesceBuffer *buf = *prev) {
+    if (buf->batch.empty() || force || buf->deadline <= now) {
+      *prev = buf->next;
+      buf->linked = false;
+
+      if (!buf->batch.empty()) {
+        Module::DeliverCoalesced(buf);
+      }
+    } else {
+      prev = &buf->next;
+    }
+  }
+}
+
 int Worker::BlockWorker() {
   worker_signal t;
   int ret;
 
+  /* modules may be reconfigured or destroyed while paused */
+  FlushCoalescedBatches(0, true);
+
   status_ = WORKER_PAUSED;
 
+  // Writers need not wait for us to free objects while we are blocked
+  bess::utils::Rcu::Offline();
   ret = read(fd_event_, &t, sizeof(t));
   DCHECK_EQ(ret, sizeof(t));
+  bess::utils::Rcu::Online();
 
   if (t == worker_signal::unblock) {
     status_ = WORKER_RUNNING;
@@ -238,7 +265,9 @@ void *Worker::Run(void *_arg) {
             << "is running on core " << core_ << " (socket " << socket_ << ")";
 
   CPU_ZERO(&set);
+  bess::utils::Rcu::RegisterThread();
   scheduler_->ScheduleLoop();
+  bess::utils::Rcu::UnregisterThread();
 
   LOG(INFO) << "Worker " << wid_ << "(" << this << ") "
             << "is quitting... (core " << core_ << ", socket " << socket_
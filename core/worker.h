@@ -85,6 +85,9 @@ class Worker {
   void set_silent_drops(uint64_t drops) { silent_drops_ = drops; }
   void incr_silent_drops(uint64_t drops) { silent_drops_ += drops; }
 
+  uint64_t alloc_failures() { return alloc_failures_; }
+  void incr_alloc_failures() { alloc_failures_++; }
+
   uint64_t current_tsc() const { return current_tsc_; }
   void set_current_tsc(uint64_t tsc) { current_tsc_ = tsc; }
 
@@ -94,6 +97,17 @@ class Worker {
   gate_idx_t current_igate() const { return current_igate_; }
   void set_current_igate(gate_idx_t idx) { current_igate_ = idx; }
 
+  bool has_coalesced_batches() const { return coalesce_pending_ != nullptr; }
+  void AddCoalescePending(bess::CoalesceBuffer *buf) {
+    buf->next = coalesce_pending_;
+    buf->linked = true;
+    coalesce_pending_ = buf;
+  }
+
+  /* Delivers coalesced batches whose deadline is before now (or all of them,
+   * if force is set) */
+  void FlushCoalescedBatches(uint64_t now, bool force = false);
+
   /* better be the last field. it's huge */
   bess::PacketBatch *splits() { return splits_; }
 
@@ -111,6 +125,8 @@ class Worker {
 
   uint64_t silent_drops_; /* packets that have been sent to a deadend */
 
+  uint64_t alloc_failures_; /* Packet::Alloc() calls on an empty pool */
+
   uint64_t current_tsc_;
   uint64_t current_ns_;
 
@@ -118,6 +134,9 @@ class Worker {
    * Modules should use get_igate() for access */
   gate_idx_t current_igate_;
 
+  /* Coalescing buffers of input gates holding packets for this worker */
+  bess::CoalesceBuffer *coalesce_pending_;
+
   /* better be the last field. it's huge */
   bess::PacketBatch splits_[MAX_GATES + 1];
 };
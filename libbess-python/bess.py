@@ -246,6 +246,7 @@ class BESS(object):
             'BPF': module_msg.BPFArg,
             'Buffer': bess_msg.EmptyArg,
             'Bypass': bess_msg.EmptyArg,
+            'Conntrack': module_msg.ConntrackArg,
             'Dump': module_msg.DumpArg,
             'EtherEncap': bess_msg.EmptyArg,
             'ExactMatch': module_msg.ExactMatchArg,
@@ -256,6 +257,7 @@ class BESS(object):
             'IPChecksum': bess_msg.EmptyArg,
             'IPEncap': bess_msg.EmptyArg,
             'IPLookup': bess_msg.EmptyArg,
+            'IPLookup6': module_msg.IPLookup6Arg,
             'IPSwap': bess_msg.EmptyArg,
             'L2Forward': module_msg.L2ForwardArg,
             'MACSwap': bess_msg.EmptyArg,
@@ -300,6 +302,29 @@ class BESS(object):
         request.name = name
         return self._request('GetModuleInfo', request)
 
+    def get_metadata_layout(self):
+        return self._request('GetMetadataLayout')
+
+    def repack_metadata(self, weights={}):
+        request = bess_msg.RepackMetadataRequest()
+        for attr, weight in weights.items():
+            w = request.weights.add()
+            w.attr = attr
+            w.weight = weight
+        return self._request('RepackMetadata', request)
+
+    def get_mem_stats(self):
+        return self._request('GetMemStats')
+
+    def enable_packet_accounting(self):
+        return self._request('EnablePacketAccounting')
+
+    def disable_packet_accounting(self):
+        return self._request('DisablePacketAccounting')
+
+    def get_pool_stats(self):
+        return self._request('GetPoolStats')
+
     def connect_modules(self, m1, m2, ogate=0, igate=0):
         request = bess_msg.ConnectModulesRequest()
         request.m1 = m1
@@ -352,9 +377,34 @@ class BESS(object):
         request.gate = gate
         return self._request('DisableTcpdump', request)
 
-    def enable_track(self, m, direction='out', gate=None):
+    def enable_capture(self, path, m, direction='out', gate=0, snaplen=0,
+                       sample_every=0, filter='', ring_size=0,
+                       max_file_size=0, max_files=0, pcapng=False):
+        request = bess_msg.EnableCaptureRequest()
+        request.name = m
+        request.is_igate = (direction == 'in')
+        request.gate = gate
+        request.path = path
+        request.snaplen = snaplen
+        request.sample_every = sample_every
+        request.filter = filter
+        request.ring_size = ring_size
+        request.max_file_size = max_file_size
+        request.max_files = max_files
+        request.pcapng = pcapng
+        return self._request('EnableCapture', request)
+
+    def disable_capture(self, m, direction='out', gate=0):
+        request = bess_msg.DisableCaptureRequest()
+        request.name = m
+        request.is_igate = (direction == 'in')
+        request.gate = gate
+        return self._request('DisableCapture', request)
+
+    def enable_track(self, m, direction='out', gate=None, cycles=False):
         request = bess_msg.EnableTrackRequest()
         request.name = m
+        request.cycles = cycles
         if gate is None:
             request.use_gate = False
         else:
@@ -363,9 +413,10 @@ class BESS(object):
         request.is_igate = (direction == 'in')
         return self._request('EnableTrack', request)
 
-    def disable_track(self, m, direction='out', gate=None):
+    def disable_track(self, m, direction='out', gate=None, cycles=False):
         request = bess_msg.DisableTrackRequest()
         request.name = m
+        request.cycles = cycles
         if gate is None:
             request.use_gate = False
         else:
@@ -374,6 +425,31 @@ class BESS(object):
         request.is_igate = (direction == 'in')
         return self._request('DisableTrack', request)
 
+    def enable_coalesce(self, m, igate=0, max_delay_ns=0):
+        request = bess_msg.EnableCoalesceRequest()
+        request.name = m
+        request.igate = igate
+        request.max_delay_ns = max_delay_ns
+        return self._request('EnableCoalesce', request)
+
+    def disable_coalesce(self, m, igate=0):
+        request = bess_msg.DisableCoalesceRequest()
+        request.name = m
+        request.igate = igate
+        return self._request('DisableCoalesce', request)
+
+    def start_trace(self, filter='', max_pkts=0):
+        request = bess_msg.StartTraceRequest()
+        request.filter = filter
+        request.max_pkts = max_pkts
+        return self._request('StartTrace', request)
+
+    def stop_trace(self):
+        return self._request('StopTrace')
+
+    def get_trace(self):
+        return self._request('GetTrace')
+
     def list_workers(self):
         return self._request('ListWorkers')
 